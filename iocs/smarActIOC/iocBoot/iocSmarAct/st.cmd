@@ -19,6 +19,8 @@ dbLoadRecords("$(MOTOR)/db/motorUtil.db", "P=smarAct:")
 #< smaractmcs.iocsh
 #< smaractmcs2.iocsh
 #< smaractscu.iocsh
+# or this one for a simulated controller
+#< smaractsim.iocsh
 ## 
 # Optional: load devIocStats records (requires DEVIOCSTATS module)
 #dbLoadRecords("$(DEVIOCSTATS)/db/iocAdminSoft.db", "IOC=$(P)$(MC_CT)")
@@ -0,0 +1,185 @@
+/* Axis capabilities remembered across restarts, shared by the smarAct MCS, MCS2 and SCU drivers */
+
+#include <string.h>
+#include <stdio.h>
+
+#include <iocsh.h>
+#include <epicsMutex.h>
+#include <epicsStdio.h>
+#include <epicsExport.h>
+
+#include "smarActCapCache.h"
+
+char                   SmarActCapCache::fileName_[256];
+SmarActCapCache::Entry SmarActCapCache::entries_[SMARACT_CAP_CACHE_SIZE];
+int                    SmarActCapCache::numEntries_ = 0;
+epicsMutexId           SmarActCapCache::lock_ = 0;
+
+/* Read the cache file, a missing file is an empty cache.
+ * Called from iocsh before the controllers are created.
+ *
+ * RETURNS:  0 on success, -1 if the file name is missing or too long.
+ */
+int
+SmarActCapCache::open(const char *fileName)
+{
+FILE *fp;
+char  line[200];
+int   lineNo = 0;
+
+  if ( !fileName || !fileName[0] || strlen(fileName) + 5 > sizeof(fileName_) )
+    return -1;
+  if ( !lock_ )
+    lock_ = epicsMutexMustCreate();
+  epicsMutexMustLock(lock_);
+  strcpy(fileName_, fileName);
+  numEntries_ = 0;
+  if ( (fp = fopen(fileName_, "r")) ) {
+    while ( fgets(line, sizeof(line), fp) ) {
+      Entry e;
+      lineNo++;
+      if ( '#' == line[0] || '\n' == line[0] )
+        continue;
+      if ( 6 != sscanf(line, "%39s %d %d %d %d %d", e.key, &e.channel,
+                       &e.caps.rotary, &e.caps.type, &e.caps.freq, &e.caps.sensor) ) {
+        printf("smarActSetCapCache: %s line %d ignored\n", fileName_, lineNo);
+        continue;
+      }
+      if ( numEntries_ < SMARACT_CAP_CACHE_SIZE && !find(e.key, e.channel) )
+        entries_[numEntries_++] = e;
+    }
+    fclose(fp);
+  }
+  epicsMutexUnlock(lock_);
+  return 0;
+}
+
+int
+SmarActCapCache::enabled()
+{
+  return 0 != fileName_[0];
+}
+
+/* Called with the lock held */
+SmarActCapCache::Entry *
+SmarActCapCache::find(const char *key, int channel)
+{
+int i;
+
+  for ( i = 0; i < numEntries_; i++ ) {
+    if ( channel == entries_[i].channel && 0 == strcmp(key, entries_[i].key) )
+      return &entries_[i];
+  }
+  return 0;
+}
+
+/* RETURNS:  1 and the capabilities in *pCaps if the axis is in the cache, 0 otherwise. */
+int
+SmarActCapCache::lookup(const char *key, int channel, SmarActCaps *pCaps)
+{
+Entry *pEntry;
+
+  if ( !enabled() || !key || !key[0] )
+    return 0;
+  epicsMutexMustLock(lock_);
+  if ( (pEntry = find(key, channel)) )
+    *pCaps = pEntry->caps;
+  epicsMutexUnlock(lock_);
+  return pEntry ? 1 : 0;
+}
+
+/* Remember what detection found, the file is written only if that is new */
+void
+SmarActCapCache::store(const char *key, int channel, const SmarActCaps *pCaps)
+{
+Entry *pEntry;
+
+  if ( !enabled() || !key || !key[0] || strlen(key) >= SMARACT_CAP_KEY_SIZE || strchr(key, ' ') )
+    return;
+  epicsMutexMustLock(lock_);
+  pEntry = find(key, channel);
+  if ( !pEntry && numEntries_ < SMARACT_CAP_CACHE_SIZE ) {
+    pEntry = &entries_[numEntries_++];
+    strcpy(pEntry->key, key);
+    pEntry->channel = channel;
+    pEntry->caps.rotary = -1;
+  }
+  if ( pEntry && 0 != memcmp(&pEntry->caps, pCaps, sizeof(*pCaps)) ) {
+    pEntry->caps = *pCaps;
+    save();
+  }
+  epicsMutexUnlock(lock_);
+}
+
+/* Write the whole cache to a new file and rename that, a crash never leaves
+ * half a file behind. Called with the lock held.
+ */
+void
+SmarActCapCache::save()
+{
+char  tmpName[sizeof(fileName_)];
+FILE *fp;
+int   i;
+
+  epicsSnprintf(tmpName, sizeof(tmpName), "%s.tmp", fileName_);
+  if ( !(fp = fopen(tmpName, "w")) ) {
+    printf("smarActCapCache: unable to write %s\n", tmpName);
+    return;
+  }
+  fprintf(fp, "# smarAct axis capabilities: key channel rotary type freq sensor\n");
+  for ( i = 0; i < numEntries_; i++ ) {
+    const Entry *e = &entries_[i];
+    fprintf(fp, "%s %d %d %d %d %d\n", e->key, e->channel,
+            e->caps.rotary, e->caps.type, e->caps.freq, e->caps.sensor);
+  }
+  if ( fclose(fp) ) {
+    printf("smarActCapCache: unable to write %s\n", tmpName);
+    remove(tmpName);
+    return;
+  }
+  // rename() doesn't replace an existing file on every target
+  if ( rename(tmpName, fileName_) && (remove(fileName_) || rename(tmpName, fileName_)) )
+    printf("smarActCapCache: unable to replace %s\n", fileName_);
+}
+
+void
+SmarActCapCache::report(FILE *fp)
+{
+  if ( !enabled() )
+    return;
+  epicsMutexMustLock(lock_);
+  fprintf(fp, "  capability cache %s, %d axes\n", fileName_, numEntries_);
+  epicsMutexUnlock(lock_);
+}
+
+/* iocsh wrapping and registration business (stolen from ACRMotorDriver.cpp) */
+static const iocshArg sc_a0 = {"Cache file name [string]",         iocshArgString};
+
+static const iocshArg * const sc_as[] = {&sc_a0};
+
+/* smarActSetCapCache: call before creating the controllers */
+static const iocshFuncDef sc_def = {"smarActSetCapCache", 1, sc_as};
+
+extern "C" int
+smarActSetCapCache(const char *fileName)
+{
+  if ( SmarActCapCache::open(fileName) ) {
+    printf("smarActSetCapCache: Error invalid file name\n");
+    return -1;
+  }
+  return 0;
+}
+
+static void sc_fn(const iocshArgBuf *args)
+{
+  smarActSetCapCache(args[0].sval);
+}
+
+static void smarActCapCacheRegister(void)
+{
+  iocshRegister(&sc_def, sc_fn);  // smarActSetCapCache
+}
+
+extern "C" {
+epicsExportRegistrar(smarActCapCacheRegister);
+}
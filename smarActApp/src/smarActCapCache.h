@@ -0,0 +1,56 @@
+#ifndef SMARACT_CAP_CACHE_H
+#define SMARACT_CAP_CACHE_H
+
+/* Axis capabilities remembered across restarts, shared by the smarAct MCS,
+ * MCS2 and SCU drivers.
+ *
+ * smarActSetCapCache() names a text file with one line per axis:
+ *   <controller key> <channel> <rotary> <type> <freq> <sensor>
+ * The key is the serial number of an MCS2 and the controller port name of an
+ * MCS or SCU. An axis found in the file takes its rotary/sensor detection
+ * from it instead of asking the controller, and checks it with the first poll
+ * cycles; the file is written again whenever detection finds something new.
+ */
+
+#ifdef __cplusplus
+
+#include <stdio.h>
+#include <epicsMutex.h>
+
+#define SMARACT_CAP_CACHE_SIZE 256
+#define SMARACT_CAP_KEY_SIZE   40
+
+struct SmarActCaps {
+  int rotary;   /* 1 if positions are angles */
+  int type;     /* sensor (MCS), positioner (SCU, MCS2) type */
+  int freq;     /* max closed loop frequency (MCS2), 0 if not used */
+  int sensor;   /* 1 if the positioner has a sensor */
+};
+
+class SmarActCapCache
+{
+public:
+  static int  open(const char *fileName);
+  static int  enabled();
+  static int  lookup(const char *key, int channel, SmarActCaps *pCaps);
+  static void store(const char *key, int channel, const SmarActCaps *pCaps);
+  static void report(FILE *fp);
+
+private:
+  struct Entry {
+    char        key[SMARACT_CAP_KEY_SIZE];
+    int         channel;
+    SmarActCaps caps;
+  };
+
+  static Entry *find(const char *key, int channel);
+  static void   save();
+
+  static char         fileName_[256];
+  static Entry        entries_[SMARACT_CAP_CACHE_SIZE];
+  static int          numEntries_;
+  static epicsMutexId lock_;
+};
+
+#endif // _cplusplus
+#endif // SMARACT_CAP_CACHE_H
@@ -0,0 +1,94 @@
+/* Deadbands of the position readbacks shared by the smarAct MCS, MCS2 and SCU drivers */
+
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <asynPortDriver.h>
+#include <epicsTime.h>
+
+#include "smarActIoStats.h"
+#include "smarActDeadband.h"
+
+SmarActDeadbands::SmarActDeadbands()
+  : pDriver_(0), numAxes_(0), last_(0), numSuppressed_(0), numPublished_(0), suppressed_(-1)
+{
+int i;
+
+  for ( i = 0; i < SmarActNumReadbacks; i++ )
+    deadband_[i] = -1;
+  epicsTimeGetCurrent(&lastPublish_);
+}
+
+SmarActDeadbands::~SmarActDeadbands()
+{
+  delete [] last_;
+}
+
+void
+SmarActDeadbands::createParams(asynPortDriver *pDriver, int numAxes)
+{
+int axis;
+
+  pDriver_ = pDriver;
+  numAxes_ = numAxes;
+  last_    = new Last[numAxes * SmarActNumReadbacks];
+  memset(last_, 0, numAxes * SmarActNumReadbacks * sizeof(Last));
+  pDriver->createParam(SmarActPosDeadbandString,   asynParamFloat64, &deadband_[SmarActReadbackPos]);
+  pDriver->createParam(SmarActEncDeadbandString,   asynParamFloat64, &deadband_[SmarActReadbackEnc]);
+  pDriver->createParam(SmarActDeadbandSupprString, asynParamInt32,   &suppressed_);
+  for ( axis = 0; axis < numAxes; axis++ ) {
+    pDriver->setDoubleParam(axis, deadband_[SmarActReadbackPos], 0.0);
+    pDriver->setDoubleParam(axis, deadband_[SmarActReadbackEnc], 0.0);
+  }
+  pDriver->setIntegerParam(0, suppressed_, 0);
+}
+
+/* A new value of a readback of the axis was read, 'done' if the axis is done.
+ * Called with the controller lock held.
+ *
+ * RETURNS:  1 if the driver sets the parameter, 0 if it stays as it is.
+ */
+int
+SmarActDeadbands::pass(int axis, SmarActReadback readback, double value, int done)
+{
+Last  *pLast;
+double deadband = 0.0;
+
+  if ( !last_ || axis < 0 || axis >= numAxes_ )
+    return 1;
+  pLast = &last_[axis * SmarActNumReadbacks + readback];
+  pDriver_->getDoubleParam(axis, deadband_[readback], &deadband);
+  if ( deadband > 0.0 && pLast->valid && fabs(value - pLast->value) <= deadband
+       && (pLast->done || !done) ) {
+    numSuppressed_++;
+    return 0;
+  }
+  pLast->value = value;
+  pLast->valid = 1;
+  pLast->done  = done;
+  return 1;
+}
+
+void
+SmarActDeadbands::publish()
+{
+epicsTimeStamp now;
+
+  if ( !pDriver_ || numSuppressed_ == numPublished_ )
+    return;
+  epicsTimeGetCurrent(&now);
+  if ( epicsTimeDiffInSeconds(&now, &lastPublish_) < SMARACT_STATS_PUBLISH_PERIOD )
+    return;
+  lastPublish_  = now;
+  numPublished_ = numSuppressed_;
+  pDriver_->setIntegerParam(0, suppressed_, (int)numSuppressed_);
+}
+
+void
+SmarActDeadbands::report(FILE *fp, int level)
+{
+  if ( level < 1 || !numSuppressed_ )
+    return;
+  fprintf(fp, "  deadbands held back %lu readbacks\n", numSuppressed_);
+}
@@ -0,0 +1,66 @@
+#ifndef SMARACT_DEADBAND_H
+#define SMARACT_DEADBAND_H
+
+/* Deadbands of the position readbacks, shared by the smarAct MCS, MCS2 and SCU drivers.
+ *
+ * asynPortDriver only calls back for parameters whose value changed, so the
+ * status bits and texts that poll() sets in every cycle cost nothing while
+ * they stay the same. The positions change with the sensor noise in every
+ * cycle though. With a deadband (POS_DEADBAND for the position, ENC_DEADBAND
+ * for the encoder position, per axis, in steps of the motor record, i.e. nm
+ * for the MCS and MCS2) a readback is only set if it moved by more than the
+ * deadband since it was last set. The first readback after the axis stopped
+ * is always set, so the motor record sees where a move ended.
+ *
+ * The readbacks held back are counted, DEADBAND_SUPPRESSED at address 0,
+ * published at most once per SMARACT_STATS_PUBLISH_PERIOD.
+ */
+
+#ifdef __cplusplus
+
+#include <stdio.h>
+#include <asynPortDriver.h>
+#include <epicsTime.h>
+
+#define SmarActPosDeadbandString   "POS_DEADBAND"
+#define SmarActEncDeadbandString   "ENC_DEADBAND"
+#define SmarActDeadbandSupprString "DEADBAND_SUPPRESSED"
+
+#define SMARACT_DEADBAND_NUM_PARAMS 3
+
+enum SmarActReadback {
+  SmarActReadbackPos,
+  SmarActReadbackEnc,
+  SmarActNumReadbacks
+};
+
+class SmarActDeadbands
+{
+public:
+  SmarActDeadbands();
+  ~SmarActDeadbands();
+
+  void createParams(asynPortDriver *pDriver, int numAxes);
+  int  pass(int axis, SmarActReadback readback, double value, int done);
+  void publish();
+  void report(FILE *fp, int level);
+
+private:
+  struct Last {
+    double value;     /* last value set */
+    int    valid;
+    int    done;      /* the axis was done when it was set */
+  };
+
+  asynPortDriver *pDriver_;
+  int             numAxes_;
+  Last           *last_;           /* numAxes_ x SmarActNumReadbacks */
+  unsigned long   numSuppressed_;
+  unsigned long   numPublished_;   /* numSuppressed_ when it was last published */
+  epicsTimeStamp  lastPublish_;
+  int             deadband_[SmarActNumReadbacks];
+  int             suppressed_;
+};
+
+#endif // _cplusplus
+#endif // SMARACT_DEADBAND_H
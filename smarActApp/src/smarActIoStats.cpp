@@ -0,0 +1,399 @@
+/* Latency and throughput statistics shared by the smarAct MCS, MCS2 and SCU drivers */
+
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+
+#include <asynPortDriver.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+
+#include "smarActIoStats.h"
+
+/* Longest IO_TYPES text, one line per command type */
+#define TYPES_STRING_SIZE 4096
+
+SmarActIoStats *SmarActIoStats::first_ = 0;
+epicsMutexId    SmarActIoStats::listLock_ = 0;
+
+void
+SmarActLatency::clear()
+{
+  count    = 0;
+  timeouts = 0;
+  errors   = 0;
+  min      = 0.0;
+  max      = 0.0;
+  sum      = 0.0;
+  memset(bins, 0, sizeof(bins));
+}
+
+/* Upper limit of a histogram bin in s; the last bin has none */
+double
+SmarActLatency::binLimit(int bin)
+{
+  return SMARACT_STATS_BIN0 * pow(2.0, 0.5 * bin);
+}
+
+void
+SmarActLatency::add(double seconds, asynStatus status)
+{
+int bin;
+
+  if ( asynTimeout == status )
+    timeouts++;
+  else if ( asynSuccess != status )
+    errors++;
+  if ( 0 == count || seconds < min )
+    min = seconds;
+  if ( 0 == count || seconds > max )
+    max = seconds;
+  sum += seconds;
+  count++;
+  if ( seconds < SMARACT_STATS_BIN0 ) {
+    bin = 0;
+  } else {
+    bin = 1 + (int)(2.0 * log(seconds / SMARACT_STATS_BIN0) / log(2.0));
+    if ( bin > SMARACT_STATS_BINS - 1 )
+      bin = SMARACT_STATS_BINS - 1;
+  }
+  bins[bin]++;
+}
+
+double
+SmarActLatency::mean() const
+{
+  return count ? sum / count : 0.0;
+}
+
+/* Upper limit of the bin that holds the given fraction of the exchanges, never more than max */
+double
+SmarActLatency::percentile(double fraction) const
+{
+unsigned long cumulative = 0;
+double        limit;
+int           bin;
+
+  if ( !count )
+    return 0.0;
+  for ( bin = 0; bin < SMARACT_STATS_BINS - 1; bin++ ) {
+    cumulative += bins[bin];
+    if ( cumulative >= fraction * count )
+      break;
+  }
+  limit = binLimit(bin);
+  return bin == SMARACT_STATS_BINS - 1 || limit > max ? max : limit;
+}
+
+SmarActIoStats::SmarActIoStats()
+  : pDriver_(0), next_(0)
+{
+  lock_ = epicsMutexMustCreate();
+  memset(&totals_, 0, sizeof(totals_));
+  clearLocked();
+}
+
+SmarActIoStats::~SmarActIoStats()
+{
+SmarActIoStats **pp;
+
+  if ( listLock_ ) {
+    epicsMutexMustLock(listLock_);
+    for ( pp = &first_; *pp; pp = &(*pp)->next_ ) {
+      if ( this == *pp ) {
+        *pp = next_;
+        break;
+      }
+    }
+    epicsMutexUnlock(listLock_);
+  }
+  epicsMutexDestroy(lock_);
+}
+
+/* RETURNS:  the statistics of the controller with the given port name, 0 if there is none */
+SmarActIoStats *
+SmarActIoStats::find(const char *portName)
+{
+SmarActIoStats *pStats;
+
+  if ( !listLock_ || !portName )
+    return 0;
+  epicsMutexMustLock(listLock_);
+  for ( pStats = first_; pStats; pStats = pStats->next_ ) {
+    if ( 0 == strcmp(portName, pStats->pDriver_->portName) )
+      break;
+  }
+  epicsMutexUnlock(listLock_);
+  return pStats;
+}
+
+void
+SmarActIoStats::createParams(asynPortDriver *pDriver)
+{
+  pDriver_ = pDriver;
+  pDriver->createParam(SmarActIoCountString,       asynParamInt32,        &ioCount_);
+  pDriver->createParam(SmarActIoRateString,        asynParamFloat64,      &ioRate_);
+  pDriver->createParam(SmarActIoTimeoutsString,    asynParamInt32,        &ioTimeouts_);
+  pDriver->createParam(SmarActIoErrorsString,      asynParamInt32,        &ioErrors_);
+  pDriver->createParam(SmarActIoLatMinString,      asynParamFloat64,      &ioLatMin_);
+  pDriver->createParam(SmarActIoLatMeanString,     asynParamFloat64,      &ioLatMean_);
+  pDriver->createParam(SmarActIoLatMaxString,      asynParamFloat64,      &ioLatMax_);
+  pDriver->createParam(SmarActIoLatP99String,      asynParamFloat64,      &ioLatP99_);
+  pDriver->createParam(SmarActIoLatHistString,     asynParamFloat64Array, &ioLatHist_);
+  pDriver->createParam(SmarActIoTypesString,       asynParamOctet,        &ioTypes_);
+  pDriver->createParam(SmarActPollPeriodString,    asynParamFloat64,      &pollPeriod_);
+  pDriver->createParam(SmarActPollPeriodMaxString, asynParamFloat64,      &pollPeriodMaxParam_);
+  pDriver->createParam(SmarActPollPeriodSetString, asynParamFloat64,      &pollPeriodSetParam_);
+  pDriver->createParam(SmarActIoResetString,       asynParamInt32,        &ioReset_);
+  pDriver->createParam(SmarActIoStopsString,       asynParamInt32,        &ioStops_);
+  pDriver->createParam(SmarActIoStopLatString,     asynParamFloat64,      &ioStopLat_);
+  pDriver->createParam(SmarActIoStopLatMaxString,  asynParamFloat64,      &ioStopLatMax_);
+  pDriver->setIntegerParam(0, ioReset_, 0);
+
+  // Controllers are created from iocsh, one at a time
+  if ( !listLock_ )
+    listLock_ = epicsMutexMustCreate();
+  epicsMutexMustLock(listLock_);
+  next_  = first_;
+  first_ = this;
+  epicsMutexUnlock(listLock_);
+}
+
+/* The type of a command: the letters after the last ':' of its first part,
+ * ":GP3" -> "GP", ":CHAN0:POS?" -> "POS?". A '+' is appended if more commands
+ * are chained to it with ';'.
+ */
+void
+SmarActIoStats::commandKey(const char *command, char *key, size_t keySize)
+{
+const char *p;
+const char *start = command;
+size_t      len = 0;
+
+  for ( p = command; *p && ';' != *p && ' ' != *p; p++ ) {
+    if ( ':' == *p )
+      start = p + 1;
+  }
+  for ( p = start; len < keySize - 2 && (isalpha((unsigned char)*p) || '?' == *p || '*' == *p); p++ )
+    key[len++] = *p;
+  if ( strchr(command, ';') )
+    key[len++] = '+';
+  key[len] = 0;
+}
+
+/* Record one exchange that started at *pStart and ended now */
+void
+SmarActIoStats::record(const char *command, const epicsTimeStamp *pStart, asynStatus status)
+{
+char           key[SMARACT_STATS_KEY_SIZE];
+epicsTimeStamp now;
+double         seconds;
+int            i;
+
+  epicsTimeGetCurrent(&now);
+  seconds = epicsTimeDiffInSeconds(&now, pStart);
+  commandKey(command, key, sizeof(key));
+
+  epicsMutexMustLock(lock_);
+  for ( i = 0; i < numTypes_; i++ ) {
+    if ( 0 == strcmp(key, keys_[i]) )
+      break;
+  }
+  if ( i == numTypes_ && numTypes_ < SMARACT_STATS_MAX_TYPES ) {
+    strcpy(keys_[i], key);
+    types_[i].clear();
+    numTypes_++;
+  }
+  if ( i < numTypes_ )
+    types_[i].add(seconds, status);
+  else
+    other_.add(seconds, status);
+  total_.add(seconds, status);
+  totals_.exchanges++;
+  totals_.latency += seconds;
+  if ( asynTimeout == status )
+    totals_.timeouts++;
+  else if ( asynSuccess != status )
+    totals_.errors++;
+  epicsMutexUnlock(lock_);
+}
+
+/* A stop command that was issued at *pIssued is on the wire now */
+void
+SmarActIoStats::stopSent(const epicsTimeStamp *pIssued)
+{
+epicsTimeStamp now;
+
+  epicsTimeGetCurrent(&now);
+  epicsMutexMustLock(lock_);
+  stopLat_ = epicsTimeDiffInSeconds(&now, pIssued);
+  if ( stopLat_ > stopLatMax_ )
+    stopLatMax_ = stopLat_;
+  numStops_++;
+  epicsMutexUnlock(lock_);
+}
+
+/* Called by the controller at the start of each poll cycle.
+ * 'moving' tells which period the poller waited for, moving or idle.
+ */
+void
+SmarActIoStats::pollCycle(int moving, double movingPollPeriod, double idlePollPeriod)
+{
+epicsTimeStamp now;
+double         period;
+
+  epicsTimeGetCurrent(&now);
+  epicsMutexMustLock(lock_);
+  totals_.polls++;
+  if ( havePoll_ ) {
+    period = epicsTimeDiffInSeconds(&now, &lastPoll_);
+    pollPeriodSum_ += period;
+    numPolls_++;
+    if ( period > pollPeriodMax_ )
+      pollPeriodMax_ = period;
+  }
+  lastPoll_      = now;
+  havePoll_      = 1;
+  pollPeriodSet_ = moving ? movingPollPeriod : idlePollPeriod;
+  epicsMutexUnlock(lock_);
+}
+
+/* Update the parameters, at most every SMARACT_STATS_PUBLISH_PERIOD.
+ * Called from the poller with the driver locked. IO_RESET is handled here,
+ * so it takes effect with the next poll cycle.
+ */
+void
+SmarActIoStats::publish()
+{
+char           types[TYPES_STRING_SIZE];
+size_t         len = 0;
+epicsTimeStamp now;
+double         elapsed;
+int            reset = 0;
+int            i;
+
+  if ( !pDriver_ )
+    return;
+  pDriver_->getIntegerParam(0, ioReset_, &reset);
+  if ( reset ) {
+    clear();
+    pDriver_->setIntegerParam(0, ioReset_, 0);
+  }
+  epicsTimeGetCurrent(&now);
+  elapsed = epicsTimeDiffInSeconds(&now, &lastPublish_);
+  if ( !reset && elapsed < SMARACT_STATS_PUBLISH_PERIOD )
+    return;
+
+  epicsMutexMustLock(lock_);
+  pDriver_->setIntegerParam(0, ioCount_,    (int)total_.count);
+  pDriver_->setDoubleParam (0, ioRate_,     elapsed > 0.0 ? (total_.count - lastCount_) / elapsed : 0.0);
+  pDriver_->setIntegerParam(0, ioTimeouts_, (int)total_.timeouts);
+  pDriver_->setIntegerParam(0, ioErrors_,   (int)total_.errors);
+  pDriver_->setDoubleParam (0, ioLatMin_,   1.0e3 * total_.min);
+  pDriver_->setDoubleParam (0, ioLatMean_,  1.0e3 * total_.mean());
+  pDriver_->setDoubleParam (0, ioLatMax_,   1.0e3 * total_.max);
+  pDriver_->setDoubleParam (0, ioLatP99_,   1.0e3 * total_.percentile(0.99));
+  if ( numPolls_ )
+    pDriver_->setDoubleParam(0, pollPeriod_, pollPeriodSum_ / numPolls_);
+  pDriver_->setDoubleParam (0, pollPeriodMaxParam_, pollPeriodMax_);
+  pDriver_->setDoubleParam (0, pollPeriodSetParam_, pollPeriodSet_);
+  pDriver_->setIntegerParam(0, ioStops_,      (int)numStops_);
+  pDriver_->setDoubleParam (0, ioStopLat_,    1.0e3 * stopLat_);
+  pDriver_->setDoubleParam (0, ioStopLatMax_, 1.0e3 * stopLatMax_);
+  for ( i = 0; i < SMARACT_STATS_BINS; i++ )
+    hist_[i] = (double)total_.bins[i];
+  types[0] = 0;
+  for ( i = 0; i < numTypes_ && len < sizeof(types); i++ ) {
+    len += epicsSnprintf(&types[len], sizeof(types) - len, "%-8s %8lu %8.3f %8.3f %8.3f\n",
+                         keys_[i], types_[i].count, 1.0e3 * types_[i].mean(),
+                         1.0e3 * types_[i].percentile(0.99), 1.0e3 * types_[i].max);
+  }
+  lastCount_     = total_.count;
+  lastPublish_   = now;
+  pollPeriodSum_ = 0.0;
+  numPolls_      = 0;
+  epicsMutexUnlock(lock_);
+
+  pDriver_->setStringParam(0, ioTypes_, types);
+  pDriver_->doCallbacksFloat64Array(hist_, SMARACT_STATS_BINS, ioLatHist_, 0);
+  pDriver_->callParamCallbacks(0);
+}
+
+void
+SmarActIoStats::totals(SmarActIoTotals *pTotals)
+{
+  epicsMutexMustLock(lock_);
+  *pTotals = totals_;
+  epicsMutexUnlock(lock_);
+}
+
+void
+SmarActIoStats::clear()
+{
+  epicsMutexMustLock(lock_);
+  clearLocked();
+  epicsMutexUnlock(lock_);
+}
+
+void
+SmarActIoStats::clearLocked()
+{
+  numTypes_      = 0;
+  other_.clear();
+  total_.clear();
+  havePoll_      = 0;
+  pollPeriodSet_ = 0.0;
+  pollPeriodMax_ = 0.0;
+  pollPeriodSum_ = 0.0;
+  numPolls_      = 0;
+  lastCount_     = 0;
+  numStops_      = 0;
+  stopLat_       = 0.0;
+  stopLatMax_    = 0.0;
+  epicsTimeGetCurrent(&lastPublish_);
+}
+
+static void
+reportLatency(FILE *fp, const char *name, const SmarActLatency *pLat)
+{
+  fprintf(fp, "    %-8s %8lu %8lu %8lu %8.3f %8.3f %8.3f %8.3f\n", name,
+          pLat->count, pLat->timeouts, pLat->errors, 1.0e3 * pLat->min,
+          1.0e3 * pLat->mean(), 1.0e3 * pLat->percentile(0.99), 1.0e3 * pLat->max);
+}
+
+void
+SmarActIoStats::report(FILE *fp, int level)
+{
+int i;
+
+  epicsMutexMustLock(lock_);
+  fprintf(fp, "  I/O: %lu exchanges, %lu timeouts, %lu errors, latency mean %.3f ms, p99 %.3f ms, max %.3f ms\n",
+          total_.count, total_.timeouts, total_.errors, 1.0e3 * total_.mean(),
+          1.0e3 * total_.percentile(0.99), 1.0e3 * total_.max);
+  fprintf(fp, "  poll period: configured %.3f s, max %.3f s\n", pollPeriodSet_, pollPeriodMax_);
+  if ( numStops_ )
+    fprintf(fp, "  stops: %lu, latency last %.3f ms, max %.3f ms\n",
+            numStops_, 1.0e3 * stopLat_, 1.0e3 * stopLatMax_);
+  if ( level > 1 ) {
+    fprintf(fp, "    %-8s %8s %8s %8s %8s %8s %8s %8s\n", "command", "count", "timeout", "error",
+            "min/ms", "mean/ms", "p99/ms", "max/ms");
+    for ( i = 0; i < numTypes_; i++ )
+      reportLatency(fp, keys_[i], &types_[i]);
+    if ( other_.count )
+      reportLatency(fp, "other", &other_);
+  }
+  if ( level > 2 ) {
+    fprintf(fp, "    latency histogram:\n");
+    for ( i = 0; i < SMARACT_STATS_BINS; i++ ) {
+      if ( !total_.bins[i] )
+        continue;
+      if ( i < SMARACT_STATS_BINS - 1 )
+        fprintf(fp, "      < %10.3f ms %8lu\n", 1.0e3 * SmarActLatency::binLimit(i), total_.bins[i]);
+      else
+        fprintf(fp, "      longer        %8lu\n", total_.bins[i]);
+    }
+  }
+  epicsMutexUnlock(lock_);
+}
@@ -0,0 +1,148 @@
+#ifndef SMARACT_IO_STATS_H
+#define SMARACT_IO_STATS_H
+
+/* Latency and throughput statistics of the controller exchanges, shared by the
+ * smarAct MCS, MCS2 and SCU drivers.
+ *
+ * Every exchange is recorded with the type of its command (the command letters
+ * of the MCS and SCU, the last SCPI node of the MCS2), its round trip time and
+ * its status. The totals and the achieved poll period are published as asyn
+ * parameters of address 0, see smarActIoStats.db; the table of all command
+ * types is printed by report().
+ *
+ * Stop commands sent through SmarActTransport::express() are also timed from
+ * the call to the write, the stop latency (IO_STOP_LAT, IO_STOP_LAT_MAX).
+ *
+ * The statistics of each controller can be found by its port name, totals()
+ * returns counts that IO_RESET doesn't clear (see smarActBenchmark()).
+ */
+
+#ifdef __cplusplus
+
+#include <stdio.h>
+#include <asynPortDriver.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+/* Number of command types, the rest is counted as "other" */
+#define SMARACT_STATS_MAX_TYPES 32
+#define SMARACT_STATS_KEY_SIZE  12
+
+/* Latency histogram: bin 0 < 10us, bin n < 10us * 2^(n/2), the last bin takes the rest */
+#define SMARACT_STATS_BINS      40
+#define SMARACT_STATS_BIN0      10.0e-6
+
+/* Minimum time between two updates of the parameters, in s */
+#define SMARACT_STATS_PUBLISH_PERIOD 1.0
+
+#define SmarActIoCountString      "IO_COUNT"
+#define SmarActIoRateString       "IO_RATE"
+#define SmarActIoTimeoutsString   "IO_TIMEOUTS"
+#define SmarActIoErrorsString     "IO_ERRORS"
+#define SmarActIoLatMinString     "IO_LAT_MIN"
+#define SmarActIoLatMeanString    "IO_LAT_MEAN"
+#define SmarActIoLatMaxString     "IO_LAT_MAX"
+#define SmarActIoLatP99String     "IO_LAT_P99"
+#define SmarActIoLatHistString    "IO_LAT_HIST"
+#define SmarActIoTypesString      "IO_TYPES"
+#define SmarActPollPeriodString   "POLL_PERIOD"
+#define SmarActPollPeriodMaxString "POLL_PERIOD_MAX"
+#define SmarActPollPeriodSetString "POLL_PERIOD_SET"
+#define SmarActIoResetString      "IO_RESET"
+#define SmarActIoStopsString      "IO_STOPS"
+#define SmarActIoStopLatString    "IO_STOP_LAT"
+#define SmarActIoStopLatMaxString "IO_STOP_LAT_MAX"
+
+#define SMARACT_STATS_NUM_PARAMS 17
+
+/** Latencies of one command type, in s */
+struct SmarActLatency {
+  unsigned long count;
+  unsigned long timeouts;
+  unsigned long errors;
+  double        min;
+  double        max;
+  double        sum;
+  unsigned long bins[SMARACT_STATS_BINS];
+
+  void   clear();
+  void   add(double seconds, asynStatus status);
+  double mean() const;
+  double percentile(double fraction) const;
+  static double binLimit(int bin);
+};
+
+/** Counts since the controller was created */
+struct SmarActIoTotals {
+  unsigned long polls;
+  unsigned long exchanges;
+  unsigned long timeouts;
+  unsigned long errors;
+  double        latency;   /* sum of the round trips, s */
+};
+
+class SmarActIoStats
+{
+public:
+  SmarActIoStats();
+  ~SmarActIoStats();
+
+  void createParams(asynPortDriver *pDriver);
+  void record(const char *command, const epicsTimeStamp *pStart, asynStatus status);
+  void pollCycle(int moving, double movingPollPeriod, double idlePollPeriod);
+  void stopSent(const epicsTimeStamp *pIssued);
+  void publish();
+  void clear();
+  void report(FILE *fp, int level);
+  void totals(SmarActIoTotals *pTotals);
+
+  static void            commandKey(const char *command, char *key, size_t keySize);
+  static SmarActIoStats *find(const char *portName);
+
+private:
+  void clearLocked();
+
+  epicsMutexId    lock_;     /* record() is also called from threads without the controller lock */
+  asynPortDriver *pDriver_;
+  char            keys_[SMARACT_STATS_MAX_TYPES][SMARACT_STATS_KEY_SIZE];
+  SmarActLatency  types_[SMARACT_STATS_MAX_TYPES];
+  int             numTypes_;
+  SmarActLatency  other_;
+  SmarActLatency  total_;
+  epicsTimeStamp  lastPoll_;
+  int             havePoll_;
+  double          pollPeriodSet_;
+  double          pollPeriodMax_;
+  double          pollPeriodSum_;   /* since the last publish */
+  unsigned long   numPolls_;        /* since the last publish */
+  epicsTimeStamp  lastPublish_;
+  unsigned long   lastCount_;
+  unsigned long   numStops_;
+  double          stopLat_;         /* of the last stop, s */
+  double          stopLatMax_;
+  SmarActIoTotals totals_;
+  SmarActIoStats *next_;            /* list of all controllers, see find() */
+  static SmarActIoStats *first_;
+  static epicsMutexId    listLock_;
+  double          hist_[SMARACT_STATS_BINS];
+  int ioCount_;
+  int ioRate_;
+  int ioTimeouts_;
+  int ioErrors_;
+  int ioLatMin_;
+  int ioLatMean_;
+  int ioLatMax_;
+  int ioLatP99_;
+  int ioLatHist_;
+  int ioTypes_;
+  int pollPeriod_;
+  int pollPeriodMaxParam_;
+  int pollPeriodSetParam_;
+  int ioReset_;
+  int ioStops_;
+  int ioStopLat_;
+  int ioStopLatMax_;
+};
+
+#endif // _cplusplus
+#endif // SMARACT_IO_STATS_H
@@ -12,9 +12,12 @@ Jan 19, 2019
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include <iocsh.h>
 #include <epicsThread.h>
+#include <epicsAtomic.h>
+#include <epicsExit.h>
 
 #include <asynOctetSyncIO.h>
 
@@ -23,6 +26,7 @@ Jan 19, 2019
 
 #include <epicsExport.h>
 #include "smarActMCS2MotorDriver.h"
+#include "smarActParse.h"
 
 /* ESS defined one bit for INFO. Tried to get that upstream, but failed */
 #ifndef ASYN_TRACE_INFO
@@ -31,22 +35,88 @@ Jan 19, 2019
 
 static const char *driverName = "SmarActMCS2MotorDriver";
 
+/* SCPI leafs of the values read in a poll cycle, indexed by MCS2_POLL_xxx */
+static const char *mcs2PollLeafs[MCS2_POLL_NUM_FIELDS] = {
+  ":STAT?", ":POS?", ":POS:TARG?", ":PTYP?", ":MCLF?"
+};
+
+/* Parse a whole reply field as a number, tracing the column where it is malformed */
+static asynStatus mcs2ParseInt(asynUser *pasynUser, const char *reply, int *pValue)
+{
+  const char *p = reply;
+  if (smarActParseInt(&p, pValue) || smarActParseEnd(&p)) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR, "%s: malformed reply '%s' at column %d\n",
+              driverName, reply, (int)(p - reply));
+    return asynError;
+  }
+  return asynSuccess;
+}
+
+static asynStatus mcs2ParseInt64(asynUser *pasynUser, const char *reply, PositionType *pValue)
+{
+  const char *p = reply;
+  if (smarActParseInt64(&p, pValue) || smarActParseEnd(&p)) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR, "%s: malformed reply '%s' at column %d\n",
+              driverName, reply, (int)(p - reply));
+    return asynError;
+  }
+  return asynSuccess;
+}
+
+static asynStatus mcs2ParseDouble(asynUser *pasynUser, const char *reply, double *pValue)
+{
+  const char *p = reply;
+  if (smarActParseDouble(&p, pValue) || smarActParseEnd(&p)) {
+    asynPrint(pasynUser, ASYN_TRACE_ERROR, "%s: malformed reply '%s' at column %d\n",
+              driverName, reply, (int)(p - reply));
+    return asynError;
+  }
+  return asynSuccess;
+}
+
+static void MCS2CaptureThreadC(void *pPvt)
+{
+  MCS2Controller *pC = (MCS2Controller*)pPvt;
+  pC->captureThread();
+}
+
+static void MCS2ProfileThreadC(void *pPvt)
+{
+  MCS2Controller *pC = (MCS2Controller*)pPvt;
+  pC->profileThread();
+}
+
+static void MCS2PollGroupThreadC(void *pPvt)
+{
+  MCS2PollGroup *pGroup = (MCS2PollGroup*)pPvt;
+  pGroup->pollerThread();
+}
+
+static void MCS2PollGroupExitC(void *pPvt)
+{
+  MCS2PollGroup *pGroup = (MCS2PollGroup*)pPvt;
+  pGroup->shutdown();
+}
+
 /** Creates a new MCS2Controller object.
   * \param[in] portName             The name of the asyn port that will be created for this driver
   * \param[in] MCS2PortName         The name of the drvAsynIPPPort that was created previously to connect to the MCS2 controller
   * \param[in] numAxes              The number of axes that this controller supports
   * \param[in] movingPollPeriod     The time between polls when any axis is moving
   * \param[in] idlePollPeriod       The time between polls when no axis is moving
+  * \param[in] unusedMask           Bit n set: there is no axis n
+  * \param[in] pollGroup            Name of an MCS2PollGroup whose thread polls this controller, NULL: own poller
   */
 MCS2Controller::MCS2Controller(const char *portName, const char *MCS2PortName, int numAxes,
-                               double movingPollPeriod, double idlePollPeriod, int unusedMask)
-  :  asynMotorController(portName, numAxes, NUM_MCS2_PARAMS,
+                               double movingPollPeriod, double idlePollPeriod, int unusedMask,
+                               const char *pollGroup)
+  :  asynMotorController(portName, numAxes, NUM_MCS2_PARAMS + SMARACT_STATS_NUM_PARAMS + SMARACT_DEADBAND_NUM_PARAMS,
 #ifdef SMARACT_ASYN_ASYNPARAMINT64
-                         asynInt64Mask |
+                         asynInt64Mask | asynInt64ArrayMask |
 #endif
                          0,
 #ifdef SMARACT_ASYN_ASYNPARAMINT64
-                         asynInt64Mask |
+                         asynInt64Mask | asynInt64ArrayMask |
 #endif
                          0,
                          ASYN_CANBLOCK | ASYN_MULTIDEVICE,
@@ -57,6 +127,15 @@ MCS2Controller::MCS2Controller(const char *portName, const char *MCS2PortName, i
   asynStatus status;
   static const char *functionName = "MCS2Controller";
   asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "MCS2Controller::MCS2Controller: Creating controller\n");
+  pollMode_ = MCS2_POLL_MODE_AXIS;
+  pollNumChunks_ = 0;
+  pollGroup_ = NULL;
+  movesDeferred_ = 0;
+  deferredLen_ = 0;
+  deferredString_[0] = '\0';
+  propertyRefreshPeriod_ = MCS2_PROPERTY_REFRESH_PERIOD;
+  fastPollPeriod_ = 0.0;
+  numErrors_ = 0;
 
   // Create controller-specific parameters
   createParam(MCS2MclfString, asynParamInt32, &this->mclf_);
@@ -79,22 +158,113 @@ MCS2Controller::MCS2Controller(const char *portName, const char *MCS2PortName, i
   createParam(MCS2STEPCNTString,  asynParamInt32, &this->stepcnt_);
   createParam(MCS2STEPSIZEFString, asynParamFloat64, &this->stepsizef_);
   createParam(MCS2STEPSIZERString, asynParamFloat64, &this->stepsizer_);
+  createParam(MCS2TrigModeString, asynParamInt32, &this->trigMode_);
+  createParam(MCS2TrigStartString, asynParamFloat64, &this->trigStart_);
+  createParam(MCS2TrigStopString, asynParamFloat64, &this->trigStop_);
+  createParam(MCS2TrigIncrString, asynParamFloat64, &this->trigIncr_);
+  createParam(MCS2TrigPulseWidthString, asynParamInt32, &this->trigPwid_);
+  createParam(MCS2TrigPolarityString, asynParamInt32, &this->trigPol_);
+  createParam(MCS2CaptEnableString, asynParamInt32, &this->captEnable_);
+  createParam(MCS2CaptRateString, asynParamInt32, &this->captRate_);
+  createParam(MCS2CaptRateRbString, asynParamFloat64, &this->captRateRb_);
+  createParam(MCS2CaptClearString, asynParamInt32, &this->captClear_);
+  createParam(MCS2CaptNumString, asynParamInt32, &this->captNum_);
+  createParam(MCS2CaptPosString, asynParamFloat64Array, &this->captPos_);
+#ifdef SMARACT_ASYN_ASYNPARAMINT64
+  createParam(MCS2CaptIPosString, asynParamInt64Array, &this->captIPos_);
+#else
+  this->captIPos_ = -1;
+#endif
+  createParam(MCS2CaptTimeString, asynParamFloat64Array, &this->captTime_);
+  createParam(MCS2FineModeString, asynParamInt32, &this->fineMode_);
+  createParam(MCS2FineRangeString, asynParamFloat64, &this->fineRange_);
+  createParam(MCS2FineActiveString, asynParamInt32, &this->fineActive_);
+  createParam(MCS2WavePosString, asynParamFloat64Array, &this->wavePos_);
+  createParam(MCS2WaveUseString, asynParamInt32, &this->waveUse_);
+  createParam(MCS2WaveRateString, asynParamInt32, &this->waveRate_);
+  createParam(MCS2WaveCyclesString, asynParamInt32, &this->waveCycles_);
+  createParam(MCS2WaveRelativeString, asynParamInt32, &this->waveRelative_);
+  createParam(MCS2WaveStartString, asynParamInt32, &this->waveStart_);
+  createParam(MCS2WaveStateString, asynParamInt32, &this->waveState_);
+  createParam(MCS2WaveUnderrunsString, asynParamInt32, &this->waveUnderrunsRb_);
+  createParam(MCS2StopAllString, asynParamInt32, &this->stopAll_);
+  createParam(MCS2ErrorLogString, asynParamOctet, &this->errLog_);
+  createParam(MCS2ErrorCountString, asynParamInt32, &this->errCount_);
+  createParam(MCS2VelEstString, asynParamFloat64, &this->velEst_);
+  createParam(MCS2VelEstEnableString, asynParamInt32, &this->velEstEnable_);
+  ioStats_.createParams(this);
+  deadbands_.createParams(this, numAxes);
+
+  // The link is taken to be up, the first failed poll finds out otherwise.
+  // Set before the first I/O, writeController() and writeReadController() check it
+  oldStatus_ = asynSuccess;
+  linkDown_ = 0;
+  linkProbing_ = 0;
+  linkBackoff_ = MCS2_LINK_BACKOFF_MIN;
+  epicsTimeGetCurrent(&linkRetry_);
+  linkDrops_ = 0;
 
   /* Connect to MCS2 controller */
   status = pasynOctetSyncIO->connect(MCS2PortName, 0, &pasynUserController_, NULL);
   pasynOctetSyncIO->setInputEos (pasynUserController_, "\r\n", 2);
   pasynOctetSyncIO->setOutputEos(pasynUserController_, "\r\n", 2);
 
+  /* Pipelined batched polls, SCPI replies come in the order of the queries */
+  transport_ = new SmarActTransport(MCS2PortName, 0, SmarActMatchFifo);
+  transport_->setStats(&ioStats_);
+  scheduler_ = new SmarActPollScheduler(numAxes, this);
+
   asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "MCS2Controller::MCS2Controller: Connecting to controller\n");
   if (status) {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
       "%s:%s: cannot connect to MCS2 controller\n",
       driverName, functionName);
   }
+  /* The capture thread has its own connection, so it never waits for the controller lock */
+  captureEvent_ = epicsEventMustCreate(epicsEventEmpty);
+  captureRateRb_ = 0.0;
+  captureScratchF_ = (epicsFloat64 *)calloc(2 * MCS2_CAPTURE_SIZE, sizeof(epicsFloat64));
+  captureScratchI_ = (PositionType *)calloc(MCS2_CAPTURE_SIZE, sizeof(PositionType));
+#ifdef SMARACT_ASYN_ASYNPARAMINT64
+  captureScratchI64_ = (epicsInt64 *)calloc(MCS2_CAPTURE_SIZE, sizeof(epicsInt64));
+#endif
+  epicsTimeGetCurrent(&captureStartTime_);
+  streamRate_ = MCS2_STREAM_RATE;
+  profileEvent_ = epicsEventMustCreate(epicsEventEmpty);
+  profileThreadId_ = NULL;
+  profileAbortRequest_ = 0;
+  profileFrames_ = NULL;
+  profileNumFrames_ = 0;
+  profilePointTimes_ = NULL;
+  profileStartTime_ = 0.0;
+  profileEndTime_ = 0.0;
+  waveRequest_ = 0;
+  waveRunning_ = 0;
+  waveAddr_ = 0;
+  waveStopRequest_ = 0;
+  waveUnderruns_ = 0;
+  status = pasynOctetSyncIO->connect(MCS2PortName, 0, &pasynUserCapture_, NULL);
+  if (status) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s:%s: capture cannot connect to MCS2 controller\n",
+      driverName, functionName);
+    pasynUserCapture_ = NULL;
+  } else {
+    pasynOctetSyncIO->setInputEos (pasynUserCapture_, "\r\n", 2);
+    pasynOctetSyncIO->setOutputEos(pasynUserCapture_, "\r\n", 2);
+  }
+
+  status = pasynOctetSyncIO->connect(MCS2PortName, 0, &pasynUserPoll_, NULL);
+  if (status) {
+    pasynUserPoll_ = NULL;
+  } else {
+    pasynOctetSyncIO->setInputEos (pasynUserPoll_, "\r\n", 2);
+    pasynOctetSyncIO->setOutputEos(pasynUserPoll_, "\r\n", 2);
+  }
+
   asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER, "MCS2Controller::MCS2Controller: Clearing error messages\n");
   this->clearErrors();
 
-  oldStatus_ = asynError;
   snprintf(this->outString_, sizeof(this->outString_)-1,":DEV:SNUM?");
   status = this->writeReadController();
   if (status) {
@@ -103,6 +273,17 @@ MCS2Controller::MCS2Controller(const char *portName, const char *MCS2PortName, i
       driverName, functionName);
   }
   asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "MCS2Controller::MCS2Controller: Device Name: %s\n", this->inString_);
+  serial_[0] = 0;
+  if (!status) {
+    /* The reply is quoted, "MCS2-00001234" */
+    const char *p = this->inString_;
+    size_t len = 0;
+    for (; *p && len < sizeof(serial_) - 1; p++) {
+      if (*p > ' ' && *p != '"')
+        serial_[len++] = *p;
+    }
+    serial_[len] = 0;
+  }
   this->clearErrors();
 
 
@@ -115,7 +296,31 @@ MCS2Controller::MCS2Controller(const char *portName, const char *MCS2PortName, i
         new MCS2Axis(this, axis);
   }
 
-  startPoller(movingPollPeriod, idlePollPeriod, 2);
+  if (pasynUserCapture_) {
+    epicsThreadCreate("MCS2Capture",
+                      epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium),
+                      (EPICSTHREADFUNC)MCS2CaptureThreadC, (void *)this);
+  }
+  if (pollGroup && pollGroup[0]) {
+    pollGroup_ = MCS2PollGroup::find(pollGroup);
+    if (!pollGroup_)
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: poll group %s not found, using a poller of its own\n", driverName, functionName, pollGroup);
+  }
+  if (pollGroup_) {
+    /* No poller thread: the one of the group polls this controller */
+    movingPollPeriod_ = pollGroup_->movingPollPeriod();
+    idlePollPeriod_ = pollGroup_->idlePollPeriod();
+    forcedFastPolls_ = 2;
+    if (pollGroup_->add(this)) {
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: poll group %s is full, using a poller of its own\n", driverName, functionName, pollGroup);
+      pollGroup_ = NULL;
+    }
+  }
+  if (!pollGroup_)
+    startPoller(movingPollPeriod, idlePollPeriod, 2);
 }
 
 
@@ -126,14 +331,169 @@ MCS2Controller::MCS2Controller(const char *portName, const char *MCS2PortName, i
   * \param[in] numAxes           The number of axes that this controller supports
   * \param[in] movingPollPeriod  The time in ms between polls when any axis is moving
   * \param[in] idlePollPeriod    The time in ms between polls when no axis is moving
+  * \param[in] unusedMask        Bit n set: there is no axis n
+  * \param[in] pollGroup         Optional name of a group created with MCS2CreatePollGroup
   */
 extern "C" int MCS2CreateController(const char *portName, const char *MCS2PortName, int numAxes,
-                                    int movingPollPeriod, int idlePollPeriod, int unusedMask)
+                                    int movingPollPeriod, int idlePollPeriod, int unusedMask,
+                                    const char *pollGroup)
 {
-  new MCS2Controller(portName, MCS2PortName, numAxes, movingPollPeriod/1000., idlePollPeriod/1000., unusedMask);
+  new MCS2Controller(portName, MCS2PortName, numAxes, movingPollPeriod/1000., idlePollPeriod/1000., unusedMask,
+                     pollGroup);
   return(asynSuccess);
 }
 
+/** Creates a poller thread that polls several controllers.
+  * Configuration command, called directly or from iocsh, before the MCS2CreateController
+  * calls that name the group. In MCS2_POLL_MODE_BATCHED the queries of all controllers of
+  * the group are written before the first reply is read.
+  * \param[in] groupName         The name of the group
+  * \param[in] movingPollPeriod  The time in ms between polls when any axis of the group is moving
+  * \param[in] idlePollPeriod    The time in ms between polls when no axis of the group is moving
+  */
+extern "C" int MCS2CreatePollGroup(const char *groupName, int movingPollPeriod, int idlePollPeriod)
+{
+  if (!groupName || !groupName[0]) {
+    printf("MCS2CreatePollGroup: Error no group name\n");
+    return asynError;
+  }
+  if (MCS2PollGroup::find(groupName)) {
+    printf("MCS2CreatePollGroup: Error group %s exists already\n", groupName);
+    return asynError;
+  }
+  new MCS2PollGroup(groupName, movingPollPeriod/1000., idlePollPeriod/1000.);
+  return asynSuccess;
+}
+
+/** Selects how the controller is polled.
+  * Configuration command, called directly or from iocsh
+  * \param[in] portName          The name of the asyn port that was created by MCS2CreateController
+  * \param[in] pollMode          MCS2_POLL_MODE_AXIS (0) or MCS2_POLL_MODE_BATCHED (1)
+  */
+extern "C" int MCS2SetPollMode(const char *portName, int pollMode)
+{
+  MCS2Controller *pC = (MCS2Controller*) findAsynPortDriver(portName);
+  if (!pC) {
+    printf("MCS2SetPollMode: Error port %s not found\n", portName);
+    return asynError;
+  }
+  pC->lock();
+  pC->setPollMode(pollMode);
+  pC->unlock();
+  return asynSuccess;
+}
+
+/** Sets how often the cached positioner type and MCL frequency are read again.
+  * Configuration command, called directly or from iocsh
+  * \param[in] portName          The name of the asyn port that was created by MCS2CreateController
+  * \param[in] period            Refresh period in seconds, 0 reads them in every idle poll
+  */
+extern "C" int MCS2SetPropertyRefreshPeriod(const char *portName, double period)
+{
+  MCS2Controller *pC = (MCS2Controller*) findAsynPortDriver(portName);
+  if (!pC) {
+    printf("MCS2SetPropertyRefreshPeriod: Error port %s not found\n", portName);
+    return asynError;
+  }
+  pC->lock();
+  pC->setPropertyRefreshPeriod(period);
+  pC->unlock();
+  return asynSuccess;
+}
+
+/** Sets how many batched poll commands may be on the link at once.
+  * Configuration command, called directly or from iocsh
+  * \param[in] portName          The name of the asyn port that was created by MCS2CreateController
+  * \param[in] depth             Number of commands, 1 (default) waits for each reply before the next command
+  */
+extern "C" int MCS2SetPipelineDepth(const char *portName, int depth)
+{
+  MCS2Controller *pC = (MCS2Controller*) findAsynPortDriver(portName);
+  if (!pC) {
+    printf("MCS2SetPipelineDepth: Error port %s not found\n", portName);
+    return asynError;
+  }
+  pC->lock();
+  pC->setPipelineDepth(depth);
+  pC->unlock();
+  return asynSuccess;
+}
+
+/** Sets how often an axis is polled when it doesn't move.
+  * Configuration command, called directly or from iocsh
+  * \param[in] portName          The name of the asyn port that was created by MCS2CreateController
+  * \param[in] axis              The axis number
+  * \param[in] priority          0 low, 1 normal, 2 high (default): polled in every cycle
+  */
+extern "C" int MCS2SetAxisPriority(const char *portName, int axis, int priority)
+{
+  MCS2Controller *pC = (MCS2Controller*) findAsynPortDriver(portName);
+  if (!pC) {
+    printf("MCS2SetAxisPriority: Error port %s not found\n", portName);
+    return asynError;
+  }
+  pC->lock();
+  pC->setAxisPriority(axis, priority);
+  pC->unlock();
+  return asynSuccess;
+}
+
+/** Enables predictive done detection.
+  * Configuration command, called directly or from iocsh
+  * \param[in] portName          The name of the asyn port that was created by MCS2CreateController
+  * \param[in] predictive        1 reads a moving axis less often until its expected arrival, 0 (default) in every cycle
+  */
+extern "C" int MCS2SetPredictivePoll(const char *portName, int predictive)
+{
+  MCS2Controller *pC = (MCS2Controller*) findAsynPortDriver(portName);
+  if (!pC) {
+    printf("MCS2SetPredictivePoll: Error port %s not found\n", portName);
+    return asynError;
+  }
+  pC->lock();
+  pC->setPredictivePoll(predictive);
+  pC->unlock();
+  return asynSuccess;
+}
+
+/** Fuses the status and position queries into each move.
+  * Configuration command, called directly or from iocsh
+  * \param[in] portName          The name of the asyn port that was created by MCS2CreateController
+  * \param[in] fastPollPeriod    Time in ms between polls right after a move, 0 (default) writes moves only
+  */
+extern "C" int MCS2SetFusedMoves(const char *portName, int fastPollPeriod)
+{
+  MCS2Controller *pC = (MCS2Controller*) findAsynPortDriver(portName);
+  if (!pC) {
+    printf("MCS2SetFusedMoves: Error port %s not found\n", portName);
+    return asynError;
+  }
+  pC->lock();
+  pC->setFusedMoves(fastPollPeriod / 1000.);
+  pC->unlock();
+  return asynSuccess;
+}
+
+/** Enables profile moves.
+  * Configuration command, called directly or from iocsh
+  * \param[in] portName          The name of the asyn port that was created by MCS2CreateController
+  * \param[in] maxPoints         The maximum number of points in a profile
+  * \param[in] streamRate        Rate of the stream frames in Hz, 0 selects MCS2_STREAM_RATE
+  */
+extern "C" int MCS2CreateProfile(const char *portName, int maxPoints, int streamRate)
+{
+  MCS2Controller *pC = (MCS2Controller*) findAsynPortDriver(portName);
+  if (!pC) {
+    printf("MCS2CreateProfile: Error port %s not found\n", portName);
+    return asynError;
+  }
+  pC->lock();
+  pC->setStreamRate(streamRate > 0 ? streamRate : MCS2_STREAM_RATE);
+  pC->initializeProfile(maxPoints);
+  pC->unlock();
+  return asynSuccess;
+}
+
 extern "C" const char *mcs2AsynStatusToString(asynStatus status) {
   switch ((int)status) {
     case asynSuccess:
@@ -163,96 +523,1625 @@ extern "C" const char *mcs2AsynStatusToString(asynStatus status) {
   }
 }
 
-asynStatus MCS2Controller::writeReadHandleDisconnect(void)
+/** Sends outString_ and reads the reply into inString_.
+  * On the poll thread the controller lock is released while the reply is on its way.
+  */
+asynStatus MCS2Controller::writeReadHandleDisconnect(void)
+{
+  asynStatus status = asynError;
+  size_t nread;
+  inString_[0] = '\0';
+  status = writeReadReleased(outString_, inString_, sizeof(inString_), &nread, DEFAULT_CONTROLLER_TIMEOUT);
+  handleStatusChange(status);
+  if (status) {
+    return asynError;
+  }
+  return status;
+}
+
+/** Sends a query with a short timeout to find out whether the controller answers at all */
+asynStatus MCS2Controller::probeLink(void)
+{
+  char inString[MAX_CONTROLLER_STRING_SIZE];
+  size_t nread = 0;
+  asynStatus status;
+
+  linkProbing_ = 1;
+  status = writeReadController(":DEV:SNUM?", inString, sizeof(inString), &nread, MCS2_LINK_PROBE_TIMEOUT);
+  linkProbing_ = 0;
+  return status;
+}
+
+/** Called with the status of every exchange of the poll.
+  * A failure takes the link down only if the controller doesn't answer a probe either,
+  * otherwise just this query failed and the axis deals with it. While the link is down
+  * startPoll() probes it with a backoff; when the controller answers again the errors
+  * are cleared once and every axis repeats its initialPoll().
+  */
+void MCS2Controller::handleStatusChange(asynStatus status) {
+  static const char *functionName = "handleStatusChange";
+  if (status && !linkDown_ && asynSuccess == probeLink())
+    status = asynSuccess;
+  if ((status != asynSuccess) != (oldStatus_ != asynSuccess)) {
+    asynPrint(
+        pasynUserController_, ASYN_TRACE_INFO,
+        "%s oldStatus=%s(%d) newStatus=%s(%d)\n",
+        functionName , mcs2AsynStatusToString(oldStatus_),
+        (int)oldStatus_, mcs2AsynStatusToString(status), (int)status);
+    if (status) {
+      /* Connected -> Disconnected */
+      int axisNo;
+      epicsAtomicSetIntT(&linkDown_, 1);
+      linkDrops_++;
+      linkBackoff_ = MCS2_LINK_BACKOFF_MIN;
+      epicsTimeGetCurrent(&linkRetry_);
+      epicsTimeAddSeconds(&linkRetry_, linkBackoff_);
+      // setAlarmStatusSeverityAllReadbacks(asynDisconnected);
+      for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+        asynMotorAxis *pAxis = getAxis(axisNo);
+        if (!pAxis) continue;
+        pAxis->asynMotorAxis::setIntegerParam(motorStatusCommsError_, 1);
+        pAxis->callParamCallbacks();
+      }
+    } else {
+      /* Disconnected -> Connected */
+      int axisNo;
+      if (linkDown_) {
+        epicsAtomicSetIntT(&linkDown_, 0);
+        for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+          MCS2Axis *pAxis = getAxis(axisNo);
+          if (pAxis) pAxis->initialPollDone_ = 0;
+        }
+        clearErrors();
+      }
+    }
+    oldStatus_ = status;
+  }
+  callParamCallbacks();
+}
+
+void MCS2Controller::setPollMode(int pollMode)
+{
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_INFO,
+            "MCS2Controller::setPollMode(%s) pollMode=%d\n", this->portName, pollMode);
+  pollMode_ = pollMode;
+}
+
+void MCS2Controller::setPropertyRefreshPeriod(double period)
+{
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_INFO,
+            "MCS2Controller::setPropertyRefreshPeriod(%s) period=%f\n", this->portName, period);
+  propertyRefreshPeriod_ = period;
+}
+
+void MCS2Controller::setPipelineDepth(int depth)
+{
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_INFO,
+            "MCS2Controller::setPipelineDepth(%s) depth=%d\n", this->portName, depth);
+  transport_->setDepth(depth);
+}
+
+void MCS2Controller::setAxisPriority(int axis, int priority)
+{
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_INFO,
+            "MCS2Controller::setAxisPriority(%s) axis=%d priority=%d\n", this->portName, axis, priority);
+  scheduler_->setPriority(axis, priority);
+}
+
+void MCS2Controller::setPredictivePoll(int predictive)
+{
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_INFO,
+            "MCS2Controller::setPredictivePoll(%s) predictive=%d\n", this->portName, predictive);
+  scheduler_->setPredictive(predictive);
+}
+
+void MCS2Controller::setFusedMoves(double fastPollPeriod)
+{
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_INFO,
+            "MCS2Controller::setFusedMoves(%s) fastPollPeriod=%f\n", this->portName, fastPollPeriod);
+  fastPollPeriod_ = fastPollPeriod > 0.0 ? fastPollPeriod : 0.0;
+}
+
+void MCS2Controller::setStreamRate(int streamRate)
+{
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_INFO,
+            "MCS2Controller::setStreamRate(%s) streamRate=%d\n", this->portName, streamRate);
+  streamRate_ = streamRate;
+}
+
+/** Called by the poller thread at the start of each poll cycle, before the axes are polled.
+  * In MCS2_POLL_MODE_BATCHED the values of all axes are read with one chained query,
+  * the axes pick up their replies in MCS2Axis::poll().
+  */
+asynStatus MCS2Controller::poll()
+{
+  startPoll();
+  return finishPoll();
+}
+
+/** First half of poll(): the statistics and the batched query are sent.
+  * Split from poll() for MCS2PollGroup, which starts the polls of all its
+  * controllers before it waits for the replies of the first one.
+  */
+void MCS2Controller::startPoll()
+{
+  int done;
+  int moving = 0;
+  int axisNo;
+
+  ioStats_.publish();
+  deadbands_.publish();
+  for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+    if (getAxis(axisNo) && !getIntegerParam(axisNo, motorStatusDone_, &done) && !done)
+      moving = 1;
+  }
+  ioStats_.pollCycle(moving, movingPollPeriod_, idlePollPeriod_);
+  scheduler_->plan(idlePollPeriod_);
+
+  if (linkDown_) {
+    epicsTimeStamp now;
+    asynStatus status;
+    epicsTimeGetCurrent(&now);
+    if (epicsTimeDiffInSeconds(&now, &linkRetry_) < 0.0)
+      return;
+    status = probeLink();
+    if (status) {
+      linkBackoff_ *= 2.0;
+      if (linkBackoff_ > MCS2_LINK_BACKOFF_MAX)
+        linkBackoff_ = MCS2_LINK_BACKOFF_MAX;
+      linkRetry_ = now;
+      epicsTimeAddSeconds(&linkRetry_, linkBackoff_);
+    }
+    handleStatusChange(status);
+    if (linkDown_)
+      return;
+  }
+
+  publishCapture();
+  if (pollMode_ == MCS2_POLL_MODE_BATCHED)
+    startBatchedPoll();
+}
+
+/** Second half of poll(): the replies of the batched query */
+asynStatus MCS2Controller::finishPoll()
+{
+  if (linkDown_)
+    return asynDisconnected;
+  return finishBatchedPoll();
+}
+
+/** Wakes the poller thread, that of the poll group if the controller is in one */
+asynStatus MCS2Controller::wakeupPoller()
+{
+  if (!pollGroup_)
+    return asynMotorController::wakeupPoller();
+  pollGroup_->wakeup();
+  return asynSuccess;
+}
+
+MCS2PollGroup *MCS2PollGroup::first_ = NULL;
+
+MCS2PollGroup::MCS2PollGroup(const char *name, double movingPollPeriod, double idlePollPeriod)
+  : movingPollPeriod_(movingPollPeriod), idlePollPeriod_(idlePollPeriod), numMembers_(0),
+    shuttingDown_(0)
+{
+  snprintf(name_, sizeof(name_), "%s", name);
+  lock_ = epicsMutexMustCreate();
+  event_ = epicsEventMustCreate(epicsEventEmpty);
+  next_ = first_;
+  first_ = this;
+  epicsThreadCreate("MCS2PollGroup",
+                    epicsThreadPriorityMedium,
+                    epicsThreadGetStackSize(epicsThreadStackMedium),
+                    (EPICSTHREADFUNC)MCS2PollGroupThreadC, (void *)this);
+  epicsAtExit(MCS2PollGroupExitC, this);
+}
+
+MCS2PollGroup *MCS2PollGroup::find(const char *name)
+{
+  MCS2PollGroup *pGroup;
+  for (pGroup = first_; pGroup; pGroup = pGroup->next_) {
+    if (0 == strcmp(pGroup->name_, name))
+      return pGroup;
+  }
+  return NULL;
+}
+
+/** \return 0 on success, -1 if the group is full */
+int MCS2PollGroup::add(MCS2Controller *pC)
+{
+  int status = -1;
+  epicsMutexMustLock(lock_);
+  if (numMembers_ < MCS2_POLL_GROUP_SIZE) {
+    members_[numMembers_++] = pC;
+    status = 0;
+  }
+  epicsMutexUnlock(lock_);
+  wakeup();
+  return status;
+}
+
+void MCS2PollGroup::wakeup()
+{
+  epicsEventSignal(event_);
+}
+
+/** Ends the poller thread at IOC exit, before the controllers go away */
+void MCS2PollGroup::shutdown()
+{
+  epicsAtomicSetIntT(&shuttingDown_, 1);
+  epicsEventSignal(event_);
+}
+
+/** The loop of asynMotorController::asynMotorPoller(), for all controllers of the group.
+  * All of them are locked for the whole cycle, in the order they were added, since their
+  * batched queries are on the link at the same time. The thread ends after shutdown().
+  */
+void MCS2PollGroup::pollerThread()
+{
+  MCS2Controller *members[MCS2_POLL_GROUP_SIZE];
+  int numMembers;
+  int forcedFastPolls = 0;
+  bool anyMoving = false;
+  double timeout;
+  int i;
+
+  while (1) {
+    if (forcedFastPolls > 0) {
+      timeout = movingPollPeriod_;
+      forcedFastPolls--;
+    } else if (anyMoving) {
+      timeout = movingPollPeriod_;
+    } else {
+      timeout = idlePollPeriod_;
+    }
+    if (timeout != 0.) {
+      if (epicsEventWaitOK == epicsEventWaitWithTimeout(event_, timeout))
+        forcedFastPolls = 2;
+    } else {
+      epicsEventWait(event_);
+      forcedFastPolls = 2;
+    }
+    if (epicsAtomicGetIntT(&shuttingDown_))
+      break;
+
+    epicsMutexMustLock(lock_);
+    numMembers = numMembers_;
+    memcpy(members, members_, numMembers * sizeof(members[0]));
+    epicsMutexUnlock(lock_);
+
+    anyMoving = false;
+    for (i = 0; i < numMembers; i++)
+      members[i]->lock();
+    for (i = 0; i < numMembers; i++)
+      members[i]->startPoll();
+    for (i = 0; i < numMembers; i++) {
+      MCS2Controller *pC = members[i];
+      int axisNo;
+      pC->finishPoll();
+      for (axisNo = 0; axisNo < pC->numAxes_; axisNo++) {
+        MCS2Axis *pAxis = pC->getAxis(axisNo);
+        bool moving = false;
+        if (!pAxis) continue;
+        pAxis->poll(&moving);
+        if (moving) anyMoving = true;
+      }
+    }
+    for (i = numMembers - 1; i >= 0; i--)
+      members[i]->unlock();
+  }
+}
+
+/** Samples the positions of all axes with capture enabled into their rings.
+  * Runs in its own thread with its own asynUser and never takes the controller lock.
+  * Its queries share the octet port with the poller, though: a poll waits for the
+  * capture query in progress. The thread is idle for at least as long as its last
+  * query took and for no less than MCS2_CAPTURE_MIN_PERIOD per sample, so it never
+  * takes more than half of the link.
+  */
+void MCS2Controller::captureThread()
+{
+  static const char *functionName = "captureThread";
+  char outString[MCS2_POLL_STRING_SIZE];
+  char inString[MCS2_POLL_STRING_SIZE];
+  epicsTimeStamp rateTime;
+  unsigned numCycles = 0;
+
+  epicsTimeGetCurrent(&rateTime);
+  while (1) {
+    epicsTimeStamp start, now;
+    double sampleTime;
+    double elapsed;
+    size_t len = 0;
+    size_t nwrite = 0;
+    size_t nread = 0;
+    int eomReason;
+    int rate = 0;
+    int axisNo;
+    const char *pReply;
+    asynStatus status;
+
+    for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+      MCS2Axis *pAxis = getAxis(axisNo);
+      int axisRate;
+      int axisLen;
+      if (!pAxis) continue;
+      pAxis->captureQueried_ = 0;
+      if (!epicsAtomicGetIntT(&pAxis->captureEnabled_)) continue;
+      axisLen = snprintf(&outString[len], sizeof(outString) - len, "%s:CHAN%d:POS?",
+                         len ? ";" : "", axisNo);
+      if (len + axisLen >= sizeof(outString)) {
+        outString[len] = '\0';
+        continue;
+      }
+      len += axisLen;
+      pAxis->captureQueried_ = 1;
+      axisRate = epicsAtomicGetIntT(&pAxis->captureRate_);
+      if (axisRate > rate) rate = axisRate;
+    }
+    if (!len) {
+      /* Nothing to do, wait for an axis to be enabled */
+      captureRateRb_ = 0.0;
+      epicsEventWait(captureEvent_);
+      numCycles = 0;
+      epicsTimeGetCurrent(&rateTime);
+      continue;
+    }
+
+    if (epicsAtomicGetIntT(&linkDown_)) {
+      /* The poller probes the link, don't wait for timeouts here */
+      captureRateRb_ = 0.0;
+      epicsEventWaitWithTimeout(captureEvent_, MCS2_LINK_BACKOFF_MIN);
+      continue;
+    }
+    epicsTimeGetCurrent(&start);
+    status = pasynOctetSyncIO->writeRead(pasynUserCapture_, outString, len,
+                                         inString, sizeof(inString) - 1,
+                                         DEFAULT_CONTROLLER_TIMEOUT,
+                                         &nwrite, &nread, &eomReason);
+    ioStats_.record(outString, &start, status);
+    if (status) {
+      asynPrint(pasynUserCapture_, ASYN_TRACE_ERROR, "%s out='%s' status=%s\n",
+                functionName, outString, mcs2AsynStatusToString(status));
+      captureRateRb_ = 0.0;
+      epicsEventWaitWithTimeout(captureEvent_, 1.0);
+      continue;
+    }
+    inString[nread] = '\0';
+    sampleTime = epicsTimeDiffInSeconds(&start, &captureStartTime_);
+
+    pReply = inString;
+    for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+      MCS2Axis *pAxis = getAxis(axisNo);
+      MCS2CaptureRing *pRing;
+      PositionType pos;
+      size_t head;
+      if (!pAxis || !pAxis->captureQueried_) continue;
+      if (smarActParseInt64(&pReply, &pos)) {
+        asynPrint(pasynUserCapture_, ASYN_TRACE_ERROR, "%s malformed reply='%s' at column %d\n",
+                  functionName, inString, (int)(pReply - inString));
+        break;
+      }
+      pRing = pAxis->captureRing_;
+      head = pRing->head;
+      pRing->pos[head % MCS2_CAPTURE_SIZE] = pos;
+      pRing->time[head % MCS2_CAPTURE_SIZE] = sampleTime;
+      epicsAtomicWriteMemoryBarrier();
+      epicsAtomicSetSizeT(&pRing->head, head + 1);
+      if (*pReply == ';') pReply++;
+    }
+
+    numCycles++;
+    epicsTimeGetCurrent(&now);
+    elapsed = epicsTimeDiffInSeconds(&now, &rateTime);
+    if (elapsed >= 1.0) {
+      captureRateRb_ = numCycles / elapsed;
+      numCycles = 0;
+      rateTime = now;
+    }
+    /* A rate of 0 samples at the shortest period, then wait for the poller's turn */
+    {
+      double roundTrip = epicsTimeDiffInSeconds(&now, &start);
+      double period = rate > 0 ? 1.0 / rate : MCS2_CAPTURE_MIN_PERIOD;
+      double remaining;
+      if (period < MCS2_CAPTURE_MIN_PERIOD) period = MCS2_CAPTURE_MIN_PERIOD;
+      remaining = period - roundTrip;
+      if (remaining < roundTrip) remaining = roundTrip;
+      epicsThreadSleep(remaining);
+    }
+  }
+}
+
+/** Hands new capture samples to the waveform records, called at the poll rate */
+void MCS2Controller::publishCapture(void)
+{
+  int axisNo;
+  for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+    MCS2Axis *pAxis = getAxis(axisNo);
+    epicsFloat64 *pTime = &captureScratchF_[MCS2_CAPTURE_SIZE];
+    size_t head;
+    size_t num;
+    size_t i;
+    if (!pAxis) continue;
+    head = epicsAtomicGetSizeT(&pAxis->captureRing_->head);
+    if (head == pAxis->capturePublished_) continue;
+    pAxis->capturePublished_ = head;
+
+    /* Positions and times share the float scratch buffer */
+    num = pAxis->captureSnapshot(captureScratchF_, captureScratchI_, pTime, MCS2_CAPTURE_SIZE);
+    for (i = 0; i < num; i++) {
+      pTime[i] -= pTime[num - 1];
+    }
+    doCallbacksFloat64Array(captureScratchF_, num, captPos_, axisNo);
+    doCallbacksFloat64Array(pTime, num, captTime_, axisNo);
+#ifdef SMARACT_ASYN_ASYNPARAMINT64
+    for (i = 0; i < num; i++) {
+      captureScratchI64_[i] = captureScratchI_[i];
+    }
+    doCallbacksInt64Array(captureScratchI64_, num, captIPos_, axisNo);
+#endif
+    setIntegerParam(axisNo, captNum_, (int)num);
+    setDoubleParam(axisNo, captRateRb_, captureRateRb_);
+  }
+}
+
+asynStatus MCS2Controller::readFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                            size_t nElements, size_t *nIn)
+{
+  int function = pasynUser->reason;
+  if (function == captPos_ || function == captTime_) {
+    MCS2Axis *pAxis = getAxis(pasynUser);
+    size_t num;
+    size_t i;
+    if (!pAxis) return asynError;
+    if (function == captPos_) {
+      num = pAxis->captureSnapshot(value, NULL, NULL, nElements);
+    } else {
+      num = pAxis->captureSnapshot(NULL, NULL, value, nElements);
+      for (i = 0; i < num; i++) {
+        value[i] -= value[num - 1];
+      }
+    }
+    *nIn = num;
+    return asynSuccess;
+  }
+  return asynMotorController::readFloat64Array(pasynUser, value, nElements, nIn);
+}
+
+/** Takes the waveform of an axis, see MCS2Axis::loadWave() */
+asynStatus MCS2Controller::writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
+                                             size_t nElements)
+{
+  int function = pasynUser->reason;
+  if (function == wavePos_) {
+    MCS2Axis *pAxis = getAxis(pasynUser);
+    if (!pAxis) return asynError;
+    return pAxis->loadWave(value, nElements);
+  }
+  return asynMotorController::writeFloat64Array(pasynUser, value, nElements);
+}
+
+#ifdef SMARACT_ASYN_ASYNPARAMINT64
+asynStatus MCS2Controller::readInt64Array(asynUser *pasynUser, epicsInt64 *value,
+                                          size_t nElements, size_t *nIn)
+{
+  int function = pasynUser->reason;
+  if (function == captIPos_) {
+    MCS2Axis *pAxis = getAxis(pasynUser);
+    size_t num;
+    size_t i;
+    if (!pAxis) return asynError;
+    if (nElements > MCS2_CAPTURE_SIZE) nElements = MCS2_CAPTURE_SIZE;
+    num = pAxis->captureSnapshot(NULL, captureScratchI_, NULL, nElements);
+    for (i = 0; i < num; i++) {
+      value[i] = captureScratchI_[i];
+    }
+    *nIn = num;
+    return asynSuccess;
+  }
+  return asynMotorController::readInt64Array(pasynUser, value, nElements, nIn);
+}
+#endif
+
+/** Sends semicolon separated SCPI queries for all active axes and splits the replies.
+  * The queries are packed into up to MCS2_POLL_CHUNKS commands, which are pipelined
+  * on the link by transport_. Axes that are not yet initialized, or don't fit into
+  * the command buffers, read their values one by one in MCS2Axis::poll().
+  */
+asynStatus MCS2Controller::batchedPoll(void)
+{
+  startBatchedPoll();
+  return finishBatchedPoll();
+}
+
+/** Builds the batched query of all axes and writes it, see SmarActTransport::start().
+  * finishBatchedPoll() must follow, the link is locked until then.
+  */
+void MCS2Controller::startBatchedPoll(void)
+{
+  int *numQueries = pollNumQueries_;
+  size_t len = 0;
+  int chunk = 0;
+  int axisNo;
+
+  pollNumChunks_ = 0;
+  memset(pollNumQueries_, 0, sizeof(pollNumQueries_));
+  pollOutString_[0][0] = '\0';
+  for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+    MCS2Axis *pAxis = getAxis(axisNo);
+    char axisQuery[128];
+    size_t axisLen = 0;
+    unsigned mask = 0;
+    int field;
+
+    if (!pAxis) continue;
+    pAxis->batchedMask_ = 0;
+    pAxis->batchedQueried_ = 0;
+    if (!pAxis->initialPollDone_ || !scheduler_->due(axisNo)) continue;
+
+    mask = 1 << MCS2_POLL_STAT;
+    if (pAxis->sensorPresent_) {
+      mask |= 1 << MCS2_POLL_POS;
+      if (!pAxis->openLoop_ && !pAxis->fineActive_)
+        mask |= 1 << MCS2_POLL_POS_TARG;
+    }
+    if (pAxis->lastDone_ && pAxis->propertiesStale())
+      mask |= 1 << MCS2_POLL_PTYP | 1 << MCS2_POLL_MCLF;
+
+    for (field = 0; field < MCS2_POLL_NUM_FIELDS; field++) {
+      if (!(mask & (1 << field))) continue;
+      axisLen += snprintf(&axisQuery[axisLen], sizeof(axisQuery) - axisLen, "%s:CHAN%d%s",
+                          axisLen ? ";" : "", axisNo, mcs2PollLeafs[field]);
+    }
+    if (len + 1 + axisLen >= MCS2_POLL_STRING_SIZE) {
+      /* Start the next command, if there is one left */
+      if (!len || chunk + 1 >= MCS2_POLL_CHUNKS)
+        continue;
+      chunk++;
+      len = 0;
+    }
+    if (len)
+      pollOutString_[chunk][len++] = ';';
+    memcpy(&pollOutString_[chunk][len], axisQuery, axisLen + 1);
+    len += axisLen;
+    pAxis->batchedQueried_ = mask;
+    pAxis->batchedChunk_ = chunk;
+    for (field = 0; field < MCS2_POLL_NUM_FIELDS; field++) {
+      if (mask & (1 << field)) numQueries[chunk]++;
+    }
+  }
+  pollNumChunks_ = numQueries[chunk] ? chunk + 1 : chunk;
+  if (!pollNumChunks_)
+    return;
+
+  for (chunk = 0; chunk < pollNumChunks_; chunk++) {
+    SmarActTransport::initRequest(&pollRequests_[chunk], pollOutString_[chunk],
+                                  pollInString_[chunk], sizeof(pollInString_[chunk]));
+  }
+  transport_->start(pollRequests_, pollNumChunks_, DEFAULT_CONTROLLER_TIMEOUT);
+}
+
+/** Reads the replies of the batched query and hands them out to the axes */
+asynStatus MCS2Controller::finishBatchedPoll(void)
+{
+  static const char *functionName = "batchedPoll";
+  int *numQueries = pollNumQueries_;
+  int numChunks = pollNumChunks_;
+  int chunk;
+  int failed = 0;
+  int released;
+  int axisNo;
+  asynStatus status;
+
+  if (!numChunks)
+    return asynSuccess;
+  /* Nothing but the poller touches pollInString_, the lock isn't needed while the replies come in */
+  released = scheduler_->releaseLock();
+  status = transport_->finish();
+  if (released)
+    scheduler_->reacquireLock();
+  pollNumChunks_ = 0;
+  handleStatusChange(status);
+  if (status) {
+    asynPrint(pasynUserController_, ASYN_TRACE_ERROR, "%s out='%s' chunks=%d status=%s\n",
+              functionName, pollOutString_[0], numChunks, mcs2AsynStatusToString(status));
+    for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+      MCS2Axis *pAxis = getAxis(axisNo);
+      if (pAxis) pAxis->batchedMask_ = 0;
+    }
+    return asynError;
+  }
+
+  /* Split the replies in place and hand out the pieces in the order they were asked for */
+  for (chunk = 0; chunk < numChunks; chunk++) {
+    SmarActTransport::midpoint(&pollRequests_[chunk], &pollStamp_[chunk]);
+    char *pReply = pollInString_[chunk];
+    int numReplies = 0;
+    for (axisNo = 0; axisNo < numAxes_ && pReply; axisNo++) {
+      MCS2Axis *pAxis = getAxis(axisNo);
+      int field;
+      if (!pAxis || !pAxis->batchedQueried_ || pAxis->batchedChunk_ != chunk) continue;
+      for (field = 0; field < MCS2_POLL_NUM_FIELDS && pReply; field++) {
+        char *pSep;
+        if (!(pAxis->batchedQueried_ & (1 << field))) continue;
+        pSep = strchr(pReply, ';');
+        if (pSep) *pSep = '\0';
+        pAxis->batchedReply_[field] = pReply;
+        pAxis->batchedMask_ |= 1 << field;
+        numReplies++;
+        pReply = pSep ? pSep + 1 : NULL;
+      }
+    }
+    if (numReplies != numQueries[chunk] || pReply) {
+      /* Most likely one of the queries failed: these axes fall back to their own queries */
+      asynPrint(pasynUserController_, ASYN_TRACE_ERROR,
+                "%s numQueries=%d numReplies=%d out='%s'\n",
+                functionName, numQueries[chunk], numReplies, pollOutString_[chunk]);
+      for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+        MCS2Axis *pAxis = getAxis(axisNo);
+        if (pAxis && pAxis->batchedChunk_ == chunk) pAxis->batchedMask_ = 0;
+      }
+      failed = 1;
+    }
+  }
+  if (failed) {
+    clearErrors();
+    return asynError;
+  }
+  return asynSuccess;
+}
+
+/** Allocates the arrays for profile moves and starts the profile thread, see MCS2CreateProfile */
+asynStatus MCS2Controller::initializeProfile(size_t maxPoints)
+{
+  if (profilePointTimes_) free(profilePointTimes_);
+  profilePointTimes_ = (double *)calloc(maxPoints, sizeof(double));
+  startProfileThread();
+  return asynMotorController::initializeProfile(maxPoints);
+}
+
+/** Starts profileThread() the first time a profile or waveform needs it, called with the lock held */
+void MCS2Controller::startProfileThread()
+{
+  if (profileThreadId_)
+    return;
+  profileThreadId_ = epicsThreadCreate("MCS2Profile",
+                                       epicsThreadPriorityMedium,
+                                       epicsThreadGetStackSize(epicsThreadStackMedium),
+                                       (EPICSTHREADFUNC)MCS2ProfileThreadC, (void *)this);
+}
+
+/** Builds the stream frames of a profile move.
+  * Point i is reached at the sum of the times of the points before it; the profile
+  * is resampled to one frame every 1/streamRate_ seconds by linear interpolation.
+  * All axes with profileUseAxis_ set must be in closed loop.
+  */
+asynStatus MCS2Controller::buildProfile()
+{
+  static const char *functionName = "buildProfile";
+  const char *message = "";
+  int buildStatus = PROFILE_STATUS_FAILURE;
+  int executeState = PROFILE_EXECUTE_DONE;
+  int numPoints = 0;
+  int timeMode = PROFILE_TIME_MODE_FIXED;
+  double fixedTime = 0.0;
+  double totalTime;
+  size_t numFrames;
+  size_t frame;
+  int numUsed = 0;
+  int axisNo;
+  int i;
+
+  setIntegerParam(profileBuildState_, PROFILE_BUILD_BUSY);
+  setIntegerParam(profileBuildStatus_, PROFILE_STATUS_UNDEFINED);
+  setStringParam(profileBuildMessage_, "");
+  callParamCallbacks();
+
+  getIntegerParam(profileExecuteState_, &executeState);
+  getIntegerParam(profileNumPoints_, &numPoints);
+  getIntegerParam(profileTimeMode_, &timeMode);
+  getDoubleParam(profileFixedTime_, &fixedTime);
+
+  if (executeState != PROFILE_EXECUTE_DONE) {
+    message = "Profile is executing";
+    goto done;
+  }
+  if (!profilePointTimes_ || !profileTimes_) {
+    message = "MCS2CreateProfile was not called";
+    goto done;
+  }
+  if (numPoints < 2 || (size_t)numPoints > (size_t)maxProfilePoints_) {
+    message = "Invalid number of points";
+    goto done;
+  }
+  profilePointTimes_[0] = 0.0;
+  for (i = 1; i < numPoints; i++) {
+    double dt = (timeMode == PROFILE_TIME_MODE_FIXED) ? fixedTime : profileTimes_[i - 1];
+    if (dt <= 0.0) {
+      message = "Profile times must be > 0";
+      goto done;
+    }
+    profilePointTimes_[i] = profilePointTimes_[i - 1] + dt;
+  }
+  totalTime = profilePointTimes_[numPoints - 1];
+  /* One frame every 1/streamRate_, the last frame is exactly the last point */
+  numFrames = (size_t)(totalTime * streamRate_) + 2;
+  if (numFrames > MCS2_PROFILE_MAX_FRAMES) {
+    message = "Profile too long for the stream rate";
+    goto done;
+  }
+
+  for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+    MCS2Axis *pAxis = getAxis(axisNo);
+    int useAxis = 0;
+    if (!pAxis) continue;
+    getIntegerParam(axisNo, profileUseAxis_, &useAxis);
+    pAxis->profileUsed_ = useAxis ? 1 : 0;
+    if (!useAxis) continue;
+    if (!pAxis->sensorPresent_ || pAxis->openLoop_) {
+      message = "Profile axes must be in closed loop";
+      goto done;
+    }
+    numUsed++;
+  }
+  if (!numUsed) {
+    message = "No axis is used";
+    goto done;
+  }
+
+  free(profileFrames_);
+  profileNumFrames_ = 0;
+  profileFrames_ = (PositionType *)calloc(numFrames * numAxes_, sizeof(PositionType));
+  if (!profileFrames_) {
+    message = "Cannot allocate the stream frames";
+    goto done;
+  }
+  i = 0;
+  for (frame = 0; frame < numFrames; frame++) {
+    double t = (double)frame / streamRate_;
+    double fraction;
+    if (t > totalTime || frame == numFrames - 1) t = totalTime;
+    while (i < numPoints - 2 && profilePointTimes_[i + 1] <= t) i++;
+    fraction = (t - profilePointTimes_[i]) / (profilePointTimes_[i + 1] - profilePointTimes_[i]);
+    for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+      MCS2Axis *pAxis = getAxis(axisNo);
+      double position;
+      if (!pAxis || !pAxis->profileUsed_) continue;
+      position = pAxis->profilePositions_[i] +
+                 fraction * (pAxis->profilePositions_[i + 1] - pAxis->profilePositions_[i]);
+      profileFrames_[frame * numAxes_ + axisNo] = (PositionType)(position * PULSES_PER_STEP);
+    }
+  }
+  profileNumFrames_ = numFrames;
+  buildStatus = PROFILE_STATUS_SUCCESS;
+
+done:
+  if (buildStatus != PROFILE_STATUS_SUCCESS) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n",
+              driverName, functionName, message);
+  }
+  setIntegerParam(profileBuildStatus_, buildStatus);
+  setStringParam(profileBuildMessage_, message);
+  setIntegerParam(profileBuildState_, PROFILE_BUILD_DONE);
+  callParamCallbacks();
+  return buildStatus == PROFILE_STATUS_SUCCESS ? asynSuccess : asynError;
+}
+
+/** Starts a built profile, it is run by profileThread() */
+asynStatus MCS2Controller::executeProfile()
+{
+  int buildStatus = PROFILE_STATUS_UNDEFINED;
+  int executeState = PROFILE_EXECUTE_DONE;
+
+  getIntegerParam(profileBuildStatus_, &buildStatus);
+  getIntegerParam(profileExecuteState_, &executeState);
+  if (executeState != PROFILE_EXECUTE_DONE || epicsAtomicGetIntT(&waveRequest_))
+    return asynError;
+  if (buildStatus != PROFILE_STATUS_SUCCESS || !profileNumFrames_) {
+    setIntegerParam(profileExecuteStatus_, PROFILE_STATUS_FAILURE);
+    setStringParam(profileExecuteMessage_, "Profile is not built");
+    callParamCallbacks();
+    return asynError;
+  }
+  epicsAtomicSetIntT(&profileAbortRequest_, 0);
+  setIntegerParam(profileExecuteState_, PROFILE_EXECUTE_MOVE_START);
+  setIntegerParam(profileExecuteStatus_, PROFILE_STATUS_UNDEFINED);
+  setStringParam(profileExecuteMessage_, "");
+  callParamCallbacks();
+  epicsEventSignal(profileEvent_);
+  return asynSuccess;
+}
+
+/** Requests the running profile to stop, the profile thread aborts the stream */
+asynStatus MCS2Controller::abortProfile()
+{
+  epicsAtomicSetIntT(&profileAbortRequest_, 1);
+  return asynSuccess;
+}
+
+void MCS2Controller::profileThread()
+{
+  while (1) {
+    epicsEventWait(profileEvent_);
+    if (epicsAtomicGetIntT(&waveRequest_))
+      runWave();
+    else
+      runProfile();
+  }
+}
+
+/** Sends the frames [first, first+num) of the profile, chained into as few writes as possible.
+  * While a waveform runs the frames are the next samples of the waveforms instead.
+  * Called with the lock held.
+  */
+asynStatus MCS2Controller::sendProfileFrames(size_t first, size_t num)
+{
+  char outString[MCS2_POLL_STRING_SIZE];
+  char frameString[MCS2_POLL_STRING_SIZE / 2];
+  size_t len = 0;
+  size_t frame;
+  asynStatus status;
+
+  for (frame = first; frame < first + num; frame++) {
+    size_t frameLen = snprintf(frameString, sizeof(frameString), ":STR:FRAM");
+    char sep = ' ';
+    int axisNo;
+    for (axisNo = 0; axisNo < numAxes_ && frameLen < sizeof(frameString); axisNo++) {
+      MCS2Axis *pAxis = getAxis(axisNo);
+      PositionType position;
+      if (!pAxis || !pAxis->profileUsed_) continue;
+      position = waveRunning_ ? pAxis->nextWaveFrame() : profileFrames_[frame * numAxes_ + axisNo];
+      frameLen += snprintf(&frameString[frameLen], sizeof(frameString) - frameLen, "%c%d,%lld", sep,
+                           axisNo, position + pAxis->profileOffset_);
+      sep = ',';
+    }
+    if (len && len + 1 + frameLen >= sizeof(outString)) {
+      status = writeController(outString, DEFAULT_CONTROLLER_TIMEOUT);
+      if (status) return status;
+      len = 0;
+    }
+    len += snprintf(&outString[len], sizeof(outString) - len, "%s%s", len ? ";" : "", frameString);
+  }
+  if (!len)
+    return asynSuccess;
+  return writeController(outString, DEFAULT_CONTROLLER_TIMEOUT);
+}
+
+/** Waits until no profile axis is moving or streaming any more.
+  * Called from the profile thread without the lock held.
+  * \param[in] timeout Time in seconds
+  * \return asynTimeout when the axes are still moving, asynError on abort or communication errors
+  */
+asynStatus MCS2Controller::waitProfileMotion(double timeout)
+{
+  char outString[MCS2_POLL_STRING_SIZE];
+  char inString[MCS2_POLL_STRING_SIZE];
+  epicsTimeStamp start;
+
+  epicsTimeGetCurrent(&start);
+  while (1) {
+    epicsTimeStamp now;
+    size_t len = 0;
+    size_t nread = 0;
+    int moving = 0;
+    int axisNo;
+    const char *pReply;
+    asynStatus status;
+
+    if (epicsAtomicGetIntT(&profileAbortRequest_) || epicsAtomicGetIntT(&waveStopRequest_) == 2)
+      return asynError;
+    for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+      MCS2Axis *pAxis = getAxis(axisNo);
+      if (!pAxis || !pAxis->profileUsed_) continue;
+      len += snprintf(&outString[len], sizeof(outString) - len, "%s:CHAN%d:STAT?", len ? ";" : "", axisNo);
+    }
+    lock();
+    status = writeReadController(outString, inString, sizeof(inString), &nread, DEFAULT_CONTROLLER_TIMEOUT);
+    unlock();
+    if (status)
+      return status;
+    pReply = inString;
+    for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+      MCS2Axis *pAxis = getAxis(axisNo);
+      int channelState;
+      if (!pAxis || !pAxis->profileUsed_) continue;
+      if (smarActParseInt(&pReply, &channelState)) {
+        asynPrint(pasynUserController_, ASYN_TRACE_ERROR,
+                  "%s:waitProfileMotion: malformed reply='%s' at column %d\n",
+                  driverName, inString, (int)(pReply - inString));
+        return asynError;
+      }
+      if (channelState & (CH_STATE_ACTIVELY_MOVING | CH_STATE_STREAMING))
+        moving = 1;
+      if (*pReply == ';') pReply++;
+    }
+    if (!moving)
+      return asynSuccess;
+    epicsTimeGetCurrent(&now);
+    if (epicsTimeDiffInSeconds(&now, &start) > timeout)
+      return asynTimeout;
+    epicsThreadSleep(0.05);
+  }
+}
+
+/** Runs a built profile, called in the profile thread without the lock held.
+  * Moves the axes to the first frame and streams the frames, MCS2_STREAM_LEAD seconds
+  * ahead of the trajectory. Position capture is enabled on the axes while the profile
+  * runs, readbackProfile() reads the actual positions from it.
+  */
+asynStatus MCS2Controller::runProfile(void)
+{
+  static const char *functionName = "runProfile";
+  char outString[MCS2_POLL_STRING_SIZE];
+  const char *message = "";
+  int executeStatus = PROFILE_STATUS_SUCCESS;
+  int moveMode = PROFILE_MOVE_MODE_ABSOLUTE;
+  int numPoints = 0;
+  int streamOpen = 0;
+  int point = 0;
+  epicsTimeStamp start, now;
+  size_t sent = 0;
+  size_t len = 0;
+  int axisNo;
+  asynStatus status;
+
+  lock();
+  getIntegerParam(profileMoveMode_, &moveMode);
+  getIntegerParam(profileNumPoints_, &numPoints);
+  for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+    MCS2Axis *pAxis = getAxis(axisNo);
+    if (!pAxis || !pAxis->profileUsed_) continue;
+    pAxis->profileOffset_ = 0;
+    if (moveMode == PROFILE_MOVE_MODE_RELATIVE) {
+      double position = 0.0;
+      getDoubleParam(axisNo, motorPosition_, &position);
+      pAxis->profileOffset_ = (PositionType)(position * PULSES_PER_STEP);
+    }
+    pAxis->profileCaptureWasEnabled_ = epicsAtomicGetIntT(&pAxis->captureEnabled_);
+    epicsAtomicSetIntT(&pAxis->captureEnabled_, 1);
+    if (len) outString[len++] = ';';
+    len += pAxis->streamMoveString(&outString[len], sizeof(outString) - len,
+                                   profileFrames_[axisNo] + pAxis->profileOffset_);
+  }
+  epicsEventSignal(captureEvent_);
+  status = writeController(outString, DEFAULT_CONTROLLER_TIMEOUT);
+  unlock();
+  if (!status)
+    status = waitProfileMotion(MCS2_PROFILE_MOVE_TIMEOUT);
+  if (status) {
+    message = status == asynTimeout ? "Timeout moving to the start" : "Cannot move to the start";
+    executeStatus = status == asynTimeout ? PROFILE_STATUS_TIMEOUT : PROFILE_STATUS_FAILURE;
+    goto done;
+  }
+
+  lock();
+  snprintf(outString, sizeof(outString), ":STR:BASE:RATE %d;:STR:OPEN", streamRate_);
+  status = writeController(outString, DEFAULT_CONTROLLER_TIMEOUT);
+  epicsTimeGetCurrent(&start);
+  profileStartTime_ = epicsTimeDiffInSeconds(&start, &captureStartTime_);
+  setIntegerParam(profileExecuteState_, PROFILE_EXECUTE_EXECUTING);
+  callParamCallbacks();
+  unlock();
+  if (status) {
+    message = "Cannot open the stream";
+    executeStatus = PROFILE_STATUS_FAILURE;
+    goto done;
+  }
+  streamOpen = 1;
+
+  while (sent < profileNumFrames_) {
+    double elapsed;
+    size_t due;
+    if (epicsAtomicGetIntT(&profileAbortRequest_)) break;
+    epicsTimeGetCurrent(&now);
+    elapsed = epicsTimeDiffInSeconds(&now, &start);
+    due = (size_t)((elapsed + MCS2_STREAM_LEAD) * streamRate_) + 1;
+    if (due > profileNumFrames_) due = profileNumFrames_;
+    if (due <= sent) {
+      epicsThreadSleep(MCS2_STREAM_LEAD / 4);
+      continue;
+    }
+    lock();
+    status = sendProfileFrames(sent, due - sent);
+    while (point < numPoints - 1 && profilePointTimes_[point + 1] <= elapsed) point++;
+    setIntegerParam(profileCurrentPoint_, point);
+    callParamCallbacks();
+    unlock();
+    if (status) {
+      message = "Cannot send the stream frames";
+      executeStatus = PROFILE_STATUS_FAILURE;
+      goto done;
+    }
+    sent = due;
+  }
+  if (!epicsAtomicGetIntT(&profileAbortRequest_)) {
+    lock();
+    status = writeController(":STR:CLOS", DEFAULT_CONTROLLER_TIMEOUT);
+    unlock();
+    streamOpen = 0;
+    if (!status)
+      status = waitProfileMotion(MCS2_PROFILE_MOVE_TIMEOUT);
+    if (status == asynTimeout) {
+      message = "Timeout waiting for the end of the profile";
+      executeStatus = PROFILE_STATUS_TIMEOUT;
+    } else if (status) {
+      message = "Cannot close the stream";
+      executeStatus = PROFILE_STATUS_FAILURE;
+    }
+  }
+
+done:
+  lock();
+  if (epicsAtomicGetIntT(&profileAbortRequest_)) {
+    message = "Profile aborted";
+    executeStatus = PROFILE_STATUS_ABORT;
+  }
+  if (executeStatus != PROFILE_STATUS_SUCCESS) {
+    abortStream(streamOpen);
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n",
+              driverName, functionName, message);
+    clearErrors();
+  }
+  epicsTimeGetCurrent(&now);
+  profileEndTime_ = epicsTimeDiffInSeconds(&now, &captureStartTime_);
+  for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+    MCS2Axis *pAxis = getAxis(axisNo);
+    if (!pAxis || !pAxis->profileUsed_) continue;
+    epicsAtomicSetIntT(&pAxis->captureEnabled_, pAxis->profileCaptureWasEnabled_);
+  }
+  if (executeStatus == PROFILE_STATUS_SUCCESS)
+    setIntegerParam(profileCurrentPoint_, numPoints - 1);
+  setIntegerParam(profileExecuteState_, PROFILE_EXECUTE_DONE);
+  setIntegerParam(profileExecuteStatus_, executeStatus);
+  setStringParam(profileExecuteMessage_, message);
+  callParamCallbacks();
+  if (executeStatus == PROFILE_STATUS_SUCCESS)
+    readbackProfile();
+  unlock();
+  return executeStatus == PROFILE_STATUS_SUCCESS ? asynSuccess : asynError;
+}
+
+/** Fills the profile readbacks from the position capture of the axes.
+  * The captured positions are interpolated to the times of the profile points,
+  * points older than the capture ring are set to its oldest sample.
+  */
+asynStatus MCS2Controller::readbackProfile()
+{
+  static const char *functionName = "readbackProfile";
+  epicsFloat64 *pPos = captureScratchF_;
+  epicsFloat64 *pTime = &captureScratchF_[MCS2_CAPTURE_SIZE];
+  const char *message = "";
+  int readbackStatus = PROFILE_STATUS_SUCCESS;
+  int numPoints = 0;
+  int axisNo;
+
+  setIntegerParam(profileReadbackState_, PROFILE_READBACK_BUSY);
+  setIntegerParam(profileReadbackStatus_, PROFILE_STATUS_UNDEFINED);
+  setStringParam(profileReadbackMessage_, "");
+  callParamCallbacks();
+
+  getIntegerParam(profileNumPoints_, &numPoints);
+  if (!profilePointTimes_ || numPoints <= 0 || profileEndTime_ <= profileStartTime_) {
+    message = "No profile was executed";
+    readbackStatus = PROFILE_STATUS_FAILURE;
+    numPoints = 0;
+  }
+  for (axisNo = 0; axisNo < numAxes_ && numPoints; axisNo++) {
+    MCS2Axis *pAxis = getAxis(axisNo);
+    size_t num;
+    size_t sample = 0;
+    int i;
+    if (!pAxis || !pAxis->profileUsed_) continue;
+    num = pAxis->captureSnapshot(pPos, NULL, pTime, MCS2_CAPTURE_SIZE);
+    if (!num) {
+      message = "No positions were captured";
+      readbackStatus = PROFILE_STATUS_FAILURE;
+      continue;
+    }
+    if (pTime[0] > profileStartTime_)
+      message = "Capture ring too small, early readbacks are not valid";
+    for (i = 0; i < numPoints; i++) {
+      double t = profileStartTime_ + profilePointTimes_[i];
+      double position;
+      while (sample < num - 1 && pTime[sample + 1] <= t) sample++;
+      position = pPos[sample];
+      if (sample < num - 1 && pTime[sample] <= t) {
+        position += (pPos[sample + 1] - pPos[sample]) * (t - pTime[sample]) / (pTime[sample + 1] - pTime[sample]);
+      }
+      pAxis->profileReadbacks_[i] = position;
+      pAxis->profileFollowingErrors_[i] = position -
+          (pAxis->profilePositions_[i] + (double)pAxis->profileOffset_ / PULSES_PER_STEP);
+    }
+  }
+  if (readbackStatus != PROFILE_STATUS_SUCCESS) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n",
+              driverName, functionName, message);
+  }
+  setIntegerParam(profileNumReadbacks_, numPoints);
+  setIntegerParam(profileReadbackStatus_, readbackStatus);
+  setStringParam(profileReadbackMessage_, message);
+  setIntegerParam(profileReadbackState_, PROFILE_READBACK_DONE);
+  callParamCallbacks();
+  /* Converts the readbacks to user units and does the callbacks */
+  if (numPoints)
+    asynMotorController::readbackProfile();
+  return readbackStatus == PROFILE_STATUS_SUCCESS ? asynSuccess : asynError;
+}
+
+/** Stops the axes of the profile or waveform where they are, called with the lock held.
+  * \param[in] streamOpen The stream is aborted as well
+  */
+void MCS2Controller::abortStream(int streamOpen)
+{
+  char outString[MCS2_POLL_STRING_SIZE];
+  size_t len = 0;
+  int axisNo;
+
+  if (streamOpen)
+    len = snprintf(outString, sizeof(outString), ":STR:ABOR");
+  for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+    MCS2Axis *pAxis = getAxis(axisNo);
+    if (!pAxis || !pAxis->profileUsed_) continue;
+    len += snprintf(&outString[len], sizeof(outString) - len, "%s:STOP%d", len ? ";" : "", axisNo);
+  }
+  if (len)
+    writeController(outString, DEFAULT_CONTROLLER_TIMEOUT);
+  /* The move modes and speeds in the controller are unknown now */
+  forgetSpeeds();
+}
+
+/** Starts the waveforms of all axes with WAVE_USE set, they are played by runWave().
+  * Called with the lock held.
+  * \param[in] addr Address that WAVE_RATE, WAVE_CYCLES and WAVE_RELATIVE are read from
+  */
+asynStatus MCS2Controller::startWave(int addr)
+{
+  int executeState = PROFILE_EXECUTE_DONE;
+
+  getIntegerParam(profileExecuteState_, &executeState);
+  if (executeState != PROFILE_EXECUTE_DONE || epicsAtomicGetIntT(&waveRequest_)) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:startWave: a profile or waveform is running\n", driverName);
+    return asynError;
+  }
+  startProfileThread();
+  waveAddr_ = addr;
+  epicsAtomicSetIntT(&waveStopRequest_, 0);
+  epicsAtomicSetIntT(&waveRequest_, 1);
+  epicsEventSignal(profileEvent_);
+  return asynSuccess;
+}
+
+/** Ends the waveform stream.
+  * \param[in] abort 0: the samples already sent are played, 1: the axes stop at once
+  */
+void MCS2Controller::stopWave(int abort)
+{
+  if (!epicsAtomicGetIntT(&waveRequest_))
+    return;
+  if (abort || epicsAtomicGetIntT(&waveStopRequest_) != 2)
+    epicsAtomicSetIntT(&waveStopRequest_, abort ? 2 : 1);
+}
+
+/** Plays the waveforms, called in the profile thread without the lock held.
+  * Moves the axes to their first samples and streams one sample per axis and frame at
+  * WAVE_RATE frames per second, MCS2_STREAM_LEAD seconds ahead. Each axis repeats its
+  * own waveform, so axes with different lengths draw Lissajous figures. With WAVE_CYCLES
+  * set the stream ends after that many periods of the longest waveform.
+  * A sample that is due at the controller before it was sent counts as an underrun; the
+  * stream goes on with that sample, the rest of the waveform is played late.
+  */
+asynStatus MCS2Controller::runWave(void)
+{
+  static const char *functionName = "runWave";
+  char outString[MCS2_POLL_STRING_SIZE];
+  const char *message = "";
+  int rate = MCS2_STREAM_RATE;
+  int cycles = 0;
+  int relative = 0;
+  int streamOpen = 0;
+  int failed = 0;
+  size_t maxLen = 0;
+  size_t total;
+  size_t sent = 0;
+  size_t len = 0;
+  epicsTimeStamp start, now;
+  int axisNo;
+  asynStatus status = asynSuccess;
+
+  lock();
+  getIntegerParam(waveAddr_, waveRate_, &rate);
+  getIntegerParam(waveAddr_, waveCycles_, &cycles);
+  getIntegerParam(waveAddr_, waveRelative_, &relative);
+  for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+    MCS2Axis *pAxis = getAxis(axisNo);
+    size_t waveLen;
+    if (!pAxis) continue;
+    pAxis->profileUsed_ = 0;
+    if (!pAxis->waveUse_ || failed) continue;
+    if (pAxis->wavePending_) {
+      pAxis->waveActive_ ^= 1;
+      pAxis->wavePending_ = 0;
+    }
+    pAxis->wavePhase_ = 0;
+    waveLen = pAxis->waveLen_[pAxis->waveActive_];
+    if (!waveLen) continue;
+    if (!pAxis->sensorPresent_ || pAxis->openLoop_) {
+      message = "Waveform axes must be in closed loop";
+      failed = 1;
+      continue;
+    }
+    pAxis->profileOffset_ = 0;
+    if (relative) {
+      double position = 0.0;
+      getDoubleParam(axisNo, motorPosition_, &position);
+      pAxis->profileOffset_ = (PositionType)(position * PULSES_PER_STEP);
+    }
+    pAxis->profileUsed_ = 1;
+    if (waveLen > maxLen) maxLen = waveLen;
+    if (len) outString[len++] = ';';
+    len += pAxis->streamMoveString(&outString[len], sizeof(outString) - len,
+                                   pAxis->wave_[pAxis->waveActive_][0] + pAxis->profileOffset_);
+  }
+  if (!failed && !maxLen) {
+    message = "No axis has a waveform";
+    failed = 1;
+  }
+  if (!failed && rate <= 0) {
+    message = "Invalid sample rate";
+    failed = 1;
+  }
+  if (failed) {
+    for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+      MCS2Axis *pAxis = getAxis(axisNo);
+      if (pAxis) pAxis->profileUsed_ = 0;
+    }
+    unlock();
+    goto done;
+  }
+  waveUnderruns_ = 0;
+  setIntegerParam(waveAddr_, waveUnderrunsRb_, 0);
+  setIntegerParam(waveAddr_, waveState_, MCS2_WAVE_MOVE);
+  callParamCallbacks(waveAddr_);
+  status = writeController(outString, DEFAULT_CONTROLLER_TIMEOUT);
+  unlock();
+  if (!status)
+    status = waitProfileMotion(MCS2_PROFILE_MOVE_TIMEOUT);
+  if (status) {
+    message = status == asynTimeout ? "Timeout moving to the start" : "Cannot move to the start";
+    failed = 1;
+    goto done;
+  }
+  if (epicsAtomicGetIntT(&waveStopRequest_))
+    goto done;
+
+  lock();
+  snprintf(outString, sizeof(outString), ":STR:BASE:RATE %d;:STR:OPEN", rate);
+  status = writeController(outString, DEFAULT_CONTROLLER_TIMEOUT);
+  epicsTimeGetCurrent(&start);
+  waveRunning_ = 1;
+  setIntegerParam(waveAddr_, waveState_, MCS2_WAVE_STREAMING);
+  callParamCallbacks(waveAddr_);
+  unlock();
+  if (status) {
+    message = "Cannot open the stream";
+    failed = 1;
+    goto done;
+  }
+  streamOpen = 1;
+
+  total = cycles > 0 ? (size_t)cycles * maxLen : 0;
+  while (!total || sent < total) {
+    double elapsed;
+    size_t played;
+    size_t due;
+    if (epicsAtomicGetIntT(&waveStopRequest_)) break;
+    epicsTimeGetCurrent(&now);
+    elapsed = epicsTimeDiffInSeconds(&now, &start);
+    played = (size_t)(elapsed * rate);
+    if (played > sent) {
+      /* The controller ran out of samples, from now on they are played later */
+      epicsTimeAddSeconds(&start, (double)(played - sent) / rate);
+      elapsed = epicsTimeDiffInSeconds(&now, &start);
+      lock();
+      waveUnderruns_++;
+      setIntegerParam(waveAddr_, waveUnderrunsRb_, waveUnderruns_);
+      callParamCallbacks(waveAddr_);
+      unlock();
+    }
+    due = (size_t)((elapsed + MCS2_STREAM_LEAD) * rate) + 1;
+    if (total && due > total) due = total;
+    if (due <= sent) {
+      epicsThreadSleep(MCS2_STREAM_LEAD / 4);
+      continue;
+    }
+    lock();
+    status = sendProfileFrames(sent, due - sent);
+    unlock();
+    if (status) {
+      message = "Cannot send the stream frames";
+      failed = 1;
+      goto done;
+    }
+    sent = due;
+  }
+  if (epicsAtomicGetIntT(&waveStopRequest_) != 2) {
+    lock();
+    status = writeController(":STR:CLOS", DEFAULT_CONTROLLER_TIMEOUT);
+    unlock();
+    streamOpen = 0;
+    if (!status)
+      status = waitProfileMotion(MCS2_PROFILE_MOVE_TIMEOUT);
+    if (status) {
+      message = status == asynTimeout ? "Timeout waiting for the end of the waveform" : "Cannot close the stream";
+      failed = 1;
+    }
+  }
+
+done:
+  lock();
+  if (epicsAtomicGetIntT(&waveStopRequest_) == 2) {
+    message = "Waveform aborted";
+    failed = 1;
+  }
+  if (failed) {
+    abortStream(streamOpen);
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s\n",
+              driverName, functionName, message);
+    clearErrors();
+  }
+  waveRunning_ = 0;
+  epicsAtomicSetIntT(&waveRequest_, 0);
+  setIntegerParam(waveAddr_, waveStart_, 0);
+  setIntegerParam(waveAddr_, waveState_, MCS2_WAVE_IDLE);
+  callParamCallbacks(waveAddr_);
+  unlock();
+  return failed ? asynError : asynSuccess;
+}
+
+/** Writes stop commands through the express lane of transport_, ahead of the
+  * batched query a poll may have on the link. Falls back to writeController()
+  * while the link is down.
+  * \param[in] stopString One or more :STOPn, separated by ';'
+  */
+asynStatus MCS2Controller::writeStop(const char *stopString)
+{
+  if (linkDown_ || !transport_->isConnected())
+    return writeController(stopString, DEFAULT_CONTROLLER_TIMEOUT);
+  return transport_->express(stopString, NULL, 0, DEFAULT_CONTROLLER_TIMEOUT);
+}
+
+/** Stops all axes with one write, for STOP_ALL.
+  * Queued open loop chunks are forgotten and a waveform is aborted, as by MCS2Axis::stop().
+  */
+asynStatus MCS2Controller::stopAll(void)
+{
+  char stopString[MCS2_POLL_STRING_SIZE];
+  size_t len = 0;
+  int axisNo;
+
+  stopString[0] = '\0';
+  stopWave(1);
+  for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+    MCS2Axis *pAxis = getAxis(axisNo);
+    if (!pAxis) continue;
+    scheduler_->kick(axisNo);
+    pAxis->stepsQueued_ = 0;
+    if (len)
+      len += snprintf(&stopString[len], sizeof(stopString) - len, "%s", SmarActMCS2Protocol::separator());
+    if (len < sizeof(stopString))
+      len += MCS2Command::encode(&stopString[len], sizeof(stopString) - len, SmarActCmdStop, axisNo);
+    if (len >= sizeof(stopString))
+      return asynError;
+  }
+  if (!len)
+    return asynSuccess;
+  asynPrint(pasynUserController_, ASYN_TRACE_INFO, "MCS2Controller::stopAll(%s) '%s'\n", portName, stopString);
+  return writeStop(stopString);
+}
+
+/** Sends the commands of a move, or queues them while moves are deferred.
+  * \param[in] moveString Semicolon separated SCPI commands of one axis
+  */
+asynStatus MCS2Controller::writeMove(const char *moveString)
+{
+  size_t len = strlen(moveString);
+  asynStatus status;
+
+  if (!movesDeferred_)
+    return writeController(moveString, DEFAULT_CONTROLLER_TIMEOUT);
+  if (deferredLen_ && deferredLen_ + 1 + len >= sizeof(deferredString_)) {
+    /* No space left: the queued moves start a little earlier than the others */
+    asynPrint(pasynUserController_, ASYN_TRACE_ERROR,
+              "MCS2Controller::writeMove: deferred moves do not fit into one command\n");
+    status = writeController(deferredString_, DEFAULT_CONTROLLER_TIMEOUT);
+    deferredLen_ = 0;
+    if (status) return status;
+  }
+  deferredLen_ += snprintf(&deferredString_[deferredLen_], sizeof(deferredString_) - deferredLen_,
+                           "%s%s", deferredLen_ ? ";" : "", moveString);
+  return asynSuccess;
+}
+
+/** Starts or ends deferred moves.
+  * While moves are deferred, MCS2Axis::move() queues its commands, ending it
+  * sends the commands of all axes in one write, so all axes start together.
+  * \param[in] deferMoves true to queue the moves, false to start them
+  */
+asynStatus MCS2Controller::setDeferredMoves(bool deferMoves)
+{
+  asynStatus status = asynSuccess;
+
+  asynPrint(pasynUserController_, ASYN_TRACE_INFO,
+            "MCS2Controller::setDeferredMoves(%s) deferMoves=%d deferredLen=%d\n",
+            portName, (int)deferMoves, (int)deferredLen_);
+  if (!deferMoves && deferredLen_) {
+    status = writeController(deferredString_, DEFAULT_CONTROLLER_TIMEOUT);
+    deferredLen_ = 0;
+    if (status) forgetSpeeds();
+    wakeupPoller();
+  }
+  movesDeferred_ = deferMoves ? 1 : 0;
+  return status;
+}
+
+/** Makes all axes send VEL and ACC again with their next move.
+  * A failed command may have been one of them, the values in the controller are unknown.
+  */
+void MCS2Controller::forgetSpeeds(void)
+{
+  int axisNo;
+  for (axisNo = 0; axisNo < numAxes_; axisNo++) {
+    MCS2Axis *pAxis = getAxis(axisNo);
+    if (!pAxis) continue;
+    pAxis->speedsValid_ = 0;
+    pAxis->lastMmodSent_ = -1;
+    pAxis->holdValid_ = 0;
+  }
+}
+
+/* Texts of the error codes seen most, others take the text the controller sends */
+static const struct {
+  int code;
+  const char *text;
+} mcs2ErrorTexts[] = {
+  {    0, "No error"},
+  {   34, "Invalid channel index"},
+  {  259, "No sensor present"},
+  { -101, "Invalid character"},
+  { -103, "Invalid seperator"},
+  { -104, "Data type error"},
+  { -108, "Parameter not allowed"},
+  { -109, "Missing parameter"},
+  { -113, "Command not exist"},
+  { -151, "Invalid string"},
+  { -350, "Queue overflow"},
+  { -363, "Buffer overrun"},
+};
+
+static const char *mcs2ErrorText(int code)
+{
+  size_t i;
+  for (i = 0; i < sizeof(mcs2ErrorTexts)/sizeof(mcs2ErrorTexts[0]); i++) {
+    if (code == mcs2ErrorTexts[i].code)
+      return mcs2ErrorTexts[i].text;
+  }
+  return NULL;
+}
+
+/* Parse one reply to :SYST:ERR?, <code>,"<text>", and move *pp past the ';' that ends it.
+ * The text, without quotes, goes to text[size].
+ * RETURNS: 0 on success, -1 if there is no error code.
+ */
+static int mcs2ParseError(const char **pp, int *pCode, char *text, size_t size)
 {
-  asynStatus status = asynError;
-  inString_[0] = '\0';
-  status = writeReadController();
-  handleStatusChange(status);
-  if (status) {
-    return asynError;
+  const char *p = *pp;
+  size_t len = 0;
+  int quoted = 0;
+
+  text[0] = 0;
+  while (' ' == *p) p++;
+  if (smarActParseInt(&p, pCode)) {
+    p = strchr(p, ';');
+    *pp = p ? p + 1 : *pp + strlen(*pp);
+    return -1;
   }
-  return status;
+  if (',' == *p) p++;
+  for (; *p && (quoted || ';' != *p); p++) {
+    if ('"' == *p)
+      quoted = !quoted;
+    else if (len < size - 1 && *p >= ' ')
+      text[len++] = *p;
+  }
+  text[len] = 0;
+  *pp = ';' == *p ? p + 1 : p;
+  return 0;
 }
 
-void MCS2Controller::handleStatusChange(asynStatus status) {
-  static const char *functionName = "handleStatusChange";
-  if (status != oldStatus_) {
-    asynPrint(
-        pasynUserController_, ASYN_TRACE_INFO,
-        "%s oldStatus=%s(%d) newStatus=%s(%d)\n",
-        functionName , mcs2AsynStatusToString(oldStatus_),
-        (int)oldStatus_, mcs2AsynStatusToString(status), (int)status);
-    if (status) {
-      /* Connected -> Disconnected */
-      int axisNo;
-      // setAlarmStatusSeverityAllReadbacks(asynDisconnected);
-      for (axisNo = 0; axisNo < numAxes_; axisNo++) {
-        asynMotorAxis *pAxis = getAxis(axisNo);
-        if (!pAxis) continue;
-        pAxis->asynMotorAxis::setIntegerParam(motorStatusCommsError_, 1);
-        pAxis->callParamCallbacks();
-      }
-    } else {
-      /* Disconnected -> Connected */
-    }
-    oldStatus_ = status;
+/** Put an error drained from the controller into the error log */
+void MCS2Controller::logError(int code, const char *text)
+{
+  MCS2Error *pError = &errorLog_[numErrors_ % MCS2_ERROR_LOG_SIZE];
+  const char *known = mcs2ErrorText(code);
+
+  epicsTimeGetCurrent(&pError->time);
+  pError->code = code;
+  if (known)
+    text = known;
+  if (text && text[0])
+    snprintf(pError->text, sizeof(pError->text), "%s", text);
+  else
+    snprintf(pError->text, sizeof(pError->text), "Unable to decode %d", code);
+  numErrors_++;
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+      "MCS2Controller::clearErrors: %d %s\n", code, pError->text);
+}
+
+/** Publish the error log, newest first, one line per error */
+void MCS2Controller::publishErrors(void)
+{
+  char log[MCS2_POLL_STRING_SIZE];
+  size_t len = 0;
+  unsigned long i;
+
+  log[0] = 0;
+  for (i = numErrors_; i > 0 && numErrors_ - i < MCS2_ERROR_LOG_SIZE; i--) {
+    const MCS2Error *pError = &errorLog_[(i - 1) % MCS2_ERROR_LOG_SIZE];
+    char stamp[32];
+    epicsTimeToStrftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &pError->time);
+    len += snprintf(log + len, sizeof(log) - len, "%s %d %s\n", stamp, pError->code, pError->text);
+    if (len >= sizeof(log)) break;
   }
-  callParamCallbacks();
+  setStringParam(errLog_, log);
+  setIntegerParam(errCount_, (int)numErrors_);
 }
 
+/** Drain the error queue of the controller. The :SYST:ERR? queries are chained,
+  * MCS2_ERROR_CHUNK in one exchange, so a full queue takes a few exchanges
+  * instead of one per error. The errors go to the error log, see logError().
+  */
 asynStatus MCS2Controller::clearErrors()
 {
 
   asynStatus comStatus;
   int numErrorMsgs;
-  char errorMsg[50];
+  const char *pReply;
+  char command[MCS2_POLL_STRING_SIZE];
+  char reply[MCS2_POLL_STRING_SIZE];
+  char errorMsg[MCS2_ERROR_TEXT_SIZE];
   int errorCode;
+  size_t nread;
+  unsigned long numBefore = numErrors_;
 
   // Read out error messages
-  snprintf(this->outString_, sizeof(this->outString_)-1,":SYST:ERR:COUN?");
-  comStatus = this->writeReadController();
+  comStatus = this->writeReadController(":SYST:ERR:COUN?", reply, sizeof(reply), &nread, DEFAULT_CONTROLLER_TIMEOUT);
   if (comStatus) goto skip;
-  numErrorMsgs = atoi(this->inString_);
-  for (int i=0; i<numErrorMsgs; i++){
-    snprintf(this->outString_, sizeof(this->outString_)-1,":SYST:ERR?");
-    comStatus = this->writeReadController();
+  pReply = reply;
+  if (smarActParseInt(&pReply, &numErrorMsgs)) numErrorMsgs = 0;
+  if (numErrorMsgs > 0) forgetSpeeds();
+  while (numErrorMsgs > 0) {
+    int chunk = numErrorMsgs < MCS2_ERROR_CHUNK ? numErrorMsgs : MCS2_ERROR_CHUNK;
+    int numReplies = 0;
+    size_t len = 0;
+    int i;
+    for (i = 0; i < chunk; i++)
+      len += snprintf(command + len, sizeof(command) - len, "%s:SYST:ERR?", i ? ";" : "");
+    comStatus = this->writeReadController(command, reply, sizeof(reply), &nread, DEFAULT_CONTROLLER_TIMEOUT);
     if (comStatus) goto skip;
-    printf("%s", this->inString_);
-    errorCode = atoi(this->inString_);
-    switch (errorCode){
-      case 259:   snprintf(errorMsg,sizeof(errorMsg)-1, "No sensor present");
-            break;
-      case 34:    snprintf(errorMsg,sizeof(errorMsg)-1, "Invalid channel index");
-            break;
-      case 0:   snprintf(errorMsg,sizeof(errorMsg)-1, "No error");
-            break;
-      case -101:  snprintf(errorMsg,sizeof(errorMsg)-1, "Invalid character");
-            break;
-      case -103:  snprintf(errorMsg,sizeof(errorMsg)-1, "Invalid seperator");
-            break;
-      case -104:  snprintf(errorMsg,sizeof(errorMsg)-1, "Data type error");
-            break;
-      case -108:  snprintf(errorMsg,sizeof(errorMsg)-1, "Parameter not allowed");
-            break;
-      case -109:    snprintf(errorMsg,sizeof(errorMsg)-1, "Missing parameter");
-            break;
-      case -113:  snprintf(errorMsg,sizeof(errorMsg)-1, "Command not exist");
-            break;
-      case -151:  snprintf(errorMsg,sizeof(errorMsg)-1, "Invalid string");
-            break;
-      case -350:  snprintf(errorMsg,sizeof(errorMsg)-1, "Queue overflow");
-            break;
-      case -363:  snprintf(errorMsg,sizeof(errorMsg)-1, "Buffer overrun");
-            break;
-      default:      snprintf(errorMsg,sizeof(errorMsg)-1, "Unable to decode %d", errorCode);
-            break;
+    pReply = reply;
+    while (*pReply && numReplies < chunk) {
+      if (mcs2ParseError(&pReply, &errorCode, errorMsg, sizeof(errorMsg))) continue;
+      numReplies++;
+      if (!errorCode) break;
+      logError(errorCode, errorMsg);
     }
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-        "MCS2Controller::clearErrors: %s\n", errorMsg);
+    // An empty queue, or a reply cut short: nothing more to drain
+    if (numReplies < chunk || !errorCode) break;
+    numErrorMsgs -= chunk;
   }
 
   skip:
+  if (comStatus) forgetSpeeds();
   {
     int axisNo;
     for (axisNo = 0; axisNo < numAxes_; axisNo++) {
@@ -261,6 +2150,7 @@ asynStatus MCS2Controller::clearErrors()
       pAxis->asynMotorAxis::setIntegerParam(motorStatusCommsError_, 1);
     }
   }
+  if (numErrors_ != numBefore) publishErrors();
   callParamCallbacks();
   return comStatus ? asynError : asynSuccess;
 }
@@ -277,11 +2167,94 @@ void MCS2Controller::report(FILE *fp, int level)
 {
   fprintf(fp, "MCS2 motor driver %s, numAxes=%d, moving poll period=%f, idle poll period=%f\n",
     this->portName, numAxes_, movingPollPeriod_, idlePollPeriod_);
+  if (pollGroup_)
+    fprintf(fp, "  polled by group %s\n", pollGroup_->name());
+  fprintf(fp, "  link %s, dropped %lu times%s\n", linkDown_ ? "down" : "up", linkDrops_,
+          linkDown_ ? ", probing with backoff" : "");
+  transport_->report(fp, level);
+  ioStats_.report(fp, level);
+  deadbands_.report(fp, level);
+  scheduler_->report(fp, level);
+  SmarActCapCache::report(fp);
 
   // Call the base class method
   asynMotorController::report(fp, level);
 }
 
+/** Writes a string to the controller and records the time it took in ioStats_.
+  * \param[in] output  The string to be written
+  * \param[in] timeout Timeout before returning an error
+  */
+asynStatus MCS2Controller::writeController(const char *output, double timeout)
+{
+  epicsTimeStamp start;
+  asynStatus status;
+
+  if (linkDown_ && !linkProbing_)
+    return asynDisconnected;
+  epicsTimeGetCurrent(&start);
+  status = asynMotorController::writeController(output, timeout);
+  ioStats_.record(output, &start, status);
+  return status;
+}
+
+/** Writes a string to the controller, reads the response and records the round trip time in ioStats_.
+  * \param[in] output         The string to be written
+  * \param[out] response      The response received from the controller
+  * \param[in] maxResponseLen The maximum length of the response
+  * \param[out] responseLen   The actual length of the response
+  * \param[in] timeout        Timeout before returning an error
+  */
+asynStatus MCS2Controller::writeReadController(const char *output, char *response, size_t maxResponseLen,
+                                               size_t *responseLen, double timeout)
+{
+  epicsTimeStamp start;
+  asynStatus status;
+
+  if (linkDown_ && !linkProbing_)
+    return asynDisconnected;
+  epicsTimeGetCurrent(&start);
+  status = asynMotorController::writeReadController(output, response, maxResponseLen, responseLen, timeout);
+  ioStats_.record(output, &start, status);
+  return status;
+}
+
+/** writeReadController() that releases the controller lock on the poll thread while it waits for the reply,
+  * see SmarActPollScheduler::releaseLock(). Output and reply are copied, record processing may use
+  * outString_ and inString_ meanwhile.
+  * \param[in] output         The string to be written
+  * \param[out] response      The response received from the controller
+  * \param[in] maxResponseLen The maximum length of the response
+  * \param[out] responseLen   The actual length of the response
+  * \param[in] timeout        Timeout before returning an error
+  */
+asynStatus MCS2Controller::writeReadReleased(const char *output, char *response, size_t maxResponseLen,
+                                             size_t *responseLen, double timeout)
+{
+  char outString[MAX_CONTROLLER_STRING_SIZE];
+  char inString[MAX_CONTROLLER_STRING_SIZE];
+  epicsTimeStamp start;
+  size_t nwrite;
+  int eomReason;
+  asynStatus status;
+
+  if (linkDown_ && !linkProbing_)
+    return asynDisconnected;
+  if (!pasynUserPoll_ || maxResponseLen > sizeof(inString) || !scheduler_->releaseLock())
+    return writeReadController(output, response, maxResponseLen, responseLen, timeout);
+  snprintf(outString, sizeof(outString), "%s", output);
+  *responseLen = 0;
+  epicsTimeGetCurrent(&start);
+  status = pasynOctetSyncIO->writeRead(pasynUserPoll_, outString, strlen(outString), inString, maxResponseLen,
+                                       timeout, &nwrite, responseLen, &eomReason);
+  ioStats_.record(outString, &start, status);
+  scheduler_->reacquireLock();
+  memcpy(response, inString, *responseLen);
+  if (*responseLen < maxResponseLen)
+    response[*responseLen] = '\0';
+  return status;
+}
+
 /** Returns a pointer to an MCS2MotorAxis object.
   * Returns NULL if the axis number encoded in pasynUser is invalid.
   * \param[in] pasynUser asynUser structure that encodes the axis index number. */
@@ -318,9 +2291,73 @@ MCS2Axis::MCS2Axis(MCS2Controller *pC, int axisNo)
   openLoop_ = 0;
   stepsizef_ = 0.0;
   stepsizer_ = 0.0;
+  sensorPresent_ = 0;
+  batchedQueried_ = 0;
+  batchedMask_ = 0;
+  batchedChunk_ = 0;
+  lastDone_ = 1;
+  propsValid_ = 0;
+  cachedPtyp_ = 0;
+  cachedMclf_ = 0;
+  cachedHold_ = HOLD_FOREVER;
+  holdValid_ = 0;
+  propsTime_.secPastEpoch = 0;
+  propsTime_.nsec = 0;
+  capsLoaded_ = 0;
+  captureEnabled_ = 0;
+  captureRate_ = 1000;
+  captureTail_ = 0;
+  capturePublished_ = 0;
+  captureQueried_ = 0;
+  captureRing_ = (MCS2CaptureRing *)calloc(1, sizeof(MCS2CaptureRing));
+  speedsValid_ = 0;
+  lastMmodSent_ = -1;
+  lastStepFreqSent_ = 0;
+  stepsQueued_ = 0;
+  epicsTimeGetCurrent(&replyStamp_);
+  sampleStamp_ = replyStamp_;
+  lastSampleStamp_ = replyStamp_;
+  stampPending_ = 0;
+  lastSample_ = 0;
+  haveSample_ = 0;
+  velEstEnable_ = 0;
+  lastErrTxt_ = NULL;
+  fineMode_ = 0;
+  fineRange_ = MCS2_FINE_RANGE;
+  fineActive_ = 0;
+  fineScan_ = MCS2_SCAN_RANGE / 2;
+  lastScanVelSent_ = 0.0;
+  lastAccSent_ = 0.0;
+  lastVelSent_ = 0.0;
+  profileUsed_ = 0;
+  profileOffset_ = 0;
+  profileCaptureWasEnabled_ = 0;
+  wave_[0] = (PositionType *)calloc(MCS2_WAVE_SIZE, sizeof(PositionType));
+  wave_[1] = (PositionType *)calloc(MCS2_WAVE_SIZE, sizeof(PositionType));
+  waveLen_[0] = 0;
+  waveLen_[1] = 0;
+  waveActive_ = 0;
+  wavePending_ = 0;
+  wavePhase_ = 0;
+  waveUse_ = 0;
 
   // Set hold time in the parameter database
   asynMotorAxis::setIntegerParam(pC_->hold_, HOLD_FOREVER);
+  asynMotorAxis::setIntegerParam(pC_->trigMode_, TRIG_MODE_CONSTANT);
+  asynMotorAxis::setIntegerParam(pC_->captEnable_, captureEnabled_);
+  asynMotorAxis::setIntegerParam(pC_->captRate_, captureRate_);
+  asynMotorAxis::setDoubleParam(pC_->captRateRb_, 0.0);
+  asynMotorAxis::setIntegerParam(pC_->captNum_, 0);
+  asynMotorAxis::setIntegerParam(pC_->fineMode_, fineMode_);
+  asynMotorAxis::setDoubleParam(pC_->fineRange_, fineRange_);
+  asynMotorAxis::setIntegerParam(pC_->fineActive_, fineActive_);
+  asynMotorAxis::setIntegerParam(pC_->waveUse_, waveUse_);
+  asynMotorAxis::setIntegerParam(pC_->waveRate_, MCS2_STREAM_RATE);
+  asynMotorAxis::setIntegerParam(pC_->waveCycles_, 0);
+  asynMotorAxis::setIntegerParam(pC_->waveRelative_, 0);
+  asynMotorAxis::setIntegerParam(pC_->waveStart_, 0);
+  asynMotorAxis::setIntegerParam(pC_->waveState_, MCS2_WAVE_IDLE);
+  asynMotorAxis::setIntegerParam(pC_->waveUnderrunsRb_, 0);
   // Tell motorRecord that CNEN (and PCOV, ICOV, DCOV, which we dont use) work
   asynMotorAxis::setIntegerParam(pC_->motorStatusGainSupport_, 1);
   callParamCallbacks();
@@ -355,7 +2392,7 @@ asynStatus MCS2Axis::reportHelperInteger(const char *scpi_leaf, int *pResult)
   char inString[128];
   asynStatus status = reportHelperCheckError(scpi_leaf, inString, sizeof(inString));
   if (status == asynSuccess) {
-    *pResult = atoi(inString);
+    status = mcs2ParseInt(pC_->pasynUserController_, inString, pResult);
   }
   return status;
 }
@@ -365,7 +2402,7 @@ asynStatus MCS2Axis::reportHelperDouble(const char *scpi_leaf, double *pResult)
   char inString[128];
   asynStatus status = reportHelperCheckError(scpi_leaf, inString, sizeof(inString));
   if (status == asynSuccess) {
-    *pResult = atof(inString);
+    status = mcs2ParseDouble(pC_->pasynUserController_, inString, pResult);
   }
   return status;
 }
@@ -455,6 +2492,8 @@ void MCS2Axis::report(FILE *fp, int level)
             buf.diag_clf_max,
             buf.diag_clf_aver,
             vel, acc, mclf, followError, error, temp);
+    fprintf(fp, " cached properties valid %d: positioner type %d mclf %d hold %d (valid %d)\n",
+            propsValid_, cachedPtyp_, cachedMclf_, cachedHold_, holdValid_);
     pC_->clearErrors();
   }
 
@@ -466,6 +2505,7 @@ void MCS2Axis::report(FILE *fp, int level)
 asynStatus MCS2Axis::move(double position, int relative, double minVelocity, double maxVelocity, double acceleration)
 {
   asynStatus status = asynSuccess;
+  char moveString[MAX_CONTROLLER_STRING_SIZE];
   //static const char *functionName = "move";
 
   /* MCS2 move mode is:
@@ -475,6 +2515,9 @@ asynStatus MCS2Axis::move(double position, int relative, double minVelocity, dou
    */
   unsigned traceMask = ASYN_TRACE_INFO;
   double steps_to_go_f = 0;
+
+  pC_->scheduler_->kick(axisNo_);
+  stepsQueued_ = 0;
   if (relative) {
     steps_to_go_f = position;
     stepTargetPos_nm_ += position;  // store position in global scope
@@ -488,19 +2531,27 @@ asynStatus MCS2Axis::move(double position, int relative, double minVelocity, dou
             "MCS2Axis::", axisNo_, position, relative, sensorPresent_, openLoop_,
             minVelocity, maxVelocity, acceleration);
 
-  if(sensorPresent_ && !openLoop_) {
-    // closed loop move
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:MMOD %d", axisNo_, relative > 0 ? 1 : 0);
-    status = pC_->writeController();
-    // Set acceleration
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:ACC %f", axisNo_, acceleration * PULSES_PER_STEP);
-    status = pC_->writeController();
-    // Set velocity
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:VEL %f", axisNo_, maxVelocity * PULSES_PER_STEP);
-    status = pC_->writeController();
-    // Do move
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":MOVE%d %f", axisNo_, position * PULSES_PER_STEP);
-    status = pC_->writeController();
+  if(sensorPresent_ && !openLoop_ && fineMode_ && fineMove(position, relative, maxVelocity, &status)) {
+    // done in scan mode
+  } else if(sensorPresent_ && !openLoop_) {
+    // closed loop move: mode, acceleration, velocity and target in one write
+    size_t len = snprintf(moveString, sizeof(moveString), ":CHAN%d:MMOD %d;", axisNo_, relative > 0 ? 1 : 0);
+    len += speedsString(&moveString[len], sizeof(moveString) - len, acceleration, maxVelocity);
+    snprintf(&moveString[len], sizeof(moveString) - len, ":MOVE%d %f", axisNo_, position * PULSES_PER_STEP);
+    status = sendMove(moveString);
+    if (status) {
+      speedsValid_ = 0;
+      lastMmodSent_ = -1;
+    } else {
+      lastMmodSent_ = relative > 0 ? 1 : 0;
+      // The control loop takes over the piezo again
+      fineActive_ = 0;
+      fineScan_ = MCS2_SCAN_RANGE / 2;
+      asynMotorAxis::setIntegerParam(pC_->fineActive_, 0);
+      double current = 0.0;
+      if (relative || !pC_->getDoubleParam(axisNo_, pC_->motorEncoderPosition_, &current))
+        pC_->scheduler_->expect(axisNo_, SmarActPollScheduler::moveTime(position - current, maxVelocity, acceleration));
+    }
   } else {
     // open loop move
     double frequency = maxVelocity;
@@ -551,20 +2602,191 @@ asynStatus MCS2Axis::move(double position, int relative, double minVelocity, dou
               "MCS2Axis::", axisNo_, frequency, steps_to_go_i);
     if (!steps_to_go_i)
       return status;
-    // Set mode; 4 == STEP
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:MMOD 4", axisNo_);
-    status = pC_->writeController();
-
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:STEP:FREQ %u", axisNo_, (unsigned short)frequency);
-    status = pC_->writeController();
-    // Do move
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":MOVE%d %lld", axisNo_, steps_to_go_i);
-    status = pC_->writeController();
+    // Longer moves than the controller takes at once go in chunks
+    if (steps_to_go_i > MAX_STEPS_PER_MOVE) {
+      stepsQueued_ = steps_to_go_i - MAX_STEPS_PER_MOVE;
+      steps_to_go_i = MAX_STEPS_PER_MOVE;
+    } else if (steps_to_go_i < -MAX_STEPS_PER_MOVE) {
+      stepsQueued_ = steps_to_go_i + MAX_STEPS_PER_MOVE;
+      steps_to_go_i = -MAX_STEPS_PER_MOVE;
+    }
+    // Set mode (STEP) and frequency if they changed, and do move
+    {
+      size_t len = stepModeString(moveString, sizeof(moveString), (unsigned short)frequency);
+      MCS2Command::encode(&moveString[len], sizeof(moveString) - len, SmarActCmdMove, axisNo_, (double)steps_to_go_i);
+    }
+    status = sendMove(moveString);
+    if (status) {
+      lastMmodSent_ = -1;
+      stepsQueued_ = 0;
+    } else if (frequency >= 1.0) {
+      pC_->scheduler_->expect(axisNo_, fabs((double)steps_to_go_i) / frequency);
+    }
   }
 
   return status;
 }
 
+/** Writes the :MMOD (step mode) and :STEP:FREQ commands that differ from the
+  * values last sent, each followed by ';', and remembers the values.
+  * \return Number of characters written to buf
+  */
+size_t MCS2Axis::stepModeString(char *buf, size_t maxChars, unsigned frequency)
+{
+  size_t len = 0;
+  buf[0] = '\0';
+  if (lastMmodSent_ != MOVE_MODE_STEP)
+    len += snprintf(&buf[len], maxChars - len, ":CHAN%d:MMOD %d;", axisNo_, MOVE_MODE_STEP);
+  if (lastMmodSent_ != MOVE_MODE_STEP || frequency != lastStepFreqSent_)
+    len += snprintf(&buf[len], maxChars - len, ":CHAN%d:STEP:FREQ %u;", axisNo_, frequency);
+  lastMmodSent_ = MOVE_MODE_STEP;
+  lastStepFreqSent_ = frequency;
+  return len;
+}
+
+/** Moves by flexing the piezo in scan mode, without stick-slip steps, if the move
+  * fits into what is left of the scan range. The scan value isn't read back from
+  * the controller: it is taken to be in the middle of the range after a normal move,
+  * and tracked from the fine moves after that. While fine moves are active the
+  * encoder position is the position of the axis, so the motor record's retries
+  * correct what the open loop flex misses.
+  * \param[out] pStatus The status of the write, if the move was sent
+  * \return 1 if the move was sent, 0 if it needs a normal move */
+int MCS2Axis::fineMove(double position, int relative, double velocity, asynStatus *pStatus)
+{
+  char moveString[MAX_CONTROLLER_STRING_SIZE];
+  double current = 0.0;
+  double distance = position;
+  double scanVel;
+  long delta;
+  size_t len = 0;
+
+  if (!(fineRange_ > 0.0))
+    return 0;
+  if (!relative) {
+    if (pC_->getDoubleParam(axisNo_, pC_->motorPosition_, &current))
+      return 0;
+    distance = position - current;
+  }
+  delta = (long)floor(distance * MCS2_SCAN_RANGE / fineRange_ + 0.5);
+  if (fineScan_ + delta < 0 || fineScan_ + delta > MCS2_SCAN_RANGE)
+    return 0;
+  scanVel = floor(fabs(velocity) * MCS2_SCAN_RANGE / fineRange_ + 0.5);
+
+  moveString[0] = '\0';
+  if (lastMmodSent_ != MOVE_MODE_SCAN_RELATIVE)
+    len += snprintf(&moveString[len], sizeof(moveString) - len, ":CHAN%d:MMOD %d;", axisNo_, MOVE_MODE_SCAN_RELATIVE);
+  if (scanVel >= 1.0 && (lastMmodSent_ != MOVE_MODE_SCAN_RELATIVE || scanVel != lastScanVelSent_))
+    len += snprintf(&moveString[len], sizeof(moveString) - len, ":CHAN%d:SCAN:VEL %.0f;", axisNo_, scanVel);
+  MCS2Command::encode(&moveString[len], sizeof(moveString) - len, SmarActCmdMove, axisNo_, delta);
+  asynPrint(pC_->pasynUserController_, ASYN_TRACE_INFO, "MCS2Axis::fineMove(%d) distance=%f scan=%d delta=%ld\n",
+            axisNo_, distance, fineScan_, delta);
+  *pStatus = sendMove(moveString);
+  if (*pStatus) {
+    lastMmodSent_ = -1;
+    return 1;
+  }
+  lastMmodSent_ = MOVE_MODE_SCAN_RELATIVE;
+  if (scanVel >= 1.0)
+    lastScanVelSent_ = scanVel;
+  fineScan_ += delta;
+  fineActive_ = 1;
+  asynMotorAxis::setIntegerParam(pC_->fineActive_, 1);
+  if (scanVel >= 1.0)
+    pC_->scheduler_->expect(axisNo_, fabs((double)delta) / scanVel);
+  return 1;
+}
+
+/** Sends the commands of a move.
+  * With MCS2SetFusedMoves the status and position queries are chained to the move, so
+  * the readbacks are updated with the reply to the move, and the axis is polled at the
+  * fast poll period for up to MCS2_FAST_POLL_TIME s, until it is done. Deferred moves
+  * are only queued, see MCS2Controller::writeMove().
+  * \param[in] moveString Semicolon separated SCPI commands of the move
+  */
+asynStatus MCS2Axis::sendMove(const char *moveString)
+{
+  char outString[MAX_CONTROLLER_STRING_SIZE + 64];
+  char inString[MAX_CONTROLLER_STRING_SIZE];
+  size_t nread = 0;
+  char *pPos;
+  int chanState;
+  PositionType encoderCounts;
+  epicsTimeStamp stamp, received;
+  asynStatus status;
+
+  if (!(pC_->fastPollPeriod_ > 0.0) || pC_->movesDeferred_)
+    return pC_->writeMove(moveString);
+  if (sensorPresent_)
+    snprintf(outString, sizeof(outString), "%s;:CHAN%d:STAT?;:CHAN%d:POS?", moveString, axisNo_, axisNo_);
+  else
+    snprintf(outString, sizeof(outString), "%s;:CHAN%d:STAT?", moveString, axisNo_);
+  inString[0] = '\0';
+  epicsTimeGetCurrent(&stamp);
+  status = pC_->writeReadController(outString, inString, sizeof(inString), &nread, DEFAULT_CONTROLLER_TIMEOUT);
+  epicsTimeGetCurrent(&received);
+  epicsTimeAddSeconds(&stamp, 0.5 * epicsTimeDiffInSeconds(&received, &stamp));
+  if (status)
+    return status;
+  pC_->scheduler_->fastPolls(axisNo_, pC_->fastPollPeriod_, MCS2_FAST_POLL_TIME);
+
+  /* The move was sent; a reply that doesn't parse is left to the next poll */
+  pPos = strchr(inString, ';');
+  if (pPos) *pPos++ = '\0';
+  if (mcs2ParseInt(pC_->pasynUserController_, inString, &chanState))
+    return asynSuccess;
+  // Done is left to the poll, asynMotorController sets it to 0 after the move
+  setStatusParams(chanState);
+  if (sensorPresent_ && pPos && !mcs2ParseInt64(pC_->pasynUserController_, pPos, &encoderCounts))
+    setEncoderParams(encoderCounts, &stamp, 0);
+  callStampedCallbacks();
+  return asynSuccess;
+}
+
+/** Sends the next chunk of a long open loop move, mode and frequency are still set */
+asynStatus MCS2Axis::moveNextChunk(void)
+{
+  char moveString[MAX_CONTROLLER_STRING_SIZE];
+  PositionType steps = stepsQueued_;
+  asynStatus status;
+
+  if (steps > MAX_STEPS_PER_MOVE)
+    steps = MAX_STEPS_PER_MOVE;
+  else if (steps < -MAX_STEPS_PER_MOVE)
+    steps = -MAX_STEPS_PER_MOVE;
+  MCS2Command::encode(moveString, sizeof(moveString), SmarActCmdMove, axisNo_, (double)steps);
+  asynPrint(pC_->pasynUserController_, ASYN_TRACE_INFO, "MCS2Axis::moveNextChunk(%d) steps=%lld left=%lld\n",
+            axisNo_, steps, stepsQueued_ - steps);
+  pC_->scheduler_->kick(axisNo_);
+  status = pC_->writeController(moveString, DEFAULT_CONTROLLER_TIMEOUT);
+  if (status) {
+    stepsQueued_ = 0;
+    return status;
+  }
+  stepsQueued_ -= steps;
+  if (lastStepFreqSent_)
+    pC_->scheduler_->expect(axisNo_, fabs((double)steps) / lastStepFreqSent_);
+  return asynSuccess;
+}
+
+/** Writes the :ACC and :VEL commands that differ from the values last sent,
+  * each followed by ';', and remembers the values.
+  * \return Number of characters written to buf
+  */
+size_t MCS2Axis::speedsString(char *buf, size_t maxChars, double acceleration, double velocity)
+{
+  size_t len = 0;
+  buf[0] = '\0';
+  if (!speedsValid_ || acceleration != lastAccSent_)
+    len += snprintf(&buf[len], maxChars - len, ":CHAN%d:ACC %f;", axisNo_, acceleration * PULSES_PER_STEP);
+  if (!speedsValid_ || velocity != lastVelSent_)
+    len += snprintf(&buf[len], maxChars - len, ":CHAN%d:VEL %f;", axisNo_, velocity * PULSES_PER_STEP);
+  lastAccSent_ = acceleration;
+  lastVelSent_ = velocity;
+  speedsValid_ = 1;
+  return len;
+}
+
 asynStatus MCS2Axis::home(double minVelocity, double maxVelocity, double acceleration, int forwards)
 {
   asynStatus status=asynSuccess;
@@ -576,6 +2798,11 @@ asynStatus MCS2Axis::home(double minVelocity, double maxVelocity, double acceler
     refOpt |= START_DIRECTION;
   }
   refOpt |= AUTO_ZERO;
+  pC_->scheduler_->kick(axisNo_);
+  stepsQueued_ = 0;
+  fineActive_ = 0;
+  fineScan_ = MCS2_SCAN_RANGE / 2;
+  asynMotorAxis::setIntegerParam(pC_->fineActive_, 0);
 
   // Set default reference options - direction and autozero
   printf("ref opt: %d\n", refOpt);
@@ -583,17 +2810,15 @@ asynStatus MCS2Axis::home(double minVelocity, double maxVelocity, double acceler
   status = pC_->writeController();
   pC_->clearErrors();
 
-  // Set acceleration
-  snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:ACC %f", axisNo_, acceleration*PULSES_PER_STEP);
-  status = pC_->writeController();
-  pC_->clearErrors();
-  // Set velocity
-  snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:VEL %f", axisNo_, maxVelocity*PULSES_PER_STEP);
-  status = pC_->writeController();
-  pC_->clearErrors();
-  // Begin move
-  snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":REF%d", axisNo_);
+  // Set acceleration and velocity, if they changed, and begin move
+  {
+    size_t len = speedsString(pC_->outString_, sizeof(pC_->outString_), acceleration, maxVelocity);
+    MCS2Command::encode(&pC_->outString_[len], sizeof(pC_->outString_) - len, SmarActCmdFindReference, axisNo_);
+  }
   status = pC_->writeController();
+  if (status) speedsValid_ = 0;
+  // The reference search has its own move mode
+  lastMmodSent_ = -1;
   pC_->clearErrors();
 
   return status;
@@ -604,8 +2829,12 @@ asynStatus MCS2Axis::stop(double acceleration )
   asynStatus status;
   //static const char *functionName = "stopAxis";
 
-  snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":STOP%d", axisNo_);
-  status = pC_->writeController();
+  pC_->scheduler_->kick(axisNo_);
+  stepsQueued_ = 0;
+  // Stopping one axis of a waveform stops all of them
+  if (profileUsed_) pC_->stopWave(1);
+  MCS2Command::encode(pC_->outString_, sizeof(pC_->outString_), SmarActCmdStop, axisNo_);
+  status = pC_->writeStop(pC_->outString_);
 
   return status;
 }
@@ -620,23 +2849,329 @@ asynStatus MCS2Axis::setPosition(double position)
   return status;
 }
 
+/** Formats the move to the first frame of a profile or waveform, in absolute move mode.
+  * Queued open loop steps and a fine move are forgotten, the stream moves the axis.
+  * \param[in] position Target in pm (lin) or ndeg (rot)
+  */
+size_t MCS2Axis::streamMoveString(char *buf, size_t maxChars, PositionType position)
+{
+  stepsQueued_ = 0;
+  lastMmodSent_ = 0;
+  fineActive_ = 0;
+  fineScan_ = MCS2_SCAN_RANGE / 2;
+  asynMotorAxis::setIntegerParam(pC_->fineActive_, 0);
+  pC_->scheduler_->kick(axisNo_);
+  MCS2Command cmd;
+  cmd.add(SmarActCmdMoveMode, axisNo_, 0).add(SmarActCmdMove, axisNo_, (double)position);
+  return snprintf(buf, maxChars, "%s", cmd.str());
+}
+
+/** Takes a new waveform, the samples are in nm (lin) or udeg (rot).
+  * It is written to the buffer that is not played; while the axis plays a waveform
+  * the new one takes over at the end of the current period, else at once.
+  * Called with the lock held.
+  */
+asynStatus MCS2Axis::loadWave(const epicsFloat64 *value, size_t nElements)
+{
+  int playing = epicsAtomicGetIntT(&pC_->waveRequest_) && profileUsed_;
+  int back = waveActive_ ^ 1;
+  size_t i;
+
+  if (!wave_[back] || nElements > MCS2_WAVE_SIZE || (playing && !nElements)) {
+    asynPrint(pC_->pasynUserController_, ASYN_TRACE_ERROR,
+              "MCS2Axis::loadWave(%d) invalid waveform, %d samples\n", axisNo_, (int)nElements);
+    return asynError;
+  }
+  for (i = 0; i < nElements; i++) {
+    wave_[back][i] = (PositionType)(value[i] * PULSES_PER_STEP);
+  }
+  waveLen_[back] = nElements;
+  if (playing) {
+    wavePending_ = 1;
+  } else {
+    waveActive_ = back;
+    wavePending_ = 0;
+    wavePhase_ = 0;
+  }
+  return asynSuccess;
+}
+
+/** Returns the next sample of the waveform, called with the lock held */
+PositionType MCS2Axis::nextWaveFrame(void)
+{
+  if (wavePhase_ >= waveLen_[waveActive_]) {
+    wavePhase_ = 0;
+    if (wavePending_) {
+      waveActive_ ^= 1;
+      wavePending_ = 0;
+    }
+  }
+  return wave_[waveActive_][wavePhase_++];
+}
+
+/** Copies the newest captured samples, oldest first.
+  * Must be called with the controller locked, any of the destinations may be NULL.
+  * \param[out] pPos Positions in nm (lin) or udeg (rot)
+  * \param[out] pIPos Positions in pm (lin) or ndeg (rot)
+  * \param[out] pTime Sample times in seconds since the capture thread started
+  * \param[in] maxSamples Size of the destinations
+  * \return Number of samples copied */
+size_t MCS2Axis::captureSnapshot(epicsFloat64 *pPos, PositionType *pIPos, epicsFloat64 *pTime, size_t maxSamples)
+{
+  size_t head = epicsAtomicGetSizeT(&captureRing_->head);
+  size_t first = captureTail_;
+  size_t num;
+  size_t i;
+
+  epicsAtomicReadMemoryBarrier();
+  if (head - first > MCS2_CAPTURE_SIZE - MCS2_CAPTURE_GUARD)
+    first = head - (MCS2_CAPTURE_SIZE - MCS2_CAPTURE_GUARD);
+  num = head - first;
+  if (num > maxSamples) {
+    first = head - maxSamples;
+    num = maxSamples;
+  }
+  for (i = 0; i < num; i++) {
+    size_t idx = (first + i) % MCS2_CAPTURE_SIZE;
+    if (pPos) pPos[i] = (epicsFloat64)captureRing_->pos[idx] / PULSES_PER_STEP;
+    if (pIPos) pIPos[i] = captureRing_->pos[idx];
+    if (pTime) pTime[i] = captureRing_->time[idx];
+  }
+  return num;
+}
+
+/** Returns 1 if the cached properties must be read (again) from the controller */
+int MCS2Axis::propertiesStale(void)
+{
+  epicsTimeStamp now;
+  if (!propsValid_)
+    return 1;
+  epicsTimeGetCurrent(&now);
+  return epicsTimeDiffInSeconds(&now, &propsTime_) >= pC_->propertyRefreshPeriod_;
+}
+
+/** Reads the positioner type and MCL frequency into the property cache
+  * and remembers them in the capability cache */
+asynStatus MCS2Axis::refreshProperties(void)
+{
+  const char *pReply;
+  asynStatus comStatus;
+  SmarActCaps caps;
+
+  comStatus = pollReply(MCS2_POLL_PTYP, &pReply);
+  if (comStatus) return comStatus;
+  comStatus = mcs2ParseInt(pC_->pasynUserController_, pReply, &cachedPtyp_);
+  if (comStatus) return comStatus;
+  comStatus = pollReply(MCS2_POLL_MCLF, &pReply);
+  if (comStatus) return comStatus;
+  comStatus = mcs2ParseInt(pC_->pasynUserController_, pReply, &cachedMclf_);
+  if (comStatus) return comStatus;
+  propsValid_ = 1;
+  epicsTimeGetCurrent(&propsTime_);
+  // The sensor comes with every STAT, the driver doesn't tell linear from rotary
+  caps.rotary = 0;
+  caps.type = cachedPtyp_;
+  caps.freq = cachedMclf_;
+  caps.sensor = 0;
+  SmarActCapCache::store(pC_->serial_, axisNo_, &caps);
+  return asynSuccess;
+}
+
 /** Initial poll (and update) of the axis.
   * \param[out] moving A flag that is set indicating that the axis is moving (1) or done (0). */
 asynStatus MCS2Axis::initialPoll(void)
 {
   asynStatus status=asynSuccess;
+  // VEL, ACC and the step mode are sent again with the next move
+  speedsValid_ = 0;
+  lastMmodSent_ = -1;
   // Set hold time
   {
     int hold = HOLD_FOREVER;
     (void)pC_->getIntegerParam(axisNo_, pC_->hold_,
                                &hold);
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:HOLD %d", axisNo_, hold);
+    MCS2Command::encode(pC_->outString_, sizeof(pC_->outString_), SmarActCmdHold, axisNo_, hold);
+    holdValid_ = 0;
     status = pC_->writeController();
     pC_->clearErrors();
+    if (status) return status;
+    cachedHold_ = hold;
+    holdValid_ = 1;
+  }
+  // Restore a position compare trigger after a reconnect
+  {
+    int trigMode = TRIG_MODE_CONSTANT;
+    (void)pC_->getIntegerParam(axisNo_, pC_->trigMode_, &trigMode);
+    if (trigMode != TRIG_MODE_CONSTANT) {
+      status = applyTrigger(trigMode);
+      if (status) return status;
+    }
   }
+  // Fill the property cache, on the first connect from the capability cache if the
+  // axis is in it; the next periodic refresh reads them from the controller
+  propsValid_ = 0;
+  if (!capsLoaded_) {
+    SmarActCaps caps;
+    capsLoaded_ = 1;
+    if (SmarActCapCache::lookup(pC_->serial_, axisNo_, &caps)) {
+      cachedPtyp_ = caps.type;
+      cachedMclf_ = caps.freq;
+      propsValid_ = 1;
+      epicsTimeGetCurrent(&propsTime_);
+      return status;
+    }
+  }
+  status = refreshProperties();
+  return status;
+}
+
+/** Configures the output trigger of the channel.
+  * In TRIG_MODE_POSITION_COMPARE the controller emits a pulse every trigIncr_ pm,
+  * starting at trigStart_, as long as the position is between trigStart_ and trigStop_.
+  * The direction is given by the order of start and stop.
+  * All settings are sent in one write, the mode last.
+  * \param[in] trigMode One of the TRIG_MODE_xxx defines */
+asynStatus MCS2Axis::applyTrigger(int trigMode)
+{
+  static const char *functionName = "applyTrigger";
+  char outString[512];
+  double start = 0.0;
+  double stop = 0.0;
+  double incr = 0.0;
+  int pulseWidth = 0;
+  int polarity = 1;
+  int direction;
+  asynStatus status;
+
+  if (trigMode == TRIG_MODE_CONSTANT) {
+    snprintf(outString, sizeof(outString), ":CHAN%d:TRIG:MODE %d", axisNo_, TRIG_MODE_CONSTANT);
+  } else {
+    (void)pC_->getDoubleParam(axisNo_, pC_->trigStart_, &start);
+    (void)pC_->getDoubleParam(axisNo_, pC_->trigStop_, &stop);
+    (void)pC_->getDoubleParam(axisNo_, pC_->trigIncr_, &incr);
+    (void)pC_->getIntegerParam(axisNo_, pC_->trigPwid_, &pulseWidth);
+    (void)pC_->getIntegerParam(axisNo_, pC_->trigPol_, &polarity);
+    if (incr < 0) incr = -incr;
+    if (incr == 0.0 || start == stop) {
+      asynPrint(pC_->pasynUserController_, ASYN_TRACE_ERROR,
+                "%s(%d) invalid trigger start=%f stop=%f incr=%f\n",
+                functionName, axisNo_, start, stop, incr);
+      return asynError;
+    }
+    direction = stop > start ? POS_COMP_DIRECTION_FORWARD : POS_COMP_DIRECTION_BACKWARD;
+    snprintf(outString, sizeof(outString),
+             ":CHAN%d:TRIG:MODE %d;"
+             ":CHAN%d:TRIG:POL %d;"
+             ":CHAN%d:TRIG:PWID %d;"
+             ":CHAN%d:POS:COMP:DIR %d;"
+             ":CHAN%d:POS:COMP:LIM:MIN %.0f;"
+             ":CHAN%d:POS:COMP:LIM:MAX %.0f;"
+             ":CHAN%d:POS:COMP:INCR %.0f;"
+             ":CHAN%d:POS:COMP:STAR %.0f;"
+             ":CHAN%d:TRIG:MODE %d",
+             axisNo_, TRIG_MODE_CONSTANT,
+             axisNo_, polarity ? 1 : 0,
+             axisNo_, pulseWidth,
+             axisNo_, direction,
+             axisNo_, start < stop ? start : stop,
+             axisNo_, start < stop ? stop : start,
+             axisNo_, incr,
+             axisNo_, start,
+             axisNo_, trigMode);
+  }
+  asynPrint(pC_->pasynUserController_, ASYN_TRACE_INFO, "%s(%d) '%s'\n",
+            functionName, axisNo_, outString);
+  status = pC_->writeController(outString, DEFAULT_CONTROLLER_TIMEOUT);
+  pC_->clearErrors();
   return status;
 }
 
+/** Returns the reply to one of the values read in a poll cycle.
+  * The reply is taken from the batched controller poll if it has one for this axis,
+  * otherwise the value is read from the controller.
+  * \param[in] field One of the MCS2_POLL_xxx defines
+  * \param[out] pReply The reply string, valid until the next exchange with the controller */
+asynStatus MCS2Axis::pollReply(int field, const char **pReply)
+{
+  asynStatus comStatus;
+  epicsTimeStamp received;
+
+  if (batchedMask_ & (1 << field)) {
+    *pReply = batchedReply_[field];
+    replyStamp_ = pC_->pollStamp_[batchedChunk_];
+    return asynSuccess;
+  }
+  snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d%s", axisNo_, mcs2PollLeafs[field]);
+  epicsTimeGetCurrent(&replyStamp_);
+  comStatus = pC_->writeReadHandleDisconnect();
+  epicsTimeGetCurrent(&received);
+  epicsTimeAddSeconds(&replyStamp_, 0.5 * epicsTimeDiffInSeconds(&received, &replyStamp_));
+  *pReply = pC_->inString_;
+  return comStatus;
+}
+
+/** Sets the status bits that the channel state holds, but not done.
+  * \param[in] chanState Reply to :STAT?
+  */
+void MCS2Axis::setStatusParams(int chanState)
+{
+  sensorPresent_ = (chanState & CH_STATE_SENSOR_PRESENT)?1:0;
+  asynMotorAxis::setIntegerParam(pC_->pstatrb_, chanState);
+  asynMotorAxis::setIntegerParam(pC_->motorClosedLoop_, (chanState & CH_STATE_CLOSED_LOOP_ACTIVE)?1:0);
+  asynMotorAxis::setIntegerParam(pC_->motorStatusHasEncoder_, sensorPresent_);
+  asynMotorAxis::setIntegerParam(pC_->motorStatusHomed_, (chanState & CH_STATE_IS_REFERENCED)?1:0);
+  asynMotorAxis::setIntegerParam(pC_->motorStatusHighLimit_, (chanState & CH_STATE_END_STOP_REACHED)?1:0);
+  asynMotorAxis::setIntegerParam(pC_->motorStatusLowLimit_, (chanState & CH_STATE_END_STOP_REACHED)?1:0);
+  asynMotorAxis::setIntegerParam(pC_->motorStatusFollowingError_,
+                                 (chanState & (CH_STATE_FOLLOWING_LIMIT_REACHED | CH_STATE_MOVEMENT_FAILED))?1:0);
+  asynMotorAxis::setIntegerParam(pC_->motorStatusAtHome_, (chanState & CH_STATE_REFERENCE_MARK)?1:0);
+  asynMotorAxis::setIntegerParam(pC_->motorStatusPowerOn_, (chanState & CH_STATE_ACTIVELY_MOVING)?1:0);
+}
+
+/** Sets the readbacks of the encoder position, and the velocity estimate if it is enabled.
+  * \param[in] encoderCounts Reply to :POS?, pm (lin) or ndeg (rot)
+  * \param[in] pStamp Midpoint of the exchange the reply came from, the callbacks carry it
+  * \param[in] done The axis is done, the first position after a move passes the deadband
+  */
+void MCS2Axis::setEncoderParams(PositionType encoderCounts, const epicsTimeStamp *pStamp, int done)
+{
+  if (velEstEnable_) {
+    double dt = haveSample_ ? epicsTimeDiffInSeconds(pStamp, &lastSampleStamp_) : 0.0;
+    if (!haveSample_ || dt >= MCS2_VEL_EST_MIN_DT) {
+      if (haveSample_)
+        asynMotorAxis::setDoubleParam(pC_->velEst_, (double)(encoderCounts - lastSample_) / dt);
+      lastSample_ = encoderCounts;
+      lastSampleStamp_ = *pStamp;
+      haveSample_ = 1;
+    }
+  }
+  if (!pC_->deadbands_.pass(axisNo_, SmarActReadbackEnc, (double)encoderCounts / PULSES_PER_STEP, done))
+    return;
+  sampleStamp_ = *pStamp;
+  stampPending_ = 1;
+  asynMotorAxis::setDoubleParam(pC_->freadback_, (double)encoderCounts);
+  asynMotorAxis::setDoubleParam(pC_->motorEncoderPosition_, (double)encoderCounts / PULSES_PER_STEP);
+#ifdef SMARACT_ASYN_ASYNPARAMINT64
+  pC_->setInteger64Param(axisNo_, pC_->ireadback_, encoderCounts);
+#endif
+}
+
+/** callParamCallbacks() with the time stamp of the position readback, if one was set since the
+  * last callbacks: records with TSE -2 then carry the time the controller sampled the position
+  * instead of the time of the callback. Called with the lock held.
+  */
+void MCS2Axis::callStampedCallbacks(void)
+{
+  if (!stampPending_) {
+    callParamCallbacks();
+    return;
+  }
+  pC_->setTimeStamp(&sampleStamp_);
+  callParamCallbacks();
+  pC_->updateTimeStamp();
+  stampPending_ = 0;
+}
+
 /** Polls the axis.
   * This function reads the controller position, encoder position, the limit status, the moving status,
   * the drive power-on status and positioner type. It does not current detect following error, etc.
@@ -648,97 +3183,115 @@ asynStatus MCS2Axis::poll(bool *moving)
 {
   int done;
   int chanState;
-  int closedLoop;
   int isCalibrated;
   int isReferenced;
   int endStopReached;
   int followLimitReached;
   int movementFailed = 0;
-  int refMark;
-  int positionerType;
   double encoderPosition;
   double theoryPosition;
-  int driveOn;
-  int mclf;
+  PositionType encoderCounts;
+  PositionType targetCounts;
+  const char *pReply;
   asynStatus comStatus = asynSuccess;
 
+  if (!pC_->scheduler_->due(axisNo_)) {
+    *moving = pC_->scheduler_->skipped(axisNo_);
+    return asynSuccess;
+  }
+  // Nothing is sent while the link is down, the controller probes it
+  if (pC_->linkDown()) {
+    comStatus = asynDisconnected;
+    goto skip;
+  }
   if (!initialPollDone_) {
     comStatus = initialPoll();
     if (comStatus) goto skip;
     initialPollDone_ = 1;
   }
   // Read the channel state
-  snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:STAT?", axisNo_);
-  comStatus = pC_->writeReadHandleDisconnect();
+  comStatus = pollReply(MCS2_POLL_STAT, &pReply);
   if (comStatus) goto skip;
-  chanState = atoi(pC_->inString_);
-  asynMotorAxis::setIntegerParam(pC_->pstatrb_, chanState);
+  comStatus = mcs2ParseInt(pC_->pasynUserController_, pReply, &chanState);
+  if (comStatus) goto skip;
+  setStatusParams(chanState);
   done               = (chanState & CH_STATE_ACTIVELY_MOVING)?0:1;
-  closedLoop         = (chanState & CH_STATE_CLOSED_LOOP_ACTIVE)?1:0;
-  sensorPresent_     = (chanState & CH_STATE_SENSOR_PRESENT)?1:0;
   isCalibrated       = (chanState & CH_STATE_IS_CALIBRATED)?1:0;
   isReferenced       = (chanState & CH_STATE_IS_REFERENCED)?1:0;
   endStopReached     = (chanState & CH_STATE_END_STOP_REACHED)?1:0;
   followLimitReached = (chanState & CH_STATE_FOLLOWING_LIMIT_REACHED)?1:0;
   movementFailed     = (chanState & CH_STATE_MOVEMENT_FAILED)?1:0;
-  refMark            = (chanState & CH_STATE_REFERENCE_MARK)?1:0;
-  driveOn            = (chanState & CH_STATE_ACTIVELY_MOVING)?1:0;
 
+  // A move sent while the lock was released for this poll isn't in the replies yet
+  if (done && pC_->scheduler_->stale(axisNo_))
+    done = 0;
+
+  // A chunk of a long open loop move is done: send the next one, the move goes on,
+  // unless the positioner ran into an end stop
+  if (done && stepsQueued_ && (endStopReached || movementFailed))
+    stepsQueued_ = 0;
+  if (done && stepsQueued_) {
+    comStatus = moveNextChunk();
+    if (comStatus) goto skip;
+    done = 0;
+  }
   *moving = done ? false:true;
+  lastDone_ = done;
   asynMotorAxis::setIntegerParam(pC_->motorStatusDone_, done);
-  asynMotorAxis::setIntegerParam(pC_->motorClosedLoop_, closedLoop);
-  asynMotorAxis::setIntegerParam(pC_->motorStatusHasEncoder_, sensorPresent_);
-  asynMotorAxis::setIntegerParam(pC_->motorStatusHomed_, isReferenced);
-  asynMotorAxis::setIntegerParam(pC_->motorStatusHighLimit_, endStopReached);
-  asynMotorAxis::setIntegerParam(pC_->motorStatusLowLimit_, endStopReached);
-  asynMotorAxis::setIntegerParam(pC_->motorStatusFollowingError_, followLimitReached || movementFailed);
-  asynMotorAxis::setIntegerParam(pC_->motorStatusAtHome_, refMark);
-  asynMotorAxis::setIntegerParam(pC_->motorStatusPowerOn_, driveOn);
 
   // Read the current encoder position, if the positioner has a sensor
   if(sensorPresent_) {
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:POS?", axisNo_);
-    comStatus = pC_->writeReadHandleDisconnect();
+    comStatus = pollReply(MCS2_POLL_POS, &pReply);
     if (comStatus) goto skip;
-    encoderPosition = (double)strtod(pC_->inString_, NULL);
-    asynMotorAxis::setDoubleParam(pC_->freadback_, encoderPosition);
-    asynMotorAxis::setDoubleParam(pC_->motorEncoderPosition_, encoderPosition / PULSES_PER_STEP);
-#ifdef SMARACT_ASYN_ASYNPARAMINT64
-    pC_->setInteger64Param(axisNo_, pC_->ireadback_, atoll(pC_->inString_));
-#endif
-    if (!openLoop_) {
+    // The position is an integer number of pm (ndeg): parse it once, exactly,
+    // and derive all readbacks from that value
+    comStatus = mcs2ParseInt64(pC_->pasynUserController_, pReply, &encoderCounts);
+    if (comStatus) goto skip;
+    encoderPosition = (double)encoderCounts;
+    setEncoderParams(encoderCounts, &replyStamp_, done);
+    if (!openLoop_ && fineActive_) {
+      // Scan mode has no target, the axis is where the sensor says
+      if (pC_->deadbands_.pass(axisNo_, SmarActReadbackPos, encoderPosition / PULSES_PER_STEP, done))
+        asynMotorAxis::setDoubleParam(pC_->motorPosition_, encoderPosition / PULSES_PER_STEP);
+    } else if (!openLoop_) {
       // Read the current theoretical position
-      snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:POS:TARG?", axisNo_);
-      comStatus = pC_->writeReadHandleDisconnect();
+      comStatus = pollReply(MCS2_POLL_POS_TARG, &pReply);
       if (comStatus) goto skip;
-      theoryPosition = (double)strtod(pC_->inString_, NULL);
-      theoryPosition /= PULSES_PER_STEP;
-      asynMotorAxis::setDoubleParam(pC_->motorPosition_, theoryPosition);
+      comStatus = mcs2ParseInt64(pC_->pasynUserController_, pReply, &targetCounts);
+      if (comStatus) goto skip;
+      theoryPosition = (double)targetCounts / PULSES_PER_STEP;
+      if (pC_->deadbands_.pass(axisNo_, SmarActReadbackPos, theoryPosition, done))
+        asynMotorAxis::setDoubleParam(pC_->motorPosition_, theoryPosition);
     }
   }
 
 
-  // Read the currently selected positioner type
-  snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:PTYP?", axisNo_);
-  comStatus = pC_->writeReadHandleDisconnect();
-  if (comStatus) goto skip;
-  positionerType = atoi(pC_->inString_);
-  asynMotorAxis::setIntegerParam(pC_->ptyprb_, positionerType);
+  // Positioner type and MCLF only change when written, re-read them when idle and stale
+  if (done && propertiesStale()) {
+    comStatus = refreshProperties();
+    if (comStatus) goto skip;
+  }
+  asynMotorAxis::setIntegerParam(pC_->ptyprb_, cachedPtyp_);
 
-  // Read CAL/REF status and MCLF when idle
+  // Report CAL/REF status and MCLF when idle
   if(done)
   {
         asynMotorAxis::setIntegerParam(pC_->cal_, isCalibrated);
         asynMotorAxis::setIntegerParam(pC_->ref_, isReferenced);
-        snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:MCLF?", axisNo_);
-        comStatus = pC_->writeReadHandleDisconnect();
-        if (comStatus) goto skip;
-        mclf = atoi(pC_->inString_);
-        asynMotorAxis::setIntegerParam(pC_->mclf_, mclf);
+        asynMotorAxis::setIntegerParam(pC_->mclf_, cachedMclf_);
   }
 
   skip:
-  if (comStatus) initialPollDone_ = 0;
+  batchedMask_ = 0;
+  if (comStatus) {
+    initialPollDone_ = 0;
+    propsValid_ = 0;
+    speedsValid_ = 0;
+    lastMmodSent_ = -1;
+    holdValid_ = 0;
+    stepsQueued_ = 0;
+    haveSample_ = 0;
+  }
   asynMotorAxis::setIntegerParam(pC_->motorStatusCommsError_, comStatus ? 1:0);
   {
     const char *strErrorMessage = "";
@@ -759,14 +3312,19 @@ asynStatus MCS2Axis::poll(bool *moving)
     else if (chanState & CH_STATE_OVERTEMP)
       strErrorMessage = "overtemperature";
 
-    setStringParam(pC_->errTxt_, strErrorMessage);
-    /* ESS motor has a MsgTxt variable */
+    // The texts are literals: the same pointer is the same text, nothing to set
+    if (strErrorMessage != lastErrTxt_) {
+      setStringParam(pC_->errTxt_, strErrorMessage);
+      /* ESS motor has a MsgTxt variable */
 #ifdef motorMessageTextString
-    updateMsgTxtFromDriver(strErrorMessage);
+      updateMsgTxtFromDriver(strErrorMessage);
 #endif
+      lastErrTxt_ = strErrorMessage;
+    }
 
   }
-  callParamCallbacks();
+  *moving = pC_->scheduler_->polled(axisNo_, *moving);
+  callStampedCallbacks();
   return comStatus ? asynError : asynSuccess;
 }
 
@@ -788,22 +3346,82 @@ asynStatus MCS2Axis::setIntegerParam(int function, epicsInt32  value) {
     /* set MCLF */
     snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:MCLF:CURR %d", axisNo_, value);
     status = pC_->writeController();
+    propsValid_ = 0;
   }
   else if (function == pC_->ptyp_) {
     /* set positioner type */
     snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:PTYP %d", axisNo_, value);
     status = pC_->writeController();
+    propsValid_ = 0;
   }
   else if (function == pC_->cal_) {
     /* send calibration command */
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CAL%d", axisNo_);
+    MCS2Command::encode(pC_->outString_, sizeof(pC_->outString_), SmarActCmdCalibrate, axisNo_);
     return pC_->writeController();
   }
   else if (function == pC_->hold_) {
     asynPrint(pC_->pasynUserController_, ASYN_TRACE_INFO, "%s(%d) hold=%d\n",
               functionName, axisNo_, value);
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:HOLD %d", axisNo_, value);
-    status = pC_->writeController();
+    if (holdValid_ && value == cachedHold_) {
+      /* The controller has it already */
+      status = asynSuccess;
+    } else {
+      MCS2Command::encode(pC_->outString_, sizeof(pC_->outString_), SmarActCmdHold, axisNo_, value);
+      status = pC_->writeController();
+      cachedHold_ = value;
+      holdValid_ = !status;
+    }
+  }
+  else if (function == pC_->trigMode_) {
+    asynPrint(pC_->pasynUserController_, ASYN_TRACE_INFO, "%s(%d) trigMode=%d\n",
+              functionName, axisNo_, value);
+    status = applyTrigger(value);
+    if (status) {
+      /* Report the trigger as off when the settings were not accepted */
+      asynMotorAxis::setIntegerParam(function, TRIG_MODE_CONSTANT);
+      return status;
+    }
+  }
+  else if (function == pC_->captEnable_) {
+    asynPrint(pC_->pasynUserController_, ASYN_TRACE_INFO, "%s(%d) captEnable=%d\n",
+              functionName, axisNo_, value);
+    epicsAtomicSetIntT(&captureEnabled_, value ? 1 : 0);
+    epicsEventSignal(pC_->captureEvent_);
+  }
+  else if (function == pC_->captRate_) {
+    epicsAtomicSetIntT(&captureRate_, value > 0 ? value : 0);
+  }
+  else if (function == pC_->captClear_) {
+    captureTail_ = epicsAtomicGetSizeT(&captureRing_->head);
+    capturePublished_ = captureTail_ - 1;
+  }
+  else if (function == pC_->velEstEnable_) {
+    velEstEnable_ = value ? 1 : 0;
+    haveSample_ = 0;
+  }
+  else if (function == pC_->fineMode_) {
+    asynPrint(pC_->pasynUserController_, ASYN_TRACE_INFO, "%s(%d) fineMode=%d\n",
+              functionName, axisNo_, value);
+    fineMode_ = value ? 1 : 0;
+  }
+  else if (function == pC_->waveUse_) {
+    waveUse_ = value ? 1 : 0;
+  }
+  else if (function == pC_->waveStart_) {
+    asynPrint(pC_->pasynUserController_, ASYN_TRACE_INFO, "%s(%d) waveStart=%d\n",
+              functionName, axisNo_, value);
+    if (value) {
+      status = pC_->startWave(axisNo_);
+      if (status) {
+        asynMotorAxis::setIntegerParam(function, 0);
+        return status;
+      }
+    } else {
+      pC_->stopWave(0);
+    }
+  }
+  else if (function == pC_->stopAll_) {
+    return value ? pC_->stopAll() : asynSuccess;
   }
   else if (function == pC_->openLoop_) {
     asynPrint(pC_->pasynUserController_, ASYN_TRACE_INFO, "%s(%d) openLoop=%d\n",
@@ -819,14 +3437,16 @@ asynStatus MCS2Axis::setIntegerParam(int function, epicsInt32  value) {
     }
     asynPrint(pC_->pasynUserController_, ASYN_TRACE_INFO, "%s(%d) move stepcnt=%d frequency=%d\n",
               functionName, axisNo_, value, frequency);
-    // Set mode; 4 == STEP
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:MMOD 4", axisNo_);
-    status = pC_->writeController();
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":CHAN%d:STEP:FREQ %u", axisNo_, (unsigned short)frequency);
+    // Set mode (STEP) and frequency if they changed, and do move
+    {
+      size_t len = stepModeString(pC_->outString_, sizeof(pC_->outString_), (unsigned short)frequency);
+      MCS2Command::encode(&pC_->outString_[len], sizeof(pC_->outString_) - len, SmarActCmdMove, axisNo_, value);
+    }
+    stepsQueued_ = 0;
+    pC_->scheduler_->kick(axisNo_);
     status = pC_->writeController();
-    // Do move
-    snprintf(pC_->outString_,sizeof(pC_->outString_)-1, ":MOVE%d %d", axisNo_, value);
-    return pC_->writeController();
+    if (status) lastMmodSent_ = -1;
+    return status;
   }
   /* Call base class method */
   status = asynMotorAxis::setIntegerParam(function, value);
@@ -848,6 +3468,12 @@ asynStatus MCS2Axis::setDoubleParam(int function, double value) {
               "MCS2Axis::", axisNo_, value);
     this->stepsizer_ = value;
   }
+  else if (function == pC_->fineRange_) {
+    asynPrint(pC_->pasynUserController_, ASYN_TRACE_INFO,
+            "%ssetDoubleParam(%d) function=fineRange value=%f\n",
+              "MCS2Axis::", axisNo_, value);
+    this->fineRange_ = value;
+  }
   // Call the base class method
   status = asynMotorAxis::setDoubleParam(function, value);
   return status;
@@ -860,21 +3486,119 @@ static const iocshArg MCS2CreateControllerArg2 = {"Number of axes", iocshArgInt}
 static const iocshArg MCS2CreateControllerArg3 = {"Moving poll period (ms)", iocshArgInt};
 static const iocshArg MCS2CreateControllerArg4 = {"Idle poll period (ms)", iocshArgInt};
 static const iocshArg MCS2CreateControllerArg5 = {"Unused bit mask", iocshArgInt};
+static const iocshArg MCS2CreateControllerArg6 = {"Poll group name", iocshArgString};
 static const iocshArg * const MCS2CreateControllerArgs[] = {&MCS2CreateControllerArg0,
                                                             &MCS2CreateControllerArg1,
                                                             &MCS2CreateControllerArg2,
                                                             &MCS2CreateControllerArg3,
                                                             &MCS2CreateControllerArg4,
-                                                            &MCS2CreateControllerArg5};
-static const iocshFuncDef MCS2CreateControllerDef = {"MCS2CreateController", 6, MCS2CreateControllerArgs};
+                                                            &MCS2CreateControllerArg5,
+                                                            &MCS2CreateControllerArg6};
+static const iocshFuncDef MCS2CreateControllerDef = {"MCS2CreateController", 7, MCS2CreateControllerArgs};
 static void MCS2CreateContollerCallFunc(const iocshArgBuf *args)
 {
-  MCS2CreateController(args[0].sval, args[1].sval, args[2].ival, args[3].ival, args[4].ival, args[5].ival);
+  MCS2CreateController(args[0].sval, args[1].sval, args[2].ival, args[3].ival, args[4].ival, args[5].ival,
+                       args[6].sval);
+}
+
+static const iocshArg MCS2CreatePollGroupArg0 = {"Group name", iocshArgString};
+static const iocshArg MCS2CreatePollGroupArg1 = {"Moving poll period (ms)", iocshArgInt};
+static const iocshArg MCS2CreatePollGroupArg2 = {"Idle poll period (ms)", iocshArgInt};
+static const iocshArg * const MCS2CreatePollGroupArgs[] = {&MCS2CreatePollGroupArg0,
+                                                           &MCS2CreatePollGroupArg1,
+                                                           &MCS2CreatePollGroupArg2};
+static const iocshFuncDef MCS2CreatePollGroupDef = {"MCS2CreatePollGroup", 3, MCS2CreatePollGroupArgs};
+static void MCS2CreatePollGroupCallFunc(const iocshArgBuf *args)
+{
+  MCS2CreatePollGroup(args[0].sval, args[1].ival, args[2].ival);
+}
+
+static const iocshArg MCS2SetPollModeArg0 = {"Port name", iocshArgString};
+static const iocshArg MCS2SetPollModeArg1 = {"Poll mode (0=axis 1=batched)", iocshArgInt};
+static const iocshArg * const MCS2SetPollModeArgs[] = {&MCS2SetPollModeArg0,
+                                                       &MCS2SetPollModeArg1};
+static const iocshFuncDef MCS2SetPollModeDef = {"MCS2SetPollMode", 2, MCS2SetPollModeArgs};
+static void MCS2SetPollModeCallFunc(const iocshArgBuf *args)
+{
+  MCS2SetPollMode(args[0].sval, args[1].ival);
+}
+
+static const iocshArg MCS2SetPropertyRefreshPeriodArg0 = {"Port name", iocshArgString};
+static const iocshArg MCS2SetPropertyRefreshPeriodArg1 = {"Refresh period (s)", iocshArgDouble};
+static const iocshArg * const MCS2SetPropertyRefreshPeriodArgs[] = {&MCS2SetPropertyRefreshPeriodArg0,
+                                                                    &MCS2SetPropertyRefreshPeriodArg1};
+static const iocshFuncDef MCS2SetPropertyRefreshPeriodDef = {"MCS2SetPropertyRefreshPeriod", 2,
+                                                             MCS2SetPropertyRefreshPeriodArgs};
+static void MCS2SetPropertyRefreshPeriodCallFunc(const iocshArgBuf *args)
+{
+  MCS2SetPropertyRefreshPeriod(args[0].sval, args[1].dval);
+}
+
+static const iocshArg MCS2CreateProfileArg0 = {"Port name", iocshArgString};
+static const iocshArg MCS2CreateProfileArg1 = {"Max points", iocshArgInt};
+static const iocshArg MCS2CreateProfileArg2 = {"Stream rate (Hz)", iocshArgInt};
+static const iocshArg * const MCS2CreateProfileArgs[] = {&MCS2CreateProfileArg0,
+                                                         &MCS2CreateProfileArg1,
+                                                         &MCS2CreateProfileArg2};
+static const iocshFuncDef MCS2CreateProfileDef = {"MCS2CreateProfile", 3, MCS2CreateProfileArgs};
+static void MCS2CreateProfileCallFunc(const iocshArgBuf *args)
+{
+  MCS2CreateProfile(args[0].sval, args[1].ival, args[2].ival);
+}
+
+static const iocshArg MCS2SetPipelineDepthArg0 = {"Port name", iocshArgString};
+static const iocshArg MCS2SetPipelineDepthArg1 = {"Pipeline depth", iocshArgInt};
+static const iocshArg * const MCS2SetPipelineDepthArgs[] = {&MCS2SetPipelineDepthArg0,
+                                                            &MCS2SetPipelineDepthArg1};
+static const iocshFuncDef MCS2SetPipelineDepthDef = {"MCS2SetPipelineDepth", 2, MCS2SetPipelineDepthArgs};
+static void MCS2SetPipelineDepthCallFunc(const iocshArgBuf *args)
+{
+  MCS2SetPipelineDepth(args[0].sval, args[1].ival);
+}
+
+static const iocshArg MCS2SetAxisPriorityArg0 = {"Port name", iocshArgString};
+static const iocshArg MCS2SetAxisPriorityArg1 = {"Axis number", iocshArgInt};
+static const iocshArg MCS2SetAxisPriorityArg2 = {"Priority", iocshArgInt};
+static const iocshArg * const MCS2SetAxisPriorityArgs[] = {&MCS2SetAxisPriorityArg0,
+                                                           &MCS2SetAxisPriorityArg1,
+                                                           &MCS2SetAxisPriorityArg2};
+static const iocshFuncDef MCS2SetAxisPriorityDef = {"MCS2SetAxisPriority", 3, MCS2SetAxisPriorityArgs};
+static void MCS2SetAxisPriorityCallFunc(const iocshArgBuf *args)
+{
+  MCS2SetAxisPriority(args[0].sval, args[1].ival, args[2].ival);
+}
+
+static const iocshArg MCS2SetPredictivePollArg0 = {"Port name", iocshArgString};
+static const iocshArg MCS2SetPredictivePollArg1 = {"Predictive", iocshArgInt};
+static const iocshArg * const MCS2SetPredictivePollArgs[] = {&MCS2SetPredictivePollArg0,
+                                                             &MCS2SetPredictivePollArg1};
+static const iocshFuncDef MCS2SetPredictivePollDef = {"MCS2SetPredictivePoll", 2, MCS2SetPredictivePollArgs};
+static void MCS2SetPredictivePollCallFunc(const iocshArgBuf *args)
+{
+  MCS2SetPredictivePoll(args[0].sval, args[1].ival);
+}
+
+static const iocshArg MCS2SetFusedMovesArg0 = {"Port name", iocshArgString};
+static const iocshArg MCS2SetFusedMovesArg1 = {"Fast poll period (ms)", iocshArgInt};
+static const iocshArg * const MCS2SetFusedMovesArgs[] = {&MCS2SetFusedMovesArg0,
+                                                         &MCS2SetFusedMovesArg1};
+static const iocshFuncDef MCS2SetFusedMovesDef = {"MCS2SetFusedMoves", 2, MCS2SetFusedMovesArgs};
+static void MCS2SetFusedMovesCallFunc(const iocshArgBuf *args)
+{
+  MCS2SetFusedMoves(args[0].sval, args[1].ival);
 }
 
 static void MCS2MotorRegister(void)
 {
   iocshRegister(&MCS2CreateControllerDef, MCS2CreateContollerCallFunc);
+  iocshRegister(&MCS2CreatePollGroupDef, MCS2CreatePollGroupCallFunc);
+  iocshRegister(&MCS2SetPollModeDef, MCS2SetPollModeCallFunc);
+  iocshRegister(&MCS2SetPropertyRefreshPeriodDef, MCS2SetPropertyRefreshPeriodCallFunc);
+  iocshRegister(&MCS2CreateProfileDef, MCS2CreateProfileCallFunc);
+  iocshRegister(&MCS2SetPipelineDepthDef, MCS2SetPipelineDepthCallFunc);
+  iocshRegister(&MCS2SetAxisPriorityDef, MCS2SetAxisPriorityCallFunc);
+  iocshRegister(&MCS2SetPredictivePollDef, MCS2SetPredictivePollCallFunc);
+  iocshRegister(&MCS2SetFusedMovesDef, MCS2SetFusedMovesCallFunc);
 }
 
 extern "C" {
@@ -23,9 +23,9 @@ Someone with more experience may have a better solution.
 Note on controller capability:
 The controller supports many more sophisticated features than are supported in this driver.
 The two that may be of significant interest are:
-  * TTL triggering at specified positions
+  * TTL triggering at specified positions (position compare, see MCS2Axis::applyTrigger())
   * "scan" mode where the piezo stick slip can flex up to 1.6micron to give
-     very precise and fast motion
+     very precise and fast motion (FINE_MODE, see MCS2Axis::fineMove())
 
 */
 
@@ -33,6 +33,16 @@ The two that may be of significant interest are:
 #include "asynMotorAxis.h"
 /* Need to find out, if we have asyn with support for 64 bit integers */
 #include "asynDriver.h"
+#include <epicsTime.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsTypes.h>
+#include "smarActTransport.h"
+#include "smarActIoStats.h"
+#include "smarActDeadband.h"
+#include "smarActPollScheduler.h"
+#include "smarActCapCache.h"
+#include "smarActProtocol.h"
 
 #ifndef VERSION_INT
 #define VERSION_INT(V, R, M, P) (((V) << 24) | ((R) << 16) | ((M) << 8) | (P))
@@ -88,6 +98,95 @@ const unsigned short   STOP_ON_REF_FOUND       = 0x0020;
 /** MCS2 Axis constants **/
 #define HOLD_FOREVER 0xffffffff
 #define MAX_FREQUENCY 20000
+/* Move mode of open loop moves, and the most steps one :MOVE takes in it */
+#define MOVE_MODE_STEP 4
+#define MAX_STEPS_PER_MOVE 100000
+/* Scan mode: the piezo is flexed without steps, :MOVE adds to the scan value 0..MCS2_SCAN_RANGE */
+#define MOVE_MODE_SCAN_RELATIVE 3
+#define MCS2_SCAN_RANGE 65535
+/* Default travel of the full scan range, in nm (udeg) */
+#define MCS2_FINE_RANGE 1600.0
+
+/** MCS2 channel output trigger modes */
+#define TRIG_MODE_CONSTANT         0
+#define TRIG_MODE_POSITION_COMPARE 1
+
+/** MCS2 position compare directions */
+#define POS_COMP_DIRECTION_FORWARD  0
+#define POS_COMP_DIRECTION_BACKWARD 1
+
+/** MCS2 controller poll modes */
+#define MCS2_POLL_MODE_AXIS    0 /**< every axis queries its own values (default) */
+#define MCS2_POLL_MODE_BATCHED 1 /**< one chained SCPI query per cycle for all axes */
+
+/** Values read in a poll cycle, index into MCS2Axis::batchedReply_ */
+#define MCS2_POLL_STAT       0
+#define MCS2_POLL_POS        1
+#define MCS2_POLL_POS_TARG   2
+#define MCS2_POLL_PTYP       3
+#define MCS2_POLL_MCLF       4
+#define MCS2_POLL_NUM_FIELDS 5
+
+/* Default time in seconds after which cached axis properties are read again */
+#define MCS2_PROPERTY_REFRESH_PERIOD 30.0
+
+/* Link to the controller: after a failed exchange that a probe (:DEV:SNUM?)
+ * doesn't get an answer to either, nothing is sent to the controller but
+ * probes, the first one after MCS2_LINK_BACKOFF_MIN s, doubling up to
+ * MCS2_LINK_BACKOFF_MAX s */
+#define MCS2_LINK_PROBE_TIMEOUT 0.3
+#define MCS2_LINK_BACKOFF_MIN   0.5
+#define MCS2_LINK_BACKOFF_MAX  30.0
+
+/* Fused moves: for up to this many seconds after a move the axis is polled
+ * at the fast poll period, see MCS2SetFusedMoves */
+#define MCS2_FAST_POLL_TIME 0.5
+
+/* Number of position samples kept per axis by the capture thread */
+#define MCS2_CAPTURE_SIZE 8192
+
+/* Samples the producer may add while a snapshot is copied, never reported */
+#define MCS2_CAPTURE_GUARD 256
+
+/* Shortest capture period in s, CAPT_RATE 0 or above 1/MCS2_CAPTURE_MIN_PERIOD
+ * samples at this period. The capture thread also waits at least as long as its
+ * last query took, so the poller always gets half of the link. */
+#define MCS2_CAPTURE_MIN_PERIOD 0.002
+
+/* Default rate of the trajectory stream frames in Hz */
+#define MCS2_STREAM_RATE 100
+
+/* Seconds of stream frames that are sent ahead of the trajectory */
+#define MCS2_STREAM_LEAD 0.2
+
+/* Upper limit for the number of stream frames of one profile */
+#define MCS2_PROFILE_MAX_FRAMES 200000
+
+/* Time in seconds to reach the start of a profile, or to stop after its end */
+#define MCS2_PROFILE_MOVE_TIMEOUT 60.0
+
+/* Samples of one waveform, see MCS2Axis::loadWave() */
+#define MCS2_WAVE_SIZE 16384
+
+/** MCS2 waveform stream states, WAVE_STATE */
+#define MCS2_WAVE_IDLE      0
+#define MCS2_WAVE_MOVE      1 /**< moving to the first sample */
+#define MCS2_WAVE_STREAMING 2
+
+/* Large enough for all fields of all channels of a fully equipped MCS2 */
+#define MCS2_POLL_STRING_SIZE 2048
+
+/* Number of commands a batched poll may be split into */
+#define MCS2_POLL_CHUNKS 4
+
+/* Shortest time between two position samples the velocity estimate takes, s */
+#define MCS2_VEL_EST_MIN_DT 0.001
+
+/* Controller errors: :SYST:ERR? queries chained into one exchange when the
+ * error queue is drained, and the number of errors ERR_LOG keeps */
+#define MCS2_ERROR_CHUNK     16
+#define MCS2_ERROR_LOG_SIZE  16
+#define MCS2_ERROR_TEXT_SIZE 48
 
 /** drvInfo strings for extra parameters that the MCS2 controller supports */
 #define MCS2MclfString "MCLF"
@@ -105,6 +204,88 @@ const unsigned short   STOP_ON_REF_FOUND       = 0x0020;
 #define MCS2STEPSIZEFString "STEPSIZEF"
 #define MCS2STEPSIZERString "STEPSIZER"
 #define MCS2HoldString "HOLD"
+#define MCS2TrigModeString "TRIG_MODE"
+#define MCS2TrigStartString "TRIG_START"
+#define MCS2TrigStopString "TRIG_STOP"
+#define MCS2TrigIncrString "TRIG_INCR"
+#define MCS2TrigPulseWidthString "TRIG_PWID"
+#define MCS2TrigPolarityString "TRIG_POL"
+#define MCS2CaptEnableString "CAPT_ENABLE"
+#define MCS2CaptRateString "CAPT_RATE"
+#define MCS2CaptRateRbString "CAPT_RATE_RB"
+#define MCS2CaptClearString "CAPT_CLEAR"
+#define MCS2CaptNumString "CAPT_NUM"
+#define MCS2CaptPosString "CAPT_POS"
+#define MCS2CaptIPosString "CAPT_IPOS"
+#define MCS2CaptTimeString "CAPT_TIME"
+#define MCS2FineModeString "FINE_MODE"
+#define MCS2FineRangeString "FINE_RANGE"
+#define MCS2FineActiveString "FINE_ACTIVE"
+#define MCS2WavePosString "WAVE_POS"
+#define MCS2WaveUseString "WAVE_USE"
+#define MCS2WaveRateString "WAVE_RATE"
+#define MCS2WaveCyclesString "WAVE_CYCLES"
+#define MCS2WaveRelativeString "WAVE_RELATIVE"
+#define MCS2WaveStartString "WAVE_START"
+#define MCS2WaveStateString "WAVE_STATE"
+#define MCS2WaveUnderrunsString "WAVE_UNDERRUNS"
+#define MCS2StopAllString "STOP_ALL"
+#define MCS2ErrorLogString "ERR_LOG"
+#define MCS2ErrorCountString "ERR_COUNT"
+#define MCS2VelEstString "VEL_EST"
+#define MCS2VelEstEnableString "VEL_EST_ENABLE"
+
+typedef SmarActCommand<SmarActMCS2Protocol> MCS2Command;
+
+/** An error drained from the controller error queue, see MCS2Controller::clearErrors() */
+typedef struct {
+  epicsTimeStamp time;
+  int code;
+  char text[MCS2_ERROR_TEXT_SIZE];
+} MCS2Error;
+
+/** Position samples of one axis, written by the capture thread only (single producer)
+ *  and read under the controller lock (single consumer). No lock is shared between them:
+ *  the producer publishes a sample by incrementing head with epicsAtomic. */
+typedef struct {
+  PositionType pos[MCS2_CAPTURE_SIZE];  /**< pm (lin) or ndeg (rot) */
+  double time[MCS2_CAPTURE_SIZE];       /**< seconds since the capture thread started */
+  size_t head;                          /**< total number of samples written */
+} MCS2CaptureRing;
+
+class MCS2Controller;
+
+/* Controllers in one poll group */
+#define MCS2_POLL_GROUP_SIZE 16
+
+/** One poller thread for several controllers, see MCS2CreatePollGroup.
+  * A cycle starts the polls of all controllers before it reads the replies
+  * of the first one, so the round trips to the controllers overlap.
+  */
+class MCS2PollGroup {
+public:
+  MCS2PollGroup(const char *name, double movingPollPeriod, double idlePollPeriod);
+  static MCS2PollGroup *find(const char *name);
+  int add(MCS2Controller *pC);
+  void wakeup();
+  void shutdown();
+  void pollerThread();
+  const char *name() const { return name_; }
+  double movingPollPeriod() const { return movingPollPeriod_; }
+  double idlePollPeriod() const { return idlePollPeriod_; }
+
+private:
+  char name_[64];
+  double movingPollPeriod_;
+  double idlePollPeriod_;
+  MCS2Controller *members_[MCS2_POLL_GROUP_SIZE];
+  int numMembers_;
+  epicsMutexId lock_;    /**< protects members_ and numMembers_ */
+  epicsEventId event_;
+  int shuttingDown_;     /**< set by shutdown(), accessed with epicsAtomic */
+  MCS2PollGroup *next_;
+  static MCS2PollGroup *first_;
+};
 
 class epicsShareClass MCS2Axis : public asynMotorAxis
 {
@@ -133,7 +314,80 @@ private:
   int openLoop_;
   double stepsizef_;
   double stepsizer_;
+  unsigned batchedQueried_; /**< bit n set: field n is part of the batched query */
+  unsigned batchedMask_;    /**< bit n set: batchedReply_[n] is valid for this poll cycle */
+  int batchedChunk_;        /**< command of the batched poll the queries are in */
+  const char *batchedReply_[MCS2_POLL_NUM_FIELDS];
+  epicsTimeStamp replyStamp_;   /**< midpoint of the exchange the last pollReply() came from */
+  epicsTimeStamp sampleStamp_;  /**< of the last position readback */
+  int stampPending_;            /**< the readbacks set since the last callbacks carry sampleStamp_ */
+  PositionType lastSample_;     /**< position and time of the sample the velocity estimate starts from */
+  epicsTimeStamp lastSampleStamp_;
+  int haveSample_;
+  int velEstEnable_;
+  const char *lastErrTxt_;       /**< errTxt_ set last, one of the texts of poll() */
+  int lastDone_;
+  /* Properties that only change when written through this driver,
+   * read in initialPoll() and refreshed at propertyRefreshPeriod_ */
+  int propsValid_;
+  int cachedPtyp_;
+  int cachedMclf_;
+  int cachedHold_;
+  int holdValid_;           /**< cachedHold_ is what the controller has, :HOLD is only written when it differs */
+  epicsTimeStamp propsTime_;
+  int capsLoaded_;          /**< the capability cache was consulted, it is only used for the first connect */
+  int propertiesStale(void);
+  asynStatus refreshProperties(void);
+  /* Capture of position samples, see MCS2Controller::captureThread() */
+  int captureEnabled_;       /**< accessed with epicsAtomic */
+  int captureRate_;          /**< requested rate in Hz, accessed with epicsAtomic */
+  size_t captureTail_;       /**< first sample that is reported, consumer side */
+  size_t capturePublished_;  /**< head at the last waveform callback, consumer side */
+  int captureQueried_;       /**< capture thread only: part of the current capture query */
+  MCS2CaptureRing *captureRing_;
+  size_t captureSnapshot(epicsFloat64 *pPos, PositionType *pIPos, epicsFloat64 *pTime, size_t maxSamples);
+  /* ACC and VEL last sent to the controller, see speedsString() */
+  int speedsValid_;
+  double lastAccSent_;
+  double lastVelSent_;
+  size_t speedsString(char *buf, size_t maxChars, double acceleration, double velocity);
+  /* MMOD and STEP:FREQ last sent to the controller, see stepModeString() */
+  int lastMmodSent_;         /**< -1: unknown, sent again with the next move */
+  unsigned lastStepFreqSent_;
+  size_t stepModeString(char *buf, size_t maxChars, unsigned frequency);
+  /* Open loop moves longer than MAX_STEPS_PER_MOVE are sent in chunks, the poll
+   * that sees a chunk done sends the next one */
+  PositionType stepsQueued_;  /**< steps not sent yet */
+  asynStatus moveNextChunk(void);
+  /* Fine moves in scan mode, see fineMove() */
+  int fineMode_;             /**< small closed loop moves flex the piezo */
+  double fineRange_;         /**< travel of the full scan range in nm (udeg) */
+  int fineActive_;           /**< the last move was a fine move, the position is the encoder position */
+  int fineScan_;             /**< estimated scan value, MCS2_SCAN_RANGE/2 after a normal move */
+  double lastScanVelSent_;   /**< SCAN:VEL last sent, valid while lastMmodSent_ is */
+  int fineMove(double position, int relative, double velocity, asynStatus *pStatus);
+  /* Profile move, see MCS2Controller::runProfile() */
+  int profileUsed_;          /**< axis takes part in the current profile or waveform */
+  PositionType profileOffset_;  /**< pm added to all frames, for relative profiles */
+  int profileCaptureWasEnabled_;
+  size_t streamMoveString(char *buf, size_t maxChars, PositionType position);
+  /* Waveform stream, see MCS2Controller::runWave(). The stream plays wave_[waveActive_],
+   * a new waveform is written to the other buffer and replaces it at the end of a period */
+  PositionType *wave_[2];    /**< pm (lin) or ndeg (rot) */
+  size_t waveLen_[2];
+  int waveActive_;
+  int wavePending_;          /**< the other buffer holds a new waveform */
+  size_t wavePhase_;         /**< next sample of the active buffer */
+  int waveUse_;
+  asynStatus loadWave(const epicsFloat64 *value, size_t nElements);
+  PositionType nextWaveFrame(void);
+  asynStatus sendMove(const char *moveString);
+  void setStatusParams(int chanState);
+  void setEncoderParams(PositionType encoderCounts, const epicsTimeStamp *pStamp, int done);
+  void callStampedCallbacks(void);
+  asynStatus applyTrigger(int trigMode);
   asynStatus initialPoll(void);
+  asynStatus pollReply(int field, const char **pReply);
   asynStatus reportHelperCheckError(const char *scpi_leaf, char *input, size_t maxChars);
 #define REPORTHELPERCHECKERROR(a,b) reportHelperCheckError(a,b,sizeof(b))
   asynStatus reportHelperInteger(const char *scpi_leaf, int *pResult);
@@ -144,18 +398,123 @@ friend class MCS2Controller;
 
 class epicsShareClass MCS2Controller : public asynMotorController {
 public:
-  MCS2Controller(const char *portName, const char *MCS2PortName, int numAxes, double movingPollPeriod, double idlePollPeriod, int unusedMask = 0);
+  MCS2Controller(const char *portName, const char *MCS2PortName, int numAxes, double movingPollPeriod, double idlePollPeriod,
+                 int unusedMask = 0, const char *pollGroup = 0);
   void handleStatusChange(asynStatus status);
   asynStatus writeReadHandleDisconnect(void);
+  asynStatus probeLink(void);
+  int linkDown() const { return linkDown_; }
   virtual asynStatus clearErrors();
 
   /* These are the methods that we override from asynMotorDriver */
   void report(FILE *fp, int level);
   MCS2Axis* getAxis(asynUser *pasynUser);
   MCS2Axis* getAxis(int axisNo);
+  asynStatus poll();
+  void startPoll();
+  asynStatus finishPoll();
+  asynStatus wakeupPoller();
+  asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements, size_t *nIn);
+  asynStatus writeFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements);
+#ifdef SMARACT_ASYN_ASYNPARAMINT64
+  asynStatus readInt64Array(asynUser *pasynUser, epicsInt64 *value, size_t nElements, size_t *nIn);
+#endif
+  void captureThread();
+  asynStatus setDeferredMoves(bool deferMoves);
+
+  /* These are the methods for profile moves */
+  asynStatus initializeProfile(size_t maxPoints);
+  asynStatus buildProfile();
+  asynStatus executeProfile();
+  asynStatus abortProfile();
+  asynStatus readbackProfile();
+  void profileThread();
+  void startProfileThread();
+  void setStreamRate(int streamRate);
+
+  /* Waveform stream, see runWave() */
+  asynStatus startWave(int addr);
+  void stopWave(int abort);
+
+  void setPollMode(int pollMode);
+  void setPropertyRefreshPeriod(double period);
+  void setPipelineDepth(int depth);
+  void setAxisPriority(int axis, int priority);
+  void setPredictivePoll(int predictive);
+  void setFusedMoves(double fastPollPeriod);
+
+  /* Time every exchange with the controller */
+  using asynMotorController::writeController;
+  using asynMotorController::writeReadController;
+  asynStatus writeController(const char *output, double timeout);
+  asynStatus writeReadController(const char *output, char *response, size_t maxResponseLen, size_t *responseLen, double timeout);
+  asynStatus writeReadReleased(const char *output, char *response, size_t maxResponseLen, size_t *responseLen, double timeout);
 
 protected:
   asynStatus oldStatus_;
+  int linkDown_;            /**< only probes are sent, see MCS2_LINK_BACKOFF_MIN; accessed with epicsAtomic */
+  int linkProbing_;         /**< the exchange is a probe, it is sent while the link is down */
+  double linkBackoff_;      /**< time between two probes */
+  epicsTimeStamp linkRetry_; /**< time of the next probe */
+  unsigned long linkDrops_;
+  int pollMode_;
+  double fastPollPeriod_;   /**< 0: moves are only written, else see MCS2Axis::sendMove() */
+  double propertyRefreshPeriod_;
+  char serial_[SMARACT_CAP_KEY_SIZE]; /**< :DEV:SNUM?, the key of the capability cache */
+  char pollOutString_[MCS2_POLL_CHUNKS][MCS2_POLL_STRING_SIZE];
+  char pollInString_[MCS2_POLL_CHUNKS][MCS2_POLL_STRING_SIZE];
+  SmarActTransport *transport_;
+  SmarActRequest pollRequests_[MCS2_POLL_CHUNKS];
+  int pollNumQueries_[MCS2_POLL_CHUNKS];
+  epicsTimeStamp pollStamp_[MCS2_POLL_CHUNKS];  /**< midpoints of the exchanges of the chunks */
+  int pollNumChunks_;
+  MCS2PollGroup *pollGroup_; /**< polled by the thread of this group, NULL: by its own poller */
+  SmarActIoStats ioStats_;
+  SmarActDeadbands deadbands_;
+  SmarActPollScheduler *scheduler_;
+  asynStatus batchedPoll(void);
+  void startBatchedPoll(void);
+  asynStatus finishBatchedPoll(void);
+  asynStatus writeMove(const char *moveString);
+  asynStatus writeStop(const char *stopString);
+  asynStatus stopAll(void);
+  void logError(int code, const char *text);
+  void publishErrors(void);
+  MCS2Error errorLog_[MCS2_ERROR_LOG_SIZE]; /**< ring of the last errors, numErrors_ is the head */
+  unsigned long numErrors_;      /**< drained from the error queue since the start */
+  void forgetSpeeds(void);
+  char deferredString_[MCS2_POLL_STRING_SIZE];  /**< moves queued while movesDeferred_ is set */
+  size_t deferredLen_;
+  void publishCapture(void);
+  asynUser *pasynUserCapture_;   /**< separate asynUser, the capture thread does not use the controller lock */
+  asynUser *pasynUserPoll_;      /**< separate asynUser of the poller while it has released the lock */
+  epicsEventId captureEvent_;
+  epicsTimeStamp captureStartTime_;
+  double captureRateRb_;         /**< written by the capture thread only */
+  epicsFloat64 *captureScratchF_;
+  PositionType *captureScratchI_;
+#ifdef SMARACT_ASYN_ASYNPARAMINT64
+  epicsInt64 *captureScratchI64_;
+#endif
+  int streamRate_;               /**< stream frames per second */
+  epicsEventId profileEvent_;
+  epicsThreadId profileThreadId_; /**< NULL until a profile or waveform needs the thread */
+  int profileAbortRequest_;      /**< accessed with epicsAtomic */
+  PositionType *profileFrames_;  /**< pm, numAxes_ positions per frame */
+  size_t profileNumFrames_;
+  double *profilePointTimes_;    /**< time of each profile point in s, relative to the first */
+  double profileStartTime_;      /**< capture time of the first frame */
+  double profileEndTime_;        /**< capture time the axes stopped after the last frame */
+  int waveRequest_;              /**< the next run of the profile thread is a waveform */
+  int waveRunning_;              /**< sendProfileFrames() sends waveform samples */
+  int waveAddr_;                 /**< address the waveform parameters are read from */
+  int waveStopRequest_;          /**< 1: end after the samples sent, 2: abort; accessed with epicsAtomic */
+  int waveUnderruns_;
+  asynStatus runProfile(void);
+  asynStatus runWave(void);
+  asynStatus sendProfileFrames(size_t first, size_t num);
+  asynStatus waitProfileMotion(double timeout);
+  void abortStream(int streamOpen);
   int mclf_; /**< MCL frequency */
 #define FIRST_MCS2_PARAM mclf_
   int ptyp_; /**< positioner type */
@@ -172,10 +531,41 @@ protected:
   int stepsizef_; /** size of an open loop step, forward, in pm */
   int stepsizer_; /** size of an open loop step, reverse==backward, in pm */
   int hold_; /** hold time */
+  int trigMode_; /** output trigger mode, writing it applies the trigger settings */
+  int trigStart_; /** position of the first trigger pulse in pm */
+  int trigStop_; /** no pulses beyond this position, in pm */
+  int trigIncr_; /** distance between trigger pulses in pm */
+  int trigPwid_; /** trigger pulse width in ns */
+  int trigPol_; /** trigger polarity, 0=active low 1=active high */
+  int captEnable_; /** sample the position in the capture thread */
+  int captRate_; /** requested capture rate in Hz */
+  int captRateRb_; /** achieved capture rate in Hz */
+  int captClear_; /** forget the samples captured so far */
+  int captNum_; /** number of valid samples in the capture waveforms */
+  int captPos_; /** captured positions in nm (lin) or udeg (rot) */
+  int captIPos_; /** captured positions in pm (lin) or ndeg (rot) */
+  int captTime_; /** time of the captured samples in s, relative to the newest one */
+  int fineMode_; /** 1: small moves in scan mode */
+  int fineRange_; /** travel of the full scan range in nm (udeg) */
+  int fineActive_; /** the last move was done in scan mode */
+  int wavePos_; /** waveform setpoints in nm (lin) or udeg (rot) */
+  int waveUse_; /** the axis plays its waveform */
+  int waveRate_; /** samples per second */
+  int waveCycles_; /** periods of the longest waveform to play, 0: until stopped */
+  int waveRelative_; /** the setpoints are relative to the position at the start */
+  int waveStart_; /** 1: start the waveform stream, 0: stop it */
+  int waveState_; /** MCS2_WAVE_IDLE, MCS2_WAVE_MOVE or MCS2_WAVE_STREAMING */
+  int waveUnderrunsRb_; /** samples that were sent too late */
+  int stopAll_; /** stop all axes with one write */
+  int errLog_; /** the last MCS2_ERROR_LOG_SIZE controller errors, newest first */
+  int errCount_; /** controller errors since the start */
+  int velEst_; /** velocity from consecutive position readbacks, pm/s or ndeg/s */
+  int velEstEnable_; /** compute velEst_ */
 
-#define LAST_MCS2_PARAM hold_
+#define LAST_MCS2_PARAM velEstEnable_
 #define NUM_MCS2_PARAMS (&LAST_MCS2_PARAM - &FIRST_MCS2_PARAM + 1)
 
 friend class MCS2Axis;
+friend class MCS2PollGroup;
 };
 
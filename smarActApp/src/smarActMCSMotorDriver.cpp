@@ -11,6 +11,8 @@
 #include <asynMotorController.h>
 #include <asynMotorAxis.h>
 #include <smarActMCSMotorDriver.h>
+#include <smarActParse.h>
+#include <smarActCapCache.h>
 #include <errlog.h>
 
 #include <string.h>
@@ -30,6 +32,15 @@
 #define REP_LEN 50
 #define DEFLT_TIMEOUT 2.0
 
+// Fast startup: timeouts of the telnet slurp and of the pipelined axis probe.
+// A GP to a rotary channel is not answered, so the probe always waits this once.
+#define SLURP_TIMEOUT_FAST 0.1
+#define PROBE_TIMEOUT      0.3
+
+// 'physical position known' only changes with a reference search or a power cycle;
+// re-read it at least this often (in s) in case it was changed by another client
+#define PPK_REFRESH_PERIOD 60.0
+
 #define HOLD_FOREVER 60000
 #define HOLD_NEVER       0
 #define FAR_AWAY     1000000000 /*nm*/
@@ -99,7 +110,8 @@ SmarActMCSException::SmarActMCSException(SmarActMCSExceptionType t, const char *
  * If the string cannot be parsed, i.e., is not in the format
  *  ':' , <string_of_upper_case_letters> , <number1> , ',' , <number2>
  *
- * then the routine returns '-1'.
+ * then the routine returns '-1 - <column>', where <column> is the
+ * offset of the first character that doesn't fit the format.
  *
  * Otherwise, if <string_of_upper_case_letters> starts with 'E'
  * (which means an 'Error' code) then the (always non-negative)
@@ -117,9 +129,14 @@ SmarActMCSException::SmarActMCSException(SmarActMCSExceptionType t, const char *
 int
 SmarActMCSController::parseReply(const char *reply, int *ax_p, int *val_p)
 {
-char cmd[10];
-  if ( 3 != sscanf(reply, ":%10[A-Z]%i,%i", cmd, ax_p, val_p) )
-    return -1;
+char        cmd[10];
+const char *p = reply;
+  if (    smarActParseChar(&p, ':')
+       || smarActParseUpper(&p, cmd, sizeof(cmd))
+       || smarActParseInt(&p, ax_p)
+       || smarActParseChar(&p, ',')
+       || smarActParseInt(&p, val_p) )
+    return -1 - (int)(p - reply);
   return 'E' == cmd[0] ? *val_p : 0;
 }
 
@@ -128,7 +145,8 @@ char cmd[10];
  * If the string cannot be parsed, i.e., is not in the format
  *  ':' , <string_of_upper_case_letters> , <number1> , ',' , <number2> , ',' , <number3>
  *
- * then the routine returns '-1'.
+ * then the routine returns '-1 - <column>', where <column> is the
+ * offset of the first character that doesn't fit the format.
  *
  * Otherwise, if <string_of_upper_case_letters> starts with 'E'
  * (which means an 'Error' code) then the (always non-negative)
@@ -146,22 +164,34 @@ char cmd[10];
 int
 SmarActMCSController::parseAngle(const char *reply, int *ax_p, int *val_p, int *rot_p)
 {
-char cmd[10];
-  if ( 4 != sscanf(reply, ":%10[A-Z]%i,%i,%i", cmd, ax_p, val_p, rot_p) )
-    return -1;
+char        cmd[10];
+const char *p = reply;
+  if (    smarActParseChar(&p, ':')
+       || smarActParseUpper(&p, cmd, sizeof(cmd))
+       || smarActParseInt(&p, ax_p)
+       || smarActParseChar(&p, ',')
+       || smarActParseInt(&p, val_p)
+       || smarActParseChar(&p, ',')
+       || smarActParseInt(&p, rot_p) )
+    return -1 - (int)(p - reply);
   // Will this ever get called? An error response fewer values than an angle response
   return 'E' == cmd[0] ? *val_p : 0;
 }
 
-SmarActMCSController::SmarActMCSController(const char *portName, const char *IOPortName, int numAxes, double movingPollPeriod, double idlePollPeriod, int disableSpeed)
+SmarActMCSController::SmarActMCSController(const char *portName, const char *IOPortName, int numAxes, double movingPollPeriod, double idlePollPeriod, int disableSpeed, int fastStartup)
   : asynMotorController(portName, numAxes,
-                        0, // parameters
-                        0, // interface mask
-                        0, // interrupt mask
+                        SMARACT_STATS_NUM_PARAMS + SMARACT_DEADBAND_NUM_PARAMS, // parameters
+                        asynOctetMask | asynFloat64ArrayMask, // interface mask
+                        asynOctetMask | asynFloat64ArrayMask, // interrupt mask
                         ASYN_CANBLOCK | ASYN_MULTIDEVICE,
                         1, // autoconnect
                         0,0) // default priority and stack size
   , asynUserMot_p_(0)
+  , asynUserPoll_p_(0)
+  , fastStartup_(fastStartup)
+  , pollMode_(SMARACT_POLL_SINGLE)
+  , transport_(0)
+  , pollRequests_(0)
 {
 asynStatus       status;
 char             junk[100];
@@ -182,7 +212,7 @@ if (disableSpeed_)
   // slurp away any initial telnet negotiation; there is no guarantee that
   // the other end will not send some telnet chars in the future. The terminal
   // server should really be configured to 'raw' mode!
-  pasynOctetSyncIO->read(asynUserMot_p_, junk, sizeof(junk), 2.0, &got_junk, &eomReason);
+  pasynOctetSyncIO->read(asynUserMot_p_, junk, sizeof(junk), fastStartup_ ? SLURP_TIMEOUT_FAST : 2.0, &got_junk, &eomReason);
   if ( got_junk ) {
     epicsPrintf("SmarActMCSController(%s): WARNING - detected unexpected characters on link (%s); make sure you have a RAW (not TELNET) connection\n", portName, IOPortName);
   }
@@ -190,6 +220,19 @@ if (disableSpeed_)
   pasynOctetSyncIO->setInputEos ( asynUserMot_p_, "\n", 1 );
   pasynOctetSyncIO->setOutputEos( asynUserMot_p_, "\n", 1 );
 
+  // The poller talks on a connection of its own while it doesn't hold the lock
+  if ( pasynOctetSyncIO->connect(IOPortName, 0, &asynUserPoll_p_, NULL) )
+    asynUserPoll_p_ = 0;
+
+  // Replies carry the channel, so the poll queries of all axes can be pipelined
+  transport_    = new SmarActTransport(IOPortName, 0, SmarActMatchChannel);
+  pollRequests_ = new SmarActRequest[numAxes * SMARACT_PREFETCH_SLOTS];
+  scheduler_    = new SmarActPollScheduler(numAxes, this);
+
+  ioStats_.createParams(this);
+  deadbands_.createParams(this, numAxes);
+  transport_->setStats(&ioStats_);
+
   // Create axes
 /*  for ( ax=0; ax<numAxes; ax++ ) {
     //axis_p = new SmarActMCSAxis(this, ax);
@@ -211,10 +254,18 @@ char       buf[CMD_LEN];
 size_t     nwrite;
 int        eomReason;
 asynStatus status;
+epicsTimeStamp start;
+int        released;
 
   epicsVsnprintf(buf, sizeof(buf), fmt, ap);
 
-  status = pasynOctetSyncIO->writeRead( asynUserMot_p_, buf, strlen(buf), rep, len, timeout, &nwrite, got_p, &eomReason);
+  // On the poll thread the lock is released while waiting, 'rep' is the caller's own
+  released = asynUserPoll_p_ && scheduler_->releaseLock();
+  epicsTimeGetCurrent(&start);
+  status = pasynOctetSyncIO->writeRead( released ? asynUserPoll_p_ : asynUserMot_p_, buf, strlen(buf), rep, len, timeout, &nwrite, got_p, &eomReason);
+  ioStats_.record(buf, &start, status);
+  if ( released )
+    scheduler_->reacquireLock();
 
   //asynPrint(c_p_->pasynUserSelf, ASYN_TRACEIO_DRIVER, "sendCmd()=%s", buf);
 
@@ -254,6 +305,107 @@ size_t     got;
   return status;
 }
 
+void
+SmarActMCSController::setPipelineDepth(int depth)
+{
+  transport_->setDepth(depth);
+}
+
+void
+SmarActMCSController::setPollMode(int mode)
+{
+int ax;
+
+  pollMode_ = SMARACT_POLL_CHAINED == mode ? SMARACT_POLL_CHAINED : SMARACT_POLL_SINGLE;
+  // Give chaining another try on the axes that had given it up
+  for ( ax = 0; ax < numAxes_; ax++ ) {
+    if ( pAxes_[ax] )
+      pAxes_[ax]->chainFailures_ = 0;
+  }
+}
+
+void
+SmarActMCSController::setAxisPriority(int axis, int priority)
+{
+  scheduler_->setPriority(axis, priority);
+}
+
+void
+SmarActMCSController::setPredictivePoll(int predictive)
+{
+  scheduler_->setPredictive(predictive);
+}
+
+/* Called by the poller before the axes are polled.
+ * With a pipeline depth > 1 the position, status and physical position known
+ * queries of all axes are sent back to back; the axes take the replies in
+ * getVal() and getAngle() instead of sending the queries one by one.
+ */
+asynStatus
+SmarActMCSController::poll()
+{
+int ax;
+int numRequests = 0;
+int done;
+int moving = 0;
+
+  ioStats_.publish();
+  deadbands_.publish();
+  for ( ax = 0; ax < numAxes_; ax++ ) {
+    if ( getAxis(ax) && !getIntegerParam(ax, motorStatusDone_, &done) && !done )
+      moving = 1;
+  }
+  ioStats_.pollCycle(moving, movingPollPeriod_, idlePollPeriod_);
+  scheduler_->plan(idlePollPeriod_);
+
+  for ( ax = 0; ax < numAxes_; ax++ ) {
+    SmarActMCSAxis *pAxis = static_cast<SmarActMCSAxis*>(getAxis(ax));
+    if ( !pAxis )
+      continue;
+    pAxis->prefetch_.clear();
+    if ( transport_->getDepth() <= 1 || !scheduler_->due(ax) )
+      continue;
+    if ( pAxis->getEncoder() &&
+         !pAxis->prefetch_.add(&pollRequests_[numRequests], pAxis->isRot_ ? ":GA%u" : ":GP%u", pAxis->channel_) )
+      numRequests++;
+    if ( !pAxis->prefetch_.add(&pollRequests_[numRequests], ":GS%u", pAxis->channel_) )
+      numRequests++;
+    if ( pAxis->ppkStale() &&
+         !pAxis->prefetch_.add(&pollRequests_[numRequests], ":GPPK%u", pAxis->channel_) )
+      numRequests++;
+  }
+  if ( numRequests ) {
+    int released;
+    // The replies go to the prefetch slots, the axes don't hand them out before they are all in
+    for ( ax = 0; ax < numAxes_; ax++ ) {
+      if ( pAxes_[ax] )
+        pAxes_[ax]->prefetch_.setBusy(1);
+    }
+    released = scheduler_->releaseLock();
+    transport_->transact(pollRequests_, numRequests, DEFLT_TIMEOUT);
+    if ( released )
+      scheduler_->reacquireLock();
+    for ( ax = 0; ax < numAxes_; ax++ ) {
+      if ( pAxes_[ax] )
+        pAxes_[ax]->prefetch_.setBusy(0);
+    }
+  }
+  // Errors are reported by the axes, which send the queries themselves then
+  return asynSuccess;
+}
+
+void
+SmarActMCSController::report(FILE *fp, int level)
+{
+  fprintf(fp, "smarAct MCS motor driver %s, numAxes=%d\n", portName, numAxes_);
+  transport_->report(fp, level);
+  ioStats_.report(fp, level);
+  deadbands_.report(fp, level);
+  scheduler_->report(fp, level);
+  SmarActCapCache::report(fp);
+  asynMotorController::report(fp, level);
+}
+
 /* Obtain value of the 'motorClosedLoop_' parameter (which
  * maps to the record's CNEN field)
  */
@@ -274,15 +426,61 @@ int SmarActMCSAxis::getEncoder()
   return val;
 }
 
-SmarActMCSAxis::SmarActMCSAxis(class SmarActMCSController *cnt_p, int axis, int channel)
-  : asynMotorAxis(cnt_p, axis), c_p_(cnt_p)
+/* Fast startup: send all queries of the constructor back to back and read their
+ * replies with a short timeout; the getters then take the replies from prefetch_.
+ * With a declared type the sensor and rotary detection is skipped.
+ */
+void
+SmarActMCSAxis::probe(int type)
+{
+SmarActRequest requests[SMARACT_PREFETCH_SLOTS];
+int            n = 0;
+int            depth;
+
+  prefetch_.clear();
+  if ( !c_p_->disableSpeed_ && !prefetch_.add(&requests[n], ":GCLS%u", channel_) )
+    n++;
+  if ( !prefetch_.add(&requests[n], ":GS%u", channel_) )
+    n++;
+  if ( SMARACT_AXIS_PROBE == type ) {
+    if ( !prefetch_.add(&requests[n], ":GP%u", channel_) )
+      n++;
+    if ( !prefetch_.add(&requests[n], ":GST%u", channel_) )
+      n++;
+    if ( !prefetch_.add(&requests[n], ":GA%u", channel_) )
+      n++;
+  }
+  depth = c_p_->transport_->getDepth();
+  c_p_->transport_->setDepth(n);
+  c_p_->transport_->transact(requests, n, PROBE_TIMEOUT);
+  c_p_->transport_->setDepth(depth);
+}
+
+SmarActMCSAxis::SmarActMCSAxis(class SmarActMCSController *cnt_p, int axis, int channel, int type)
+  : asynMotorAxis(cnt_p, axis), c_p_(cnt_p), chainFailures_(0), ppk_(0), ppkValid_(0), wasMoving_(false)
 {
   int val;
-  int angle;
-  int rev;
+  SmarActCaps caps;
   channel_ = channel;
   stepCount_ = 0; // initialize open loop step count to 0. Does it need to be restored from auto save?
+  sensorType_ = -1;
+  verifyCaps_ = 0;
   asynPrint(c_p_->pasynUserSelf, ASYN_TRACEIO_DRIVER, "SmarActMCSAxis::SmarActMCSAxis -- creating axis %u\n", axis);
+  if ( SMARACT_AXIS_PROBE == type && SmarActCapCache::lookup(c_p_->portName, channel_, &caps) ) {
+    // Nothing to ask the controller: the speed is sent with the first move,
+    // the holding state and the sensor type are checked by the first poll.
+    isRot_ = caps.rotary;
+    sensorType_ = caps.type;
+    setIntegerParam(c_p_->motorStatusHasEncoder_, caps.sensor);
+    setIntegerParam(c_p_->motorStatusGainSupport_, caps.sensor);
+    vel_ = -1;
+    holdTime_ = getClosedLoop() ? HOLD_FOREVER : 0;
+    verifyCaps_ = 1;
+    comStatus_ = asynSuccess;
+    goto bail;
+  }
+  if ( c_p_->fastStartup_ || SMARACT_AXIS_PROBE != type )
+    probe(type);
   if (c_p_->disableSpeed_)
     comStatus_ = asynSuccess;
   else
@@ -306,29 +504,21 @@ SmarActMCSAxis::SmarActMCSAxis(class SmarActMCSController *cnt_p, int axis, int
     holdTime_ = getClosedLoop() ? HOLD_FOREVER : 0;
   }
 
-  // Attempt to check linear position, if we receive
-  // an error, we're a rotary motor.
-  isRot_ = 0;
-
-  if ( (comStatus_ = getVal("GP", &val)) ) {
-    isRot_ = 1;
-  }
-
-        // Query the sensor type
-  if ( (comStatus_ = getVal("GST", &sensorType_)) )
+  if ( SMARACT_AXIS_PROBE != type ) {
+    // declared in iocsh, nothing to detect
+    isRot_ = SMARACT_AXIS_ROTARY == type;
+    if ( SMARACT_AXIS_NO_SENSOR != type ) {
+      setIntegerParam(c_p_->motorStatusHasEncoder_, 1);
+      setIntegerParam(c_p_->motorStatusGainSupport_, 1);
+    }
     goto bail;
-
-  if (isRot_ == 1 && asynSuccess == getAngle(&angle, &rev) ) {
-    setIntegerParam(c_p_->motorStatusHasEncoder_, 1);
-    setIntegerParam(c_p_->motorStatusGainSupport_, 1);
-  }
-  else if (isRot_ == 0 &&  asynSuccess == getVal("GP",&val) ) {
-    setIntegerParam(c_p_->motorStatusHasEncoder_, 1);
-    setIntegerParam(c_p_->motorStatusGainSupport_, 1);
   }
 
+  comStatus_ = detect();
 
 bail:
+  // what the probe read ahead is not valid in the first poll cycle
+  prefetch_.clear();
   setIntegerParam(c_p_->motorStatusProblem_, comStatus_ ? 1 : 0 );
   setIntegerParam(c_p_->motorStatusCommsError_, comStatus_ ? 1 : 0 );
 
@@ -340,6 +530,70 @@ bail:
 
 }
 
+/* Find out whether the axis is rotary and has a sensor, and remember it in
+ * the capability cache.
+ */
+asynStatus
+SmarActMCSAxis::detect()
+{
+int         val;
+int         angle;
+int         rev;
+int         hasEncoder = 0;
+char        cmd[CMD_LEN];
+asynStatus  gpStatus;
+asynStatus  status;
+SmarActCaps caps;
+
+  // Attempt to check linear position, if we receive
+  // an error, we're a rotary motor. A GP the probe got no reply
+  // to is a rotary channel as well and is not sent again, it would
+  // only wait for the timeout once more; GA decides about the sensor.
+  epicsSnprintf(cmd, sizeof(cmd), ":GP%u", channel_);
+  gpStatus = prefetch_.failed(cmd) ? asynTimeout : getVal("GP", &val);
+  isRot_ = gpStatus ? 1 : 0;
+
+        // Query the sensor type
+  if ( (status = getVal("GST", &sensorType_)) )
+    return status;
+
+  if (isRot_ == 1 && asynSuccess == getAngle(&angle, &rev) )
+    hasEncoder = 1;
+  else if (isRot_ == 0 && asynSuccess == gpStatus )
+    hasEncoder = 1;
+  setIntegerParam(c_p_->motorStatusHasEncoder_, hasEncoder);
+  setIntegerParam(c_p_->motorStatusGainSupport_, hasEncoder);
+
+  caps.rotary = isRot_;
+  caps.type   = sensorType_;
+  caps.freq   = 0;
+  caps.sensor = hasEncoder;
+  SmarActCapCache::store(c_p_->portName, channel_, &caps);
+  return asynSuccess;
+}
+
+/* The capabilities came from the cache: check the sensor type, which
+ * changes when a different positioner is connected, and detect again if
+ * it doesn't match.
+ */
+asynStatus
+SmarActMCSAxis::verifyCaps()
+{
+int        val;
+asynStatus status;
+
+  if ( (status = getVal("GST", &val)) )
+    return status;
+  if ( val == sensorType_ )
+    return asynSuccess;
+  asynPrint(c_p_->pasynUserSelf, ASYN_TRACE_ERROR,
+            "SmarActMCSAxis::verifyCaps -- channel %u sensor type %d, cached %d: detecting again\n",
+            channel_, val, sensorType_);
+  // Only GPs the probe got no reply to stand for a rotary channel, not poll queries that timed out
+  prefetch_.clear();
+  return detect();
+}
+
 /* Read a parameter from the MCS (nothing to do with asyn's parameter
  * library).
  *
@@ -351,17 +605,27 @@ bail:
 asynStatus
 SmarActMCSAxis::getVal(const char *parm_cmd, int *val_p)
 {
+char       cmd[CMD_LEN];
 char       rep[REP_LEN];
 asynStatus st;
 int        ax;
+int        rc;
 
   //asynPrint(c_p_->pasynUserSelf, ASYN_TRACEIO_DRIVER, "getVal() cmd=:%s%u", parm_cmd, this->channel_);
 
   //st = c_p_->sendCmd(rep, sizeof(rep), ":%s%u", parm_cmd, this->axisNo_);
-  st = c_p_->sendCmd(rep, sizeof(rep), ":%s%u", parm_cmd, this->channel_);
-  if ( st )
-    return st;
-  return c_p_->parseReply(rep, &ax, val_p) ? asynError: asynSuccess;
+  epicsSnprintf(cmd, sizeof(cmd), ":%s%u", parm_cmd, this->channel_);
+  if ( !prefetch_.take(cmd, rep, sizeof(rep)) ) {
+    st = c_p_->sendCmd(rep, sizeof(rep), "%s", cmd);
+    if ( st )
+      return st;
+  }
+  if ( (rc = c_p_->parseReply(rep, &ax, val_p)) ) {
+    if ( rc < 0 )
+      asynPrint(c_p_->pasynUserSelf, ASYN_TRACE_ERROR, "getVal: malformed reply '%s' at column %d\n", rep, -1 - rc);
+    return asynError;
+  }
+  return asynSuccess;
 }
 
 /* Read the position of rotation stage
@@ -374,16 +638,100 @@ int        ax;
 asynStatus
 SmarActMCSAxis::getAngle(int *val_p, int *rev_p)
 {
+char       cmd[CMD_LEN];
 char       rep[REP_LEN];
 asynStatus st;
 int        ax;
+int        rc;
 
   //asynPrint(c_p_->pasynUserSelf, ASYN_TRACEIO_DRIVER, "getAngle() cmd=:%s%u", parm_cmd, this->channel_);
 
-  st = c_p_->sendCmd(rep, sizeof(rep), ":GA%u", this->channel_);
-  if ( st )
+  epicsSnprintf(cmd, sizeof(cmd), ":GA%u", this->channel_);
+  if ( !prefetch_.take(cmd, rep, sizeof(rep)) ) {
+    st = c_p_->sendCmd(rep, sizeof(rep), "%s", cmd);
+    if ( st )
+      return st;
+  }
+  if ( (rc = c_p_->parseAngle(rep, &ax, val_p, rev_p)) ) {
+    if ( rc < 0 )
+      asynPrint(c_p_->pasynUserSelf, ASYN_TRACE_ERROR, "getAngle: malformed reply '%s' at column %d\n", rep, -1 - rc);
+    return asynError;
+  }
+  return asynSuccess;
+}
+
+/* Return 1 if the 'physical position known' flag must be read in this poll cycle */
+int
+SmarActMCSAxis::ppkStale()
+{
+epicsTimeStamp now;
+
+  if ( !ppkValid_ )
+    return 1;
+  epicsTimeGetCurrent(&now);
+  return epicsTimeDiffInSeconds(&now, &ppkTime_) >= PPK_REFRESH_PERIOD;
+}
+
+/* Ask for the position, status and physical position known flag with
+ * one chained command ":GP0:GS0:GPPK0" and keep the replies, getVal() and
+ * getAngle() take them like replies the controller read ahead.
+ * If the replies can't be assigned, poll() sends the queries one by one: the
+ * lines after the first one are only waited for SMARACT_CHAIN_READ_TIMEOUT and
+ * an error reply ends the chain. After SMARACT_CHAIN_MAX_FAILURES of these in a
+ * row the axis no longer chains its queries.
+ */
+asynStatus
+SmarActMCSAxis::chainedPoll()
+{
+char       cmd[CMD_LEN];
+char       rep[SMARACT_PREFETCH_SLOTS * REP_LEN];
+size_t     got;
+size_t     more;
+int        eomReason;
+asynStatus st;
+
+  prefetch_.clear();
+  if ( getEncoder() )
+    prefetch_.queue(isRot_ ? ":GA%u" : ":GP%u", channel_);
+  prefetch_.queue(":GS%u", channel_);
+  if ( ppkStale() )
+    prefetch_.queue(":GPPK%u", channel_);
+  if ( !prefetch_.chain(cmd, sizeof(cmd)) ) {
+    prefetch_.clear();
+    return asynSuccess;
+  }
+  // The lock is kept until all the reply lines are in, nobody else may read them
+  c_p_->scheduler_->holdLock(1);
+  st = c_p_->sendCmd(&got, rep, sizeof(rep) - 1, DEFLT_TIMEOUT, "%s", cmd);
+  if ( st ) {
+    c_p_->scheduler_->holdLock(0);
+    prefetch_.clear();
     return st;
-  return c_p_->parseAngle(rep, &ax, val_p, rev_p) ? asynError: asynSuccess;
+  }
+  rep[got] = 0;
+  // The controller may send each reply on a line of its own
+  while ( SmarActPrefetch::numReplies(rep) < prefetch_.size() && !SmarActPrefetch::hasError(rep)
+          && got < sizeof(rep) - 1 ) {
+    if ( pasynOctetSyncIO->read(c_p_->asynUserMot_p_, &rep[got], sizeof(rep) - 1 - got,
+                                SMARACT_CHAIN_READ_TIMEOUT, &more, &eomReason) )
+      break;
+    got += more;
+    rep[got] = 0;
+  }
+  if ( SmarActPrefetch::hasError(rep) || !prefetch_.split(rep) ) {
+    // Lines that are still on their way must not be taken for replies to the single queries
+    pasynOctetSyncIO->flush(c_p_->asynUserMot_p_);
+    c_p_->scheduler_->holdLock(0);
+    prefetch_.clear();
+    if ( ++chainFailures_ >= SMARACT_CHAIN_MAX_FAILURES )
+      asynPrint(c_p_->pasynUserSelf, ASYN_TRACE_ERROR, "chainedPoll: axis %d polls with single queries, unexpected reply '%s' to '%s'\n", axisNo_, rep, cmd);
+    else
+      asynPrint(c_p_->pasynUserSelf, ASYN_TRACE_ERROR, "chainedPoll: unexpected reply '%s' to '%s'\n", rep, cmd);
+    return asynSuccess;
+  }
+  c_p_->scheduler_->holdLock(0);
+  chainFailures_ = 0;
+  return asynSuccess;
 }
 
 asynStatus
@@ -392,8 +740,27 @@ SmarActMCSAxis::poll(bool* moving_p)
   int                    val;
   int                    angle;
   int                    rev;
+  double                 pos;
   enum SmarActMCSStatus status;
 
+  if ( !c_p_->scheduler_->due(axisNo_) ) {
+    *moving_p = c_p_->scheduler_->skipped(axisNo_);
+    return asynSuccess;
+  }
+
+  // Capabilities from the cache are checked before the position is read with them
+  if ( 1 == verifyCaps_ ) {
+    if ((comStatus_ = verifyCaps()))
+      goto bail;
+    verifyCaps_ = 2;
+  }
+
+  // Replies the controller read ahead take precedence
+  if ( SMARACT_POLL_CHAINED == c_p_->pollMode_ && chainFailures_ < SMARACT_CHAIN_MAX_FAILURES && prefetch_.empty() ) {
+    if ((comStatus_ = chainedPoll()))
+      goto bail;
+  }
+
   if (getEncoder())
   {
     if (isRot_) {
@@ -410,8 +777,7 @@ SmarActMCSAxis::poll(bool* moving_p)
   else {
     val = stepCount_;
   }
-  setDoubleParam(c_p_->motorEncoderPosition_, (double)val);
-  setDoubleParam(c_p_->motorPosition_, (double)val);
+  pos = (double)val;
 #ifdef DEBUG
   printf("POLL (position %d)", val);
 #endif
@@ -421,6 +787,13 @@ SmarActMCSAxis::poll(bool* moving_p)
 
   status = (enum SmarActMCSStatus)val;
 
+  if ( verifyCaps_ ) {
+    // still holding from a previous life, see the constructor
+    if ( Holding == status )
+      holdTime_ = HOLD_FOREVER;
+    verifyCaps_ = 0;
+  }
+
   switch (status) {
   default:
     *moving_p = false;
@@ -445,22 +818,47 @@ SmarActMCSAxis::poll(bool* moving_p)
     break;
   }
 
+  // A move sent while the lock was released for this poll isn't in the replies yet
+  if ( c_p_->scheduler_->stale(axisNo_) )
+    *moving_p = true;
+
   setIntegerParam(c_p_->motorStatusDone_, !*moving_p);
+  // After done is known, the first position after a move passes the deadbands
+  if ( c_p_->deadbands_.pass(axisNo_, SmarActReadbackEnc, pos, !*moving_p) )
+    setDoubleParam(c_p_->motorEncoderPosition_, pos);
+  if ( c_p_->deadbands_.pass(axisNo_, SmarActReadbackPos, pos, !*moving_p) )
+    setDoubleParam(c_p_->motorPosition_, pos);
 
+  // A finished reference search (or any other move) may have changed it
+  if ( wasMoving_ && !*moving_p )
+    ppkValid_ = 0;
+  wasMoving_ = *moving_p;
 
   /* Check if the sensor 'knows' absolute position and
    * update the MSTA 'HOMED' bit.
    */
-  if ((comStatus_ = getVal("GPPK", &val)))
-    goto bail;
+  if ( ppkStale() ) {
+    if ((comStatus_ = getVal("GPPK", &val)))
+      goto bail;
+    ppk_      = val;
+    ppkValid_ = 1;
+    epicsTimeGetCurrent(&ppkTime_);
+  }
 
-  setIntegerParam(c_p_->motorStatusHomed_, val ? 1 : 0);
+  setIntegerParam(c_p_->motorStatusHomed_, ppk_ ? 1 : 0);
 
 #ifdef DEBUG
   printf(" status %u", status);
 #endif
 
 bail:
+  /* Replies that were read ahead are only valid for this poll cycle */
+  prefetch_.clear();
+  /* The controller may have been power cycled: re-send the speed with the next move */
+  if ( comStatus_ ) {
+    vel_      = -1;
+    ppkValid_ = 0;
+  }
   setIntegerParam(c_p_->motorStatusProblem_, comStatus_ ? 1 : 0);
   setIntegerParam(c_p_->motorStatusCommsError_, comStatus_ ? 1 : 0);
 #ifdef DEBUG
@@ -468,6 +866,7 @@ bail:
 #endif
 
   callParamCallbacks();
+  *moving_p = c_p_->scheduler_->polled(axisNo_, *moving_p);
 
   return comStatus_;
 }
@@ -481,6 +880,8 @@ size_t  got;
 double  tout = DEFLT_TIMEOUT;
 va_list ap;
 
+  // Read the axis in the next poll cycles, whatever priority it has
+  c_p_->scheduler_->kick(axisNo_);
   va_start(ap, fmt);
   comStatus_ = c_p_->sendCmd(&got, rep, sizeof(rep), tout, fmt, ap);
   va_end(ap);
@@ -501,6 +902,14 @@ bail:
   return comStatus_;
 }
 
+asynStatus
+SmarActMCSAxis::moveCmd(const SmarActMCSCommand &cmd)
+{
+  if ( !cmd.complete() )
+    return comStatus_ = asynError;
+  return moveCmd("%s", cmd.str());
+}
+
 asynStatus
 SmarActMCSAxis::setSpeed(double velocity)
 {
@@ -513,8 +922,11 @@ asynStatus status;
 
   if ( (vel = (long)rint(fabs(velocity))) != vel_ ) {
     /* change speed */
-    if ( asynSuccess == (status = moveCmd(":SCLS%u,%ld", channel_, vel)) ) {
+    if ( asynSuccess == (status = moveCmd(SmarActMCSCommand().add(SmarActCmdSetSpeed, channel_, vel))) ) {
       vel_ = vel;
+    } else {
+      /* unknown what the controller has now; send it again next time */
+      vel_ = -1;
     }
     return status;
   }
@@ -524,10 +936,10 @@ asynStatus status;
 asynStatus
 SmarActMCSAxis::move(double position, int relative, double min_vel, double max_vel, double accel)
 {
-  const char* fmt_rot = relative ? ":MAR%u,%ld,%d,%d" : ":MAA%u,%ld,%d,%d";
-  const char* fmt_lin = relative ? ":MPR%u,%ld,%d" : ":MPA%u,%ld,%d";
-  const char* fmt_step = ":MST%u,%ld,%d,%d"; // open loop move using step count, amplitude (0-4095; 0V-100V), frequency (1-18500 Hz)
-  const char* fmt;
+  SmarActCommandId cmd_rot = relative ? SmarActCmdMoveAngleRelative : SmarActCmdMoveAngleAbsolute;
+  SmarActCommandId cmd_lin = relative ? SmarActCmdMoveRelative : SmarActCmdMoveAbsolute;
+  SmarActCommandId cmd_step = SmarActCmdMoveSteps; // open loop move using step count, amplitude (0-4095; 0V-100V), frequency (1-18500 Hz)
+  SmarActCommandId cmd;
   const int MAX_FREQ = 18500; // max allowed frequency
   const int MAX_VOLTAGE = 100; // max voltage 100V
   const double STEP_PER_VOLT = 4095.0/MAX_VOLTAGE; // max voltage index, 4095=100V
@@ -540,10 +952,10 @@ SmarActMCSAxis::move(double position, int relative, double min_vel, double max_v
   if (getEncoder())
   {
     if (isRot_) {
-      fmt = fmt_rot;
+      cmd = cmd_rot;
     }
     else {
-      fmt = fmt_lin;
+      cmd = cmd_lin;
     }
 
 
@@ -562,15 +974,21 @@ SmarActMCSAxis::move(double position, int relative, double min_vel, double max_v
         angle += UDEG_PER_REV;
         rev -= 1;
       }
-      comStatus_ = moveCmd(fmt, channel_, angle, rev, holdTime_);
+      comStatus_ = moveCmd(SmarActMCSCommand().add(cmd, channel_, angle, rev, holdTime_));
     }
     else {
-      comStatus_ = moveCmd(fmt, channel_, (long)rpos, holdTime_);
+      comStatus_ = moveCmd(SmarActMCSCommand().add(cmd, channel_, rpos, holdTime_));
+    }
+    /* Without speed control (SCLS 0) the duration of the move is unknown */
+    if ( !comStatus_ && !c_p_->disableSpeed_ && vel_ > 0 ) {
+      double current = 0.0;
+      if ( relative || asynSuccess == c_p_->getDoubleParam(axisNo_, c_p_->motorPosition_, &current) )
+        c_p_->scheduler_->expect(axisNo_, SmarActPollScheduler::moveTime(rpos - current, (double)vel_, 0.0));
     }
   }
   else
   {
-    fmt = fmt_step;
+    cmd = cmd_step;
 
     rpos = rint(position);
     if (relative == 0 ) // absolute move
@@ -594,7 +1012,9 @@ SmarActMCSAxis::move(double position, int relative, double min_vel, double max_v
     printf("Open loop Step to %ld (piezo voltage %d ,frequency %d)\n", (long)rpos, amplitude, frequency);
 #endif
     // overload accel as frequency
-    comStatus_ = moveCmd(fmt, channel_, (long)rpos, amplitude, frequency);
+    comStatus_ = moveCmd(SmarActMCSCommand().add(cmd, channel_, rpos, amplitude, frequency));
+    if ( !comStatus_ )
+      c_p_->scheduler_->expect(axisNo_, fabs(rpos) / frequency);
   }
 bail:
   if (comStatus_) {
@@ -621,7 +1041,8 @@ SmarActMCSAxis::home(double min_vel, double max_vel, double accel, int forwards)
     /* cache 'closed-loop' setting until next move */
     holdTime_  = getClosedLoop() ? HOLD_FOREVER : 0;
 
-    comStatus_ = moveCmd(":FRM%u,%u,%d,%d", channel_, forwards ? 0 : 1, holdTime_, isRot_ ? 1 : 0);
+    ppkValid_  = 0;
+    comStatus_ = moveCmd(SmarActMCSCommand().add(SmarActCmdFindReference, channel_, forwards ? 0 : 1, holdTime_, isRot_ ? 1 : 0));
   }
   else
   {
@@ -641,10 +1062,23 @@ bail:
 asynStatus
 SmarActMCSAxis::stop(double acceleration)
 {
+char cmd[CMD_LEN];
+char rep[REP_LEN];
+int  val, ax;
+
 #ifdef DEBUG
   printf("Stop\n");
 #endif
-  comStatus_ = moveCmd(":S%u", channel_);
+  if ( !c_p_->transport_->isConnected() ) {
+    comStatus_ = moveCmd(SmarActMCSCommand().add(SmarActCmdStop, channel_));
+  } else {
+    // The express lane goes ahead of the poll queries the transport has queued
+    c_p_->scheduler_->kick(axisNo_);
+    SmarActMCSCommand::encode(cmd, sizeof(cmd), SmarActCmdStop, channel_);
+    comStatus_ = c_p_->transport_->express(cmd, rep, sizeof(rep), DEFLT_TIMEOUT);
+    if ( !comStatus_ && c_p_->parseReply(rep, &ax, &val) )
+      comStatus_ = asynError;
+  }
 
   if ( comStatus_ ) {
     setIntegerParam(c_p_->motorStatusProblem_, 1);
@@ -660,19 +1094,20 @@ SmarActMCSAxis::setPosition(double position)
   double rpos;
 
   rpos = rint(position);
+  ppkValid_ = 0;
   if (getEncoder()) {
     if (isRot_) {
       // For rotation stages the revolution will always be set to zero
       // Only set position if it is between zero an 360 degrees
       if (rpos >= 0.0 && rpos < (double)UDEG_PER_REV) {
-        comStatus_ = moveCmd(":SP%u,%d", channel_, (long)rpos);
+        comStatus_ = moveCmd(SmarActMCSCommand().add(SmarActCmdSetPosition, channel_, rpos));
       }
       else {
         comStatus_ = asynError;
       }
     }
     else {
-      comStatus_ = moveCmd(":SP%u,%d", channel_, (long)rpos);
+      comStatus_ = moveCmd(SmarActMCSCommand().add(SmarActCmdSetPosition, channel_, rpos));
     }
   }
   else
@@ -719,7 +1154,7 @@ SmarActMCSAxis::moveVelocity(double min_vel, double max_vel, double accel)
   if ( (comStatus_ = setSpeed(max_vel)) )
     goto bail;
 
-  comStatus_ = moveCmd(":MPR%u,%ld,0", channel_, tgt_pos);
+  comStatus_ = moveCmd(SmarActMCSCommand().add(SmarActCmdMoveRelative, channel_, tgt_pos, 0));
 
 bail:
   if ( comStatus_ ) {
@@ -737,8 +1172,9 @@ static const iocshArg cc_a2 = {"Number of axes [int]",             iocshArgInt};
 static const iocshArg cc_a3 = {"Moving poll period (s) [double]",  iocshArgDouble};
 static const iocshArg cc_a4 = {"Idle poll period (s) [double]",    iocshArgDouble};
 static const iocshArg cc_a5 = {"Disable speed cmds [int]",         iocshArgInt};
+static const iocshArg cc_a6 = {"Fast startup [int]",               iocshArgInt};
 
-static const iocshArg * const cc_as[] = {&cc_a0, &cc_a1, &cc_a2, &cc_a3, &cc_a4, &cc_a5};
+static const iocshArg * const cc_as[] = {&cc_a0, &cc_a1, &cc_a2, &cc_a3, &cc_a4, &cc_a5, &cc_a6};
 
 static const iocshFuncDef cc_def = {"smarActMCSCreateController", sizeof(cc_as)/sizeof(cc_as[0]), cc_as};
 
@@ -749,7 +1185,8 @@ smarActMCSCreateController(
   int         numAxes,
   double      movingPollPeriod,
   double      idlePollPeriod,
-  int     disableSpeed)
+  int     disableSpeed,
+  int     fastStartup)
 {
 void *rval = 0;
   // the asyn stuff doesn't seem to be prepared for exceptions. I get segfaults
@@ -758,7 +1195,7 @@ void *rval = 0;
 #ifdef ASYN_CANDO_EXCEPTIONS
   try {
 #endif
-    rval = new SmarActMCSController(motorPortName, ioPortName, numAxes, movingPollPeriod, idlePollPeriod, disableSpeed);
+    rval = new SmarActMCSController(motorPortName, ioPortName, numAxes, movingPollPeriod, idlePollPeriod, disableSpeed, fastStartup);
 #ifdef ASYN_CANDO_EXCEPTIONS
   } catch (SmarActMCSException &e) {
     epicsPrintf("smarActMCSCreateController failed (exception caught):\n%s\n", e.what());
@@ -777,25 +1214,28 @@ static void cc_fn(const iocshArgBuf *args)
     args[2].ival,
     args[3].dval,
     args[4].dval,
-    args[5].ival);
+    args[5].ival,
+    args[6].ival);
 }
 
 
 static const iocshArg ca_a0 = {"Controller Port name [string]",    iocshArgString};
 static const iocshArg ca_a1 = {"Axis number [int]",                iocshArgInt};
 static const iocshArg ca_a2 = {"Channel [int]",                    iocshArgInt};
+static const iocshArg ca_a3 = {"Axis type [int]",                  iocshArgInt};
 
-static const iocshArg * const ca_as[] = {&ca_a0, &ca_a1, &ca_a2};
+static const iocshArg * const ca_as[] = {&ca_a0, &ca_a1, &ca_a2, &ca_a3};
 
 /* iocsh wrapping and registration business (stolen from ACRMotorDriver.cpp) */
 /* smarActMCSCreateAxis called to create each axis of the smarActMCS controller*/
-static const iocshFuncDef ca_def = {"smarActMCSCreateAxis", 3, ca_as};
+static const iocshFuncDef ca_def = {"smarActMCSCreateAxis", 4, ca_as};
 
 extern "C" void *
 smarActMCSCreateAxis(
   const char *controllerPortName,
   int        axisNumber,
-  int        channel)
+  int        channel,
+  int        type)
 {
 void *rval = 0;
 
@@ -826,7 +1266,7 @@ asynMotorAxis *pAsynAxis;
       return rval;
     }
     pC->lock();
-    new SmarActMCSAxis(pC, axisNumber, channel);
+    new SmarActMCSAxis(pC, axisNumber, channel, type);
     pC->unlock();
 
 #ifdef ASYN_CANDO_EXCEPTIONS
@@ -842,15 +1282,155 @@ asynMotorAxis *pAsynAxis;
 static void ca_fn(const iocshArgBuf *args)
 {
   smarActMCSCreateAxis(
+    args[0].sval,
+    args[1].ival,
+    args[2].ival,
+    args[3].ival);
+}
+
+static const iocshArg pd_a0 = {"Controller Port name [string]",    iocshArgString};
+static const iocshArg pd_a1 = {"Pipeline depth [int]",             iocshArgInt};
+
+static const iocshArg * const pd_as[] = {&pd_a0, &pd_a1};
+
+/* smarActMCSSetPipelineDepth: number of poll queries on the link at once, 1 (default) disables pipelining */
+static const iocshFuncDef pd_def = {"smarActMCSSetPipelineDepth", 2, pd_as};
+
+extern "C" int
+smarActMCSSetPipelineDepth(
+  const char *controllerPortName,
+  int        depth)
+{
+SmarActMCSController *pC;
+
+  pC = (SmarActMCSController*) findAsynPortDriver(controllerPortName);
+  if (!pC) {
+    printf("smarActMCSSetPipelineDepth: Error port %s not found\n", controllerPortName);
+    return -1;
+  }
+  pC->lock();
+  pC->setPipelineDepth(depth);
+  pC->unlock();
+  return 0;
+}
+
+static void pd_fn(const iocshArgBuf *args)
+{
+  smarActMCSSetPipelineDepth(
+    args[0].sval,
+    args[1].ival);
+}
+
+static const iocshArg pm_a0 = {"Controller Port name [string]",    iocshArgString};
+static const iocshArg pm_a1 = {"Poll mode [int]",                  iocshArgInt};
+
+static const iocshArg * const pm_as[] = {&pm_a0, &pm_a1};
+
+/* smarActMCSSetPollMode: 0 (default) one command per value, 1 all values of an axis with one chained command */
+static const iocshFuncDef pm_def = {"smarActMCSSetPollMode", 2, pm_as};
+
+extern "C" int
+smarActMCSSetPollMode(
+  const char *controllerPortName,
+  int        mode)
+{
+SmarActMCSController *pC;
+
+  pC = (SmarActMCSController*) findAsynPortDriver(controllerPortName);
+  if (!pC) {
+    printf("smarActMCSSetPollMode: Error port %s not found\n", controllerPortName);
+    return -1;
+  }
+  pC->lock();
+  pC->setPollMode(mode);
+  pC->unlock();
+  return 0;
+}
+
+static void pm_fn(const iocshArgBuf *args)
+{
+  smarActMCSSetPollMode(
+    args[0].sval,
+    args[1].ival);
+}
+
+static const iocshArg ap_a0 = {"Controller Port name [string]",    iocshArgString};
+static const iocshArg ap_a1 = {"Axis number [int]",                iocshArgInt};
+static const iocshArg ap_a2 = {"Priority [int]",                   iocshArgInt};
+
+static const iocshArg * const ap_as[] = {&ap_a0, &ap_a1, &ap_a2};
+
+/* smarActMCSSetAxisPriority: 0 low, 1 normal (scheduled), 2 high (default, polled every cycle) */
+static const iocshFuncDef ap_def = {"smarActMCSSetAxisPriority", 3, ap_as};
+
+extern "C" int
+smarActMCSSetAxisPriority(
+  const char *controllerPortName,
+  int        axisNumber,
+  int        priority)
+{
+SmarActMCSController *pC;
+
+  pC = (SmarActMCSController*) findAsynPortDriver(controllerPortName);
+  if (!pC) {
+    printf("smarActMCSSetAxisPriority: Error port %s not found\n", controllerPortName);
+    return -1;
+  }
+  pC->lock();
+  pC->setAxisPriority(axisNumber, priority);
+  pC->unlock();
+  return 0;
+}
+
+static void ap_fn(const iocshArgBuf *args)
+{
+  smarActMCSSetAxisPriority(
     args[0].sval,
     args[1].ival,
     args[2].ival);
 }
 
+static const iocshArg pp_a0 = {"Controller Port name [string]",    iocshArgString};
+static const iocshArg pp_a1 = {"Predictive [int]",                 iocshArgInt};
+
+static const iocshArg * const pp_as[] = {&pp_a0, &pp_a1};
+
+/* smarActMCSSetPredictivePoll: 1 reads a moving axis less often until its expected arrival */
+static const iocshFuncDef pp_def = {"smarActMCSSetPredictivePoll", 2, pp_as};
+
+extern "C" int
+smarActMCSSetPredictivePoll(
+  const char *controllerPortName,
+  int        predictive)
+{
+SmarActMCSController *pC;
+
+  pC = (SmarActMCSController*) findAsynPortDriver(controllerPortName);
+  if (!pC) {
+    printf("smarActMCSSetPredictivePoll: Error port %s not found\n", controllerPortName);
+    return -1;
+  }
+  pC->lock();
+  pC->setPredictivePoll(predictive);
+  pC->unlock();
+  return 0;
+}
+
+static void pp_fn(const iocshArgBuf *args)
+{
+  smarActMCSSetPredictivePoll(
+    args[0].sval,
+    args[1].ival);
+}
+
 static void smarActMCSMotorRegister(void)
 {
   iocshRegister(&cc_def, cc_fn);  // smarActMCSCreateController
   iocshRegister(&ca_def, ca_fn);  // smarActMCSCreateAxis
+  iocshRegister(&pd_def, pd_fn);  // smarActMCSSetPipelineDepth
+  iocshRegister(&pm_def, pm_fn);  // smarActMCSSetPollMode
+  iocshRegister(&ap_def, ap_fn);  // smarActMCSSetAxisPriority
+  iocshRegister(&pp_def, pp_fn);  // smarActMCSSetPredictivePoll
 }
 
 extern "C" {
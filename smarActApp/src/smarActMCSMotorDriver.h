@@ -11,6 +11,11 @@
 
 #include <asynMotorController.h>
 #include <asynMotorAxis.h>
+#include <smarActTransport.h>
+#include <smarActIoStats.h>
+#include <smarActDeadband.h>
+#include <smarActPollScheduler.h>
+#include <smarActProtocol.h>
 #include <stdarg.h>
 #include <exception>
 
@@ -40,10 +45,12 @@ protected:
 };
 
 
+typedef SmarActCommand<SmarActMCSProtocol> SmarActMCSCommand;
+
 class SmarActMCSAxis : public asynMotorAxis
 {
 public:
-  SmarActMCSAxis(class SmarActMCSController *cnt_p, int axis, int channel);
+  SmarActMCSAxis(class SmarActMCSController *cnt_p, int axis, int channel, int type = SMARACT_AXIS_PROBE);
   asynStatus  poll(bool *moving_p);
   asynStatus  move(double position, int relative, double min_vel, double max_vel, double accel);
   asynStatus  home(double min_vel, double max_vel, double accel, int forwards);
@@ -54,6 +61,7 @@ public:
   virtual asynStatus getVal(const char *parm, int *val_p);
   virtual asynStatus getAngle(int *val_p, int *rev_p);
   virtual asynStatus moveCmd(const char *cmd, ...);
+  asynStatus         moveCmd(const SmarActMCSCommand &cmd);
   virtual int        getClosedLoop();
   int        getEncoder();
 
@@ -61,6 +69,10 @@ public:
 
 protected:
   asynStatus  setSpeed(double velocity);
+  asynStatus  chainedPoll();
+  void        probe(int type);
+  asynStatus  detect();
+  asynStatus  verifyCaps();
 private:
   SmarActMCSController   *c_p_;  // pointer to asynMotorController for this axis
   asynStatus             comStatus_;
@@ -69,7 +81,15 @@ private:
   int                    channel_;
   int                    sensorType_;
   int                    isRot_;
+  int                    verifyCaps_; // capabilities from the cache, 1: check them, 2: check the holding state
   int            stepCount_; // open loop current step count
+  SmarActPrefetch        prefetch_; // poll replies read by SmarActMCSController::poll()
+  int                    chainFailures_; // chained polls that failed in a row, see SMARACT_CHAIN_MAX_FAILURES
+  int                    ppk_;       // physical position known, refreshed by poll() when ppkStale()
+  int                    ppkValid_;
+  epicsTimeStamp         ppkTime_;
+  bool                   wasMoving_;
+  int                    ppkStale();
 
 friend class SmarActMCSController;
 };
@@ -77,7 +97,7 @@ friend class SmarActMCSController;
 class SmarActMCSController : public asynMotorController
 {
 public:
-  SmarActMCSController(const char *portName, const char *IOPortName, int numAxes, double movingPollPeriod, double idlePollPeriod, int disableSpeed = 0);
+  SmarActMCSController(const char *portName, const char *IOPortName, int numAxes, double movingPollPeriod, double idlePollPeriod, int disableSpeed = 0, int fastStartup = 0);
   virtual asynStatus sendCmd(size_t *got_p, char *rep, int len, double timeout, const char *fmt, va_list ap);
   virtual asynStatus sendCmd(size_t *got_p, char *rep, int len, double timeout, const char *fmt, ...);
   virtual asynStatus sendCmd(size_t *got_p, char *rep, int len, const char *fmt, ...);
@@ -86,12 +106,27 @@ public:
   static int parseReply(const char *reply, int *ax_p, int *val_p);
   static int parseAngle(const char *reply, int *ax_p, int *val_p, int *rot_p);
 
+  virtual asynStatus poll();
+  virtual void report(FILE *fp, int level);
+  void setPipelineDepth(int depth);
+  void setPollMode(int mode);
+  void setAxisPriority(int axis, int priority);
+  void setPredictivePoll(int predictive);
+
 protected:
   SmarActMCSAxis **pAxes_;
 
 private:
   asynUser *asynUserMot_p_;
+  asynUser *asynUserPoll_p_;  // of the poller while the lock is released
   int disableSpeed_;
+  int fastStartup_;
+  int pollMode_;
+  SmarActTransport *transport_;
+  SmarActRequest   *pollRequests_;
+  SmarActIoStats    ioStats_;
+  SmarActDeadbands  deadbands_;
+  SmarActPollScheduler *scheduler_;
 friend class SmarActMCSAxis;
 };
 
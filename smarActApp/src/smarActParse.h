@@ -0,0 +1,190 @@
+#ifndef SMARACT_PARSE_H
+#define SMARACT_PARSE_H
+
+/* Reply parsing shared by the smarAct MCS, MCS2 and SCU drivers.
+ *
+ * Each function parses one token at *pp. On success it returns 0 and moves
+ * *pp past the token. If the text doesn't fit it returns -1 and leaves *pp at
+ * the first character that doesn't, so (*pp - reply) is the column where the
+ * reply is malformed. Numbers are decimal, there are no locale lookups, no
+ * format strings and no allocation.
+ */
+
+#ifdef __cplusplus
+
+#include <stddef.h>
+
+/* Exactly representable powers of ten */
+static const double smarActPow10[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+#define SMARACT_POW10_MAX 22
+
+/* Significant digits kept by smarActParseDouble(), they fit into an unsigned long long */
+#define SMARACT_PARSE_DIGITS 19
+
+inline int smarActIsDigit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+/* The character c */
+inline int smarActParseChar(const char **pp, char c)
+{
+  if ( **pp != c )
+    return -1;
+  (*pp)++;
+  return 0;
+}
+
+/* One or more upper case letters, the first size - 1 of them are copied to buf */
+inline int smarActParseUpper(const char **pp, char *buf, size_t size)
+{
+const char *p = *pp;
+size_t      len = 0;
+
+  while ( *p >= 'A' && *p <= 'Z' ) {
+    if ( len < size - 1 )
+      buf[len++] = *p;
+    p++;
+  }
+  buf[len] = 0;
+  if ( p == *pp )
+    return -1;
+  *pp = p;
+  return 0;
+}
+
+/* [+|-]<digits>, fails on overflow with *pp at the digit that overflows */
+inline int smarActParseInt64(const char **pp, long long *val_p)
+{
+const char        *p = *pp;
+unsigned long long val = 0;
+unsigned long long limit;
+int                neg = 0;
+
+  if ( '-' == *p || '+' == *p )
+    neg = '-' == *p++;
+  if ( !smarActIsDigit(*p) ) {
+    *pp = p;
+    return -1;
+  }
+  limit = neg ? 9223372036854775808ULL : 9223372036854775807ULL;
+  while ( smarActIsDigit(*p) ) {
+    unsigned d = *p - '0';
+    if ( val > (limit - d) / 10 ) {
+      *pp = p;
+      return -1;
+    }
+    val = val * 10 + d;
+    p++;
+  }
+  *val_p = neg ? (long long)(0 - val) : (long long)val;
+  *pp = p;
+  return 0;
+}
+
+/* [+|-]<digits> in the range of an int */
+inline int smarActParseInt(const char **pp, int *val_p)
+{
+const char *p = *pp;
+long long   val;
+
+  if ( smarActParseInt64(&p, &val) ) {
+    *pp = p;
+    return -1;
+  }
+  if ( val < -2147483647LL - 1 || val > 2147483647LL )
+    return -1;
+  *val_p = (int)val;
+  *pp = p;
+  return 0;
+}
+
+/* [+|-]<digits>[.<digits>][e|E[+|-]<digits>], or [+|-].<digits>...
+ * Digits beyond SMARACT_PARSE_DIGITS are ignored, which is far below the
+ * resolution of any reply of the controllers.
+ */
+inline int smarActParseDouble(const char **pp, double *val_p)
+{
+const char        *p = *pp;
+unsigned long long mant = 0;
+int                digits = 0;
+int                exp10 = 0;
+int                any = 0;
+int                neg = 0;
+double             val;
+
+  if ( '-' == *p || '+' == *p )
+    neg = '-' == *p++;
+  for ( ; smarActIsDigit(*p); p++, any = 1 ) {
+    if ( digits < SMARACT_PARSE_DIGITS ) {
+      mant = mant * 10 + (*p - '0');
+      if ( mant )
+        digits++;
+    } else {
+      exp10++;
+    }
+  }
+  if ( '.' == *p ) {
+    const char *q = p + 1;
+    for ( ; smarActIsDigit(*q); q++, any = 1 ) {
+      if ( digits < SMARACT_PARSE_DIGITS ) {
+        mant = mant * 10 + (*q - '0');
+        if ( mant )
+          digits++;
+        exp10--;
+      }
+    }
+    if ( any )
+      p = q;
+  }
+  if ( !any ) {
+    *pp = p;
+    return -1;
+  }
+  if ( 'e' == *p || 'E' == *p ) {
+    const char *q = p + 1;
+    int         expNeg = 0;
+    int         e = 0;
+    if ( '-' == *q || '+' == *q )
+      expNeg = '-' == *q++;
+    if ( smarActIsDigit(*q) ) {
+      for ( ; smarActIsDigit(*q); q++ ) {
+        if ( e < 10000 )
+          e = e * 10 + (*q - '0');
+      }
+      exp10 += expNeg ? -e : e;
+      p = q;
+    }
+  }
+  val = (double)mant;
+  while ( exp10 > 0 && val != 0.0 ) {
+    int n = exp10 > SMARACT_POW10_MAX ? SMARACT_POW10_MAX : exp10;
+    val *= smarActPow10[n];
+    exp10 -= n;
+  }
+  while ( exp10 < 0 && val != 0.0 ) {
+    int n = -exp10 > SMARACT_POW10_MAX ? SMARACT_POW10_MAX : -exp10;
+    val /= smarActPow10[n];
+    exp10 += n;
+  }
+  *val_p = neg ? -val : val;
+  *pp = p;
+  return 0;
+}
+
+/* Nothing but white space up to the end of the reply */
+inline int smarActParseEnd(const char **pp)
+{
+const char *p = *pp;
+
+  while ( ' ' == *p || '\t' == *p || '\r' == *p || '\n' == *p )
+    p++;
+  *pp = p;
+  return *p ? -1 : 0;
+}
+
+#endif // _cplusplus
+#endif // SMARACT_PARSE_H
@@ -0,0 +1,359 @@
+/* Per-axis poll scheduling shared by the smarAct MCS, MCS2 and SCU drivers */
+
+#include <string.h>
+#include <stdio.h>
+
+#include <math.h>
+
+#include <epicsTime.h>
+#include <epicsTimer.h>
+#include <epicsThread.h>
+#include <asynMotorController.h>
+
+#include "smarActPollScheduler.h"
+
+/* Polls the poller does a bit early still count, it doesn't wait exactly one period */
+#define PERIOD_TOLERANCE 0.9
+
+/* Number of polls an axis is read in every cycle after a move was sent to it,
+ * in case the controller doesn't report it as moving yet in the first one */
+#define KICK_POLLS 2
+
+SmarActPollScheduler::SmarActPollScheduler(int numAxes, asynMotorController *pController)
+  : numAxes_(numAxes), next_(0), predictive_(0), pController_(pController),
+    pollThread_(0), held_(0), numReleased_(0)
+{
+int i;
+
+  axes_ = new Axis[numAxes];
+  memset(axes_, 0, numAxes * sizeof(Axis));
+  for ( i = 0; i < numAxes; i++ )
+    axes_[i].priority = SMARACT_PRIO_HIGH;
+  epicsTimeGetCurrent(&now_);
+  timerQueue_ = epicsTimerQueueAllocate(1, epicsThreadPriorityScanHigh);
+  timer_      = epicsTimerQueueCreateTimer(timerQueue_, wakeup, this);
+}
+
+SmarActPollScheduler::~SmarActPollScheduler()
+{
+  epicsTimerQueueDestroyTimer(timerQueue_, timer_);
+  epicsTimerQueueRelease(timerQueue_);
+  delete [] axes_;
+}
+
+/* Timer callback: start a poll cycle now, don't wait for the poll period */
+void
+SmarActPollScheduler::wakeup(void *pPvt)
+{
+SmarActPollScheduler *pScheduler = (SmarActPollScheduler*)pPvt;
+
+  pScheduler->pController_->wakeupPoller();
+}
+
+/* Start the timer for the first expected arrival still ahead, or the next fast poll */
+void
+SmarActPollScheduler::arm()
+{
+epicsTimeStamp now;
+double         delay = -1.0;
+int            i;
+
+  epicsTimeGetCurrent(&now);
+  for ( i = 0; i < numAxes_; i++ ) {
+    double d;
+    if ( axes_[i].fastPeriod > 0.0 ) {
+      if ( epicsTimeDiffInSeconds(&axes_[i].fastEnd, &now) > 0.0 ) {
+        d = axes_[i].fastPeriod;
+        if ( delay < 0.0 || d < delay )
+          delay = d;
+      } else {
+        axes_[i].fastPeriod = 0.0;
+      }
+    }
+    if ( !axes_[i].haveArrival )
+      continue;
+    d = epicsTimeDiffInSeconds(&axes_[i].arrival, &now);
+    if ( d > 0.0 && (delay < 0.0 || d < delay) )
+      delay = d;
+  }
+  if ( delay > 0.0 )
+    epicsTimerStartDelay(timer_, delay);
+  else
+    epicsTimerCancel(timer_);
+}
+
+void
+SmarActPollScheduler::setPriority(int axis, int priority)
+{
+  if ( axis < 0 || axis >= numAxes_ )
+    return;
+  if ( priority < SMARACT_PRIO_LOW )
+    priority = SMARACT_PRIO_LOW;
+  if ( priority > SMARACT_PRIO_HIGH )
+    priority = SMARACT_PRIO_HIGH;
+  axes_[axis].priority = priority;
+}
+
+void
+SmarActPollScheduler::setPredictive(int predictive)
+{
+int i;
+
+  predictive_ = predictive ? 1 : 0;
+  if ( !predictive_ ) {
+    for ( i = 0; i < numAxes_; i++ )
+      axes_[i].haveArrival = 0;
+    arm();
+  }
+}
+
+/* A move (or stop) was sent to the axis: read it in the next cycles.
+ * This also forgets an expected arrival, expect() sets a new one.
+ */
+void
+SmarActPollScheduler::kick(int axis)
+{
+  if ( axis < 0 || axis >= numAxes_ )
+    return;
+  axes_[axis].kicked      = KICK_POLLS;
+  axes_[axis].haveArrival = 0;
+  axes_[axis].numKicks++;
+}
+
+/* The move just sent to the axis is expected to take 'seconds', 0 if unknown.
+ * Only used in predictive mode.
+ */
+void
+SmarActPollScheduler::expect(int axis, double seconds)
+{
+Axis *pAxis;
+
+  if ( !predictive_ || axis < 0 || axis >= numAxes_ || !(seconds > 0.0) )
+    return;
+  pAxis = &axes_[axis];
+  epicsTimeGetCurrent(&pAxis->arrival);
+  pAxis->burst = pAxis->arrival;
+  epicsTimeAddSeconds(&pAxis->arrival, seconds);
+  epicsTimeAddSeconds(&pAxis->burst, (1.0 - SMARACT_ARRIVAL_LEAD) * seconds);
+  pAxis->haveArrival = 1;
+  arm();
+}
+
+/* A move was sent to the axis: wake the poller every 'period' s for up to
+ * 'duration' s, until the axis reports done.
+ */
+void
+SmarActPollScheduler::fastPolls(int axis, double period, double duration)
+{
+Axis *pAxis;
+
+  if ( axis < 0 || axis >= numAxes_ || !(period > 0.0) )
+    return;
+  pAxis = &axes_[axis];
+  epicsTimeGetCurrent(&pAxis->fastEnd);
+  epicsTimeAddSeconds(&pAxis->fastEnd, duration);
+  pAxis->fastPeriod = period;
+  arm();
+}
+
+/* Duration of a trapezoidal move, 0 if the velocity is unknown.
+ * Without an acceleration the axis is taken to reach its velocity at once.
+ */
+double
+SmarActPollScheduler::moveTime(double distance, double velocity, double acceleration)
+{
+  distance     = fabs(distance);
+  velocity     = fabs(velocity);
+  acceleration = fabs(acceleration);
+  if ( !(velocity > 0.0) )
+    return 0.0;
+  if ( !(acceleration > 0.0) )
+    return distance / velocity;
+  if ( distance < velocity * velocity / acceleration )
+    return 2.0 * sqrt(distance / acceleration);
+  return distance / velocity + velocity / acceleration;
+}
+
+int
+SmarActPollScheduler::settling(const Axis *pAxis, const epicsTimeStamp *pNow) const
+{
+  return !pAxis->moving && epicsTimeDiffInSeconds(pNow, &pAxis->stopped) < SMARACT_SETTLE_TIME;
+}
+
+/* Decide which axes are read in this poll cycle, called by the controller
+ * at the start of each cycle before the axes are polled.
+ */
+void
+SmarActPollScheduler::plan(double idlePollPeriod)
+{
+int anyMoving = 0;
+int anyFast = 0;
+int numIdle = 0;
+int i;
+int k;
+
+  epicsTimeGetCurrent(&now_);
+  pollThread_ = epicsThreadGetIdSelf();
+  for ( i = 0; i < numAxes_; i++ ) {
+    Axis *pAxis = &axes_[i];
+    pAxis->kicksAtPlan = pAxis->numKicks;
+    if ( pAxis->moving || pAxis->kicked )
+      anyMoving = 1;
+    if ( pAxis->fastPeriod > 0.0 )
+      anyFast = 1;
+    if ( pAxis->haveArrival && pAxis->moving && !pAxis->kicked
+         && epicsTimeDiffInSeconds(&pAxis->burst, &now_) > 0.0 )
+      pAxis->due = epicsTimeDiffInSeconds(&now_, &pAxis->lastPoll) >= PERIOD_TOLERANCE * SMARACT_BACKOFF_PERIOD;
+    else if ( !pAxis->havePoll || SMARACT_PRIO_HIGH == pAxis->priority || pAxis->moving || pAxis->kicked )
+      pAxis->due = 1;
+    else if ( settling(pAxis, &now_) )
+      pAxis->due = epicsTimeDiffInSeconds(&now_, &pAxis->lastPoll) >= PERIOD_TOLERANCE * SMARACT_SETTLE_PERIOD;
+    else
+      pAxis->due = 0;
+  }
+
+  /* Idle axes, starting where the last round left off */
+  for ( k = 0; k < numAxes_; k++ ) {
+    Axis  *pAxis;
+    double period;
+
+    i     = (next_ + k) % numAxes_;
+    pAxis = &axes_[i];
+    if ( pAxis->due || SMARACT_PRIO_HIGH == pAxis->priority || settling(pAxis, &now_) )
+      continue;
+    period = idlePollPeriod;
+    if ( SMARACT_PRIO_LOW == pAxis->priority )
+      period *= SMARACT_LOW_PRIO_FACTOR;
+    if ( epicsTimeDiffInSeconds(&now_, &pAxis->lastPoll) < PERIOD_TOLERANCE * period )
+      continue;
+    if ( anyMoving && numIdle )
+      break;
+    pAxis->due = 1;
+    numIdle++;
+    next_ = (i + 1) % numAxes_;
+  }
+  /* The timer is one shot, start it again for the next fast poll */
+  if ( anyFast )
+    arm();
+}
+
+/* 1 if the axis is read in this cycle */
+int
+SmarActPollScheduler::due(int axis) const
+{
+  return axis < 0 || axis >= numAxes_ || axes_[axis].due;
+}
+
+/* The axis was not read in this cycle.
+ *
+ * RETURNS:  the 'moving' flag to hand to the poller; true while the axis moves
+ *           or settles, so that the poller keeps the moving poll period.
+ */
+bool
+SmarActPollScheduler::skipped(int axis)
+{
+Axis *pAxis;
+
+  if ( axis < 0 || axis >= numAxes_ )
+    return false;
+  pAxis = &axes_[axis];
+  pAxis->numSkipped++;
+  return pAxis->moving || settling(pAxis, &now_);
+}
+
+/* The axis was read in this cycle and reported 'moving'.
+ *
+ * RETURNS:  the 'moving' flag to hand to the poller, see skipped().
+ */
+bool
+SmarActPollScheduler::polled(int axis, bool moving)
+{
+Axis *pAxis;
+
+  if ( axis < 0 || axis >= numAxes_ )
+    return moving;
+  pAxis = &axes_[axis];
+  if ( pAxis->moving && !moving )
+    pAxis->stopped = now_;
+  if ( moving )
+    pAxis->kicked = 0;
+  else if ( pAxis->kicked )
+    pAxis->kicked--;
+  if ( !moving && !pAxis->kicked ) {
+    pAxis->haveArrival = 0;
+    if ( pAxis->fastPeriod > 0.0 ) {
+      pAxis->fastPeriod = 0.0;
+      arm();
+    }
+  }
+  pAxis->moving   = moving;
+  pAxis->lastPoll = now_;
+  pAxis->havePoll = 1;
+  pAxis->numPolls++;
+  if ( SMARACT_PRIO_HIGH == pAxis->priority )
+    return moving;
+  return moving || settling(pAxis, &now_);
+}
+
+/* 1 if a move was sent to the axis since the start of this cycle, while the
+ * controller lock was released: the replies read for the axis may predate it.
+ */
+int
+SmarActPollScheduler::stale(int axis) const
+{
+  return axis >= 0 && axis < numAxes_ && axes_[axis].numKicks != axes_[axis].kicksAtPlan;
+}
+
+/* Called before an exchange with the controller. On the poll thread the
+ * controller lock is released until the reply is in; the caller must work
+ * on copies of shared buffers and must not touch parameters until
+ * reacquireLock(). The poller holds the lock exactly once, other threads
+ * keep it, as does the poll thread within holdLock().
+ *
+ * RETURNS:  1 if the lock was released, 0 if the caller still holds it.
+ */
+int
+SmarActPollScheduler::releaseLock()
+{
+  if ( held_ || !pollThread_ || epicsThreadGetIdSelf() != pollThread_ )
+    return 0;
+  numReleased_++;
+  pController_->unlock();
+  return 1;
+}
+
+void
+SmarActPollScheduler::reacquireLock()
+{
+  pController_->lock();
+}
+
+/* Keep the lock over several exchanges that belong together, e.g. a command
+ * whose reply lines are read one by one. Calls nest.
+ */
+void
+SmarActPollScheduler::holdLock(int hold)
+{
+  held_ += hold ? 1 : -1;
+}
+
+void
+SmarActPollScheduler::report(FILE *fp, int level)
+{
+static const char *prioNames[] = { "low", "normal", "high" };
+int i;
+
+  if ( level < 1 )
+    return;
+  if ( predictive_ )
+    fprintf(fp, "  predictive done detection\n");
+  fprintf(fp, "  controller lock released for %lu exchanges of the poller\n", numReleased_);
+  for ( i = 0; i < numAxes_; i++ ) {
+    const Axis *pAxis = &axes_[i];
+    if ( !pAxis->numPolls )
+      continue;
+    fprintf(fp, "  axis %d: priority %s, %lu polls, %lu skipped%s\n",
+            i, prioNames[pAxis->priority], pAxis->numPolls, pAxis->numSkipped,
+            pAxis->haveArrival ? ", move with expected arrival" : "");
+  }
+}
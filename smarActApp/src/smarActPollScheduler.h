@@ -0,0 +1,116 @@
+#ifndef SMARACT_POLL_SCHEDULER_H
+#define SMARACT_POLL_SCHEDULER_H
+
+/* Per-axis poll scheduling shared by the smarAct MCS, MCS2 and SCU drivers.
+ *
+ * The poller of asynMotorController runs at the moving poll period while any
+ * axis moves and polls every axis in each cycle. The scheduler decides at the
+ * start of each cycle which axes are actually read:
+ *   - moving axes, and axes a move was just sent to: every cycle
+ *   - settling axes, for SMARACT_SETTLE_TIME after they stopped:
+ *     every SMARACT_SETTLE_PERIOD
+ *   - idle axes: every idle poll period (low priority: SMARACT_LOW_PRIO_FACTOR
+ *     idle poll periods); while other axes move, at most one idle axis per
+ *     cycle, round robin
+ * Axes with SMARACT_PRIO_HIGH, the default, are read in every cycle as before.
+ *
+ * In predictive mode the driver passes the expected duration of a move to
+ * expect(). Up to SMARACT_ARRIVAL_LEAD before the expected arrival the moving
+ * axis is only read every SMARACT_BACKOFF_PERIOD; a timer wakes the poller at
+ * the expected arrival and the axis is read in every cycle from then on, so
+ * the end of the move is seen within one moving poll period.
+ *
+ * fastPolls() starts a short window after a move in which the timer wakes the
+ * poller every 'period' s, faster than the moving poll period, until the axis
+ * reports done. Small moves are then seen done within that period.
+ *
+ * The poll thread releases the controller lock while it waits for a reply,
+ * see releaseLock(): record processing, and stop() in particular, then waits
+ * for the one exchange on the link at most instead of the whole poll cycle.
+ * The driver updates its parameters only after reacquireLock(). A move sent
+ * meanwhile isn't in the replies yet, stale() tells the axis not to report it
+ * done in this cycle.
+ */
+
+#ifdef __cplusplus
+
+#include <stdio.h>
+#include <epicsTime.h>
+#include <epicsTimer.h>
+#include <epicsThread.h>
+
+class asynMotorController;
+
+#define SMARACT_PRIO_LOW    0
+#define SMARACT_PRIO_NORMAL 1
+#define SMARACT_PRIO_HIGH   2
+
+#define SMARACT_SETTLE_TIME      1.0   /* s */
+#define SMARACT_SETTLE_PERIOD    0.1   /* s */
+#define SMARACT_LOW_PRIO_FACTOR 10
+
+#define SMARACT_BACKOFF_PERIOD   0.5   /* s */
+#define SMARACT_ARRIVAL_LEAD     0.1   /* fraction of the expected duration */
+
+class SmarActPollScheduler
+{
+public:
+  SmarActPollScheduler(int numAxes, asynMotorController *pController);
+  ~SmarActPollScheduler();
+
+  void setPriority(int axis, int priority);
+  void setPredictive(int predictive);
+  void kick(int axis);
+  void expect(int axis, double seconds);
+  void fastPolls(int axis, double period, double duration);
+  void plan(double idlePollPeriod);
+  int  due(int axis) const;
+  bool skipped(int axis);
+  bool polled(int axis, bool moving);
+  int  stale(int axis) const;
+  int  releaseLock();
+  void reacquireLock();
+  void holdLock(int hold);
+  void report(FILE *fp, int level);
+
+  static double moveTime(double distance, double velocity, double acceleration);
+
+private:
+  struct Axis {
+    int            priority;
+    int            kicked;     /* a move was sent, poll until the axis reports it */
+    int            moving;     /* result of the last poll */
+    int            due;        /* poll in this cycle */
+    int            havePoll;
+    int            haveArrival; /* a move with an expected duration is under way */
+    epicsTimeStamp lastPoll;
+    epicsTimeStamp stopped;
+    epicsTimeStamp burst;       /* read in every cycle from here on */
+    epicsTimeStamp arrival;
+    epicsTimeStamp fastEnd;     /* end of the fast polls, see fastPolls() */
+    double         fastPeriod;  /* 0: no fast polls */
+    unsigned long  numPolls;
+    unsigned long  numSkipped;
+    unsigned long  numKicks;
+    unsigned long  kicksAtPlan; /* numKicks at the start of the cycle */
+  };
+
+  int  settling(const Axis *pAxis, const epicsTimeStamp *pNow) const;
+  void arm();
+  static void wakeup(void *pPvt);
+
+  Axis *axes_;
+  int   numAxes_;
+  int   next_;                  /* first idle axis to look at in the next round */
+  epicsTimeStamp now_;          /* start of the current cycle */
+  int   predictive_;
+  asynMotorController *pController_;
+  epicsTimerQueueId    timerQueue_;
+  epicsTimerId         timer_;  /* wakes the poller at the next expected arrival */
+  epicsThreadId        pollThread_;  /* the thread that calls plan() */
+  int                  held_;   /* holdLock() nesting, the lock is not released */
+  unsigned long        numReleased_;
+};
+
+#endif // _cplusplus
+#endif // SMARACT_POLL_SCHEDULER_H
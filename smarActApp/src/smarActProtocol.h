@@ -0,0 +1,265 @@
+#ifndef SMARACT_PROTOCOL_H
+#define SMARACT_PROTOCOL_H
+
+/* Command encoding shared by the smarAct MCS, MCS2 and SCU drivers.
+ *
+ * The commands the drivers have in common are listed in SmarActCommandId.
+ * Each protocol is a traits class with a static table of them: the text
+ * before the channel, the text after it and, for each argument, the
+ * separator in front of it and its type:
+ *   'i'  integer, the value is rounded
+ *   'f'  fixed point with three decimals
+ * commands a protocol doesn't have are NULL. SmarActCommand<Protocol> takes
+ * the table of the protocol it is instantiated with, so the encoding of each
+ * driver is fixed at compile time; the text is written digit by digit, no
+ * format string is interpreted and there are no locale lookups.
+ *
+ * Transport, statistics, poll scheduling, the capability cache and reply
+ * parsing are already shared between the drivers (smarActTransport.h,
+ * smarActIoStats.h, smarActPollScheduler.h, smarActCapCache.h,
+ * smarActParse.h), so this completes the protocol layer that a new feature
+ * has to know about.
+ */
+
+#ifdef __cplusplus
+
+#include <stddef.h>
+#include <string.h>
+
+/* Longest command text, without chaining */
+#define SMARACT_COMMAND_SIZE 64
+
+/* Command text of chained commands */
+#define SMARACT_CHAIN_SIZE   256
+
+/* The order is that of the tables of the protocols */
+enum SmarActCommandId {
+  SmarActCmdStop,             /* */
+  SmarActCmdGetPosition,      /* */
+  SmarActCmdGetAngle,         /* */
+  SmarActCmdMoveAbsolute,     /* position, hold time (MCS, SCU) */
+  SmarActCmdMoveRelative,     /* distance, hold time (MCS, SCU) */
+  SmarActCmdMoveAngleAbsolute,/* angle, revolution, hold time */
+  SmarActCmdMoveAngleRelative,/* angle, revolution, hold time */
+  SmarActCmdMoveSteps,        /* steps, amplitude, frequency */
+  SmarActCmdMove,             /* target in the current move mode (MCS2) */
+  SmarActCmdMoveMode,         /* mode (MCS2) */
+  SmarActCmdStepFrequency,    /* frequency (MCS2) */
+  SmarActCmdSetSpeed,         /* closed loop speed (MCS) or frequency (SCU) */
+  SmarActCmdSetPosition,      /* position */
+  SmarActCmdFindReference,    /* MCS: direction, hold time, auto zero; SCU: hold time, auto zero */
+  SmarActCmdHold,             /* hold time (MCS2) */
+  SmarActCmdCalibrate,        /* */
+  SmarActNumCommands
+};
+
+typedef struct {
+  const char *prefix;         /* before the channel, NULL: not in this protocol */
+  const char *suffix;         /* after the channel */
+  const char *args;           /* separator and type of each argument */
+} SmarActCommandDef;
+
+/* MCS ASCII protocol, one command per write, arguments separated by ',' */
+struct SmarActMCSProtocol {
+  static const char *separator() { return ""; }
+  static const SmarActCommandDef *command(SmarActCommandId id)
+  {
+    static const SmarActCommandDef table[SmarActNumCommands] = {
+      { ":S",     "", ""        },
+      { ":GP",    "", ""        },
+      { ":GA",    "", ""        },
+      { ":MPA",   "", ",i,i"    },
+      { ":MPR",   "", ",i,i"    },
+      { ":MAA",   "", ",i,i,i"  },
+      { ":MAR",   "", ",i,i,i"  },
+      { ":MST",   "", ",i,i,i"  },
+      { NULL,     "", ""        },
+      { NULL,     "", ""        },
+      { NULL,     "", ""        },
+      { ":SCLS",  "", ",i"      },
+      { ":SP",    "", ",i"      },
+      { ":FRM",   "", ",i,i,i"  },
+      { NULL,     "", ""        },
+      { ":CS",    "", ""        },
+    };
+    return &table[id];
+  }
+};
+
+/* SCU ASCII protocol, chained commands follow each other without separator,
+ * each argument is tagged with a letter */
+struct SmarActSCUProtocol {
+  static const char *separator() { return ""; }
+  static const SmarActCommandDef *command(SmarActCommandId id)
+  {
+    static const SmarActCommandDef table[SmarActNumCommands] = {
+      { ":S",     "", ""        },
+      { ":GP",    "", ""        },
+      { ":GA",    "", ""        },
+      { ":MPA",   "", "PfHi"    },
+      { ":MPR",   "", "PfHi"    },
+      { ":MAA",   "", "AfRiHi"  },
+      { ":MAR",   "", "AfRiHi"  },
+      { NULL,     "", ""        },
+      { NULL,     "", ""        },
+      { NULL,     "", ""        },
+      { NULL,     "", ""        },
+      { ":SCLF",  "", "Fi"      },
+      { NULL,     "", ""        },
+      { ":MTR",   "", "HiZi"    },
+      { NULL,     "", ""        },
+      { NULL,     "", ""        },
+    };
+    return &table[id];
+  }
+};
+
+/* MCS2 SCPI protocol, chained commands are separated by ';' */
+struct SmarActMCS2Protocol {
+  static const char *separator() { return ";"; }
+  static const SmarActCommandDef *command(SmarActCommandId id)
+  {
+    static const SmarActCommandDef table[SmarActNumCommands] = {
+      { ":STOP",  "",           ""    },
+      { ":CHAN",  ":POS?",      ""    },
+      { NULL,     "",           ""    },
+      { NULL,     "",           ""    },
+      { NULL,     "",           ""    },
+      { NULL,     "",           ""    },
+      { NULL,     "",           ""    },
+      { NULL,     "",           ""    },
+      { ":MOVE",  "",           " i"  },
+      { ":CHAN",  ":MMOD",      " i"  },
+      { ":CHAN",  ":STEP:FREQ", " i"  },
+      { NULL,     "",           ""    },
+      { ":CHAN",  ":POS",       " i"  },
+      { ":REF",   "",           ""    },
+      { ":CHAN",  ":HOLD",      " i"  },
+      { ":CAL",   "",           ""    },
+    };
+    return &table[id];
+  }
+};
+
+/* Unsigned decimal, backwards from the end of buf; returns the first digit */
+inline char *smarActFormatDigits(char *end, unsigned long long val)
+{
+  do {
+    *--end = (char)('0' + val % 10);
+    val /= 10;
+  } while ( val );
+  return end;
+}
+
+/* One argument of type 'i' or 'f' at buf, which has room for 32 characters;
+ * returns the number of characters written */
+inline size_t smarActFormatArg(char *buf, char type, double val)
+{
+char               digits[24];
+char              *end = digits + sizeof(digits);
+char              *p;
+unsigned long long mag;
+size_t             len = 0;
+int                scale = 'f' == type ? 1000 : 1;
+int                neg = val < 0.0;
+
+  mag = (unsigned long long)((neg ? -val : val) * scale + 0.5);
+  if ( neg && mag )
+    buf[len++] = '-';
+  p = smarActFormatDigits(end, mag / scale);
+  while ( p < end )
+    buf[len++] = *p++;
+  if ( scale > 1 ) {
+    unsigned frac = (unsigned)(mag % scale);
+    buf[len++] = '.';
+    buf[len++] = (char)('0' + frac / 100);
+    buf[len++] = (char)('0' + frac / 10 % 10);
+    buf[len++] = (char)('0' + frac % 10);
+  }
+  return len;
+}
+
+template <class Protocol>
+class SmarActCommand
+{
+public:
+  SmarActCommand() : len_(0), truncated_(0) { text_[0] = 0; }
+
+  /* Append a command, after the separator of the protocol if there is one already */
+  SmarActCommand &add(SmarActCommandId id, unsigned channel,
+                      double a0 = 0.0, double a1 = 0.0, double a2 = 0.0)
+  {
+    const char *sep = len_ ? Protocol::separator() : "";
+    size_t      sepLen = strlen(sep);
+    size_t      n;
+
+    if ( len_ + sepLen >= sizeof(text_) ) {
+      truncated_ = 1;
+      return *this;
+    }
+    memcpy(text_ + len_, sep, sepLen + 1);
+    n = encode(text_ + len_ + sepLen, sizeof(text_) - len_ - sepLen, id, channel, a0, a1, a2);
+    if ( !n || len_ + sepLen + n >= sizeof(text_) ) {
+      truncated_ = 1;
+      text_[len_] = 0;
+      return *this;
+    }
+    len_ += sepLen + n;
+    return *this;
+  }
+
+  const char *str() const    { return text_; }
+  size_t      length() const { return len_; }
+  /* 0 if a command was left out, it wasn't in the protocol or didn't fit */
+  int         complete() const { return !truncated_; }
+
+  /* One command into buf[size], like snprintf().
+   * RETURNS:  the length of the command, which may be size or more if it was
+   *           cut short; 0 if the protocol doesn't have it.
+   */
+  static size_t encode(char *buf, size_t size, SmarActCommandId id, unsigned channel,
+                       double a0 = 0.0, double a1 = 0.0, double a2 = 0.0)
+  {
+    const SmarActCommandDef *pDef = Protocol::command(id);
+    const double             args[3] = { a0, a1, a2 };
+    char                     text[SMARACT_COMMAND_SIZE];
+    char                     digits[16];
+    char                    *end = digits + sizeof(digits);
+    char                    *p;
+    const char              *spec;
+    size_t                   len;
+    int                      i;
+
+    if ( size )
+      buf[0] = 0;
+    if ( !pDef->prefix )
+      return 0;
+    len = strlen(pDef->prefix);
+    memcpy(text, pDef->prefix, len);
+    for ( p = smarActFormatDigits(end, channel); p < end; )
+      text[len++] = *p++;
+    memcpy(text + len, pDef->suffix, strlen(pDef->suffix));
+    len += strlen(pDef->suffix);
+    for ( spec = pDef->args, i = 0; spec[0] && spec[1] && i < 3; spec += 2, i++ ) {
+      if ( len + 34 > sizeof(text) )
+        return 0;
+      text[len++] = spec[0];
+      len += smarActFormatArg(text + len, spec[1], args[i]);
+    }
+    text[len] = 0;
+    if ( size ) {
+      size_t n = len < size ? len : size - 1;
+      memcpy(buf, text, n);
+      buf[n] = 0;
+    }
+    return len;
+  }
+
+private:
+  char   text_[SMARACT_CHAIN_SIZE];
+  size_t len_;
+  int    truncated_;
+};
+
+#endif // _cplusplus
+#endif // SMARACT_PROTOCOL_H
@@ -11,6 +11,8 @@
 #include <asynMotorController.h>
 #include <asynMotorAxis.h>
 #include <smarActSCUMotorDriver.h>
+#include <smarActParse.h>
+#include <smarActCapCache.h>
 #include <errlog.h>
 
 #include <string.h>
@@ -30,6 +32,13 @@
 #define REP_LEN 50
 #define DEFAULT_TIMEOUT 2.0
 
+// Fast startup: timeout of the pipelined axis probe
+#define PROBE_TIMEOUT 0.3
+
+// 'physical position known' only changes with a reference search or a power cycle;
+// re-read it at least this often (in s) in case it was changed by another client
+#define PPK_REFRESH_PERIOD 60.0
+
 #define HOLD_FOREVER 60000
 #define HOLD_NEVER       0
 #define FAR_AWAY     1000000000 /*nm*/
@@ -91,14 +100,17 @@ SmarActSCUException::SmarActSCUException(SmarActSCUExceptionType t, const char *
   epicsVsnprintf(str_, sizeof(str_), fmt, ap);
 }
 
-SmarActSCUController::SmarActSCUController(const char *portName, const char *IOPortName, int numAxes, double movingPollPeriod, double idlePollPeriod)
+SmarActSCUController::SmarActSCUController(const char *portName, const char *IOPortName, int numAxes, double movingPollPeriod, double idlePollPeriod, int fastStartup)
   : asynMotorController(portName, numAxes,
-                        0, // parameters
-                        0, // interface mask
-                        0, // interrupt mask
+                        SMARACT_STATS_NUM_PARAMS + SMARACT_DEADBAND_NUM_PARAMS, // parameters
+                        asynOctetMask | asynFloat64ArrayMask, // interface mask
+                        asynOctetMask | asynFloat64ArrayMask, // interrupt mask
                         ASYN_CANBLOCK | ASYN_MULTIDEVICE,
                         1, // autoconnect
                         0,0) // default priority and stack size
+  , pasynUserPoll_(0)
+  , fastStartup_(fastStartup)
+  , pollMode_(SMARACT_POLL_SINGLE)
 {
 asynStatus       status;
 pAxes_ = (SmarActSCUAxis **)(asynMotorController::pAxes_);
@@ -109,11 +121,171 @@ pAxes_ = (SmarActSCUAxis **)(asynMotorController::pAxes_);
               "SmarActSCUController:SmarActSCUController: cannot connect to SCU controller\n");
     THROW_(SmarActSCUException(SCUConnectionError, "SmarActSCUController: unable to connect serial channel"));
   }
+  // The poller talks on a connection of its own while it doesn't hold the lock
+  if ( pasynOctetSyncIO->connect(IOPortName, 0, &pasynUserPoll_, NULL) )
+    pasynUserPoll_ = 0;
+
+  // Replies carry the channel, so the poll queries of all axes can be pipelined
+  transport_    = new SmarActTransport(IOPortName, 0, SmarActMatchChannel);
+  pollRequests_ = new SmarActRequest[numAxes * SMARACT_PREFETCH_SLOTS];
+  scheduler_    = new SmarActPollScheduler(numAxes, this);
+
+  ioStats_.createParams(this);
+  deadbands_.createParams(this, numAxes);
+  transport_->setStats(&ioStats_);
 
   startPoller( movingPollPeriod, idlePollPeriod, 0 );
 
 }
 
+void
+SmarActSCUController::setPipelineDepth(int depth)
+{
+  transport_->setDepth(depth);
+}
+
+void
+SmarActSCUController::setPollMode(int mode)
+{
+  int ax;
+
+  pollMode_ = SMARACT_POLL_CHAINED == mode ? SMARACT_POLL_CHAINED : SMARACT_POLL_SINGLE;
+  // Give chaining another try on the axes that had given it up
+  for (ax = 0; ax < numAxes_; ax++) {
+    if (pAxes_[ax])
+      pAxes_[ax]->chainFailures_ = 0;
+  }
+}
+
+void
+SmarActSCUController::setAxisPriority(int axis, int priority)
+{
+  scheduler_->setPriority(axis, priority);
+}
+
+/* Called by the poller before the axes are polled.
+ * With a pipeline depth > 1 the position, moving status and physical position
+ * known queries of all axes are sent back to back; the axes take the replies in
+ * sendCmd() instead of sending the queries one by one.
+ */
+asynStatus
+SmarActSCUController::poll()
+{
+int ax;
+int numRequests = 0;
+int done;
+int moving = 0;
+
+  ioStats_.publish();
+  deadbands_.publish();
+  for ( ax = 0; ax < numAxes_; ax++ ) {
+    if ( getAxis(ax) && !getIntegerParam(ax, motorStatusDone_, &done) && !done )
+      moving = 1;
+  }
+  ioStats_.pollCycle(moving, movingPollPeriod_, idlePollPeriod_);
+  scheduler_->plan(idlePollPeriod_);
+
+  for ( ax = 0; ax < numAxes_; ax++ ) {
+    SmarActSCUAxis *pAxis = static_cast<SmarActSCUAxis*>(getAxis(ax));
+    if ( !pAxis )
+      continue;
+    pAxis->prefetch_.clear();
+    if ( transport_->getDepth() <= 1 || !scheduler_->due(ax) )
+      continue;
+    if ( !pAxis->prefetch_.add(&pollRequests_[numRequests], pAxis->isRot_ ? ":GA%u" : ":GP%u", pAxis->channel_) )
+      numRequests++;
+    if ( !pAxis->prefetch_.add(&pollRequests_[numRequests], ":M%u", pAxis->channel_) )
+      numRequests++;
+    if ( pAxis->ppkStale() &&
+         !pAxis->prefetch_.add(&pollRequests_[numRequests], ":GPPK%u", pAxis->channel_) )
+      numRequests++;
+  }
+  if ( numRequests ) {
+    int released;
+    // The replies go to the prefetch slots, the axes don't hand them out before they are all in
+    for ( ax = 0; ax < numAxes_; ax++ ) {
+      if ( pAxes_[ax] )
+        pAxes_[ax]->prefetch_.setBusy(1);
+    }
+    released = scheduler_->releaseLock();
+    transport_->transact(pollRequests_, numRequests, DEFAULT_TIMEOUT);
+    if ( released )
+      scheduler_->reacquireLock();
+    for ( ax = 0; ax < numAxes_; ax++ ) {
+      if ( pAxes_[ax] )
+        pAxes_[ax]->prefetch_.setBusy(0);
+    }
+  }
+  // Errors are reported by the axes, which send the queries themselves then
+  return asynSuccess;
+}
+
+void
+SmarActSCUController::report(FILE *fp, int level)
+{
+  fprintf(fp, "smarAct SCU motor driver %s, numAxes=%d\n", portName, numAxes_);
+  transport_->report(fp, level);
+  ioStats_.report(fp, level);
+  deadbands_.report(fp, level);
+  scheduler_->report(fp, level);
+  SmarActCapCache::report(fp);
+  asynMotorController::report(fp, level);
+}
+
+asynStatus
+SmarActSCUController::writeController(const char *output, double timeout)
+{
+epicsTimeStamp start;
+asynStatus     status;
+
+  epicsTimeGetCurrent(&start);
+  status = asynMotorController::writeController(output, timeout);
+  ioStats_.record(output, &start, status);
+  return status;
+}
+
+asynStatus
+SmarActSCUController::writeReadController(const char *output, char *response, size_t maxResponseLen, size_t *responseLen, double timeout)
+{
+epicsTimeStamp start;
+asynStatus     status;
+
+  epicsTimeGetCurrent(&start);
+  status = asynMotorController::writeReadController(output, response, maxResponseLen, responseLen, timeout);
+  ioStats_.record(output, &start, status);
+  return status;
+}
+
+/* writeReadController() that releases the controller lock on the poll thread
+ * while it waits for the reply, see SmarActPollScheduler::releaseLock().
+ * The command and the reply are copied, 'output' and 'response' may be the
+ * buffers of an axis that record processing uses meanwhile.
+ */
+asynStatus
+SmarActSCUController::writeReadReleased(const char *output, char *response, size_t maxResponseLen, size_t *responseLen, double timeout)
+{
+char           cmd[MAX_CONTROLLER_STRING_SIZE];
+char           rep[MAX_CONTROLLER_STRING_SIZE];
+size_t         nwrite;
+int            eomReason;
+epicsTimeStamp start;
+asynStatus     status;
+
+  if ( !pasynUserPoll_ || maxResponseLen > sizeof(rep) || !scheduler_->releaseLock() )
+    return writeReadController(output, response, maxResponseLen, responseLen, timeout);
+  epicsSnprintf(cmd, sizeof(cmd), "%s", output);
+  *responseLen = 0;
+  epicsTimeGetCurrent(&start);
+  status = pasynOctetSyncIO->writeRead(pasynUserPoll_, cmd, strlen(cmd), rep, maxResponseLen, timeout,
+                                       &nwrite, responseLen, &eomReason);
+  ioStats_.record(cmd, &start, status);
+  scheduler_->reacquireLock();
+  memcpy(response, rep, *responseLen);
+  if ( *responseLen < maxResponseLen )
+    response[*responseLen] = 0;
+  return status;
+}
+
 /* Obtain value of the 'motorClosedLoop_' parameter (which
  * maps to the record's CNEN field)
  */
@@ -125,15 +297,62 @@ int val;
   return val;
 }
 
-SmarActSCUAxis::SmarActSCUAxis(class SmarActSCUController *cnt_p, int axis, int channel)
-  : asynMotorAxis(cnt_p, axis), pC_(cnt_p)
+/* Fast startup: send all queries of the constructor back to back and read their
+ * replies with a short timeout; the getters then take the replies from prefetch_.
+ * Before the positioner type is known both GP and GA are sent, one of them
+ * is answered with an error. With a declared type none of the three is sent.
+ */
+void
+SmarActSCUAxis::probe(int type)
+{
+SmarActRequest requests[SMARACT_PREFETCH_SLOTS];
+int            n = 0;
+int            depth;
+
+  prefetch_.clear();
+  if ( !prefetch_.add(&requests[n], ":GCLF%u", channel_) )
+    n++;
+  if ( !prefetch_.add(&requests[n], ":M%u", channel_) )
+    n++;
+  if ( SMARACT_AXIS_PROBE == type ) {
+    if ( !prefetch_.add(&requests[n], ":GST%u", channel_) )
+      n++;
+    if ( !prefetch_.add(&requests[n], ":GP%u", channel_) )
+      n++;
+    if ( !prefetch_.add(&requests[n], ":GA%u", channel_) )
+      n++;
+  }
+  depth = pC_->transport_->getDepth();
+  pC_->transport_->setDepth(n);
+  pC_->transport_->transact(requests, n, PROBE_TIMEOUT);
+  pC_->transport_->setDepth(depth);
+}
+
+SmarActSCUAxis::SmarActSCUAxis(class SmarActSCUController *cnt_p, int axis, int channel, int type)
+  : asynMotorAxis(cnt_p, axis), pC_(cnt_p), chainFailures_(0), ppk_(0), ppkValid_(0), wasMoving_(false)
 {
   char moveStatus;
-  double currentPosition;
-  int rev;
+  SmarActCaps caps;
   channel_ = channel;
+  positionerType_ = -1;
+  verifyCaps_ = 0;
 
   asynPrint(pC_->pasynUserSelf, ASYN_TRACEIO_DRIVER, "SmarActSCUAxis::SmarActSCUAxis -- creating axis %u\n", axis);
+  if ( SMARACT_AXIS_PROBE == type && SmarActCapCache::lookup(pC_->portName, channel_, &caps) ) {
+    // Nothing to ask the controller: the holding state and the positioner
+    // type are checked by the first poll.
+    isRot_ = caps.rotary;
+    positionerType_ = caps.type;
+    setIntegerParam(pC_->motorStatusHasEncoder_, caps.sensor);
+    setIntegerParam(pC_->motorStatusGainSupport_, caps.sensor);
+    maxFreq_ = -1;
+    holdTime_ = getClosedLoop() ? HOLD_FOREVER : 0;
+    verifyCaps_ = 1;
+    comStatus_ = asynSuccess;
+    goto bail;
+  }
+  if ( pC_->fastStartup_ || SMARACT_AXIS_PROBE != type )
+    probe(type);
 
   comStatus_ = getIntegerVal("GCLF", &maxFreq_);
 #ifdef DEBUG
@@ -155,11 +374,51 @@ SmarActSCUAxis::SmarActSCUAxis(class SmarActSCUController *cnt_p, int axis, int
     holdTime_ = getClosedLoop() ? HOLD_FOREVER : 0;
   }
 
+  if ( SMARACT_AXIS_PROBE != type ) {
+    // declared in iocsh, nothing to detect
+    isRot_ = SMARACT_AXIS_ROTARY == type;
+    if ( SMARACT_AXIS_NO_SENSOR != type ) {
+      setIntegerParam(pC_->motorStatusHasEncoder_, 1);
+      setIntegerParam(pC_->motorStatusGainSupport_, 1);
+    }
+    goto bail;
+  }
+
   // Query the sensor type
   if ( (comStatus_ = getIntegerVal("GST", &positionerType_)) )
     goto bail;
 
-        // Determine if stage is a rotation stage
+  detect();
+
+bail:
+  // what the probe read ahead is not valid in the first poll cycle
+  prefetch_.clear();
+  setIntegerParam(pC_->motorStatusProblem_, comStatus_ ? 1 : 0);
+  setIntegerParam(pC_->motorStatusCommsError_, comStatus_ ? 1 : 0);
+
+  callParamCallbacks();
+
+  if ( comStatus_ ) {
+    THROW_(SmarActSCUException(SCUCommunicationError, "SmarActSCUAxis::SmarActSCUAxis -- channel %u ASYN error %i", axis, comStatus_));
+  }
+
+}
+
+/* Find out from the positioner type whether the axis is rotary, and whether
+ * it has a sensor; remember both in the capability cache.
+ */
+void
+SmarActSCUAxis::detect()
+{
+double      currentPosition;
+int         rev;
+int         hasEncoder;
+char        cmd[SMARACT_PREFETCH_CMD_LEN];
+SmarActCaps caps;
+
+        // Determine if stage is a rotation stage.
+        // A position query the probe got no reply to is taken as no sensor
+        // and not sent again, it would only wait for the timeout once more.
   if (positionerType_ == 2 ||
       positionerType_ == 8 ||
       positionerType_ == 14 ||
@@ -168,30 +427,45 @@ SmarActSCUAxis::SmarActSCUAxis(class SmarActSCUController *cnt_p, int axis, int
       positionerType_ == 23 ||
       (positionerType_ >= 25 && positionerType_ <= 29)) {
     isRot_ = 1;
-    if ( asynSuccess == getAngle(&currentPosition, &rev) ) {
-      setIntegerParam(pC_->motorStatusHasEncoder_, 1);
-      setIntegerParam(pC_->motorStatusGainSupport_, 1);
-    }
+    epicsSnprintf(cmd, sizeof(cmd), ":GA%u", channel_);
+    hasEncoder = !prefetch_.failed(cmd) && asynSuccess == getAngle(&currentPosition, &rev);
   }
   else {
     isRot_ = 0;
-    if (asynSuccess == getDoubleVal("GP", &currentPosition)) {
-      setIntegerParam(pC_->motorStatusHasEncoder_, 1);
-      setIntegerParam(pC_->motorStatusGainSupport_, 1);
-    }
+    epicsSnprintf(cmd, sizeof(cmd), ":GP%u", channel_);
+    hasEncoder = !prefetch_.failed(cmd) && asynSuccess == getDoubleVal("GP", &currentPosition);
   }
+  setIntegerParam(pC_->motorStatusHasEncoder_, hasEncoder);
+  setIntegerParam(pC_->motorStatusGainSupport_, hasEncoder);
+
+  caps.rotary = isRot_;
+  caps.type   = positionerType_;
+  caps.freq   = 0;
+  caps.sensor = hasEncoder;
+  SmarActCapCache::store(pC_->portName, channel_, &caps);
+}
 
+/* The capabilities came from the cache: check the positioner type and
+ * detect again if it doesn't match.
+ */
+asynStatus
+SmarActSCUAxis::verifyCaps()
+{
+int        val;
+asynStatus status;
 
-bail:
-  setIntegerParam(pC_->motorStatusProblem_, comStatus_ ? 1 : 0);
-  setIntegerParam(pC_->motorStatusCommsError_, comStatus_ ? 1 : 0);
-
-  callParamCallbacks();
-
-  if ( comStatus_ ) {
-    THROW_(SmarActSCUException(SCUCommunicationError, "SmarActSCUAxis::SmarActSCUAxis -- channel %u ASYN error %i", axis, comStatus_));
+  if ( (status = getIntegerVal("GST", &val)) )
+    return status;
+  if ( val != positionerType_ ) {
+    asynPrint(pC_->pasynUserSelf, ASYN_TRACE_ERROR,
+              "SmarActSCUAxis::verifyCaps -- channel %u positioner type %d, cached %d: detecting again\n",
+              channel_, val, positionerType_);
+    positionerType_ = val;
+    // A poll query that timed out is no reason to take the axis for one without sensor
+    prefetch_.clear();
+    detect();
   }
-
+  return asynSuccess;
 }
 
 /* Send a command to the controller and read the response.
@@ -204,7 +478,11 @@ asynStatus SmarActSCUAxis::sendCmd()
   size_t replyLen;
   asynStatus status;
 
-  status = pC_->writeReadController(toController_, fromController_, sizeof(fromController_), &replyLen, DEFAULT_TIMEOUT);
+  if (prefetch_.take(toController_, fromController_, sizeof(fromController_))) {
+    asynPrint(pasynUser_, ASYN_TRACEIO_DRIVER, "sendCmd: prefetched: %s, received: %s\n", toController_, fromController_);
+    return asynSuccess;
+  }
+  status = pC_->writeReadReleased(toController_, fromController_, sizeof(fromController_), &replyLen, DEFAULT_TIMEOUT);
   if (status)
     asynPrint(pasynUser_, ASYN_TRACE_ERROR, "ERROR: sendCmd: status=%d, sent: %s, received: %s\n", status, toController_, fromController_);
   else
@@ -212,6 +490,24 @@ asynStatus SmarActSCUAxis::sendCmd()
   return status;
 }
 
+/* Send the commands of cmd, see sendCmd() */
+asynStatus SmarActSCUAxis::sendCmd(const SmarActSCUCommand &cmd)
+{
+  if (!cmd.complete() || cmd.length() >= sizeof(toController_))
+    return asynError;
+  memcpy(toController_, cmd.str(), cmd.length() + 1);
+  return sendCmd();
+}
+
+/* Parse the ':' <command letters> <channel> part every SCU reply starts with */
+static int
+parseHeader(const char **pp, char *cmd, size_t cmdSize, int *axis_p)
+{
+  return    smarActParseChar(pp, ':')
+         || smarActParseUpper(pp, cmd, cmdSize)
+         || smarActParseInt(pp, axis_p);
+}
+
 /* Read an integer parameter from the SCU (nothing to do with asyn's parameter library).
  *
  * parm_cmd: SCU command (w/o ':' char) to read parameter
@@ -225,20 +521,26 @@ SmarActSCUAxis::getIntegerVal(const char *parm_cmd, int *val_p)
   char       cmd[REP_LEN];
   char       param[REP_LEN];
   int        axis;
+  const char *p;
   asynStatus status;
 
   epicsSnprintf(toController_, sizeof(toController_), ":%s%u", parm_cmd, this->channel_);
   status = sendCmd();
   if (status)
     return status;
-  if (4 != sscanf(fromController_, ":%10[A-Z]%i%10[A-Z]%i", cmd, &axis, param, val_p)) {
-    asynPrint(pasynUser_, ASYN_TRACE_ERROR, "getIntegerVal:ERROR parsing response %s\n", fromController_);
-    return asynError;
-  }
-
+  p = fromController_;
+  if (parseHeader(&p, cmd, sizeof(cmd), &axis))
+    goto malformed;
   if ('E' == cmd[0])
     return asynError;
+  if (smarActParseUpper(&p, param, sizeof(param)) || smarActParseInt(&p, val_p))
+    goto malformed;
   return asynSuccess;
+
+malformed:
+  asynPrint(pasynUser_, ASYN_TRACE_ERROR, "getIntegerVal:ERROR parsing response %s at column %d\n",
+            fromController_, (int)(p - fromController_));
+  return asynError;
 }
 
 /* Read a double parameter from the SCU (nothing to do with asyn's parameter library).
@@ -254,19 +556,26 @@ SmarActSCUAxis::getDoubleVal(const char *parm_cmd, double *val_p)
   char       cmd[REP_LEN];
   char       param[REP_LEN];
   int        axis;
+  const char *p;
   asynStatus status;
 
   epicsSnprintf(toController_, sizeof(toController_), ":%s%u", parm_cmd, this->channel_);
   status = sendCmd();
   if (status)
     return status;
-  if (4 != sscanf(fromController_, ":%10[A-Z]%i%10[A-Z]%lf", cmd, &axis, param, val_p)) {
-    asynPrint(pasynUser_, ASYN_TRACE_ERROR, "getDoubleVal:ERROR parsing response %s\n", fromController_);
-    return asynError;
-  }
+  p = fromController_;
+  if (parseHeader(&p, cmd, sizeof(cmd), &axis))
+    goto malformed;
   if ('E' == cmd[0])
     return asynError;
+  if (smarActParseUpper(&p, param, sizeof(param)) || smarActParseDouble(&p, val_p))
+    goto malformed;
   return asynSuccess;
+
+malformed:
+  asynPrint(pasynUser_, ASYN_TRACE_ERROR, "getDoubleVal:ERROR parsing response %s at column %d\n",
+            fromController_, (int)(p - fromController_));
+  return asynError;
 }
 
 /* Read a char parameter from the SCU (nothing to do with asyn's parameter library).
@@ -281,19 +590,27 @@ SmarActSCUAxis::getCharVal(const char *parm_cmd, char *val_p)
 {
   char       cmd[REP_LEN];
   int        axis;
+  const char *p;
   asynStatus status;
 
   epicsSnprintf(toController_, sizeof(toController_), ":%s%u", parm_cmd, this->channel_);
   status = sendCmd();
   if (status)
     return status;
-  if (3 != sscanf(fromController_, ":%10[A-Z]%i%c", cmd, &axis, val_p)) {
-    asynPrint(pasynUser_, ASYN_TRACE_ERROR, "getCharVal:ERROR parsing response %s\n", fromController_);
-    return asynError;
-  }
+  p = fromController_;
+  if (parseHeader(&p, cmd, sizeof(cmd), &axis))
+    goto malformed;
   if ('E' == cmd[0])
     return asynError;
+  if (!*p)
+    goto malformed;
+  *val_p = *p;
   return asynSuccess;
+
+malformed:
+  asynPrint(pasynUser_, ASYN_TRACE_ERROR, "getCharVal:ERROR parsing response %s at column %d\n",
+            fromController_, (int)(p - fromController_));
+  return asynError;
 }
 
 /* Read the position of rotation stage
@@ -308,30 +625,127 @@ SmarActSCUAxis::getAngle(double *val_p, int *rev_p)
 {
   asynStatus status;
   int        axis;
+  const char *p;
 
   epicsSnprintf(toController_, sizeof(toController_), ":GA%u", this->channel_);
   status = sendCmd();
   if (status)
     return status;
 
-  if (4 != sscanf(fromController_, ":A%iA%lfR%i", &axis, val_p, rev_p)) {
-    asynPrint(pasynUser_, ASYN_TRACE_ERROR, "getAngle:ERROR parsing response %s\n", fromController_);
+  p = fromController_;
+  if (    smarActParseChar(&p, ':')
+       || smarActParseChar(&p, 'A')
+       || smarActParseInt(&p, &axis)
+       || smarActParseChar(&p, 'A')
+       || smarActParseDouble(&p, val_p)
+       || smarActParseChar(&p, 'R')
+       || smarActParseInt(&p, rev_p)) {
+    asynPrint(pasynUser_, ASYN_TRACE_ERROR, "getAngle:ERROR parsing response %s at column %d\n",
+              fromController_, (int)(p - fromController_));
     return asynError;
   }
 
   return asynSuccess;
 }
 
+/* Return 1 if the 'physical position known' flag must be read in this poll cycle */
+int
+SmarActSCUAxis::ppkStale()
+{
+  epicsTimeStamp now;
+
+  if (!ppkValid_)
+    return 1;
+  epicsTimeGetCurrent(&now);
+  return epicsTimeDiffInSeconds(&now, &ppkTime_) >= PPK_REFRESH_PERIOD;
+}
+
+/* Ask for the position, moving status and physical position known flag
+ * with one chained command ":GP0:M0:GPPK0" and keep the replies, sendCmd()
+ * takes them like replies the controller read ahead.
+ * If the replies can't be assigned, poll() sends the queries one by one: the
+ * lines after the first one are only waited for SMARACT_CHAIN_READ_TIMEOUT and
+ * an error reply ends the chain. After SMARACT_CHAIN_MAX_FAILURES of these in a
+ * row the axis no longer chains its queries.
+ */
+asynStatus
+SmarActSCUAxis::chainedPoll()
+{
+  size_t     got;
+  size_t     more;
+  int        eomReason;
+  asynStatus status;
+
+  prefetch_.clear();
+  prefetch_.queue(isRot_ ? ":GA%u" : ":GP%u", channel_);
+  prefetch_.queue(":M%u", channel_);
+  if (ppkStale())
+    prefetch_.queue(":GPPK%u", channel_);
+  if (!prefetch_.chain(toController_, sizeof(toController_))) {
+    prefetch_.clear();
+    return asynSuccess;
+  }
+  status = pC_->writeReadController(toController_, fromController_, sizeof(fromController_) - 1, &got, DEFAULT_TIMEOUT);
+  if (status) {
+    asynPrint(pasynUser_, ASYN_TRACE_ERROR, "ERROR: chainedPoll: status=%d, sent: %s\n", status, toController_);
+    prefetch_.clear();
+    return status;
+  }
+  fromController_[got] = 0;
+  // The controller may send each reply on a line of its own
+  while (SmarActPrefetch::numReplies(fromController_) < prefetch_.size() && !SmarActPrefetch::hasError(fromController_)
+         && got < sizeof(fromController_) - 1) {
+    if (pasynOctetSyncIO->read(pC_->pasynUserController_, &fromController_[got], sizeof(fromController_) - 1 - got,
+                               SMARACT_CHAIN_READ_TIMEOUT, &more, &eomReason))
+      break;
+    got += more;
+    fromController_[got] = 0;
+  }
+  asynPrint(pasynUser_, ASYN_TRACEIO_DRIVER, "chainedPoll: sent: %s, received: %s\n", toController_, fromController_);
+  if (SmarActPrefetch::hasError(fromController_) || !prefetch_.split(fromController_)) {
+    // Lines that are still on their way must not be taken for replies to the single queries
+    pasynOctetSyncIO->flush(pC_->pasynUserController_);
+    prefetch_.clear();
+    if (++chainFailures_ >= SMARACT_CHAIN_MAX_FAILURES)
+      asynPrint(pasynUser_, ASYN_TRACE_ERROR, "chainedPoll: axis %d polls with single queries, unexpected reply %s\n",
+                axisNo_, fromController_);
+    else
+      asynPrint(pasynUser_, ASYN_TRACE_ERROR, "chainedPoll: unexpected reply %s\n", fromController_);
+    return asynSuccess;
+  }
+  chainFailures_ = 0;
+  return asynSuccess;
+}
+
 asynStatus
 SmarActSCUAxis::poll(bool *moving_p)
 {
 double                 doubleVal;
+double                 pos;
 int                    integerVal;
 char                   charVal;
 double                 angle;
 int                    rev;
 enum SmarActSCUStatus  movingStatus;
 
+  if ( !pC_->scheduler_->due(axisNo_) ) {
+    *moving_p = pC_->scheduler_->skipped(axisNo_);
+    return asynSuccess;
+  }
+
+  // Capabilities from the cache are checked before the position is read with them
+  if (1 == verifyCaps_) {
+    if ((comStatus_ = verifyCaps()))
+      goto bail;
+    verifyCaps_ = 2;
+  }
+
+  // Replies the controller read ahead take precedence
+  if (SMARACT_POLL_CHAINED == pC_->pollMode_ && chainFailures_ < SMARACT_CHAIN_MAX_FAILURES && prefetch_.empty()) {
+    if ((comStatus_ = chainedPoll()))
+      goto bail;
+  }
+
   if (isRot_) {
     if ((comStatus_ = getAngle(&angle, &rev)))
       goto bail;
@@ -343,8 +757,7 @@ enum SmarActSCUStatus  movingStatus;
       goto bail;
   }
 
-  setDoubleParam(pC_->motorEncoderPosition_, (doubleVal+positionOffset_)*STEPS_PER_EGU);
-  setDoubleParam(pC_->motorPosition_, (doubleVal+positionOffset_)*STEPS_PER_EGU);
+  pos = (doubleVal+positionOffset_)*STEPS_PER_EGU;
 #ifdef DEBUG
   printf("POLL (position %f)", doubleVal);
 #endif
@@ -354,6 +767,13 @@ enum SmarActSCUStatus  movingStatus;
 
   movingStatus = parseMovingStatus(charVal);
 
+  if (verifyCaps_) {
+    // still holding from a previous life, see the constructor
+    if (Holding == movingStatus)
+      holdTime_ = HOLD_FOREVER;
+    verifyCaps_ = 0;
+  }
+
   switch (movingStatus) {
     default:
       *moving_p = false;
@@ -376,22 +796,44 @@ enum SmarActSCUStatus  movingStatus;
     break;
   }
 
+  // A move sent while the lock was released for this poll isn't in the replies yet
+  if (pC_->scheduler_->stale(axisNo_))
+    *moving_p = true;
+
   setIntegerParam(pC_->motorStatusDone_, ! *moving_p );
+  // After done is known, the first position after a move passes the deadbands
+  if (pC_->deadbands_.pass(axisNo_, SmarActReadbackEnc, pos, !*moving_p))
+    setDoubleParam(pC_->motorEncoderPosition_, pos);
+  if (pC_->deadbands_.pass(axisNo_, SmarActReadbackPos, pos, !*moving_p))
+    setDoubleParam(pC_->motorPosition_, pos);
 
+  // A finished reference search (or any other move) may have changed it
+  if (wasMoving_ && !*moving_p)
+    ppkValid_ = 0;
+  wasMoving_ = *moving_p;
 
   /* Check if the sensor 'knows' absolute position and
    * update the MSTA 'HOMED' bit.
    */
-  if ((comStatus_ = getIntegerVal("GPPK", &integerVal)))
-    goto bail;
+  if (ppkStale()) {
+    if ((comStatus_ = getIntegerVal("GPPK", &integerVal)))
+      goto bail;
+    ppk_      = integerVal;
+    ppkValid_ = 1;
+    epicsTimeGetCurrent(&ppkTime_);
+  }
 
-  setIntegerParam(pC_->motorStatusHomed_, integerVal ? 1 : 0 );
+  setIntegerParam(pC_->motorStatusHomed_, ppk_ ? 1 : 0 );
 
 #ifdef DEBUG
   printf(" status %u", status);
 #endif
 
 bail:
+  /* Replies that were read ahead are only valid for this poll cycle */
+  prefetch_.clear();
+  if ( comStatus_ )
+    ppkValid_ = 0;
   setIntegerParam(pC_->motorStatusProblem_,    comStatus_ ? 1 : 0 );
   setIntegerParam(pC_->motorStatusCommsError_, comStatus_ ? 1 : 0 );
 #ifdef DEBUG
@@ -399,6 +841,7 @@ bail:
 #endif
 
   callParamCallbacks();
+  *moving_p = pC_->scheduler_->polled(axisNo_, *moving_p);
 
   return comStatus_;
 }
@@ -419,6 +862,7 @@ SmarActSCUAxis::move(double position, int relative, double min_vel, double max_v
 
   rpos = (position / STEPS_PER_EGU) - positionOffset_;
 
+  pC_->scheduler_->kick(axisNo_);
   if ( isRot_ ) {
     angle = (long)rpos % UDEG_PER_REV;
     rev = (int)(rpos / UDEG_PER_REV);
@@ -426,23 +870,13 @@ SmarActSCUAxis::move(double position, int relative, double min_vel, double max_v
       angle += UDEG_PER_REV;
       rev -= 1;
     }
-    if (relative) {
-      epicsSnprintf(toController_, sizeof(toController_), ":MAR%uA%.3fR%dH%d:GP%u", this->channel_, angle, rev, holdTime_, this->channel_);
-      comStatus_ = sendCmd();
-    }
-    else {
-      epicsSnprintf(toController_, sizeof(toController_), ":MAA%uA%.3fR%dH%d:GP%u", this->channel_, angle, rev, holdTime_, this->channel_);
-      comStatus_ = sendCmd();
-    }
+    comStatus_ = sendCmd(SmarActSCUCommand().add(relative ? SmarActCmdMoveAngleRelative : SmarActCmdMoveAngleAbsolute,
+                                                 channel_, angle, rev, holdTime_)
+                                            .add(SmarActCmdGetPosition, channel_));
   } else {
-    if (relative) {
-      epicsSnprintf(toController_, sizeof(toController_), ":MPR%uP%.3fH%d:GP%u", this->channel_, rpos, holdTime_, this->channel_);
-      comStatus_ = sendCmd();
-    }
-    else {
-      epicsSnprintf(toController_, sizeof(toController_), ":MPA%uP%.3fH%d:GP%u", this->channel_, rpos, holdTime_, this->channel_);
-      comStatus_ = sendCmd();
-    }
+    comStatus_ = sendCmd(SmarActSCUCommand().add(relative ? SmarActCmdMoveRelative : SmarActCmdMoveAbsolute,
+                                                 channel_, rpos, holdTime_)
+                                            .add(SmarActCmdGetPosition, channel_));
   }
 
   if (comStatus_) {
@@ -463,8 +897,10 @@ SmarActSCUAxis::home(double min_vel, double max_vel, double accel, int forwards)
   /* cache 'closed-loop' setting until next move */
   holdTime_  = getClosedLoop() ? HOLD_FOREVER : 0;
 
-  epicsSnprintf(toController_, sizeof(toController_), ":MTR%uH%dZ0:GP%u", this->channel_, holdTime_, this->channel_);
-  comStatus_ = sendCmd();
+  ppkValid_ = 0;
+  pC_->scheduler_->kick(axisNo_);
+  comStatus_ = sendCmd(SmarActSCUCommand().add(SmarActCmdFindReference, channel_, holdTime_, 0)
+                                          .add(SmarActCmdGetPosition, channel_));
 
   if (comStatus_) {
     setIntegerParam(pC_->motorStatusProblem_, 1);
@@ -481,8 +917,14 @@ SmarActSCUAxis::stop(double acceleration)
 #ifdef DEBUG
   printf("Stop\n");
 #endif
-  epicsSnprintf(toController_, sizeof(toController_), ":S%u:GP%u", this->channel_, this->channel_);
-  comStatus_ = sendCmd();
+  pC_->scheduler_->kick(axisNo_);
+  SmarActSCUCommand cmd;
+  cmd.add(SmarActCmdStop, channel_).add(SmarActCmdGetPosition, channel_);
+  // The express lane goes ahead of the poll queries the transport has queued
+  if (pC_->transport_->isConnected())
+    comStatus_ = pC_->transport_->express(cmd.str(), fromController_, sizeof(fromController_), DEFAULT_TIMEOUT);
+  else
+    comStatus_ = sendCmd(cmd);
 
   if (comStatus_) {
     setIntegerParam(pC_->motorStatusProblem_, 1);
@@ -530,8 +972,9 @@ static const iocshArg cc_a1 = {"I/O port name [string]",           iocshArgStrin
 static const iocshArg cc_a2 = {"Number of axes [int]",             iocshArgInt};
 static const iocshArg cc_a3 = {"Moving poll period (s) [double]",  iocshArgDouble};
 static const iocshArg cc_a4 = {"Idle poll period (s) [double]",    iocshArgDouble};
+static const iocshArg cc_a5 = {"Fast startup [int]",               iocshArgInt};
 
-static const iocshArg * const cc_as[] = {&cc_a0, &cc_a1, &cc_a2, &cc_a3, &cc_a4};
+static const iocshArg * const cc_as[] = {&cc_a0, &cc_a1, &cc_a2, &cc_a3, &cc_a4, &cc_a5};
 
 static const iocshFuncDef cc_def = {"smarActSCUCreateController", sizeof(cc_as)/sizeof(cc_as[0]), cc_as};
 
@@ -541,7 +984,8 @@ smarActSCUCreateController(
   const char *ioPortName,
   int         numAxes,
   double      movingPollPeriod,
-  double      idlePollPeriod)
+  double      idlePollPeriod,
+  int         fastStartup)
 {
 void *rval = 0;
   // the asyn stuff doesn't seem to be prepared for exceptions. I get segfaults
@@ -550,7 +994,7 @@ void *rval = 0;
 #ifdef ASYN_CANDO_EXCEPTIONS
   try {
 #endif
-    rval = new SmarActSCUController(motorPortName, ioPortName, numAxes, movingPollPeriod, idlePollPeriod);
+    rval = new SmarActSCUController(motorPortName, ioPortName, numAxes, movingPollPeriod, idlePollPeriod, fastStartup);
 #ifdef ASYN_CANDO_EXCEPTIONS
   } catch (SmarActSCUException &e) {
     epicsPrintf("smarActSCUCreateController failed (exception caught):\n%s\n", e.what());
@@ -568,25 +1012,28 @@ static void cc_fn(const iocshArgBuf *args)
     args[1].sval,
     args[2].ival,
     args[3].dval,
-    args[4].dval);
+    args[4].dval,
+    args[5].ival);
 }
 
 
 static const iocshArg ca_a0 = {"Controller Port name [string]",    iocshArgString};
 static const iocshArg ca_a1 = {"Axis number [int]",                iocshArgInt};
 static const iocshArg ca_a2 = {"Channel [int]",                    iocshArgInt};
+static const iocshArg ca_a3 = {"Axis type [int]",                  iocshArgInt};
 
-static const iocshArg * const ca_as[] = {&ca_a0, &ca_a1, &ca_a2};
+static const iocshArg * const ca_as[] = {&ca_a0, &ca_a1, &ca_a2, &ca_a3};
 
 /* iocsh wrapping and registration business (stolen from ACRMotorDriver.cpp) */
 /* smarActSCUCreateAxis called to create each axis of the smarActSCU controller*/
-static const iocshFuncDef ca_def = {"smarActSCUCreateAxis", 3, ca_as};
+static const iocshFuncDef ca_def = {"smarActSCUCreateAxis", 4, ca_as};
 
 extern "C" void *
 smarActSCUCreateAxis(
   const char *controllerPortName,
   int        axisNumber,
-  int        channel)
+  int        channel,
+  int        type)
 {
 void *rval = 0;
 
@@ -617,7 +1064,7 @@ asynMotorAxis *pAsynAxis;
       return rval;
     }
     pC->lock();
-    new SmarActSCUAxis(pC, axisNumber, channel);
+    new SmarActSCUAxis(pC, axisNumber, channel, type);
     pC->unlock();
 
 #ifdef ASYN_CANDO_EXCEPTIONS
@@ -633,6 +1080,109 @@ asynMotorAxis *pAsynAxis;
 static void ca_fn(const iocshArgBuf *args)
 {
   smarActSCUCreateAxis(
+    args[0].sval,
+    args[1].ival,
+    args[2].ival,
+    args[3].ival);
+}
+
+static const iocshArg pd_a0 = {"Controller Port name [string]",    iocshArgString};
+static const iocshArg pd_a1 = {"Pipeline depth [int]",             iocshArgInt};
+
+static const iocshArg * const pd_as[] = {&pd_a0, &pd_a1};
+
+/* smarActSCUSetPipelineDepth: number of poll queries on the link at once, 1 (default) disables pipelining */
+static const iocshFuncDef pd_def = {"smarActSCUSetPipelineDepth", 2, pd_as};
+
+extern "C" int
+smarActSCUSetPipelineDepth(
+  const char *controllerPortName,
+  int        depth)
+{
+SmarActSCUController *pC;
+
+  pC = (SmarActSCUController*) findAsynPortDriver(controllerPortName);
+  if (!pC) {
+    printf("smarActSCUSetPipelineDepth: Error port %s not found\n", controllerPortName);
+    return -1;
+  }
+  pC->lock();
+  pC->setPipelineDepth(depth);
+  pC->unlock();
+  return 0;
+}
+
+static void pd_fn(const iocshArgBuf *args)
+{
+  smarActSCUSetPipelineDepth(
+    args[0].sval,
+    args[1].ival);
+}
+
+static const iocshArg pm_a0 = {"Controller Port name [string]",    iocshArgString};
+static const iocshArg pm_a1 = {"Poll mode [int]",                  iocshArgInt};
+
+static const iocshArg * const pm_as[] = {&pm_a0, &pm_a1};
+
+/* smarActSCUSetPollMode: 0 (default) one command per value, 1 all values of an axis with one chained command */
+static const iocshFuncDef pm_def = {"smarActSCUSetPollMode", 2, pm_as};
+
+extern "C" int
+smarActSCUSetPollMode(
+  const char *controllerPortName,
+  int        mode)
+{
+SmarActSCUController *pC;
+
+  pC = (SmarActSCUController*) findAsynPortDriver(controllerPortName);
+  if (!pC) {
+    printf("smarActSCUSetPollMode: Error port %s not found\n", controllerPortName);
+    return -1;
+  }
+  pC->lock();
+  pC->setPollMode(mode);
+  pC->unlock();
+  return 0;
+}
+
+static void pm_fn(const iocshArgBuf *args)
+{
+  smarActSCUSetPollMode(
+    args[0].sval,
+    args[1].ival);
+}
+
+static const iocshArg ap_a0 = {"Controller Port name [string]",    iocshArgString};
+static const iocshArg ap_a1 = {"Axis number [int]",                iocshArgInt};
+static const iocshArg ap_a2 = {"Priority [int]",                   iocshArgInt};
+
+static const iocshArg * const ap_as[] = {&ap_a0, &ap_a1, &ap_a2};
+
+/* smarActSCUSetAxisPriority: 0 low, 1 normal (scheduled), 2 high (default, polled every cycle) */
+static const iocshFuncDef ap_def = {"smarActSCUSetAxisPriority", 3, ap_as};
+
+extern "C" int
+smarActSCUSetAxisPriority(
+  const char *controllerPortName,
+  int        axisNumber,
+  int        priority)
+{
+SmarActSCUController *pC;
+
+  pC = (SmarActSCUController*) findAsynPortDriver(controllerPortName);
+  if (!pC) {
+    printf("smarActSCUSetAxisPriority: Error port %s not found\n", controllerPortName);
+    return -1;
+  }
+  pC->lock();
+  pC->setAxisPriority(axisNumber, priority);
+  pC->unlock();
+  return 0;
+}
+
+static void ap_fn(const iocshArgBuf *args)
+{
+  smarActSCUSetAxisPriority(
     args[0].sval,
     args[1].ival,
     args[2].ival);
@@ -642,6 +1192,9 @@ static void smarActSCUMotorRegister(void)
 {
   iocshRegister(&cc_def, cc_fn);  // smarActSCUCreateController
   iocshRegister(&ca_def, ca_fn);  // smarActSCUCreateAxis
+  iocshRegister(&pd_def, pd_fn);  // smarActSCUSetPipelineDepth
+  iocshRegister(&pm_def, pm_fn);  // smarActSCUSetPollMode
+  iocshRegister(&ap_def, ap_fn);  // smarActSCUSetAxisPriority
 }
 
 extern "C" {
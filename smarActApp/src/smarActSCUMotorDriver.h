@@ -11,6 +11,11 @@
 
 #include <asynMotorController.h>
 #include <asynMotorAxis.h>
+#include <smarActTransport.h>
+#include <smarActIoStats.h>
+#include <smarActDeadband.h>
+#include <smarActPollScheduler.h>
+#include <smarActProtocol.h>
 #include <stdarg.h>
 #include <exception>
 
@@ -40,10 +45,12 @@ protected:
 };
 
 
+typedef SmarActCommand<SmarActSCUProtocol> SmarActSCUCommand;
+
 class SmarActSCUAxis : public asynMotorAxis
 {
 public:
-  SmarActSCUAxis(class SmarActSCUController *cnt_p, int axis, int channel);
+  SmarActSCUAxis(class SmarActSCUController *cnt_p, int axis, int channel, int type = SMARACT_AXIS_PROBE);
   asynStatus  poll(bool *moving_p);
   asynStatus  move(double position, int relative, double min_vel, double max_vel, double accel);
   asynStatus  home(double min_vel, double max_vel, double accel, int forwards);
@@ -61,6 +68,10 @@ public:
 
 protected:
   asynStatus setSpeed(double velocity);
+  asynStatus chainedPoll();
+  void       probe(int type);
+  void       detect();
+  asynStatus verifyCaps();
 
 private:
   SmarActSCUController   *pC_;  // pointer to asynMotorController for this axis
@@ -70,10 +81,19 @@ private:
   int                    channel_;
   int                    positionerType_;
   int                    isRot_;
+  int                    verifyCaps_; // capabilities from the cache, 1: check them, 2: check the holding state
   double                 positionOffset_;
   asynStatus             sendCmd();
+  asynStatus             sendCmd(const SmarActSCUCommand &cmd);
   char toController_[MAX_CONTROLLER_STRING_SIZE];
   char fromController_[MAX_CONTROLLER_STRING_SIZE];
+  SmarActPrefetch        prefetch_; // poll replies read by SmarActSCUController::poll()
+  int                    chainFailures_; // chained polls that failed in a row, see SMARACT_CHAIN_MAX_FAILURES
+  int                    ppk_;       // physical position known, refreshed by poll() when ppkStale()
+  int                    ppkValid_;
+  epicsTimeStamp         ppkTime_;
+  bool                   wasMoving_;
+  int                    ppkStale();
 
 friend class SmarActSCUController;
 };
@@ -81,15 +101,36 @@ friend class SmarActSCUController;
 class SmarActSCUController : public asynMotorController
 {
 public:
-  SmarActSCUController(const char *portName, const char *IOPortName, int numAxes, double movingPollPeriod, double idlePollPeriod);
+  SmarActSCUController(const char *portName, const char *IOPortName, int numAxes, double movingPollPeriod, double idlePollPeriod, int fastStartup = 0);
 
   static int parseIntegerReply(const char *reply, int *ax_p, int *val_p);
   static int parseAngle(const char *reply, int *ax_p, int *val_p, int *rot_p);
 
+  virtual asynStatus poll();
+  virtual void report(FILE *fp, int level);
+  void setPipelineDepth(int depth);
+  void setPollMode(int mode);
+  void setAxisPriority(int axis, int priority);
+
+  /* Time every exchange with the controller */
+  using asynMotorController::writeController;
+  using asynMotorController::writeReadController;
+  virtual asynStatus writeController(const char *output, double timeout);
+  virtual asynStatus writeReadController(const char *output, char *response, size_t maxResponseLen, size_t *responseLen, double timeout);
+  asynStatus writeReadReleased(const char *output, char *response, size_t maxResponseLen, size_t *responseLen, double timeout);
+
 protected:
   SmarActSCUAxis **pAxes_;
 
 private:
+  asynUser         *pasynUserPoll_;  // of the poller while the lock is released
+  int               fastStartup_;
+  int               pollMode_;
+  SmarActTransport *transport_;
+  SmarActRequest   *pollRequests_;
+  SmarActIoStats    ioStats_;
+  SmarActDeadbands  deadbands_;
+  SmarActPollScheduler *scheduler_;
 friend class SmarActSCUAxis;
 };
 
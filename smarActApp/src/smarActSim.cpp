@@ -0,0 +1,889 @@
+/* Simulated smarAct controller and benchmark, for the smarAct MCS, MCS2 and SCU drivers */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <math.h>
+
+#include <iocsh.h>
+#include <asynPortDriver.h>
+#include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsStdio.h>
+#include <epicsString.h>
+#include <epicsExport.h>
+
+#include "smarActSim.h"
+#include "smarActIoStats.h"
+#include "smarActParse.h"
+#include "smarActMCS2MotorDriver.h"
+
+/* MCS error codes of the replies */
+#define MCS_ERR_COMMAND       2    /* invalid command */
+#define MCS_ERR_PARAMS        5    /* too few parameters */
+#define MCS_ERR_CHANNEL       7    /* invalid channel index */
+#define MCS_ERR_SENSOR        143  /* wrong sensor type, GA of a linear sensor */
+
+/* MCS and SCU hold time that never ends, in ms */
+#define SIM_HOLD_FOREVER      60000
+
+/* MCS and MCS2 full step amplitude */
+#define MCS_MAX_AMPLITUDE     4095
+#define MCS2_MAX_AMPLITUDE    65535
+
+/* Largest MCS2 :HOLD value that is a time, 0xffffffff holds forever */
+#define MCS2_HOLD_MAX         4294967294.0
+
+/* snprintf() that returns the length of what fits */
+static size_t
+put(char *buf, size_t size, const char *fmt, ...)
+{
+va_list ap;
+int     len;
+
+  if ( !size )
+    return 0;
+  va_start(ap, fmt);
+  len = epicsVsnprintf(buf, size, fmt, ap);
+  va_end(ap);
+  if ( len < 0 )
+    return 0;
+  return (size_t)len < size ? (size_t)len : size - 1;
+}
+
+/* MCS and SCU hold time in ms -> s, < 0 forever */
+static double
+holdSeconds(double ms)
+{
+  return ms >= SIM_HOLD_FOREVER ? -1.0 : (ms > 0.0 ? 1.0e-3 * ms : 0.0);
+}
+
+SmarActSim::SmarActSim(const char *portName, SmarActSimProtocol protocol, int numAxes,
+                       double latency, double jitter, double commandTime)
+  : asynPortDriver(portName, 1, asynOctetMask | asynDrvUserMask, 0, ASYN_CANBLOCK, 1, 0, 0),
+    protocol_(protocol), numAxes_(numAxes), latency_(latency), jitter_(jitter), commandTime_(commandTime),
+    seed_(1), head_(0), numReplies_(0), numErrors_(0), numWrites_(0), numCommands_(0),
+    numUnknown_(0), numDropped_(0), numTimeouts_(0)
+{
+int i;
+
+  memset(axes_, 0, sizeof(axes_));
+  for ( i = 0; i < SMARACT_SIM_MAX_AXES; i++ ) {
+    axes_[i].state    = SimIdle;
+    axes_[i].holdTime = -1.0;
+    axes_[i].ampl     = SmarActSimMCS == protocol ? MCS_MAX_AMPLITUDE : MCS2_MAX_AMPLITUDE;
+    axes_[i].ptyp     = SmarActSimMCS2 == protocol ? 300 : 1;
+    axes_[i].mclf     = 18500;
+  }
+  replies_ = new Reply[SMARACT_SIM_QUEUE_SIZE];
+  epicsTimeGetCurrent(&now_);
+  busyUntil_ = now_;
+  lastReady_ = now_;
+  for ( i = 0; i < SMARACT_SIM_MAX_AXES; i++ )
+    axes_[i].t0 = now_;
+}
+
+SmarActSim::~SmarActSim()
+{
+  delete [] replies_;
+}
+
+double
+SmarActSim::defaultSpeed() const
+{
+  switch ( protocol_ ) {
+  case SmarActSimMCS:  return SMARACT_SIM_SPEED_MCS;
+  case SmarActSimSCU:  return SMARACT_SIM_SPEED_SCU;
+  default:             return SMARACT_SIM_SPEED_MCS2;
+  }
+}
+
+/* 0 <= random() < 1, the same sequence on every start */
+double
+SmarActSim::random()
+{
+  seed_ = seed_ * 1103515245u + 12345u;
+  return ((seed_ >> 16) & 0x7fff) / 32768.0;
+}
+
+/* The axis of a channel, brought up to the time of the current write; 0 if there is none */
+SmarActSim::Axis *
+SmarActSim::axis(int channel)
+{
+  if ( channel < 0 || channel >= numAxes_ )
+    return 0;
+  update(&axes_[channel]);
+  return &axes_[channel];
+}
+
+/* Advance the motion of the axis to now_ */
+void
+SmarActSim::update(Axis *pAxis)
+{
+double dt = epicsTimeDiffInSeconds(&now_, &pAxis->t0);
+
+  switch ( pAxis->state ) {
+  case SimTargeting:
+  case SimStepping:
+  case SimReferencing:
+  case SimCalibrating:
+    if ( pAxis->duration > 0.0 && dt < pAxis->duration ) {
+      pAxis->pos = pAxis->start + (pAxis->target - pAxis->start) * dt / pAxis->duration;
+      return;
+    }
+    pAxis->pos = pAxis->target;
+    if ( SimReferencing == pAxis->state )
+      pAxis->referenced = 1;
+    if ( SimCalibrating == pAxis->state )
+      pAxis->calibrated = 1;
+    if ( SimTargeting != pAxis->state || 0.0 == pAxis->holdTime ) {
+      pAxis->state = SimIdle;
+      return;
+    }
+    // Holding from the arrival on
+    epicsTimeAddSeconds(&pAxis->t0, pAxis->duration);
+    dt -= pAxis->duration;
+    pAxis->state = SimHolding;
+    /* fall through */
+  case SimHolding:
+    if ( pAxis->holdTime >= 0.0 && dt >= pAxis->holdTime )
+      pAxis->state = SimIdle;
+    break;
+  default:
+    break;
+  }
+}
+
+void
+SmarActSim::startMotion(Axis *pAxis, State state, double target, double duration)
+{
+  pAxis->state    = state;
+  pAxis->start    = pAxis->pos;
+  pAxis->target   = target;
+  pAxis->duration = duration;
+  pAxis->t0       = now_;
+}
+
+/* Closed loop move */
+void
+SmarActSim::moveTo(Axis *pAxis, double target, double holdTime)
+{
+double speed = pAxis->speed > 0.0 ? pAxis->speed : defaultSpeed();
+
+  pAxis->holdTime = holdTime;
+  startMotion(pAxis, SimTargeting, target, fabs(target - pAxis->pos) / speed);
+}
+
+void
+SmarActSim::stopAxis(Axis *pAxis)
+{
+  pAxis->state  = SimIdle;
+  pAxis->target = pAxis->pos;
+}
+
+/* Put a reply on the link behind the ones already there */
+void
+SmarActSim::queue(const char *text, size_t len)
+{
+Reply *pReply;
+
+  if ( numReplies_ >= SMARACT_SIM_QUEUE_SIZE ) {
+    numDropped_++;
+    return;
+  }
+  pReply = &replies_[(head_ + numReplies_) % SMARACT_SIM_QUEUE_SIZE];
+  pReply->ready = busyUntil_;
+  epicsTimeAddSeconds(&pReply->ready, latency_ + jitter_ * random());
+  if ( epicsTimeDiffInSeconds(&pReply->ready, &lastReady_) < 0.0 )
+    pReply->ready = lastReady_;
+  lastReady_     = pReply->ready;
+  pReply->len    = len < sizeof(pReply->text) ? len : sizeof(pReply->text) - 1;
+  pReply->offset = 0;
+  memcpy(pReply->text, text, pReply->len);
+  numReplies_++;
+}
+
+/* One MCS command, ":<letters><channel>[,<arg>...]".
+ *
+ * RETURNS:  the length of its reply line
+ */
+size_t
+SmarActSim::executeMCS(const char *command, char *reply, size_t size)
+{
+const char *p = command;
+char        cmd[8];
+int         ch = -1;
+long long   args[4];
+int         numArgs = 0;
+int         status;
+Axis       *pAxis;
+
+  if ( smarActParseChar(&p, ':') || smarActParseUpper(&p, cmd, sizeof(cmd)) || smarActParseInt(&p, &ch) ) {
+    numUnknown_++;
+    return put(reply, size, ":E%d,%d", ch, MCS_ERR_COMMAND);
+  }
+  while ( numArgs < 4 && !smarActParseChar(&p, ',') && !smarActParseInt64(&p, &args[numArgs]) )
+    numArgs++;
+  if ( !(pAxis = axis(ch)) )
+    return put(reply, size, ":E%d,%d", ch, MCS_ERR_CHANNEL);
+
+  if ( 0 == strcmp(cmd, "GP") )
+    return put(reply, size, ":P%d,%.0f", ch, pAxis->pos);
+  if ( 0 == strcmp(cmd, "GS") ) {
+    switch ( pAxis->state ) {
+    case SimTargeting:   status = 4; break;
+    case SimStepping:    status = 1; break;
+    case SimHolding:     status = 3; break;
+    case SimCalibrating: status = 6; break;
+    case SimReferencing: status = 7; break;
+    default:             status = 0; break;
+    }
+    return put(reply, size, ":S%d,%d", ch, status);
+  }
+  if ( 0 == strcmp(cmd, "GPPK") )
+    return put(reply, size, ":PPK%d,%d", ch, pAxis->referenced);
+  if ( 0 == strcmp(cmd, "GCLS") )
+    return put(reply, size, ":CLS%d,%.0f", ch, pAxis->speed);
+  if ( 0 == strcmp(cmd, "GST") )
+    return put(reply, size, ":ST%d,%d", ch, pAxis->ptyp);
+  if ( 0 == strcmp(cmd, "GA") || 0 == strcmp(cmd, "MAA") || 0 == strcmp(cmd, "MAR") )
+    return put(reply, size, ":E%d,%d", ch, MCS_ERR_SENSOR);
+
+  if ( 0 == strcmp(cmd, "MPA") || 0 == strcmp(cmd, "MPR") ) {
+    if ( numArgs < 1 )
+      return put(reply, size, ":E%d,%d", ch, MCS_ERR_PARAMS);
+    moveTo(pAxis, ('R' == cmd[2] ? pAxis->pos : 0.0) + args[0], holdSeconds(numArgs > 1 ? args[1] : 0));
+  } else if ( 0 == strcmp(cmd, "MST") ) {
+    double freq;
+    if ( numArgs < 3 )
+      return put(reply, size, ":E%d,%d", ch, MCS_ERR_PARAMS);
+    freq = args[2] > 0 ? (double)args[2] : SMARACT_SIM_STEP_FREQ;
+    startMotion(pAxis, SimStepping, pAxis->pos + args[0] * SMARACT_SIM_STEP_MCS * args[1] / MCS_MAX_AMPLITUDE,
+                fabs((double)args[0]) / freq);
+  } else if ( 0 == strcmp(cmd, "SCLS") ) {
+    if ( numArgs < 1 )
+      return put(reply, size, ":E%d,%d", ch, MCS_ERR_PARAMS);
+    pAxis->speed = (double)args[0];
+  } else if ( 0 == strcmp(cmd, "FRM") ) {
+    startMotion(pAxis, SimReferencing, 0.0, fabs(pAxis->pos) / defaultSpeed());
+  } else if ( 0 == strcmp(cmd, "S") ) {
+    stopAxis(pAxis);
+  } else if ( 0 == strcmp(cmd, "SP") ) {
+    if ( numArgs < 1 )
+      return put(reply, size, ":E%d,%d", ch, MCS_ERR_PARAMS);
+    stopAxis(pAxis);
+    pAxis->pos = pAxis->target = (double)args[0];
+  } else {
+    numUnknown_++;
+    return put(reply, size, ":E%d,%d", ch, MCS_ERR_COMMAND);
+  }
+  return put(reply, size, ":E%d,0", ch);
+}
+
+/* One SCU command, ":<letters><channel>[<param letters><value>...]".
+ *
+ * RETURNS:  the length of its reply, 0 for moves
+ */
+size_t
+SmarActSim::executeSCU(const char *command, char *reply, size_t size)
+{
+const char *p = command;
+char        cmd[8];
+char        names[4][4];
+double      vals[4];
+double      hold = 0.0;
+double      pos = 0.0;
+int         havePos = 0;
+int         ch = -1;
+int         n = 0;
+int         i;
+char        status;
+Axis       *pAxis;
+
+  if ( smarActParseChar(&p, ':') || smarActParseUpper(&p, cmd, sizeof(cmd)) || smarActParseInt(&p, &ch) ) {
+    numUnknown_++;
+    return put(reply, size, ":E%dE%d", ch, MCS_ERR_COMMAND);
+  }
+  while ( n < 4 && !smarActParseUpper(&p, names[n], sizeof(names[n])) && !smarActParseDouble(&p, &vals[n]) )
+    n++;
+  for ( i = 0; i < n; i++ ) {
+    if ( 0 == strcmp(names[i], "H") )
+      hold = vals[i];
+    else if ( 0 == strcmp(names[i], "P") || 0 == strcmp(names[i], "F") ) {
+      pos = vals[i];
+      havePos = 1;
+    }
+  }
+  if ( !(pAxis = axis(ch)) )
+    return put(reply, size, ":E%dE%d", ch, MCS_ERR_CHANNEL);
+
+  if ( 0 == strcmp(cmd, "GP") )
+    return put(reply, size, ":P%dP%.3f", ch, pAxis->pos);
+  if ( 0 == strcmp(cmd, "M") ) {
+    switch ( pAxis->state ) {
+    case SimTargeting:   status = 'T'; break;
+    case SimStepping:    status = 'M'; break;
+    case SimHolding:     status = 'H'; break;
+    case SimCalibrating: status = 'C'; break;
+    case SimReferencing: status = 'R'; break;
+    default:             status = 'S'; break;
+    }
+    return put(reply, size, ":M%d%c", ch, status);
+  }
+  if ( 0 == strcmp(cmd, "GPPK") )
+    return put(reply, size, ":PPK%dPPK%d", ch, pAxis->referenced);
+  if ( 0 == strcmp(cmd, "GCLF") )
+    return put(reply, size, ":CLF%dF%d", ch, pAxis->freq);
+  if ( 0 == strcmp(cmd, "GST") )
+    return put(reply, size, ":ST%dST%d", ch, pAxis->ptyp);
+  if ( 0 == strcmp(cmd, "GA") || 0 == strcmp(cmd, "MAA") || 0 == strcmp(cmd, "MAR") )
+    return put(reply, size, ":E%dE%d", ch, MCS_ERR_SENSOR);
+
+  if ( 0 == strcmp(cmd, "MPA") || 0 == strcmp(cmd, "MPR") ) {
+    if ( !havePos )
+      return put(reply, size, ":E%dE%d", ch, MCS_ERR_PARAMS);
+    // The speed follows the max closed loop frequency
+    pAxis->speed = pAxis->freq * SMARACT_SIM_STEP_SCU;
+    moveTo(pAxis, ('R' == cmd[2] ? pAxis->pos : 0.0) + pos, holdSeconds(hold));
+  } else if ( 0 == strcmp(cmd, "MTR") ) {
+    startMotion(pAxis, SimReferencing, 0.0, fabs(pAxis->pos) / defaultSpeed());
+  } else if ( 0 == strcmp(cmd, "S") ) {
+    stopAxis(pAxis);
+  } else if ( 0 == strcmp(cmd, "SCLF") ) {
+    if ( !havePos )
+      return put(reply, size, ":E%dE%d", ch, MCS_ERR_PARAMS);
+    pAxis->freq = (int)pos;
+  } else {
+    numUnknown_++;
+    return put(reply, size, ":E%dE%d", ch, MCS_ERR_COMMAND);
+  }
+  return 0;
+}
+
+/* One MCS2 command or query, "[:CHAN<ch>]:<node>[:<node>...][?] [<value>]",
+ * or ":<node><ch> [<value>]" (:MOVE, :STOP, :CAL, :REF).
+ *
+ * RETURNS:  the length of its reply, 0 if it isn't a query
+ */
+size_t
+SmarActSim::executeMCS2(const char *command, char *reply, size_t size)
+{
+const char *p = command;
+char        path[48];
+size_t      len = 0;
+int         ch = -1;
+int         query;
+double      val = 0.0;
+int         haveVal;
+Axis       *pAxis;
+
+  while ( ' ' == *p )
+    p++;
+  if ( ':' == *p )
+    p++;
+  if ( 0 == strncmp(p, "CHAN", 4) && smarActIsDigit(p[4]) ) {
+    p += 4;
+    smarActParseInt(&p, &ch);
+    if ( ':' == *p )
+      p++;
+  }
+  while ( *p && ' ' != *p && len < sizeof(path) - 1 )
+    path[len++] = *p++;
+  path[len] = 0;
+  // A channel at the end of the node, :MOVE0
+  if ( ch < 0 && len && smarActIsDigit(path[len - 1]) ) {
+    while ( len && smarActIsDigit(path[len - 1]) )
+      len--;
+    ch = atoi(&path[len]);
+    path[len] = 0;
+  }
+  while ( ' ' == *p )
+    p++;
+  haveVal = !smarActParseDouble(&p, &val);
+  query   = len && '?' == path[len - 1];
+
+  if ( ch < 0 ) {
+    if ( 0 == strcmp(path, "DEV:SNUM?") )
+      return put(reply, size, "\"MCS2-SIM-%s\"", portName);
+    if ( 0 == strcmp(path, "SYST:ERR:COUN?") )
+      return put(reply, size, "%d", numErrors_);
+    if ( 0 == strcmp(path, "SYST:ERR?") ) {
+      if ( !numErrors_ )
+        return put(reply, size, "0,\"No error\"");
+      numErrors_--;
+      return put(reply, size, "%d,\"Invalid channel index\"", MCS_ERR_CHANNEL);
+    }
+    // Streaming and everything else of the device is taken as it is
+    return query ? put(reply, size, "0") : 0;
+  }
+  if ( !(pAxis = axis(ch)) ) {
+    numErrors_++;
+    return query ? put(reply, size, "0") : 0;
+  }
+
+  if ( query ) {
+    if ( 0 == strcmp(path, "STAT?") ) {
+      int state = CH_STATE_SENSOR_PRESENT | CH_STATE_AMPLIFIER_ENABLED;
+      switch ( pAxis->state ) {
+      case SimTargeting:   state |= CH_STATE_ACTIVELY_MOVING | CH_STATE_CLOSED_LOOP_ACTIVE; break;
+      case SimStepping:    state |= CH_STATE_ACTIVELY_MOVING; break;
+      case SimHolding:     state |= CH_STATE_CLOSED_LOOP_ACTIVE; break;
+      case SimCalibrating: state |= CH_STATE_ACTIVELY_MOVING | CH_STATE_CALIBRATING; break;
+      case SimReferencing: state |= CH_STATE_ACTIVELY_MOVING | CH_STATE_REFERENCING; break;
+      default:             break;
+      }
+      if ( pAxis->referenced )
+        state |= CH_STATE_IS_REFERENCED;
+      if ( pAxis->calibrated )
+        state |= CH_STATE_IS_CALIBRATED;
+      return put(reply, size, "%d", state);
+    }
+    if ( 0 == strcmp(path, "POS?") )
+      return put(reply, size, "%.0f", pAxis->pos);
+    if ( 0 == strcmp(path, "POS:TARG?") )
+      return put(reply, size, "%.0f", pAxis->target);
+    if ( 0 == strcmp(path, "PTYP?") )
+      return put(reply, size, "%d", pAxis->ptyp);
+    if ( 0 == strcmp(path, "PTYP:NAME?") )
+      return put(reply, size, "\"SIM\"");
+    if ( 0 == strcmp(path, "MCLF?") )
+      return put(reply, size, "%d", pAxis->mclf);
+    if ( 0 == strcmp(path, "VEL?") )
+      return put(reply, size, "%.0f", pAxis->speed);
+    if ( 0 == strcmp(path, "STEP:FREQ?") )
+      return put(reply, size, "%d", pAxis->freq);
+    if ( 0 == strcmp(path, "STEP:AMPL?") )
+      return put(reply, size, "%d", pAxis->ampl);
+    return put(reply, size, "0");
+  }
+
+  if ( 0 == strcmp(path, "MOVE") && haveVal ) {
+    double freq = pAxis->freq > 0 ? pAxis->freq : SMARACT_SIM_STEP_FREQ;
+    switch ( pAxis->mmod ) {
+    case 0:
+      moveTo(pAxis, val, pAxis->holdTime);
+      break;
+    case 1:
+      moveTo(pAxis, pAxis->pos + val, pAxis->holdTime);
+      break;
+    case MOVE_MODE_SCAN_RELATIVE:
+      stopAxis(pAxis);
+      pAxis->pos = pAxis->target = pAxis->pos + val * SMARACT_SIM_SCAN_MCS2;
+      break;
+    case MOVE_MODE_STEP:
+      startMotion(pAxis, SimStepping, pAxis->pos + val * SMARACT_SIM_STEP_MCS2 * pAxis->ampl / MCS2_MAX_AMPLITUDE,
+                  fabs(val) / freq);
+      break;
+    default:
+      numUnknown_++;
+      break;
+    }
+  } else if ( 0 == strcmp(path, "STOP") ) {
+    stopAxis(pAxis);
+  } else if ( 0 == strcmp(path, "CAL") ) {
+    startMotion(pAxis, SimCalibrating, pAxis->pos, SMARACT_SIM_CAL_TIME);
+  } else if ( 0 == strcmp(path, "REF") ) {
+    startMotion(pAxis, SimReferencing, 0.0, fabs(pAxis->pos) / defaultSpeed());
+  } else if ( !haveVal ) {
+    numUnknown_++;
+  } else if ( 0 == strcmp(path, "MMOD") ) {
+    pAxis->mmod = (int)val;
+  } else if ( 0 == strcmp(path, "VEL") ) {
+    pAxis->speed = val;
+  } else if ( 0 == strcmp(path, "HOLD") ) {
+    pAxis->holdTime = val < 0.0 || val > MCS2_HOLD_MAX ? -1.0 : 1.0e-3 * val;
+  } else if ( 0 == strcmp(path, "POS") ) {
+    stopAxis(pAxis);
+    pAxis->pos = pAxis->target = val;
+  } else if ( 0 == strcmp(path, "PTYP") ) {
+    pAxis->ptyp = (int)val;
+  } else if ( 0 == strcmp(path, "MCLF:CURR") ) {
+    pAxis->mclf = (int)val;
+  } else if ( 0 == strcmp(path, "STEP:FREQ") ) {
+    pAxis->freq = (int)val;
+  } else if ( 0 == strcmp(path, "STEP:AMPL") || 0 == strcmp(path, "AMPL") ) {
+    pAxis->ampl = (int)val;
+  }
+  // Everything else (ACC, trigger, reference options...) has no effect here
+  return 0;
+}
+
+/* Execute the commands of one write and put their replies on the link */
+asynStatus
+SmarActSim::writeOctet(asynUser *pasynUser, const char *value, size_t maxChars, size_t *nActual)
+{
+char        commands[SMARACT_SIM_REPLY_SIZE];
+char        reply[SMARACT_SIM_REPLY_SIZE];
+char        part[256];
+size_t      len = maxChars < sizeof(commands) ? maxChars : sizeof(commands) - 1;
+size_t      replyLen = 0;
+char        sep = SmarActSimMCS2 == protocol_ ? ';' : ':';
+char       *pCommand;
+char       *pEnd;
+
+  memcpy(commands, value, len);
+  while ( len && ('\r' == commands[len - 1] || '\n' == commands[len - 1]) )
+    len--;
+  commands[len] = 0;
+  *nActual = maxChars;
+  numWrites_++;
+  epicsTimeGetCurrent(&now_);
+
+  // ':' starts each MCS and SCU command, ';' separates the MCS2 ones
+  for ( pCommand = commands; *pCommand; pCommand = pEnd ) {
+    char   saved;
+    size_t n;
+
+    pEnd = strchr(pCommand + 1, sep);
+    if ( !pEnd )
+      pEnd = pCommand + strlen(pCommand);
+    saved = *pEnd;
+    *pEnd = 0;
+    numCommands_++;
+    if ( epicsTimeDiffInSeconds(&busyUntil_, &now_) < 0.0 )
+      busyUntil_ = now_;
+    epicsTimeAddSeconds(&busyUntil_, commandTime_);
+    switch ( protocol_ ) {
+    case SmarActSimMCS:
+      n = executeMCS(pCommand, reply, sizeof(reply));
+      queue(reply, n);
+      break;
+    case SmarActSimSCU:
+      replyLen += executeSCU(pCommand, &reply[replyLen], sizeof(reply) - replyLen);
+      break;
+    default:
+      if ( (n = executeMCS2(pCommand, part, sizeof(part))) )
+        replyLen += put(&reply[replyLen], sizeof(reply) - replyLen, "%s%s", replyLen ? ";" : "", part);
+      break;
+    }
+    *pEnd = saved;
+    if ( ';' == *pEnd )
+      pEnd++;
+  }
+  if ( replyLen )
+    queue(reply, replyLen);
+  return asynSuccess;
+}
+
+/* Wait for the next reply on the link, up to the timeout of pasynUser */
+asynStatus
+SmarActSim::readOctet(asynUser *pasynUser, char *value, size_t maxChars, size_t *nActual, int *eomReason)
+{
+epicsTimeStamp now;
+Reply         *pReply;
+double         wait;
+size_t         len;
+
+  *nActual = 0;
+  if ( eomReason )
+    *eomReason = 0;
+  if ( !numReplies_ ) {
+    if ( pasynUser->timeout > 0.0 )
+      epicsThreadSleep(pasynUser->timeout);
+    numTimeouts_++;
+    return asynTimeout;
+  }
+  pReply = &replies_[head_];
+  epicsTimeGetCurrent(&now);
+  wait = epicsTimeDiffInSeconds(&pReply->ready, &now);
+  if ( wait > 0.0 ) {
+    if ( pasynUser->timeout >= 0.0 && wait > pasynUser->timeout ) {
+      epicsThreadSleep(pasynUser->timeout);
+      numTimeouts_++;
+      return asynTimeout;
+    }
+    epicsThreadSleep(wait);
+  }
+  len = pReply->len - pReply->offset;
+  if ( len > maxChars )
+    len = maxChars;
+  memcpy(value, &pReply->text[pReply->offset], len);
+  if ( len < maxChars )
+    value[len] = 0;
+  pReply->offset += len;
+  *nActual = len;
+  if ( pReply->offset < pReply->len ) {
+    if ( eomReason )
+      *eomReason = ASYN_EOM_CNT;
+    return asynSuccess;
+  }
+  if ( eomReason )
+    *eomReason = ASYN_EOM_EOS;
+  head_ = (head_ + 1) % SMARACT_SIM_QUEUE_SIZE;
+  numReplies_--;
+  return asynSuccess;
+}
+
+/* Drop the replies that arrived, later ones are still on their way */
+asynStatus
+SmarActSim::flushOctet(asynUser *pasynUser)
+{
+epicsTimeStamp now;
+
+  epicsTimeGetCurrent(&now);
+  while ( numReplies_ && epicsTimeDiffInSeconds(&replies_[head_].ready, &now) <= 0.0 ) {
+    head_ = (head_ + 1) % SMARACT_SIM_QUEUE_SIZE;
+    numReplies_--;
+    numDropped_++;
+  }
+  return asynSuccess;
+}
+
+void
+SmarActSim::report(FILE *fp, int details)
+{
+static const char *protocolNames[] = { "MCS", "SCU", "MCS2" };
+int i;
+
+  fprintf(fp, "smarAct %s simulator %s, numAxes=%d, latency %.3f ms, jitter %.3f ms, command time %.3f ms\n",
+          protocolNames[protocol_], portName, numAxes_, 1.0e3 * latency_, 1.0e3 * jitter_, 1.0e3 * commandTime_);
+  fprintf(fp, "  %lu writes, %lu commands, %lu unknown, %lu timeouts, %lu replies dropped\n",
+          numWrites_, numCommands_, numUnknown_, numTimeouts_, numDropped_);
+  if ( details < 1 )
+    return;
+  lock();
+  epicsTimeGetCurrent(&now_);
+  for ( i = 0; i < numAxes_; i++ ) {
+    const Axis *pAxis = axis(i);
+    fprintf(fp, "  axis %d: state %d, position %.3f, target %.3f%s\n",
+            i, (int)pAxis->state, pAxis->pos, pAxis->target, pAxis->referenced ? ", referenced" : "");
+  }
+  unlock();
+}
+
+/* iocsh wrapping and registration business (stolen from ACRMotorDriver.cpp) */
+static const iocshArg cs_a0 = {"Port name [string]",               iocshArgString};
+static const iocshArg cs_a1 = {"Protocol MCS|SCU|MCS2 [string]",   iocshArgString};
+static const iocshArg cs_a2 = {"Number of axes [int]",             iocshArgInt};
+static const iocshArg cs_a3 = {"Latency (ms) [double]",            iocshArgDouble};
+static const iocshArg cs_a4 = {"Jitter (ms) [double]",             iocshArgDouble};
+static const iocshArg cs_a5 = {"Command time (ms) [double]",       iocshArgDouble};
+
+static const iocshArg * const cs_as[] = {&cs_a0, &cs_a1, &cs_a2, &cs_a3, &cs_a4, &cs_a5};
+
+/* smarActCreateSim called to create a simulated controller port */
+static const iocshFuncDef cs_def = {"smarActCreateSim", 6, cs_as};
+
+extern "C" int
+smarActCreateSim(const char *portName, const char *protocol, int numAxes,
+                 double latency, double jitter, double commandTime)
+{
+SmarActSimProtocol proto;
+
+  if ( !portName || !protocol ) {
+    printf("smarActCreateSim: Error port name and protocol are required\n");
+    return -1;
+  }
+  if ( 0 == epicsStrCaseCmp(protocol, "MCS") )
+    proto = SmarActSimMCS;
+  else if ( 0 == epicsStrCaseCmp(protocol, "SCU") )
+    proto = SmarActSimSCU;
+  else if ( 0 == epicsStrCaseCmp(protocol, "MCS2") )
+    proto = SmarActSimMCS2;
+  else {
+    printf("smarActCreateSim: Error unknown protocol '%s', use MCS, SCU or MCS2\n", protocol);
+    return -1;
+  }
+  if ( numAxes < 1 || numAxes > SMARACT_SIM_MAX_AXES ) {
+    printf("smarActCreateSim: Error number of axes must be 1..%d\n", SMARACT_SIM_MAX_AXES);
+    return -1;
+  }
+  new SmarActSim(portName, proto, numAxes, 1.0e-3 * latency, 1.0e-3 * jitter, 1.0e-3 * commandTime);
+  return 0;
+}
+
+static void cs_fn(const iocshArgBuf *args)
+{
+  smarActCreateSim(args[0].sval, args[1].sval, args[2].ival, args[3].dval, args[4].dval, args[5].dval);
+}
+
+static const iocshArg bm_a0 = {"Controller port name [string]",    iocshArgString};
+static const iocshArg bm_a1 = {"Duration (s) [double]",            iocshArgDouble};
+static const iocshArg bm_a2 = {"Simulator port name [string]",     iocshArgString};
+
+static const iocshArg * const bm_as[] = {&bm_a0, &bm_a1, &bm_a2};
+
+/* smarActBenchmark: the poll and I/O rates of a controller over some time */
+static const iocshFuncDef bm_def = {"smarActBenchmark", 3, bm_as};
+
+extern "C" int
+smarActBenchmark(const char *portName, double seconds, const char *simPortName)
+{
+SmarActIoStats *pStats = SmarActIoStats::find(portName);
+SmarActSim     *pSim = 0;
+SmarActIoTotals start;
+SmarActIoTotals end;
+unsigned long   simWrites = 0;
+unsigned long   simCommands = 0;
+unsigned long   polls;
+unsigned long   exchanges;
+clock_t         cpu;
+double          cpuSeconds;
+
+  if ( !pStats ) {
+    printf("smarActBenchmark: Error controller %s not found\n", portName ? portName : "");
+    return -1;
+  }
+  if ( simPortName && simPortName[0] ) {
+    pSim = dynamic_cast<SmarActSim*>((asynPortDriver*)findAsynPortDriver(simPortName));
+    if ( !pSim ) {
+      printf("smarActBenchmark: Error simulator %s not found\n", simPortName);
+      return -1;
+    }
+    simWrites   = pSim->numWrites();
+    simCommands = pSim->numCommands();
+  }
+  if ( !(seconds > 0.0) )
+    seconds = 10.0;
+
+  pStats->totals(&start);
+  cpu = clock();
+  epicsThreadSleep(seconds);
+  cpuSeconds = (double)(clock() - cpu) / CLOCKS_PER_SEC;
+  pStats->totals(&end);
+
+  polls     = end.polls - start.polls;
+  exchanges = end.exchanges - start.exchanges;
+  printf("smarActBenchmark(%s): %.1f s\n", portName, seconds);
+  printf("  poll cycles  %8lu  %10.1f /s\n", polls, polls / seconds);
+  printf("  exchanges    %8lu  %10.2f per poll, %.3f ms mean round trip\n", exchanges,
+         polls ? (double)exchanges / polls : 0.0,
+         exchanges ? 1.0e3 * (end.latency - start.latency) / exchanges : 0.0);
+  printf("  timeouts     %8lu\n", end.timeouts - start.timeouts);
+  printf("  errors       %8lu\n", end.errors - start.errors);
+  printf("  CPU          %8.3f ms  %10.3f ms per poll (whole IOC)\n", 1.0e3 * cpuSeconds,
+         polls ? 1.0e3 * cpuSeconds / polls : 0.0);
+  if ( pSim ) {
+    simWrites   = pSim->numWrites() - simWrites;
+    simCommands = pSim->numCommands() - simCommands;
+    printf("  sim writes   %8lu  %10.2f per poll, %.2f commands per poll, %d axes\n", simWrites,
+           polls ? (double)simWrites / polls : 0.0, polls ? (double)simCommands / polls : 0.0,
+           pSim->numAxes());
+  }
+  return 0;
+}
+
+static void bm_fn(const iocshArgBuf *args)
+{
+  smarActBenchmark(args[0].sval, args[1].dval, args[2].sval);
+}
+
+static const iocshArg pb_a0 = {"Iterations [int]",                 iocshArgInt};
+
+static const iocshArg * const pb_as[] = {&pb_a0};
+
+/* smarActParseBenchmark: smarActParse.h against the C library on typical reply fields */
+static const iocshFuncDef pb_def = {"smarActParseBenchmark", 1, pb_as};
+
+/* Fields as they follow the reply prefix, e.g. ":P0," of the MCS or a MCS2 :POS? */
+static const char *pbInts[]    = { "-1234567", "0", "987654321", "42", "-7", "100000" };
+static const char *pbInt64s[]  = { "-123456789012", "0", "4398046511104", "-42", "7000000", "9876543210" };
+static const char *pbDoubles[] = { "12.345", "-0.001", "1000", "3.14159", "-250.5", "1e-3" };
+#define PB_NUM_FIELDS (sizeof(pbInts) / sizeof(pbInts[0]))
+
+/* CPU ns per field since start */
+static double
+pbNs(clock_t start, int iterations)
+{
+  return 1.0e9 * (double)(clock() - start) / CLOCKS_PER_SEC / ((double)iterations * PB_NUM_FIELDS);
+}
+
+extern "C" int
+smarActParseBenchmark(int iterations)
+{
+volatile double sink = 0.0;
+clock_t         start;
+double          ns[8];
+double          dval;
+long long       llval;
+int             ival;
+const char     *p;
+int             i;
+size_t          f;
+
+  if ( iterations <= 0 )
+    iterations = 1000000;
+
+  start = clock();
+  for ( i = 0; i < iterations; i++ )
+    for ( f = 0; f < PB_NUM_FIELDS; f++ ) {
+      p = pbInts[f];
+      if ( !smarActParseInt(&p, &ival) )
+        sink += ival;
+    }
+  ns[0] = pbNs(start, iterations);
+  start = clock();
+  for ( i = 0; i < iterations; i++ )
+    for ( f = 0; f < PB_NUM_FIELDS; f++ )
+      sink += atoi(pbInts[f]);
+  ns[1] = pbNs(start, iterations);
+  start = clock();
+  for ( i = 0; i < iterations; i++ )
+    for ( f = 0; f < PB_NUM_FIELDS; f++ ) {
+      if ( 1 == sscanf(pbInts[f], "%d", &ival) )
+        sink += ival;
+    }
+  ns[2] = pbNs(start, iterations);
+
+  start = clock();
+  for ( i = 0; i < iterations; i++ )
+    for ( f = 0; f < PB_NUM_FIELDS; f++ ) {
+      p = pbInt64s[f];
+      if ( !smarActParseInt64(&p, &llval) )
+        sink += (double)llval;
+    }
+  ns[3] = pbNs(start, iterations);
+  start = clock();
+  for ( i = 0; i < iterations; i++ )
+    for ( f = 0; f < PB_NUM_FIELDS; f++ ) {
+      if ( 1 == sscanf(pbInt64s[f], "%lld", &llval) )
+        sink += (double)llval;
+    }
+  ns[4] = pbNs(start, iterations);
+
+  start = clock();
+  for ( i = 0; i < iterations; i++ )
+    for ( f = 0; f < PB_NUM_FIELDS; f++ ) {
+      p = pbDoubles[f];
+      if ( !smarActParseDouble(&p, &dval) )
+        sink += dval;
+    }
+  ns[5] = pbNs(start, iterations);
+  start = clock();
+  for ( i = 0; i < iterations; i++ )
+    for ( f = 0; f < PB_NUM_FIELDS; f++ )
+      sink += strtod(pbDoubles[f], NULL);
+  ns[6] = pbNs(start, iterations);
+  start = clock();
+  for ( i = 0; i < iterations; i++ )
+    for ( f = 0; f < PB_NUM_FIELDS; f++ ) {
+      if ( 1 == sscanf(pbDoubles[f], "%lf", &dval) )
+        sink += dval;
+    }
+  ns[7] = pbNs(start, iterations);
+
+  printf("smarActParseBenchmark: %d x %u fields, CPU ns per field\n", iterations, (unsigned)PB_NUM_FIELDS);
+  printf("  int     smarActParseInt    %7.1f  atoi   %7.1f  sscanf %%d   %7.1f\n", ns[0], ns[1], ns[2]);
+  printf("  int64   smarActParseInt64  %7.1f                 sscanf %%lld %7.1f\n", ns[3], ns[4]);
+  printf("  double  smarActParseDouble %7.1f  strtod %7.1f  sscanf %%lf  %7.1f\n", ns[5], ns[6], ns[7]);
+  return 0;
+}
+
+static void pb_fn(const iocshArgBuf *args)
+{
+  smarActParseBenchmark(args[0].ival);
+}
+
+static void smarActSimRegister(void)
+{
+  iocshRegister(&cs_def, cs_fn);  // smarActCreateSim
+  iocshRegister(&bm_def, bm_fn);  // smarActBenchmark
+  iocshRegister(&pb_def, pb_fn);  // smarActParseBenchmark
+}
+
+extern "C" {
+epicsExportRegistrar(smarActSimRegister);
+}
@@ -0,0 +1,139 @@
+#ifndef SMARACT_SIM_H
+#define SMARACT_SIM_H
+
+/* Simulated smarAct controller, for benchmarks and soak tests of the MCS,
+ * MCS2 and SCU drivers without hardware.
+ *
+ * smarActCreateSim() creates an asyn port that speaks the MCS, SCU or MCS2
+ * (SCPI) protocol; a controller is created on it instead of the IP or serial
+ * port. Each write is one message without terminator, as the drivers send
+ * them. The commands are executed when they are written, one after the other,
+ * each taking 'command time'; the reply is ready 'latency' plus a random
+ * 0..'jitter' after that, in the order the commands were written:
+ *   - MCS:  one reply line per command, commands are acknowledged with :E<ch>,0
+ *   - SCU:  the replies of one write on one line, moves have no reply of their own
+ *   - MCS2: the replies to the queries of one write on one line, separated
+ *           by ';', no reply if there is no query
+ * Every channel is a linear positioner with a sensor. Closed loop moves run
+ * at the speed set with SCLS (MCS) or :VEL (MCS2), SMARACT_SIM_SPEED units/s
+ * otherwise, open loop steps at their frequency; the axis then holds the
+ * target for the hold time. A reference search moves to 0 and sets PPK or
+ * IS_REFERENCED.
+ *
+ * smarActBenchmark() measures a controller against it, see the READMEs.
+ */
+
+#ifdef __cplusplus
+
+#include <stdio.h>
+#include <asynPortDriver.h>
+#include <epicsTime.h>
+
+#define SMARACT_SIM_MAX_AXES    32
+#define SMARACT_SIM_QUEUE_SIZE  64    /* replies on the link */
+#define SMARACT_SIM_REPLY_SIZE  2048
+
+/* Defaults of the axis dynamics, in the position units of each protocol:
+ * nm (MCS), um (SCU), pm (MCS2) */
+#define SMARACT_SIM_SPEED_MCS   1.0e6     /* /s */
+#define SMARACT_SIM_SPEED_SCU   1.0e3
+#define SMARACT_SIM_SPEED_MCS2  1.0e9
+#define SMARACT_SIM_STEP_MCS    50.0      /* per step at full amplitude */
+#define SMARACT_SIM_STEP_SCU    0.05
+#define SMARACT_SIM_STEP_MCS2   5.0e4
+#define SMARACT_SIM_SCAN_MCS2   25.0      /* per scan increment */
+#define SMARACT_SIM_STEP_FREQ   1000.0    /* Hz, if none is given */
+#define SMARACT_SIM_CAL_TIME    0.5       /* s */
+
+enum SmarActSimProtocol {
+  SmarActSimMCS,
+  SmarActSimSCU,
+  SmarActSimMCS2
+};
+
+class SmarActSim : public asynPortDriver
+{
+public:
+  SmarActSim(const char *portName, SmarActSimProtocol protocol, int numAxes,
+             double latency, double jitter, double commandTime);
+  ~SmarActSim();
+
+  virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t maxChars, size_t *nActual);
+  virtual asynStatus readOctet(asynUser *pasynUser, char *value, size_t maxChars, size_t *nActual, int *eomReason);
+  virtual asynStatus flushOctet(asynUser *pasynUser);
+  virtual void       report(FILE *fp, int details);
+
+  int           numAxes() const { return numAxes_; }
+  unsigned long numWrites() const { return numWrites_; }
+  unsigned long numCommands() const { return numCommands_; }
+
+private:
+  enum State {
+    SimIdle,
+    SimTargeting,    /* closed loop move */
+    SimStepping,     /* open loop steps */
+    SimHolding,      /* at the target, closed loop */
+    SimReferencing,
+    SimCalibrating
+  };
+
+  struct Axis {
+    State          state;
+    double         pos;
+    double         start;
+    double         target;
+    double         duration;  /* of the motion, s */
+    double         holdTime;  /* s, < 0: forever */
+    epicsTimeStamp t0;        /* start of the motion, or of the holding */
+    double         speed;     /* closed loop speed, 0: SMARACT_SIM_SPEED_xxx */
+    int            freq;      /* SCU max closed loop, MCS2 step frequency */
+    int            ampl;      /* MCS2 step amplitude */
+    int            mmod;      /* MCS2 move mode */
+    int            ptyp;
+    int            mclf;
+    int            referenced;
+    int            calibrated;
+  };
+
+  struct Reply {
+    epicsTimeStamp ready;
+    size_t         len;
+    size_t         offset;    /* already read */
+    char           text[SMARACT_SIM_REPLY_SIZE];
+  };
+
+  Axis  *axis(int channel);
+  void   update(Axis *pAxis);
+  void   startMotion(Axis *pAxis, State state, double target, double duration);
+  void   moveTo(Axis *pAxis, double target, double holdTime);
+  void   stopAxis(Axis *pAxis);
+  double defaultSpeed() const;
+  double random();
+  void   queue(const char *text, size_t len);
+  size_t executeMCS(const char *command, char *reply, size_t size);
+  size_t executeSCU(const char *command, char *reply, size_t size);
+  size_t executeMCS2(const char *command, char *reply, size_t size);
+
+  SmarActSimProtocol protocol_;
+  int                numAxes_;
+  Axis               axes_[SMARACT_SIM_MAX_AXES];
+  double             latency_;
+  double             jitter_;
+  double             commandTime_;
+  unsigned int       seed_;          /* of the jitter, the same on every start */
+  epicsTimeStamp     now_;           /* time of the write being executed */
+  epicsTimeStamp     busyUntil_;     /* end of the last command */
+  epicsTimeStamp     lastReady_;
+  Reply             *replies_;       /* ring of SMARACT_SIM_QUEUE_SIZE */
+  int                head_;
+  int                numReplies_;
+  int                numErrors_;     /* MCS2 error queue */
+  unsigned long      numWrites_;
+  unsigned long      numCommands_;
+  unsigned long      numUnknown_;
+  unsigned long      numDropped_;    /* by a full queue or a flush */
+  unsigned long      numTimeouts_;
+};
+
+#endif // _cplusplus
+#endif // SMARACT_SIM_H
@@ -0,0 +1,549 @@
+/* Pipelined command transport shared by the smarAct MCS, MCS2 and SCU drivers */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdarg.h>
+
+#include <asynDriver.h>
+#include <asynOctet.h>
+#include <epicsStdio.h>
+#include <epicsAtomic.h>
+
+#include "smarActTransport.h"
+#include "smarActIoStats.h"
+#include "smarActParse.h"
+
+#define REQUEST_NOT_SENT  0
+#define REQUEST_ON_LINK   1
+#define REQUEST_COMPLETED 2
+
+/* Connects to an asyn octet port, e.g. the drvAsynIPPort of the controller.
+ * The EOS of the port must have been set already, every reply is one EOS terminated line.
+ */
+SmarActTransport::SmarActTransport(const char *portName, int addr, SmarActReplyMatch match)
+  : pasynUser_(0), pasynUserExpress_(0), pasynOctet_(0), octetPvt_(0), pStats_(0), match_(match),
+    depth_(SMARACT_TRANSPORT_DEPTH), numRequests_(0), numBatches_(0), numUnmatched_(0),
+    numExpress_(0), numYields_(0), preempt_(0), pPending_(0), numPending_(0), numSent_(0), numDone_(0), portLocked_(0), pendStatus_(asynSuccess)
+{
+asynInterface *pasynInterface;
+asynStatus     status;
+
+  epicsSnprintf(portName_, sizeof(portName_), "%s", portName);
+  reply_[0] = 0;
+  resumed_ = epicsEventMustCreate(epicsEventEmpty);
+  pasynUser_        = pasynManager->createAsynUser(0, 0);
+  pasynUserExpress_ = pasynManager->createAsynUser(0, 0);
+  status = pasynManager->connectDevice(pasynUser_, portName, addr);
+  if ( !status && (status = pasynManager->connectDevice(pasynUserExpress_, portName, addr)) )
+    pasynManager->disconnect(pasynUser_);
+  if ( status ) {
+    printf("SmarActTransport: cannot connect to port %s\n", portName);
+    return;
+  }
+  pasynInterface = pasynManager->findInterface(pasynUser_, asynOctetType, 1);
+  if ( !pasynInterface ) {
+    printf("SmarActTransport: port %s has no octet interface\n", portName);
+    pasynManager->disconnect(pasynUser_);
+    pasynManager->disconnect(pasynUserExpress_);
+    return;
+  }
+  pasynOctet_ = (asynOctet *)pasynInterface->pinterface;
+  octetPvt_   = pasynInterface->drvPvt;
+}
+
+SmarActTransport::~SmarActTransport()
+{
+  if ( pasynOctet_ ) {
+    pasynManager->disconnect(pasynUser_);
+    pasynManager->disconnect(pasynUserExpress_);
+  }
+  pasynManager->freeAsynUser(pasynUser_);
+  pasynManager->freeAsynUser(pasynUserExpress_);
+  epicsEventDestroy(resumed_);
+}
+
+void
+SmarActTransport::initRequest(SmarActRequest *pRequest, const char *command, char *reply, size_t replySize,
+                              SmarActRequestCallback callback, void *pvt)
+{
+  pRequest->command   = command;
+  pRequest->reply     = reply;
+  pRequest->replySize = replySize;
+  pRequest->replyLen  = 0;
+  pRequest->status    = asynError;
+  pRequest->callback  = callback;
+  pRequest->pvt       = pvt;
+  pRequest->channel   = -1;
+  pRequest->key[0]    = 0;
+  pRequest->state     = REQUEST_NOT_SENT;
+  if ( reply && replySize )
+    reply[0] = 0;
+}
+
+void
+SmarActTransport::setDepth(int depth)
+{
+  if ( depth < 1 )
+    depth = 1;
+  if ( depth > SMARACT_TRANSPORT_MAX_DEPTH )
+    depth = SMARACT_TRANSPORT_MAX_DEPTH;
+  depth_ = depth;
+}
+
+/* Extract the letters and the channel from a command (":GP3") or reply (":P3,1234").
+ * The reply to a 'G' (get) command carries the letters without the 'G'.
+ * The channel is -1 if there is none.
+ */
+void
+SmarActTransport::parseKey(const char *msg, int isCommand, char *key, int *channel_p)
+{
+size_t len = 0;
+
+  if ( ':' == *msg )
+    msg++;
+  while ( isupper((unsigned char)*msg) ) {
+    if ( len < SMARACT_REPLY_KEY_SIZE - 1 )
+      key[len++] = *msg;
+    msg++;
+  }
+  key[len] = 0;
+  if ( isCommand && 'G' == key[0] && len > 1 )
+    memmove(key, key + 1, len);
+  if ( !isdigit((unsigned char)*msg) || smarActParseInt(&msg, channel_p) )
+    *channel_p = -1;
+}
+
+/* Returns the index of the request a reply belongs to, -1 if there is none */
+int
+SmarActTransport::matchReply(SmarActRequest *pRequests, int numSent, const char *reply)
+{
+char key[SMARACT_REPLY_KEY_SIZE];
+int  channel;
+int  i;
+
+  if ( SmarActMatchFifo == match_ ) {
+    for ( i = 0; i < numSent; i++ ) {
+      if ( REQUEST_ON_LINK == pRequests[i].state )
+        return i;
+    }
+    return -1;
+  }
+  parseKey(reply, 0, key, &channel);
+  for ( i = 0; i < numSent; i++ ) {
+    SmarActRequest *pRequest = &pRequests[i];
+    if ( REQUEST_ON_LINK != pRequest->state || channel != pRequest->channel )
+      continue;
+    /* An error (or acknowledge) reply belongs to the oldest request of the channel */
+    if ( 'E' == key[0] || 0 == strcmp(key, pRequest->key) )
+      return i;
+  }
+  return -1;
+}
+
+/* Midpoint of the exchange of a completed request, the best guess of when
+ * the controller sampled the values in its reply */
+void
+SmarActTransport::midpoint(const SmarActRequest *pRequest, epicsTimeStamp *pStamp)
+{
+  *pStamp = pRequest->sent;
+  epicsTimeAddSeconds(pStamp, 0.5 * epicsTimeDiffInSeconds(&pRequest->received, &pRequest->sent));
+}
+
+void
+SmarActTransport::complete(SmarActRequest *pRequest, asynStatus status)
+{
+  epicsTimeGetCurrent(&pRequest->received);
+  if ( REQUEST_ON_LINK != pRequest->state )
+    pRequest->sent = pRequest->received;
+  if ( pStats_ && REQUEST_ON_LINK == pRequest->state )
+    pStats_->record(pRequest->command, &pRequest->sent, status);
+  pRequest->status = status;
+  pRequest->state  = REQUEST_COMPLETED;
+  if ( pRequest->callback )
+    pRequest->callback(pRequest->pvt, pRequest);
+}
+
+/* Send the commands of all requests, keeping up to depth_ of them on the link,
+ * and complete every request when its reply arrives.
+ * The port is locked for the whole batch, so no other user of the port can
+ * take a reply that belongs to one of these requests.
+ *
+ * RETURNS:  status of the link; the status of every request is in its 'status' member,
+ *           and every request was completed when this returns.
+ */
+asynStatus
+SmarActTransport::transact(SmarActRequest *pRequests, int numRequests, double timeout)
+{
+  start(pRequests, numRequests, timeout);
+  return finish();
+}
+
+/* First half of transact(): lock the port and write the first commands, up to depth_.
+ * The caller must call finish() afterwards, the port stays locked until then.
+ * Other work, e.g. the batch of another controller, can be done in between
+ * while the replies are on their way.
+ */
+void
+SmarActTransport::start(SmarActRequest *pRequests, int numRequests, double timeout)
+{
+int i;
+
+  pPending_    = pRequests;
+  numPending_  = numRequests;
+  numSent_     = 0;
+  numDone_     = 0;
+  portLocked_  = 0;
+  pendStatus_  = asynSuccess;
+  for ( i = 0; i < numRequests; i++ ) {
+    SmarActRequest *pRequest = &pRequests[i];
+    parseKey(pRequest->command, 1, pRequest->key, &pRequest->channel);
+    pRequest->state    = REQUEST_NOT_SENT;
+    pRequest->replyLen = 0;
+  }
+  if ( !pasynOctet_ ) {
+    pendStatus_ = asynDisconnected;
+    return;
+  }
+  pasynUser_->timeout = timeout;
+  if ( (pendStatus_ = pasynManager->lockPort(pasynUser_)) )
+    return;
+  portLocked_ = 1;
+  /* Drop what is left from an earlier timeout, it would be taken as a reply */
+  pasynOctet_->flush(octetPvt_, pasynUser_);
+  numBatches_++;
+  pendStatus_ = send();
+}
+
+/* Write commands while there are fewer than depth_ on the link, none while an express command waits */
+asynStatus
+SmarActTransport::send()
+{
+asynStatus status = asynSuccess;
+size_t     nbytes;
+
+  while ( numSent_ < numPending_ && numSent_ - numDone_ < depth_ && !epicsAtomicGetIntT(&preempt_) ) {
+    SmarActRequest *pRequest = &pPending_[numSent_];
+    epicsTimeGetCurrent(&pRequest->sent);
+    status = pasynOctet_->write(octetPvt_, pasynUser_, pRequest->command, strlen(pRequest->command), &nbytes);
+    if ( status )
+      break;
+    asynPrint(pasynUser_, ASYN_TRACEIO_DRIVER, "SmarActTransport(%s): sent '%s'\n", portName_, pRequest->command);
+    pRequest->state = REQUEST_ON_LINK;
+    numSent_++;
+  }
+  return status;
+}
+
+/* Second half of transact(): read the replies, write the remaining commands and unlock the port.
+ *
+ * RETURNS:  see transact()
+ */
+asynStatus
+SmarActTransport::finish()
+{
+asynStatus status = pendStatus_;
+int        i;
+
+  while ( !status && numDone_ < numPending_ ) {
+    size_t nbytes = 0;
+    int    eomReason = 0;
+    int    idx;
+    SmarActRequest *pRequest;
+
+    if ( numSent_ == numDone_ ) {
+      // Nothing on the link, send() held back for an express command
+      if ( !(status = yield()) )
+        status = send();
+      continue;
+    }
+    status = pasynOctet_->read(octetPvt_, pasynUser_, reply_, sizeof(reply_) - 1, &nbytes, &eomReason);
+    if ( status )
+      break;
+    reply_[nbytes] = 0;
+    if ( (idx = matchReply(pPending_, numSent_, reply_)) < 0 ) {
+      numUnmatched_++;
+      asynPrint(pasynUser_, ASYN_TRACE_ERROR, "SmarActTransport(%s): unexpected reply '%s'\n", portName_, reply_);
+      continue;
+    }
+    pRequest = &pPending_[idx];
+    if ( pRequest->reply && pRequest->replySize ) {
+      pRequest->replyLen = nbytes < pRequest->replySize ? nbytes : pRequest->replySize - 1;
+      memcpy(pRequest->reply, reply_, pRequest->replyLen);
+      pRequest->reply[pRequest->replyLen] = 0;
+    }
+    asynPrint(pasynUser_, ASYN_TRACEIO_DRIVER, "SmarActTransport(%s): '%s' -> '%s'\n",
+              portName_, pRequest->command, reply_);
+    numDone_++;
+    complete(pRequest, asynSuccess);
+    status = send();
+  }
+  if ( portLocked_ )
+    pasynManager->unlockPort(pasynUser_);
+  portLocked_ = 0;
+
+  numRequests_ += numPending_;
+  if ( status ) {
+    asynPrint(pasynUser_, ASYN_TRACE_ERROR, "SmarActTransport(%s): status=%d after %d of %d replies\n",
+              portName_, (int)status, numDone_, numPending_);
+    for ( i = 0; i < numPending_; i++ ) {
+      if ( REQUEST_COMPLETED != pPending_[i].state )
+        complete(&pPending_[i], status);
+    }
+  }
+  pPending_   = 0;
+  numPending_ = 0;
+  return status;
+}
+
+/* Hand the port to the express commands waiting for it and take it back when
+ * they are done, or after SMARACT_EXPRESS_WAIT. Called by finish() with
+ * nothing on the link.
+ */
+asynStatus
+SmarActTransport::yield()
+{
+asynStatus status;
+
+  pasynManager->unlockPort(pasynUser_);
+  portLocked_ = 0;
+  numYields_++;
+  while ( epicsAtomicGetIntT(&preempt_) > 0 ) {
+    if ( epicsEventWaitOK != epicsEventWaitWithTimeout(resumed_, SMARACT_EXPRESS_WAIT) )
+      break;
+  }
+  if ( (status = pasynManager->lockPort(pasynUser_)) )
+    return status;
+  portLocked_ = 1;
+  /* A late reply to an express command would be taken as one of ours */
+  pasynOctet_->flush(octetPvt_, pasynUser_);
+  return asynSuccess;
+}
+
+/* Write a command ahead of the batch that may be running on another thread,
+ * and read one reply line if 'reply' is given. The command is on the wire as
+ * soon as the port is free: after the exchange a user of the port is in, or
+ * after the replies of a batch that are on the link. The time from the call
+ * to the write is recorded as the stop latency.
+ *
+ * RETURNS:  status of the exchange
+ */
+asynStatus
+SmarActTransport::express(const char *command, char *reply, size_t replySize, double timeout)
+{
+epicsTimeStamp issued;
+size_t         nbytes = 0;
+int            eomReason = 0;
+asynStatus     status;
+
+  epicsTimeGetCurrent(&issued);
+  if ( reply && replySize )
+    reply[0] = 0;
+  if ( !pasynOctet_ )
+    return asynDisconnected;
+  epicsAtomicIncrIntT(&preempt_);
+  pasynUserExpress_->timeout = timeout;
+  status = pasynManager->lockPort(pasynUserExpress_);
+  if ( !status ) {
+    status = pasynOctet_->write(octetPvt_, pasynUserExpress_, command, strlen(command), &nbytes);
+    if ( pStats_ && !status )
+      pStats_->stopSent(&issued);
+    if ( !status && reply && replySize ) {
+      status = pasynOctet_->read(octetPvt_, pasynUserExpress_, reply, replySize - 1, &nbytes, &eomReason);
+      reply[status ? 0 : nbytes] = 0;
+    }
+    pasynManager->unlockPort(pasynUserExpress_);
+  }
+  epicsAtomicDecrIntT(&preempt_);
+  epicsEventSignal(resumed_);
+  numExpress_++;
+  if ( pStats_ )
+    pStats_->record(command, &issued, status);
+  asynPrint(pasynUserExpress_, status ? ASYN_TRACE_ERROR : ASYN_TRACEIO_DRIVER,
+            "SmarActTransport(%s): express '%s' -> '%s', status=%d\n",
+            portName_, command, reply ? reply : "", (int)status);
+  return status;
+}
+
+void
+SmarActTransport::report(FILE *fp, int level)
+{
+  fprintf(fp, "  transport on %s: %s, depth %d, %lu requests in %lu batches, %lu unexpected replies\n",
+          portName_, pasynOctet_ ? "connected" : "not connected", depth_,
+          numRequests_, numBatches_, numUnmatched_);
+  fprintf(fp, "  express lane: %lu commands, batches gave way %lu times\n", numExpress_, numYields_);
+}
+
+/* Format a command into the next free slot and set up a request that reads its reply.
+ *
+ * RETURNS:  0 on success, -1 if all slots are in use.
+ */
+int
+SmarActPrefetch::add(SmarActRequest *pRequest, const char *fmt, ...)
+{
+SmarActPrefetchSlot *pSlot;
+va_list              ap;
+
+  if ( numSlots_ >= SMARACT_PREFETCH_SLOTS )
+    return -1;
+  pSlot = &slots_[numSlots_++];
+  va_start(ap, fmt);
+  epicsVsnprintf(pSlot->command, sizeof(pSlot->command), fmt, ap);
+  va_end(ap);
+  pSlot->valid  = 0;
+  pSlot->status = asynSuccess;
+  SmarActTransport::initRequest(pRequest, pSlot->command, pSlot->reply, sizeof(pSlot->reply), done, pSlot);
+  return 0;
+}
+
+void
+SmarActPrefetch::done(void *pvt, SmarActRequest *pRequest)
+{
+SmarActPrefetchSlot *pSlot = (SmarActPrefetchSlot *)pvt;
+  pSlot->valid  = asynSuccess == pRequest->status;
+  pSlot->status = pRequest->status;
+}
+
+/* RETURNS:  1 if the command was read ahead and got no reply (e.g. a timeout), 0 otherwise. */
+int
+SmarActPrefetch::failed(const char *command) const
+{
+int i;
+
+  if ( busy_ )
+    return 0;
+  for ( i = 0; i < numSlots_; i++ ) {
+    if ( asynSuccess != slots_[i].status && 0 == strcmp(command, slots_[i].command) )
+      return 1;
+  }
+  return 0;
+}
+
+/* Hand out the reply of a command that was read ahead; each reply is used once.
+ *
+ * RETURNS:  1 if the reply was copied to 'reply', 0 if the command must be sent.
+ */
+int
+SmarActPrefetch::take(const char *command, char *reply, size_t replySize)
+{
+int i;
+
+  if ( busy_ )
+    return 0;
+  for ( i = 0; i < numSlots_; i++ ) {
+    SmarActPrefetchSlot *pSlot = &slots_[i];
+    if ( pSlot->valid && 0 == strcmp(command, pSlot->command) ) {
+      epicsSnprintf(reply, replySize, "%s", pSlot->reply);
+      pSlot->valid = 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Format a command into the next free slot, its reply comes from split().
+ *
+ * RETURNS:  0 on success, -1 if all slots are in use.
+ */
+int
+SmarActPrefetch::queue(const char *fmt, ...)
+{
+SmarActPrefetchSlot *pSlot;
+va_list              ap;
+
+  if ( numSlots_ >= SMARACT_PREFETCH_SLOTS )
+    return -1;
+  pSlot = &slots_[numSlots_++];
+  va_start(ap, fmt);
+  epicsVsnprintf(pSlot->command, sizeof(pSlot->command), fmt, ap);
+  va_end(ap);
+  pSlot->valid    = 0;
+  pSlot->status   = asynSuccess;
+  pSlot->reply[0] = 0;
+  return 0;
+}
+
+/* All commands back to back, ":GP0:GS0:GPPK0".
+ *
+ * RETURNS:  length of the chain, 0 if it doesn't fit into buf.
+ */
+size_t
+SmarActPrefetch::chain(char *buf, size_t size) const
+{
+size_t len = 0;
+int    i;
+
+  buf[0] = 0;
+  for ( i = 0; i < numSlots_; i++ ) {
+    size_t cmdLen = strlen(slots_[i].command);
+    if ( len + cmdLen >= size ) {
+      buf[0] = 0;
+      return 0;
+    }
+    memcpy(&buf[len], slots_[i].command, cmdLen + 1);
+    len += cmdLen;
+  }
+  return len;
+}
+
+/* Number of replies in the text read for a chain; every reply starts with ':' */
+int
+SmarActPrefetch::numReplies(const char *replies)
+{
+int n = 0;
+
+  for ( ; *replies; replies++ ) {
+    if ( ':' == *replies )
+      n++;
+  }
+  return n;
+}
+
+/* RETURNS:  1 if one of the replies is an error reply ":E...", the controller
+ *           doesn't answer the rest of the chain then.
+ */
+int
+SmarActPrefetch::hasError(const char *replies)
+{
+  for ( ; (replies = strchr(replies, ':')); replies++ ) {
+    if ( 'E' == replies[1] )
+      return 1;
+  }
+  return 0;
+}
+
+/* Hand out the replies to a chain, in the order of the commands. The replies
+ * may be on one line or on several, EOS characters between them are dropped.
+ * If the number of replies doesn't match the number of commands, no reply is
+ * used: an error reply in the middle would be given to the wrong command.
+ *
+ * RETURNS:  the number of replies handed out.
+ */
+int
+SmarActPrefetch::split(const char *replies)
+{
+const char *p = replies;
+int         i;
+
+  if ( numReplies(replies) != numSlots_ )
+    return 0;
+  for ( i = 0; i < numSlots_; i++ ) {
+    SmarActPrefetchSlot *pSlot = &slots_[i];
+    const char          *end;
+    size_t               len;
+
+    p   = strchr(p, ':');
+    end = strchr(p + 1, ':');
+    len = end ? (size_t)(end - p) : strlen(p);
+    while ( len && ('\r' == p[len - 1] || '\n' == p[len - 1]) )
+      len--;
+    if ( len >= sizeof(pSlot->reply) )
+      len = sizeof(pSlot->reply) - 1;
+    memcpy(pSlot->reply, p, len);
+    pSlot->reply[len] = 0;
+    pSlot->valid      = 1;
+    p += 1;
+  }
+  return numSlots_;
+}
@@ -0,0 +1,179 @@
+#ifndef SMARACT_TRANSPORT_H
+#define SMARACT_TRANSPORT_H
+
+/* Pipelined command transport shared by the smarAct MCS, MCS2 and SCU drivers.
+ *
+ * Up to 'depth' commands are written to the link before their replies are read,
+ * so the round trip time of the link is paid once per batch and not once per
+ * command. Replies are matched to their requests either in order (MCS2 SCPI)
+ * or by the command letters and channel number that the MCS and SCU put at the
+ * start of every reply (":P3,1234", ":A0A12.3R0", error ":E3,5").
+ *
+ * express() is the lane for stop commands. It has an asynUser of its own and
+ * may be called from another thread while a batch runs: the batch stops
+ * writing, and once its replies are in it hands the port over until the
+ * express command is on the wire, then goes on.
+ */
+
+#ifdef __cplusplus
+
+#include <asynDriver.h>
+#include <asynOctet.h>
+#include <epicsTime.h>
+#include <epicsEvent.h>
+
+class SmarActIoStats;
+
+/* Default and maximum number of commands on the link at once */
+#define SMARACT_TRANSPORT_DEPTH     1
+#define SMARACT_TRANSPORT_MAX_DEPTH 64
+
+/* Longest time a batch waits for the express commands before it takes the port back, in s */
+#define SMARACT_EXPRESS_WAIT 1.0
+
+/* Longest reply the transport reads */
+#define SMARACT_TRANSPORT_REPLY_SIZE 2048
+
+#define SMARACT_REPLY_KEY_SIZE 8
+
+/** How replies are assigned to requests */
+enum SmarActReplyMatch {
+  SmarActMatchFifo,    /**< one reply per request, in the order of the requests */
+  SmarActMatchChannel  /**< ':' <letters> <channel> ..., the letters of a 'Gxx' command are 'xx' */
+};
+
+struct SmarActRequest;
+
+/** Called when the reply of a request arrived, or the request failed.
+ *  Called from SmarActTransport::transact() with the port locked: don't do I/O here. */
+typedef void (*SmarActRequestCallback)(void *pvt, SmarActRequest *pRequest);
+
+struct SmarActRequest {
+  const char *command;             /**< without EOS, owned by the caller */
+  char *reply;                     /**< reply without EOS, owned by the caller */
+  size_t replySize;
+  size_t replyLen;
+  asynStatus status;
+  SmarActRequestCallback callback; /**< may be NULL */
+  void *pvt;
+  /* used by SmarActTransport */
+  int channel;
+  char key[SMARACT_REPLY_KEY_SIZE];
+  int state;                       /**< 0: not sent, 1: on the link, 2: completed */
+  epicsTimeStamp sent;
+  epicsTimeStamp received;         /**< when the reply was read, or the request failed */
+};
+
+class SmarActTransport
+{
+public:
+  SmarActTransport(const char *portName, int addr, SmarActReplyMatch match);
+  ~SmarActTransport();
+
+  static void initRequest(SmarActRequest *pRequest, const char *command, char *reply, size_t replySize,
+                          SmarActRequestCallback callback = 0, void *pvt = 0);
+  static void midpoint(const SmarActRequest *pRequest, epicsTimeStamp *pStamp);
+  asynStatus transact(SmarActRequest *pRequests, int numRequests, double timeout);
+  void       start(SmarActRequest *pRequests, int numRequests, double timeout);
+  asynStatus finish();
+  asynStatus express(const char *command, char *reply, size_t replySize, double timeout);
+
+  void setDepth(int depth);
+  void setStats(SmarActIoStats *pStats) { pStats_ = pStats; }
+  int  getDepth() const { return depth_; }
+  int  isConnected() const { return pasynOctet_ != 0; }
+  void report(FILE *fp, int level);
+
+private:
+  static void parseKey(const char *msg, int isCommand, char *key, int *channel_p);
+  int  matchReply(SmarActRequest *pRequests, int numSent, const char *reply);
+  void complete(SmarActRequest *pRequest, asynStatus status);
+  asynStatus send();
+  asynStatus yield();
+
+  asynUser          *pasynUser_;
+  asynUser          *pasynUserExpress_;
+  asynOctet         *pasynOctet_;
+  void              *octetPvt_;
+  SmarActIoStats    *pStats_;
+  SmarActReplyMatch  match_;
+  int                depth_;
+  char               portName_[64];
+  char               reply_[SMARACT_TRANSPORT_REPLY_SIZE];
+  unsigned long      numRequests_;
+  unsigned long      numBatches_;
+  unsigned long      numUnmatched_;
+  unsigned long      numExpress_;
+  unsigned long      numYields_;
+  int                preempt_;       /* express commands waiting for the port, accessed with epicsAtomic */
+  epicsEventId       resumed_;       /* signalled when one of them is done */
+  /* batch between start() and finish() */
+  SmarActRequest    *pPending_;
+  int                numPending_;
+  int                numSent_;
+  int                numDone_;
+  int                portLocked_;
+  asynStatus         pendStatus_;
+};
+
+/* Axis types that can be declared when an axis is created; with SMARACT_AXIS_PROBE
+ * the driver asks the controller */
+#define SMARACT_AXIS_PROBE     0
+#define SMARACT_AXIS_LINEAR    1   /* with sensor */
+#define SMARACT_AXIS_ROTARY    2   /* with sensor */
+#define SMARACT_AXIS_NO_SENSOR 3
+
+/* How an axis reads its values in a poll cycle */
+#define SMARACT_POLL_SINGLE  0   /* one command per value */
+#define SMARACT_POLL_CHAINED 1   /* all values with one chained command */
+
+/* Chained polls: the reply lines after the first one are read with this timeout
+ * in s; after this many chains in a row that failed the axis polls with single
+ * commands until the poll mode is set again */
+#define SMARACT_CHAIN_READ_TIMEOUT 0.1
+#define SMARACT_CHAIN_MAX_FAILURES 3
+
+/* Replies read ahead of time, e.g. by the controller for all axes at the start of
+ * a poll cycle, or by an axis with one chained command. An axis takes the reply
+ * of a command instead of sending it. While the transport fills the slots with
+ * the controller lock released, setBusy(), nothing is handed out. */
+#define SMARACT_PREFETCH_SLOTS   6   /* the fast startup probe reads up to 5 */
+#define SMARACT_PREFETCH_CMD_LEN 32
+#define SMARACT_PREFETCH_REP_LEN 64
+
+struct SmarActPrefetchSlot {
+  char command[SMARACT_PREFETCH_CMD_LEN];
+  char reply[SMARACT_PREFETCH_REP_LEN];
+  int  valid;
+  asynStatus status;   /* of the read-ahead, asynSuccess until it failed */
+};
+
+class SmarActPrefetch
+{
+public:
+  SmarActPrefetch() : numSlots_(0), busy_(0) {}
+  void clear() { numSlots_ = 0; }
+  void setBusy(int busy) { busy_ = busy; }
+  int  empty() const { return 0 == numSlots_; }
+  int  add(SmarActRequest *pRequest, const char *fmt, ...);
+  int  take(const char *command, char *reply, size_t replySize);
+  int  failed(const char *command) const;
+
+  /* Chained queries: queue() the commands, send chain() and split() the replies */
+  int    queue(const char *fmt, ...);
+  size_t chain(char *buf, size_t size) const;
+  int    split(const char *replies);
+  int    size() const { return numSlots_; }
+  static int numReplies(const char *replies);
+  static int hasError(const char *replies);
+
+private:
+  static void done(void *pvt, SmarActRequest *pRequest);
+
+  SmarActPrefetchSlot slots_[SMARACT_PREFETCH_SLOTS];
+  int                 numSlots_;
+  int                 busy_;
+};
+
+#endif // _cplusplus
+#endif // SMARACT_TRANSPORT_H